@@ -0,0 +1,1091 @@
+/*
+ * Host microbenchmarks for the core hot path.
+ *
+ * Reports ns per poll_registered_gpios() and per gamepad report send for a
+ * few button counts, run against the simulated HAL. Buttons past the 30
+ * GPIOs share pins, which is fine since only the loop cost is of interest.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "axis.h"
+#include "backlight.h"
+#include "board_profile.h"
+#include "config.h"
+#include "display.h"
+#include "encoder.h"
+#include "frame_sync.h"
+#include "hal_sim.h"
+#include "hat.h"
+#include "hid_desc.h"
+#include "input.h"
+#include "inputq.h"
+#include "keyboard.h"
+#include "latency.h"
+#include "layer.h"
+#include "matrix.h"
+#include "panel.h"
+#include "report.h"
+#include "sampler.h"
+#include "shiftreg.h"
+#include "suspend.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "twheel.h"
+
+#define BENCH_GPIOS 30
+#define BENCH_SAMPLES 4096
+#define BENCH_ITERS 2000000
+
+static uint32_t samples[BENCH_SAMPLES];
+static struct sampler bench_sampler;
+static struct matrix bench_matrix;
+static struct dinput_btn_reg matrix_d_btns[MATRIX_MAX_KEYS];
+static struct input_queue bench_queue;
+static struct shiftreg_chain bench_sr;
+static struct dinput_btn_reg sr_d_btns[SHIFTREG_MAX_INPUTS];
+
+// Rows on GPIO 0.., columns from GPIO 16. pressed[row] holds column bits.
+struct matrix_model {
+    uint8_t rows;
+    uint16_t pressed[MATRIX_MAX_ROWS];
+};
+
+static uint32_t matrix_model_read(uint32_t driven_low, void *ctx) {
+    struct matrix_model *mm = ctx;
+    uint32_t levels = 0xffffffff;
+    int r;
+
+    for (r = 0; r < mm->rows; r++) {
+        if ((driven_low >> r) & 1) {
+            levels &= ~((uint32_t)mm->pressed[r] << 16);
+        }
+    }
+    return levels;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Idle-high pins with the odd bouncing press, so some polls do settle.
+static void gen_samples(void) {
+    uint32_t seed = 0x1234567;
+    uint32_t level = 0xffffffff;
+    int i;
+
+    for (i = 0; i < BENCH_SAMPLES; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        if (!(seed & 0x3f)) {
+            level ^= 1u << ((seed >> 8) % BENCH_GPIOS);
+        }
+        samples[i] = level ^ ((seed & 0x7) ? 0 : 1u << ((seed >> 16) % BENCH_GPIOS));
+    }
+}
+
+static void bench_buttons(uint16_t btn_cnt) {
+    struct phy_btn_reg *phy_btns = calloc(btn_cnt, sizeof(*phy_btns));
+    struct dinput_btn_reg *d_btns = calloc(btn_cnt, sizeof(*d_btns));
+    struct report_sched sched;
+    struct gamepad_layout layout;
+    struct gpio_sample sample;
+    uint8_t hat = GAMEPAD_HAT_CENTERED;
+    uint32_t words[DINPUT_BTN_WORDS];
+    uint32_t edge_us;
+    uint64_t start, poll_ns, sampled_ns, report_ns, change_ns;
+    uint32_t reports;
+    int i;
+
+    if (!phy_btns || !d_btns) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    input_init();
+    for (i = 0; i < btn_cnt; i++) {
+        reg_dinput_btn(d_btns + i, i);
+        reg_btn(phy_btns + i, d_btns + i, i % BENCH_GPIOS, 0);
+    }
+    gamepad_layout_init(&layout, 1, 0, btn_cnt, 1, 0);
+    sim_gpio_stream(samples, BENCH_SAMPLES);
+
+    start = now_ns();
+    for (i = 0; i < BENCH_ITERS; i++) {
+        poll_registered_gpios(phy_btns, btn_cnt);
+    }
+    poll_ns = now_ns() - start;
+
+    // timer capture into the ring plus draining it from the main loop
+    sampler_init(&bench_sampler, 4000);
+    sampler_start(&bench_sampler);
+    start = now_ns();
+    for (i = 0; i < BENCH_ITERS; i++) {
+        sim_set_time_us(i * bench_sampler.period_us);
+        sim_sample_timer_fire();
+        while (sampler_pop(&bench_sampler, &sample)) {
+            poll_gpio_sample(phy_btns, btn_cnt, sample.gpio, sample.t_us,
+                             &edge_us);
+        }
+    }
+    sampled_ns = now_ns() - start;
+
+    report_sched_init(&sched, 0, REPORT_MODE_ALWAYS, 0);
+    reports = sim_hid.reports;
+    start = now_ns();
+    for (i = 0; i < BENCH_ITERS; i++) {
+        pack_dinput_btns(d_btns, btn_cnt, words);
+        send_gamepad_report(&sched, &layout, words, &hat, NULL);
+        report_sched_complete(&sched);
+    }
+    report_ns = now_ns() - start;
+
+    if (sim_hid.reports - reports != BENCH_ITERS) {
+        fprintf(stderr, "report count mismatch\n");
+        exit(1);
+    }
+
+    // unchanged state: measures the cost of deciding not to send
+    report_sched_init(&sched, 0, REPORT_MODE_ON_CHANGE, 0);
+    start = now_ns();
+    for (i = 0; i < BENCH_ITERS; i++) {
+        pack_dinput_btns(d_btns, btn_cnt, words);
+        send_gamepad_report(&sched, &layout, words, &hat, NULL);
+        report_sched_complete(&sched);
+    }
+    change_ns = now_ns() - start;
+
+    printf("%4u buttons: poll %7.2f, sampled poll %7.2f, report %7.2f, "
+           "unchanged report %7.2f ns/iter, %u byte report\n",
+           (unsigned)btn_cnt, (double)poll_ns / BENCH_ITERS,
+           (double)sampled_ns / BENCH_ITERS, (double)report_ns / BENCH_ITERS,
+           (double)change_ns / BENCH_ITERS, (unsigned)layout.len);
+
+    free(phy_btns);
+    free(d_btns);
+}
+
+// Report bits of the board profile's buttons, unrolled at compile time,
+// against packing as many registered buttons one by one.
+static void bench_board_pack(void) {
+    struct dinput_btn_reg d_btns[BOARD_BTN_CNT];
+    uint32_t words[DINPUT_BTN_WORDS];
+    uint32_t sum = 0;
+    uint64_t start, board_ns, reg_ns;
+    int i;
+
+    for (i = 0; i < BOARD_BTN_CNT; i++) {
+        reg_dinput_btn(d_btns + i, i);
+    }
+    start = now_ns();
+    for (i = 0; i < BENCH_ITERS; i++) {
+        sum += board_pack(samples[i & (BENCH_SAMPLES - 1)], BOARD_GPIO_MASK);
+    }
+    board_ns = now_ns() - start;
+    start = now_ns();
+    for (i = 0; i < BENCH_ITERS; i++) {
+        d_btns[i % BOARD_BTN_CNT].state =
+            samples[i & (BENCH_SAMPLES - 1)] & 1;
+        pack_dinput_btns(d_btns, BOARD_BTN_CNT, words);
+        sum += words[0];
+    }
+    reg_ns = now_ns() - start;
+
+    printf("board pack: %7.2f ns for %d profile buttons, %7.2f ns "
+           "registered (%lu)\n",
+           (double)board_ns / BENCH_ITERS, BOARD_BTN_CNT,
+           (double)reg_ns / BENCH_ITERS, (unsigned long)sum);
+}
+
+// A reversed mapping written through the feature report pages and stored,
+// then the boot path on it: pick and check the newer sector, copy it, build
+// the tables. Packing through the tables has to agree with the mapping.
+static void bench_config(void) {
+    static struct config_store cs;
+    static struct gpio_map map;
+    struct config_block b;
+    uint8_t feature[CONFIG_FEATURE_LEN];
+    uint32_t levels, expect, bad = 0, sum = 0;
+    uint64_t start, load_ns, build_ns, pack_ns;
+    unsigned page;
+    int i;
+
+    sim_config_erase();
+    config_store_init(&cs, BOARD_GPIO_MASK, BOARD_BTN_CNT, 1000);
+    config_from_profile(&b, 1000);
+    for (i = 0; i < CONFIG_PINS; i++) {
+        if (b.pins[i].flags & CONFIG_PIN_USED) {
+            b.pins[i].btn_id = BOARD_BTN_CNT - 1 - b.pins[i].btn_id;
+        }
+    }
+    config_seal(&b);
+    // twice, so both sectors hold a block and the newer has to win
+    for (i = 0; i < 2; i++) {
+        for (page = 0; page < CONFIG_FEATURE_PAGES; page++) {
+            feature[0] = CONFIG_OP_WRITE;
+            feature[1] = page;
+            memcpy(feature + 4, (uint8_t *)&b + page * CONFIG_PAGE_LEN,
+                   page * CONFIG_PAGE_LEN + CONFIG_PAGE_LEN > sizeof(b)
+                       ? sizeof(b) - page * CONFIG_PAGE_LEN
+                       : CONFIG_PAGE_LEN);
+            config_feature_write(&cs, feature, CONFIG_FEATURE_LEN, 1000);
+        }
+        feature[0] = CONFIG_OP_COMMIT;
+        feature[1] = 0;
+        config_feature_write(&cs, feature, 2, 1000);
+        if (!cs.commit_pending || !config_store_save(&cs)) {
+            fprintf(stderr, "config commit failed\n");
+            exit(1);
+        }
+        cs.commit_pending = false;
+    }
+
+    start = now_ns();
+    for (i = 0; i < BENCH_ITERS / 1000; i++) {
+        config_store_init(&cs, BOARD_GPIO_MASK, BOARD_BTN_CNT, 1000);
+    }
+    load_ns = now_ns() - start;
+    start = now_ns();
+    for (i = 0; i < BENCH_ITERS / 1000; i++) {
+        gpio_map_build(&map, &cs.active, 4000);
+    }
+    build_ns = now_ns() - start;
+    start = now_ns();
+    for (i = 0; i < BENCH_ITERS; i++) {
+        sum += gpio_map_pack(&map, samples[i & (BENCH_SAMPLES - 1)]);
+    }
+    pack_ns = now_ns() - start;
+    for (i = 0; i < BENCH_SAMPLES; i++) {
+        levels = samples[i];
+        expect = 0;
+        for (page = 0; page < BOARD_BTN_CNT; page++) {
+            expect |= ((board_pack(levels, BOARD_GPIO_MASK) >> page) & 1)
+                      << (BOARD_BTN_CNT - 1 - page);
+        }
+        bad += gpio_map_pack(&map, levels) != expect;
+    }
+
+    printf("config: load %7.2f ns (seq %lu), build %7.2f ns, pack %7.2f ns, "
+           "%lu mismatched (%lu)\n",
+           (double)load_ns / (BENCH_ITERS / 1000),
+           (unsigned long)cs.active.seq,
+           (double)build_ns / (BENCH_ITERS / 1000),
+           (double)pack_ns / BENCH_ITERS, (unsigned long)bad,
+           (unsigned long)sum);
+}
+
+// Full scans with the settle delay left out, so this is the CPU cost only.
+static void bench_matrix_scan(uint8_t rows, uint8_t cols) {
+    static uint8_t const row_pins[MATRIX_MAX_ROWS] = {
+        0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+    struct matrix_model mm = {.rows = rows};
+    uint32_t seed = 0x7654321;
+    uint64_t start, scan_ns;
+    int i, r, c;
+
+    matrix_init(&bench_matrix, row_pins, rows, 16, cols, false, 0);
+    for (r = 0; r < rows; r++) {
+        for (c = 0; c < cols; c++) {
+            reg_dinput_btn(matrix_d_btns + r * cols + c, r * cols + c);
+            reg_matrix_btn(&bench_matrix, matrix_d_btns + r * cols + c, r, c);
+        }
+    }
+    sim_gpio_model(matrix_model_read, &mm);
+
+    start = now_ns();
+    for (i = 0; i < BENCH_ITERS / 4; i++) {
+        // a new chord of up to three keys every 64 scans
+        if (!(i & 0x3f)) {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            memset(mm.pressed, 0, sizeof(mm.pressed));
+            for (r = 0; r < 3; r++) {
+                mm.pressed[(seed >> (r * 8)) % rows] |=
+                    1u << ((seed >> (r * 8 + 4)) % cols);
+            }
+        }
+        matrix_scan(&bench_matrix);
+    }
+    scan_ns = now_ns() - start;
+    sim_gpio_model(NULL, NULL);
+
+    printf("%2ux%-2u matrix: scan %7.2f ns/iter, %lu ghost scans\n",
+           (unsigned)rows, (unsigned)cols, (double)scan_ns / (BENCH_ITERS / 4),
+           (unsigned long)bench_matrix.ghost_scans);
+}
+
+// Poll cost per frame, with the bench standing in for the DMA interrupt:
+// bounce a random input every 64 frames on top of an idle high chain.
+static void bench_shiftreg_poll(uint8_t chips) {
+    uint32_t seed = 0x1234567;
+    uint64_t start, poll_ns;
+    uint16_t input = 0;
+    int i;
+
+    shiftreg_init(&bench_sr, 0, 1, chips, 4000);
+    for (i = 0; i < chips * 8; i++) {
+        reg_dinput_btn(sr_d_btns + i, i);
+        reg_shiftreg_btn(&bench_sr, sr_d_btns + i, i, true);
+    }
+    memset(bench_sr.buf, 0xff, sizeof(bench_sr.buf));
+
+    start = now_ns();
+    for (i = 0; i < BENCH_ITERS / 4; i++) {
+        uint32_t *buf = bench_sr.buf[bench_sr.frames & 1];
+
+        if (!(i & 0x3f)) {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            input = seed % (chips * 8);
+        }
+        memcpy(buf, bench_sr.buf[(bench_sr.frames - 1) & 1], chips);
+        if ((i & 0x3f) < 8) {
+            buf[input >> 5] ^= 1u << (input & 31);
+        }
+        bench_sr.frames++;
+        shiftreg_poll(&bench_sr);
+    }
+    poll_ns = now_ns() - start;
+
+    printf("%3u input shiftreg: poll %7.2f ns/frame\n", (unsigned)chips * 8,
+           (double)poll_ns / (BENCH_ITERS / 4));
+}
+
+// One edge per iteration through the input queue, with the consumer taking
+// a merged batch every other iteration.
+static void bench_inputq(void) {
+    struct input_snapshot snap = {0}, out;
+    uint32_t shown[DINPUT_BTN_WORDS] = {0};
+    uint32_t seed = 0x2468ace;
+    uint64_t start, q_ns;
+    uint32_t batches = 0;
+    uint16_t n;
+    int i;
+
+    inputq_init(&bench_queue);
+    start = now_ns();
+    for (i = 0; i < BENCH_ITERS; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        snap.buttons[(seed >> 5) & 3] ^= 1u << (seed & 31);
+        inputq_push(&bench_queue, &snap);
+        if (i & 1) {
+            n = inputq_peek_merged(&bench_queue, shown, &out);
+            memcpy(shown, out.buttons, sizeof(shown));
+            inputq_pop(&bench_queue, n);
+            batches++;
+        }
+    }
+    q_ns = now_ns() - start;
+
+    printf("input queue: %7.2f ns/edge, %lu reports, %lu overflows\n",
+           (double)q_ns / BENCH_ITERS, (unsigned long)batches,
+           (unsigned long)bench_queue.overflows);
+}
+
+// Recording one latency, and reading back a percentile. Checks that the
+// stage names fit the console line.
+static void bench_latency_hist(void) {
+    struct latency_hist h;
+    uint32_t seed = 0x1357bdf;
+    uint64_t start, add_ns, pct_ns;
+    uint32_t p99 = 0;
+    int i;
+
+    latency_hist_reset(&h);
+    start = now_ns();
+    for (i = 0; i < BENCH_ITERS; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        latency_hist_add(&h, seed & 0xffff);
+    }
+    add_ns = now_ns() - start;
+
+    start = now_ns();
+    for (i = 0; i < BENCH_ITERS / 64; i++) {
+        p99 += latency_hist_percentile(&h, 990 - (i & 1));
+    }
+    pct_ns = now_ns() - start;
+
+    for (i = 0; i < LATENCY_STAGES; i++) {
+        if (strlen(latency_stage_names[i]) > LATENCY_STAGE_NAME_MAX) {
+            fprintf(stderr, "latency stage name %s too long\n",
+                    latency_stage_names[i]);
+            exit(1);
+        }
+    }
+
+    printf("latency hist: add %7.2f ns, percentile %7.2f ns (p99 %lu us)\n",
+           (double)add_ns / BENCH_ITERS, (double)pct_ns / (BENCH_ITERS / 64),
+           (unsigned long)(p99 / (BENCH_ITERS / 64)));
+}
+
+// Four axes per poll, 16x oversampled and averaged, on a ring of noisy
+// readings with the bench standing in for the DMA write position.
+static void bench_axes(void) {
+    static struct adc_axes ax;
+    uint32_t seed = 0x3141592;
+    uint32_t polls = BENCH_ITERS / 4;
+    uint64_t start, poll_ns;
+    int i;
+
+    adc_axes_init(&ax, ADC_AXES_MAX, ADC_OVERSAMPLE_MAX, 64000);
+    for (i = 0; i < ADC_AXES_MAX; i++) {
+        axis_init(ax.axes + i, i & 1 ? AXIS_FILTER_IIR : AXIS_FILTER_AVERAGE,
+                  2, 256, 64);
+    }
+    start = now_ns();
+    for (i = 0; i < (int)polls; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        // a slow sweep plus a few LSBs of noise
+        ax.ring[(i * 4 + (seed & 3)) & (ADC_RING_LEN - 1)] =
+            ((i >> 4) & 0xfff) ^ (seed >> 28);
+        adc_axes_update(&ax, i * 4);
+    }
+    poll_ns = now_ns() - start;
+
+    printf("adc axes: %7.2f ns/poll for %d axes, %lu changed\n",
+           (double)poll_ns / polls, ADC_AXES_MAX, (unsigned long)ax.updates);
+}
+
+// Four encoders turning at random, one step of one of them per ring entry,
+// two pulsing buttons and two on axes, decoded one entry per update like a
+// poll that finds a single new transition. Every step has to come out in
+// the counts with none missed.
+static void bench_encoders(void) {
+    static struct encoder_bank eb;
+    static struct dinput_btn_reg btns[4];
+    int32_t expect[ENCODER_MAX] = {0};
+    uint8_t const gray[4] = {0, 1, 3, 2};
+    uint8_t phase[ENCODER_MAX] = {0};
+    uint8_t levels = 0;
+    uint32_t seed = 0x2718281;
+    uint32_t bad = 0;
+    uint64_t start, dec_ns;
+    int i, n;
+
+    encoder_bank_init(&eb, 0, ENCODER_MAX, 500000);
+    encoder_set_buttons(eb.enc + 0, btns + 0, btns + 1, 4, 20);
+    encoder_set_buttons(eb.enc + 1, btns + 2, btns + 3, 4, 20);
+    encoder_set_axis(eb.enc + 2, 96, false);
+    encoder_set_axis(eb.enc + 3, 96, true);
+    start = now_ns();
+    for (i = 0; i < BENCH_ITERS; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        n = seed & (ENCODER_MAX - 1);
+        phase[n] = (phase[n] + (seed & 0x100 ? 1 : 3)) & 3;
+        expect[n] += seed & 0x100 ? 1 : -1;
+        levels = (levels & ~(3u << (n * 2))) | gray[phase[n]] << (n * 2);
+        eb.ring[i & (ENCODER_RING_LEN - 1)] = levels;
+        encoder_bank_update(&eb, i + 1, i);
+    }
+    dec_ns = now_ns() - start;
+    for (i = 0; i < ENCODER_MAX; i++) {
+        bad += eb.enc[i].count != expect[i];
+    }
+
+    printf("encoders: %7.2f ns/transition for %d encoders, %lu missed, "
+           "%lu miscounted\n",
+           (double)dec_ns / BENCH_ITERS, ENCODER_MAX,
+           (unsigned long)encoder_bank_missed(&eb), (unsigned long)bad);
+}
+
+// All four hats of a report per update, alternating 4 and 8 way, on random
+// button states.
+static void bench_hats(void) {
+    static struct hat_set hs;
+    uint8_t ids[HAT_8WAY];
+    uint8_t hats[GAMEPAD_MAX_HATS];
+    uint32_t words[DINPUT_BTN_WORDS] = {0};
+    uint32_t seed = 0x9abcdef;
+    uint32_t sum = 0;
+    uint64_t start, hat_ns;
+    int i, h;
+
+    hat_set_init(&hs);
+    for (h = 0; h < GAMEPAD_MAX_HATS; h++) {
+        for (i = 0; i < HAT_8WAY; i++) {
+            ids[i] = h * 8 + i;
+        }
+        hat_add(&hs, h & 1 ? HAT_8WAY : HAT_4WAY, h % HAT_OPPOSE_POLICIES, ids);
+    }
+    start = now_ns();
+    for (i = 0; i < BENCH_ITERS; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        words[0] = seed;
+        hat_set_update(&hs, words, hats);
+        sum += hats[0] + hats[3];
+    }
+    hat_ns = now_ns() - start;
+
+    printf("hats: %7.2f ns/update for %d hats (%lu)\n",
+           (double)hat_ns / BENCH_ITERS, GAMEPAD_MAX_HATS, (unsigned long)sum);
+}
+
+// A fixed log line from the hot path, with the console draining a CDC
+// packet's worth every 8 lines.
+static void bench_telemetry(void) {
+    static struct telem_ring ring;
+    uint8_t out[64];
+    uint64_t start, log_ns;
+    int i;
+
+    telem_ring_init(&ring);
+    start = now_ns();
+    for (i = 0; i < BENCH_ITERS; i++) {
+        TELEM_LOG(&ring, "usb: report busy\r\n");
+        if (!(i & 7)) {
+            while (telem_read(&ring, out, sizeof(out))) {
+            }
+        }
+    }
+    log_ns = now_ns() - start;
+
+    printf("telemetry: log %7.2f ns/line, %lu dropped\n",
+           (double)log_ns / BENCH_ITERS, (unsigned long)ring.dropped);
+}
+
+// Every sample offered to the trace recorder, idle and while recording the
+// bench samples' changes, with the console draining a CDC packet every 8.
+static void bench_trace(void) {
+    static struct trace_recorder tr;
+    uint8_t out[64];
+    uint64_t start, idle_ns, rec_ns;
+    int i;
+
+    trace_recorder_init(&tr, 4000);
+    start = now_ns();
+    for (i = 0; i < BENCH_ITERS; i++) {
+        trace_capture(&tr, samples[i & (BENCH_SAMPLES - 1)], i);
+    }
+    idle_ns = now_ns() - start;
+
+    trace_start(&tr, (1u << BENCH_GPIOS) - 1);
+    start = now_ns();
+    for (i = 0; i < BENCH_ITERS; i++) {
+        trace_capture(&tr, samples[i & (BENCH_SAMPLES - 1)], i);
+        if (!(i & 7)) {
+            trace_read(&tr, out, sizeof(out), i);
+        }
+    }
+    rec_ns = now_ns() - start;
+    trace_stop(&tr);
+    while (trace_active(&tr)) {
+        trace_read(&tr, out, sizeof(out), i);
+    }
+
+    printf("trace: %7.2f ns/sample idle, %7.2f recording, %lu records, "
+           "%lu dropped\n",
+           (double)idle_ns / BENCH_ITERS, (double)rec_ns / BENCH_ITERS,
+           (unsigned long)tr.records, (unsigned long)tr.dropped);
+}
+
+// A 4 kHz sample timer against SOFs from a host clock 500 ppm slow, as seen
+// by the device. Age is how old the newest sample is at the report build
+// point, with the timer free running and phase locked to the frame. Checks
+// that the lead measured at the build point is the one set up.
+static void bench_frame_sync(void) {
+    static const int frames = 20000;
+    struct frame_sync fs;
+    uint32_t period = 250, lead = 100;
+    uint64_t age_sum[2] = {0, 0};
+    int settled = -1;
+    int lock, f;
+
+    for (lock = 0; lock < 2; lock++) {
+        uint32_t next = 37, last = 0;
+
+        frame_sync_init(&fs, lead);
+        for (f = 0; f < frames; f++) {
+            uint32_t sof = (uint32_t)((uint64_t)f * 1000500 / 1000);
+            uint32_t build = sof + FRAME_SYNC_FRAME_US - lead;
+
+            frame_sync_sof(&fs, sof);
+            while ((int32_t)(sof - next) >= 0) {
+                last = next;
+                next += period;
+            }
+            if (lock) {
+                next += frame_sync_sample_offset(&fs, sof, last, period);
+            }
+            while ((int32_t)(build - next) >= 0) {
+                last = next;
+                next += period;
+            }
+            if (f >= frames / 2) {
+                age_sum[lock] += build - last;
+            }
+            frame_sync_built(&fs, build);
+            if (lock && settled < 0 &&
+                build - last <= FRAME_SYNC_SAMPLE_MARGIN_US) {
+                settled = f;
+            }
+        }
+    }
+
+    if (frame_sync_build_lead_us(&fs) != lead) {
+        fprintf(stderr, "frame sync: built %lu us ahead, not %lu\n",
+                (unsigned long)frame_sync_build_lead_us(&fs),
+                (unsigned long)lead);
+        exit(1);
+    }
+
+    printf("frame sync: sample age at build %6.1f us free running, "
+           "%6.1f us locked after %d frames\n",
+           (double)age_sum[0] / (frames / 2),
+           (double)age_sum[1] / (frames / 2), settled);
+}
+
+// Keyboard report packing from the bench samples as pressed buttons, with
+// no button mapped to a key and with all 64 of them typing one.
+static void bench_keyboard(void) {
+    static struct keymap km;
+    uint8_t report[KEYBOARD_REPORT_LEN];
+    uint32_t words[DINPUT_BTN_WORDS] = {0};
+    uint64_t start, none_ns, all_ns;
+    uint32_t sum = 0;
+    int most = 0;
+    int i, k, n;
+
+    keymap_init(&km);
+    start = now_ns();
+    for (i = 0; i < BENCH_ITERS; i++) {
+        words[0] = samples[i & (BENCH_SAMPLES - 1)];
+        words[1] = ~words[0];
+        keyboard_report_pack(&km, words, report);
+        sum += report[0];
+    }
+    none_ns = now_ns() - start;
+
+    // letters, digits and the rest from usage 4 up, every 8th with shift
+    for (i = 0; i < 64; i++) {
+        keymap_set(&km, i, 4 + i, (i & 7) ? 0 : KEY_MOD_LEFT_SHIFT, false);
+    }
+    start = now_ns();
+    for (i = 0; i < BENCH_ITERS; i++) {
+        words[0] = samples[i & (BENCH_SAMPLES - 1)];
+        words[1] = ~words[0];
+        keyboard_report_pack(&km, words, report);
+        sum += report[0];
+        if (!(i & 1023)) {
+            for (k = 1, n = 0; k < KEYBOARD_REPORT_LEN; k++) {
+                n += __builtin_popcount(report[k]);
+            }
+            most = n > most ? n : most;
+        }
+    }
+    all_ns = now_ns() - start;
+
+    printf("keyboard: pack %7.2f ns without keys, %7.2f ns with 64 keys, up "
+           "to %d keys in one report (%lu)\n",
+           (double)none_ns / BENCH_ITERS, (double)all_ns / BENCH_ITERS, most,
+           (unsigned long)sum);
+}
+
+// Display stream decoding, one 64 byte USB packet per call as display_task()
+// feeds it, with the bands drained straight away: raw pixels, and the worst
+// case for RLE, repeats of 128 that turn a packet into thousands of pixels.
+static void bench_display(void) {
+    static struct display d;
+    static uint8_t raw[sizeof(struct display_cmd) + 240 * 128 * 2];
+    static uint8_t rle[sizeof(struct display_cmd) + 240 * 320 / 128 * 3];
+    struct display_cmd cmd = {.sync = DISPLAY_SYNC, .w = 240};
+    uint8_t *streams[2] = {raw, rle};
+    uint32_t lens[2] = {sizeof(raw), sizeof(rle)};
+    double pkt_ns[2], px_ns[2];
+    uint64_t start, ns, px;
+    uint32_t off, len, pkts;
+    int s, i;
+
+    cmd.op = DISPLAY_OP_RAW;
+    cmd.h = 128;
+    memcpy(raw, &cmd, sizeof(cmd));
+    for (i = sizeof(cmd); i < (int)sizeof(raw); i++) {
+        raw[i] = samples[i & (BENCH_SAMPLES - 1)];
+    }
+    cmd.op = DISPLAY_OP_RLE;
+    cmd.h = 320;
+    memcpy(rle, &cmd, sizeof(cmd));
+    for (i = sizeof(cmd); i < (int)sizeof(rle); i += 3) {
+        rle[i] = 0xff;
+        rle[i + 1] = i;
+        rle[i + 2] = i >> 8;
+    }
+
+    for (s = 0; s < 2; s++) {
+        display_init(&d, 240, 320);
+        ns = px = pkts = 0;
+        while (d.rects < 200) {
+            for (off = 0; off < lens[s]; pkts++) {
+                len = lens[s] - off < 64 ? lens[s] - off : 64;
+                start = now_ns();
+                off += display_feed(&d, streams[s] + off, len);
+                while (display_band_next(&d)) {
+                    px += display_band_next(&d)->len;
+                    display_band_done(&d);
+                }
+                ns += now_ns() - start;
+            }
+        }
+        pkt_ns[s] = (double)ns / pkts;
+        px_ns[s] = (double)ns / px;
+    }
+
+    printf("display: %7.1f ns per raw packet (%5.2f ns/px), %7.1f ns per "
+           "RLE packet (%5.2f ns/px), %lu errors\n",
+           pkt_ns[0], px_ns[0], pkt_ns[1], px_ns[1], (unsigned long)d.errors);
+}
+
+// Backlight updates for a 64 LED chain with press feedback: buttons held
+// still (the usual loop), and a new bench sample every update with the clock
+// running so fades step too. Only what changed is worked out again.
+static void bench_backlight(void) {
+    static struct backlight bl;
+    uint32_t words[DINPUT_BTN_WORDS] = {0};
+    uint64_t start, idle_ns, busy_ns;
+    uint32_t idle_leds, sum = 0;
+    int i;
+
+    backlight_init(&bl, BACKLIGHT_MAX_LEDS, 0);
+    backlight_fill(&bl, 0, BACKLIGHT_MAX_LEDS, 0x202020);
+    backlight_set_feedback(&bl, true, 0xffffff, 250);
+    words[0] = samples[0];
+    backlight_update(&bl, words, 0);
+    bl.recomputed = 0;
+    start = now_ns();
+    for (i = 0; i < BENCH_ITERS; i++) {
+        sum += backlight_update(&bl, words, 0);
+        bl.stale = false;
+    }
+    idle_ns = now_ns() - start;
+    idle_leds = bl.recomputed;
+
+    bl.recomputed = 0;
+    start = now_ns();
+    for (i = 0; i < BENCH_ITERS; i++) {
+        words[0] = samples[i & (BENCH_SAMPLES - 1)];
+        words[1] = ~words[0];
+        sum += backlight_update(&bl, words, i / 64);
+        bl.stale = false;
+    }
+    busy_ns = now_ns() - start;
+
+    printf("backlight: update %6.2f ns idle (%lu LEDs redone), %6.2f ns with "
+           "presses and fades (%.1f LEDs redone each) (%lu)\n",
+           (double)idle_ns / BENCH_ITERS, (unsigned long)idle_leds,
+           (double)busy_ns / BENCH_ITERS,
+           (double)bl.recomputed / BENCH_ITERS, (unsigned long)sum);
+}
+
+// With panel 0 busy, a tap on a hat contact past its buttons has to wait
+// for it instead of being folded away in the state it owes.
+static void check_panel_hat(struct hid_panel *panels) {
+    uint16_t first[2], count[2];
+    uint32_t sent[DINPUT_BTN_WORDS] = {0}, cur[DINPUT_BTN_WORDS] = {0};
+    uint32_t next[DINPUT_BTN_WORDS] = {0};
+    int k;
+
+    hid_panels_split(64, 2, NULL, 0, first, count);
+    for (k = 0; k < 2; k++) {
+        hid_panel_init(panels + k, k, k ? 0 : 1, first[k], count[k],
+                       k ? 0 : 1, 0, REPORT_MODE_ON_CHANGE, 0);
+    }
+    hid_panel_watch(panels, 64, 4);
+    hid_panel_settle(panels, -1, sent);
+    cur[2] = 1;
+    if (hid_panels_can_take(panels, 2, cur, next)) {
+        fprintf(stderr, "panels: hat tap folded on a busy panel 0\n");
+        exit(1);
+    }
+}
+
+// One edge at a time on 128 buttons, sent as one gamepad with a hat, and
+// split over four 32 button panels: time per edge including the owed check,
+// and bytes on the bus, the report ID counted. Each panel only sends when
+// one of its own buttons changed. Checks a hat tap on a busy panel 0 first.
+static void bench_panels(void) {
+    static struct hid_panel panels[HID_PANELS_MAX];
+    static struct input_snapshot s;
+    uint16_t first[HID_PANELS_MAX], count[HID_PANELS_MAX];
+    uint32_t prev[DINPUT_BTN_WORDS];
+    uint64_t start, ns[2];
+    uint32_t bytes[2], sent[2];
+    uint8_t cnt;
+    int n, k, i, b;
+
+    check_panel_hat(panels);
+    for (n = 0; n < 2; n++) {
+        cnt = n ? HID_PANELS_MAX : 1;
+        hid_panels_split(MAX_DINPUT_BTNS, cnt, NULL, 0, first, count);
+        for (k = 0; k < cnt; k++) {
+            hid_panel_init(panels + k, k, k ? 0 : 1, first[k], count[k],
+                           k ? 0 : 1, 0, REPORT_MODE_ON_CHANGE, 0);
+        }
+        memset(&s, 0, sizeof(s));
+        bytes[n] = sim_hid.bytes;
+        sent[n] = sim_hid.reports;
+        start = now_ns();
+        for (i = 0; i < BENCH_ITERS; i++) {
+            memcpy(prev, s.buttons, sizeof(prev));
+            b = (samples[i & (BENCH_SAMPLES - 1)] * 37u + i) & 127;
+            s.buttons[b >> 5] ^= 1u << (b & 31);
+            if (!hid_panels_can_take(panels, cnt, prev, s.buttons)) {
+                continue;
+            }
+            for (k = 0; k < cnt; k++) {
+                if (hid_panel_send(panels + k, &s) == 0) {
+                    report_sched_complete(&panels[k].sched);
+                }
+            }
+        }
+        ns[n] = now_ns() - start;
+        bytes[n] = sim_hid.bytes - bytes[n];
+        sent[n] = sim_hid.reports - sent[n];
+    }
+
+    printf("panels: 1x128 %6.2f ns/edge, %5.2f B/edge; 4x32 %6.2f ns/edge, "
+           "%5.2f B/edge (%lu, %lu reports)\n",
+           (double)ns[0] / BENCH_ITERS, (double)bytes[0] / BENCH_ITERS,
+           (double)ns[1] / BENCH_ITERS, (double)bytes[1] / BENCH_ITERS,
+           (unsigned long)sent[0], (unsigned long)sent[1]);
+}
+
+// 20 buttons, 19 shifting 0..7 to 20..27, 8 a tap-hold of 28 and 29, 9
+// and 10 a chord of 30, 11 with a double tap of 31
+static void layers_setup(struct layer_engine *le, bool roles, uint32_t t) {
+    int i;
+
+    layer_engine_init(le, 20, 200000, 250000, 50000, 20000, t);
+    if (!roles) {
+        return;
+    }
+    layer_engine_set(le, 19, LAYER_ROLE_SHIFT, 1, LAYER_NONE);
+    for (i = 0; i < 8; i++) {
+        layer_engine_set(le, i, LAYER_ROLE_REMAP, 1, 20 + i);
+    }
+    layer_engine_set(le, 8, LAYER_ROLE_TAP_HOLD, 28, 29);
+    layer_engine_set(le, 9, LAYER_ROLE_CHORD, 10, 30);
+    layer_engine_set(le, 11, LAYER_ROLE_DOUBLE_TAP, 31, 0);
+}
+
+// The layer engine as set up by layers_setup(), 12..18 left plain. Checks
+// that a scripted tap, hold, chord and shift come out as set up, that hat
+// contacts passed through after the outputs are not stripped, and that
+// every plain edge of the bench samples (at 4 kHz, pressed low) is in the
+// output of the very update it came in with. Times an update without roles
+// and with them, and arming and cancelling a wheel timer with none and with
+// all others pending.
+static void bench_layers(void) {
+    // {time in ms, buttons held, output expected after}
+    static uint32_t const script[][3] = {
+        {0, 1u << 8, 0},            {50, 0, 1u << 28},
+        {80, 0, 0},                 {100, 1u << 8, 0},
+        {310, 1u << 8, 1u << 29},   {320, 0, 0},
+        {400, 1u << 9, 0},          {420, 3u << 9, 1u << 30},
+        {430, 1u << 9, 0},          {440, 0, 0},
+        {500, 1u << 19, 0},         {510, 1u << 19 | 1, 1u << 20},
+        {520, 1, 1u << 20},         {530, 0, 0},
+    };
+    static struct layer_engine le;
+    static struct timer_wheel wheel;
+    uint32_t const plain = 0x7f000;
+    uint32_t in[DINPUT_BTN_WORDS] = {0}, out[DINPUT_BTN_WORDS];
+    uint64_t start, update_ns[2], arm_ns[2];
+    uint32_t t = 0, late = 0, edges = 0, prev = 0, sum = 0;
+    int i, n;
+
+    layers_setup(&le, true, 0);
+    for (i = 0; i < (int)(sizeof(script) / sizeof(script[0])); i++) {
+        t = script[i][0] * 1000;
+        layer_engine_poll(&le, t);
+        in[0] = script[i][1];
+        layer_engine_update(&le, in, t, out);
+        if ((out[0] & ~plain) != script[i][2]) {
+            fprintf(stderr, "layer script step %d: %08lx\n", i,
+                    (unsigned long)out[0]);
+            exit(1);
+        }
+    }
+    // hat contacts past the last output come straight through
+    layer_engine_pass(&le, 32, 4);
+    in[1] = 0x5;
+    layer_engine_update(&le, in, t, out);
+    if (out[1] != 0x5) {
+        fprintf(stderr, "layer hat contacts: %08lx\n", (unsigned long)out[1]);
+        exit(1);
+    }
+    in[1] = 0;
+
+    // without roles, then with them
+    for (n = 0; n < 2; n++) {
+        layers_setup(&le, n, t);
+        start = now_ns();
+        for (i = 0; i < BENCH_ITERS; i++) {
+            t += 250;
+            in[0] = ~samples[i & (BENCH_SAMPLES - 1)] & 0xfffff;
+            layer_engine_poll(&le, t);
+            layer_engine_update(&le, in, t, out);
+            sum += out[0];
+            edges += __builtin_popcount((in[0] ^ prev) & plain);
+            late += __builtin_popcount((in[0] ^ out[0]) & plain);
+            prev = in[0];
+        }
+        update_ns[n] = now_ns() - start;
+    }
+    if (late) {
+        fprintf(stderr, "%lu plain edges held back\n", (unsigned long)late);
+        exit(1);
+    }
+
+    for (n = 0; n < 2; n++) {
+        twheel_init(&wheel, 1000, 0);
+        for (i = 1; n && i < TWHEEL_MAX_TIMERS; i++) {
+            twheel_arm(&wheel, i, 0, i * 7000);
+        }
+        start = now_ns();
+        for (i = 0; i < BENCH_ITERS; i++) {
+            twheel_arm(&wheel, 0, 0, (i & 255) * 1000);
+            twheel_cancel(&wheel, 0);
+        }
+        arm_ns[n] = now_ns() - start;
+    }
+
+    printf("layers: update %6.2f ns without roles, %6.2f ns with, %lu plain "
+           "edges all in the same update; wheel arm+cancel %5.2f ns idle, "
+           "%5.2f ns with %d pending (%lu)\n",
+           (double)update_ns[0] / BENCH_ITERS, (double)update_ns[1] / BENCH_ITERS,
+           (unsigned long)edges, (double)arm_ns[0] / BENCH_ITERS,
+           (double)arm_ns[1] / BENCH_ITERS, TWHEEL_MAX_TIMERS - 1,
+           (unsigned long)sum);
+}
+
+// A tap that wakes the device from suspend and is over before the scan
+// restarts: lost from the samples alone, queued from the wake levels.
+static void bench_suspend(void) {
+    static struct phy_btn_reg btn;
+    static struct dinput_btn_reg d_btn;
+    struct usb_suspend s;
+    struct input_snapshot snap = {0}, out;
+    uint32_t const idle = 0xffffffff, tap = idle & ~(1u << 5);
+    uint32_t shown[DINPUT_BTN_WORDS];
+    uint32_t pins, gpio, t_us, edge_us, wake_us;
+    uint32_t first[2], presses[2], t = 0;
+    uint64_t start, idle_ns;
+    uint16_t merged;
+    int i, n;
+
+    input_init();
+    reg_dinput_btn(&d_btn, 0);
+    reg_btn(&btn, &d_btn, 5, 0);
+    usb_suspend_init(&s, 1000000);
+    for (n = 0; n < 2; n++) {
+        inputq_init(&bench_queue);
+        usb_suspend_enter(&s, true, t);
+        usb_suspend_sleep(&s, registered_gpio_pins(), gpio_debounce.state, t);
+        // an idle interrupt, then the tap
+        if (usb_suspend_waited(&s, t + 1000, t + 1010, idle) ||
+            !usb_suspend_waited(&s, t + 1020, t + 5000, tap)) {
+            fprintf(stderr, "suspend: woke on the wrong interrupt\n");
+            exit(1);
+        }
+        if (n && usb_suspend_take_wake(&s, &pins, &gpio, &t_us) &&
+            force_gpio_levels(&btn, 1, pins, gpio)) {
+            snap.buttons[0] = d_btn.state;
+            snap.sample_t_us = snap.edge_t_us = t_us;
+            inputq_push(&bench_queue, &snap);
+        }
+        // the scan restarts after the 200 us tap
+        for (i = 0; i < 16; i++) {
+            t_us = t + 5200 + i * 250;
+            if (poll_gpio_sample(&btn, 1, idle, t_us, &edge_us)) {
+                snap.buttons[0] = d_btn.state;
+                snap.sample_t_us = t_us;
+                snap.edge_t_us = edge_us;
+                inputq_push(&bench_queue, &snap);
+            }
+        }
+        usb_suspend_resume(&s, t + 25000);
+        memset(shown, 0, sizeof(shown));
+        first[n] = presses[n] = 0;
+        while ((merged = inputq_peek_merged(&bench_queue, shown, &out))) {
+            if (!presses[n] && (out.buttons[0] & 1)) {
+                first[n] = out.edge_t_us;
+            }
+            presses[n] += out.buttons[0] & ~shown[0] & 1;
+            memcpy(shown, out.buttons, sizeof(shown));
+            inputq_pop(&bench_queue, merged);
+        }
+        if (!usb_suspend_report_done(&s, t + 26000, &wake_us) ||
+            wake_us != 21000) {
+            fprintf(stderr, "suspend: wake to report not timed\n");
+            exit(1);
+        }
+        t += 100000;
+    }
+    if (presses[0] || presses[1] != 1 || first[1] != t - 100000 + 5000) {
+        fprintf(stderr, "suspend: %lu presses from the samples, %lu with the "
+                "wake levels\n", (unsigned long)presses[0],
+                (unsigned long)presses[1]);
+        exit(1);
+    }
+
+    // what an interrupt that is not a button costs while asleep
+    usb_suspend_enter(&s, true, t);
+    usb_suspend_sleep(&s, registered_gpio_pins(), gpio_debounce.state, t);
+    start = now_ns();
+    for (i = 0; i < BENCH_ITERS; i++) {
+        usb_suspend_waited(&s, t + i * 2, t + i * 2 + 1, idle);
+    }
+    idle_ns = now_ns() - start;
+
+    printf("suspend: a 200 us tap that wakes the device gives %lu presses "
+           "from the samples, %lu with the wake levels; %5.2f ns per idle "
+           "interrupt asleep\n",
+           (unsigned long)presses[0], (unsigned long)presses[1],
+           (double)idle_ns / BENCH_ITERS);
+}
+
+int main(void) {
+    gen_samples();
+    bench_buttons(20);
+    bench_buttons(64);
+    bench_buttons(256);
+    bench_board_pack();
+    bench_config();
+    bench_matrix_scan(8, 8);
+    bench_matrix_scan(16, 8);
+    bench_shiftreg_poll(4);
+    bench_shiftreg_poll(32);
+    bench_inputq();
+    bench_hats();
+    bench_layers();
+    bench_keyboard();
+    bench_panels();
+    bench_backlight();
+    bench_axes();
+    bench_encoders();
+    bench_latency_hist();
+    bench_telemetry();
+    bench_trace();
+    bench_frame_sync();
+    bench_suspend();
+    bench_display();
+    return 0;
+}
@@ -0,0 +1,495 @@
+/*
+ * Display stream encoder and decoder loopback.
+ *
+ *   umfd_display gen [-W width] [-H height] [-n frames] [-s seed]
+ *                    -o out.stream
+ *   umfd_display loopback [-W width] [-H height] [-n frames] [-c chunk]
+ *                         [-e] [-s seed]
+ *
+ * Both render a synthetic MFD page (flat background, moving bar gauges, a
+ * bouncing box, a block of changing text, a page switch every 100 frames)
+ * and encode each frame the way a host exporter would: 16x16 tiles that
+ * differ from the previous frame, merged along each tile row into
+ * rectangles, each sent RLE or raw, whichever is shorter, then a frame
+ * command (see src/display.h).
+ *
+ * gen writes the stream to a file, for sending to the device with any bulk
+ * writer. loopback feeds it to the device's decoder in chunks of 1 to chunk
+ * bytes (64 by default, a USB packet), drains one band per chunk into a
+ * simulated panel so the decoder has to stall, and checks the panel against
+ * the source after every frame. With -e garbage goes in between commands
+ * to exercise resyncing. It exits with status 3 on any mismatch.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "display.h"
+
+#define TILE 16
+// Full speed bulk, after the HID endpoint and protocol overhead
+#define USB_BULK_BYTES_PER_S 1000000
+
+struct frame {
+    uint16_t w, h;
+    uint16_t *px;
+};
+
+struct stream {
+    uint8_t *buf;
+    size_t len;
+    size_t cap;
+};
+
+struct sim_panel {
+    struct frame fb;
+    uint16_t wx, wy, ww, wh;
+    uint32_t pos;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint32_t xorshift(uint32_t *seed) {
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+    return *seed;
+}
+
+static void *xrealloc(void *p, size_t len) {
+    p = realloc(p, len);
+    if (!p) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static void frame_alloc(struct frame *f, uint16_t w, uint16_t h) {
+    f->w = w;
+    f->h = h;
+    f->px = xrealloc(NULL, (size_t)w * h * sizeof(*f->px));
+    memset(f->px, 0, (size_t)w * h * sizeof(*f->px));
+}
+
+static void put(struct stream *s, void const *data, size_t len) {
+    if (s->len + len > s->cap) {
+        s->cap = (s->len + len) * 2;
+        s->buf = xrealloc(s->buf, s->cap);
+    }
+    memcpy(s->buf + s->len, data, len);
+    s->len += len;
+}
+
+static void put_px(struct stream *s, uint16_t px) {
+    uint8_t b[2] = {px & 0xff, px >> 8};
+
+    put(s, b, sizeof(b));
+}
+
+//--------------------------------------------------------------------+
+// Synthetic MFD page
+//--------------------------------------------------------------------+
+
+static void fill(struct frame *f, int x, int y, int w, int h, uint16_t c) {
+    int i, j;
+
+    for (j = y; j < y + h && j < f->h; j++) {
+        for (i = x; i < x + w && i < f->w; i++) {
+            f->px[j * f->w + i] = c;
+        }
+    }
+}
+
+// Random 6x8 glyph cells, a few of them changed per frame
+static void text_cell(struct frame *f, int x, int y, uint32_t bits,
+                      uint16_t fg, uint16_t bg) {
+    int i, j;
+
+    for (j = 0; j < 8; j++) {
+        for (i = 0; i < 6; i++) {
+            f->px[(y + j) * f->w + x + i] =
+                (bits >> ((j * 6 + i) % 32)) & 0x1 ? fg : bg;
+        }
+    }
+}
+
+static void render(struct frame *f, uint32_t n, uint32_t *seed,
+                   uint32_t *glyphs, int cells) {
+    static uint16_t const page_bg[] = {0x18e3, 0x0010, 0x2104};
+    uint16_t bg = page_bg[(n / 100) % 3];
+    int cols = (f->w - 16) / 6;
+    int gauges = 6, gw = f->w / 10, i, h, x, y;
+
+    fill(f, 0, 0, f->w, f->h, bg);
+    // bar gauges along the bottom half
+    for (i = 0; i < gauges; i++) {
+        h = (f->h / 3) * (1 + ((n * (i + 1) * 7) % 97)) / 98;
+        fill(f, 8 + i * (gw + 6), f->h - 8 - h, gw, h, 0x07e0);
+    }
+    // a box bouncing around the top half
+    x = (n * 3) % (2 * (f->w - 40));
+    y = (n * 2) % (f->h - 30);
+    if (x >= f->w - 40) {
+        x = 2 * (f->w - 40) - x;
+    }
+    fill(f, x, y / 2, 40, 30, 0xf800);
+    // text block, three cells change a frame
+    for (i = 0; i < 3; i++) {
+        glyphs[xorshift(seed) % cells] = xorshift(seed);
+    }
+    for (i = 0; i < cells; i++) {
+        text_cell(f, 8 + (i % cols) * 6, f->h / 2 - 40 + (i / cols) * 8,
+                  glyphs[i], 0xffff, bg);
+    }
+}
+
+//--------------------------------------------------------------------+
+// Encoder
+//--------------------------------------------------------------------+
+
+static void put_cmd(struct stream *s, uint8_t op, int x, int y, int w,
+                    int h) {
+    struct display_cmd cmd = {
+        .sync = DISPLAY_SYNC,
+        .op = op,
+        .x = x,
+        .y = y,
+        .w = w,
+        .h = h,
+    };
+
+    put(s, &cmd, sizeof(cmd));
+}
+
+// PackBits on pixels: repeats of 3 or more as one pixel, the rest literal.
+static void put_rle(struct stream *s, uint16_t const *px, size_t n) {
+    size_t i = 0, lit, run;
+    uint8_t c;
+
+    while (i < n) {
+        run = 1;
+        while (i + run < n && run < DISPLAY_RLE_MAX &&
+               px[i + run] == px[i]) {
+            run++;
+        }
+        if (run >= 3) {
+            c = 0x7f + run;
+            put(s, &c, 1);
+            put_px(s, px[i]);
+            i += run;
+            continue;
+        }
+        // literal up to the next run of 3
+        lit = 0;
+        while (i + lit < n && lit < DISPLAY_RLE_MAX &&
+               !(i + lit + 2 < n && px[i + lit] == px[i + lit + 1] &&
+                 px[i + lit] == px[i + lit + 2])) {
+            lit++;
+        }
+        c = lit - 1;
+        put(s, &c, 1);
+        for (run = 0; run < lit; run++) {
+            put_px(s, px[i + run]);
+        }
+        i += lit;
+    }
+}
+
+static void put_rect(struct stream *s, struct frame const *f, int x, int y,
+                     int w, int h) {
+    static uint16_t *px;
+    static size_t px_cap;
+    struct stream rle = {0};
+    int j;
+
+    if ((size_t)w * h > px_cap) {
+        px_cap = (size_t)w * h;
+        px = xrealloc(px, px_cap * sizeof(*px));
+    }
+    for (j = 0; j < h; j++) {
+        memcpy(px + j * w, f->px + (y + j) * f->w + x, w * sizeof(*px));
+    }
+    put_rle(&rle, px, (size_t)w * h);
+    if (rle.len < (size_t)w * h * 2) {
+        put_cmd(s, DISPLAY_OP_RLE, x, y, w, h);
+        put(s, rle.buf, rle.len);
+    } else {
+        put_cmd(s, DISPLAY_OP_RAW, x, y, w, h);
+        for (j = 0; j < w * h; j++) {
+            put_px(s, px[j]);
+        }
+    }
+    free(rle.buf);
+}
+
+static bool tile_dirty(struct frame const *f, struct frame const *prev,
+                       int tx, int ty) {
+    int x0 = tx * TILE, y0 = ty * TILE, j, w;
+
+    w = x0 + TILE > f->w ? f->w - x0 : TILE;
+    for (j = y0; j < y0 + TILE && j < f->h; j++) {
+        if (memcmp(f->px + j * f->w + x0, prev->px + j * f->w + x0,
+                   w * sizeof(*f->px))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Dirty tiles of f against prev, merged along tile rows; prev NULL sends
+// everything. Returns the rectangles sent.
+static int encode_frame(struct stream *s, struct frame const *f,
+                        struct frame const *prev, uint32_t *seed,
+                        bool garbage) {
+    int tw = (f->w + TILE - 1) / TILE, th = (f->h + TILE - 1) / TILE;
+    int tx, ty, start, x, y, w, h, rects = 0;
+    uint8_t junk;
+    uint32_t k;
+
+    for (ty = 0; ty < th; ty++) {
+        for (tx = 0; tx < tw; tx++) {
+            if (prev && !tile_dirty(f, prev, tx, ty)) {
+                continue;
+            }
+            start = tx;
+            while (tx + 1 < tw && (!prev || tile_dirty(f, prev, tx + 1, ty))) {
+                tx++;
+            }
+            x = start * TILE;
+            y = ty * TILE;
+            w = (tx + 1) * TILE > f->w ? f->w - x : (tx + 1 - start) * TILE;
+            h = y + TILE > f->h ? f->h - y : TILE;
+            put_rect(s, f, x, y, w, h);
+            rects++;
+            // junk without the sync word's first byte, so it cannot start a
+            // bogus command
+            if (garbage && !(xorshift(seed) & 0x7)) {
+                for (k = xorshift(seed) % 40 + 1; k; k--) {
+                    junk = xorshift(seed);
+                    junk = junk == (DISPLAY_SYNC & 0xff) ? 0 : junk;
+                    put(s, &junk, 1);
+                }
+            }
+        }
+    }
+    put_cmd(s, DISPLAY_OP_FRAME, 0, 0, 0, 0);
+    return rects;
+}
+
+//--------------------------------------------------------------------+
+// Simulated panel
+//--------------------------------------------------------------------+
+
+// Write one band the way the panel's window and memory write commands do.
+static void panel_take(struct sim_panel *p, struct display *d) {
+    struct display_band *b = display_band_next(d);
+    uint16_t i;
+
+    if (!b) {
+        return;
+    }
+    if (b->w) {
+        p->wx = b->x;
+        p->wy = b->y;
+        p->ww = b->w;
+        p->wh = b->h;
+        p->pos = 0;
+    }
+    for (i = 0; i < b->len; i++, p->pos++) {
+        if (p->pos >= (uint32_t)p->ww * p->wh) {
+            // the controller wraps to the window start
+            p->pos = 0;
+        }
+        p->fb.px[(p->wy + p->pos / p->ww) * p->fb.w + p->wx +
+                 p->pos % p->ww] = b->px[i];
+    }
+    display_band_done(d);
+}
+
+//--------------------------------------------------------------------+
+// Commands
+//--------------------------------------------------------------------+
+
+struct opts {
+    uint16_t w, h;
+    uint32_t frames;
+    uint32_t chunk;
+    uint32_t seed;
+    bool garbage;
+    char const *out;
+};
+
+static int parse_opts(int argc, char **argv, struct opts *o) {
+    int c;
+
+    o->w = 240;
+    o->h = 320;
+    o->frames = 600;
+    o->chunk = 64;
+    o->seed = 0x1234567;
+    o->garbage = false;
+    o->out = NULL;
+    while ((c = getopt(argc, argv, "W:H:n:c:s:eo:")) != -1) {
+        switch (c) {
+        case 'W':
+            o->w = strtoul(optarg, NULL, 0);
+            break;
+        case 'H':
+            o->h = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            o->frames = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            o->chunk = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            o->seed = strtoul(optarg, NULL, 0);
+            break;
+        case 'e':
+            o->garbage = true;
+            break;
+        case 'o':
+            o->out = optarg;
+            break;
+        default:
+            return -1;
+        }
+    }
+    if (o->w < 64 || o->h < 96 || !o->chunk || !o->seed) {
+        fprintf(stderr, "need at least 64x96 pixels, a chunk and a seed\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int gen_main(int argc, char **argv) {
+    struct opts o;
+    struct frame cur, prev;
+    struct stream s = {0};
+    uint32_t *glyphs;
+    uint32_t n;
+    int cells;
+    FILE *f;
+
+    if (parse_opts(argc, argv, &o) || !o.out) {
+        fprintf(stderr, "gen needs -o out.stream\n");
+        return 2;
+    }
+    frame_alloc(&cur, o.w, o.h);
+    frame_alloc(&prev, o.w, o.h);
+    cells = ((o.w - 16) / 6) * 5;
+    glyphs = xrealloc(NULL, cells * sizeof(*glyphs));
+    memset(glyphs, 0, cells * sizeof(*glyphs));
+    for (n = 0; n < o.frames; n++) {
+        render(&cur, n, &o.seed, glyphs, cells);
+        encode_frame(&s, &cur, n ? &prev : NULL, &o.seed, o.garbage);
+        memcpy(prev.px, cur.px, (size_t)o.w * o.h * sizeof(*cur.px));
+    }
+    f = fopen(o.out, "wb");
+    if (!f || fwrite(s.buf, 1, s.len, f) != s.len) {
+        perror(o.out);
+        return 1;
+    }
+    fclose(f);
+    printf("%lu frames, %lu bytes\n", (unsigned long)o.frames,
+           (unsigned long)s.len);
+    return 0;
+}
+
+static int loopback_main(int argc, char **argv) {
+    static struct display d;
+    struct opts o;
+    struct frame cur, prev;
+    struct sim_panel panel = {0};
+    struct stream s = {0};
+    uint32_t *glyphs;
+    uint32_t n, frames_seen, bad = 0, rects = 0;
+    uint64_t bytes = 0, worst = 0, start, decode_ns = 0;
+    size_t off, len, took;
+    int cells;
+
+    if (parse_opts(argc, argv, &o)) {
+        return 2;
+    }
+    frame_alloc(&cur, o.w, o.h);
+    frame_alloc(&prev, o.w, o.h);
+    frame_alloc(&panel.fb, o.w, o.h);
+    cells = ((o.w - 16) / 6) * 5;
+    glyphs = xrealloc(NULL, cells * sizeof(*glyphs));
+    memset(glyphs, 0, cells * sizeof(*glyphs));
+    display_init(&d, o.w, o.h);
+
+    for (n = 0; n < o.frames; n++) {
+        render(&cur, n, &o.seed, glyphs, cells);
+        s.len = 0;
+        rects += encode_frame(&s, &cur, n ? &prev : NULL, &o.seed, o.garbage);
+        bytes += s.len;
+        worst = s.len > worst ? s.len : worst;
+
+        // USB packets of random size, one band drained per packet
+        frames_seen = d.frames;
+        start = now_ns();
+        for (off = 0; off < s.len; off += took) {
+            len = 1 + xorshift(&o.seed) % o.chunk;
+            if (len > s.len - off) {
+                len = s.len - off;
+            }
+            took = display_feed(&d, s.buf + off, len);
+            panel_take(&panel, &d);
+        }
+        while (display_band_next(&d)) {
+            panel_take(&panel, &d);
+        }
+        decode_ns += now_ns() - start;
+
+        if (d.frames != frames_seen + 1 ||
+            memcmp(panel.fb.px, cur.px, (size_t)o.w * o.h * sizeof(*cur.px))) {
+            if (bad < 10) {
+                fprintf(stderr, "frame %lu: panel differs\n",
+                        (unsigned long)n);
+            }
+            bad++;
+        }
+        memcpy(prev.px, cur.px, (size_t)o.w * o.h * sizeof(*cur.px));
+    }
+
+    printf("%lu frames %ux%u, %lu rects, %lu errors resynced, %lu stalls, "
+           "%lu bad frames\n",
+           (unsigned long)o.frames, (unsigned)o.w, (unsigned)o.h,
+           (unsigned long)rects, (unsigned long)d.errors,
+           (unsigned long)d.stalls, (unsigned long)bad);
+    printf("stream: %.0f bytes/frame avg, %lu worst, %.1f%% of a raw frame; "
+           "%.0f fps avg on full speed bulk\n",
+           (double)bytes / o.frames, (unsigned long)worst,
+           100.0 * bytes / o.frames / (2.0 * o.w * o.h),
+           (double)USB_BULK_BYTES_PER_S * o.frames / bytes);
+    printf("decode: %.1f MB/s of stream\n",
+           decode_ns ? (double)bytes * 1000.0 / decode_ns : 0.0);
+    return bad ? 3 : 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc >= 2 && !strcmp(argv[1], "gen")) {
+        return gen_main(argc - 1, argv + 1);
+    }
+    if (argc >= 2 && !strcmp(argv[1], "loopback")) {
+        return loopback_main(argc - 1, argv + 1);
+    }
+    fprintf(stderr,
+            "usage: %s gen [-W width] [-H height] [-n frames] [-s seed] "
+            "-o out.stream\n"
+            "       %s loopback [-W width] [-H height] [-n frames] "
+            "[-c chunk] [-e] [-s seed]\n",
+            argv[0], argv[0]);
+    return 2;
+}
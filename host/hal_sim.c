@@ -0,0 +1,156 @@
+/*
+ * Simulated HAL for host builds.
+ */
+
+#include <string.h>
+
+#include "hal_sim.h"
+#include "umfd_hal.h"
+
+struct sim_hid sim_hid = {.ready = true};
+uint32_t sim_config_writes;
+bool sim_power_low;
+
+static uint32_t const *gpio_samples;
+static size_t gpio_sample_cnt;
+static size_t gpio_sample_pos;
+static uint32_t (*gpio_model)(uint32_t driven_low, void *ctx);
+static void *gpio_model_ctx;
+static uint32_t gpio_driven_low;
+static uint32_t sim_us;
+static void (*sample_timer_fn)(void *);
+static void *sample_timer_ctx;
+static int32_t sample_timer_nudge_us;
+static void (*usb_sof_fn)(void *);
+static void *usb_sof_ctx;
+static uint8_t config_sectors[2][SIM_CONFIG_SECTOR_LEN]
+    __attribute__((aligned(4)));
+
+void sim_gpio_stream(uint32_t const *samples, size_t cnt) {
+    gpio_samples = samples;
+    gpio_sample_cnt = cnt;
+    gpio_sample_pos = 0;
+}
+
+void sim_gpio_model(uint32_t (*model)(uint32_t driven_low, void *ctx),
+                    void *ctx) {
+    gpio_model = model;
+    gpio_model_ctx = ctx;
+}
+
+void sim_set_millis(uint32_t ms) { sim_us = ms * 1000; }
+
+void sim_set_time_us(uint32_t us) { sim_us = us; }
+
+void sim_sample_timer_fire(void) {
+    if (sample_timer_fn) {
+        sample_timer_fn(sample_timer_ctx);
+    }
+}
+
+int32_t sim_sample_timer_nudge(void) {
+    int32_t us = sample_timer_nudge_us;
+
+    sample_timer_nudge_us = 0;
+    return us;
+}
+
+void sim_usb_sof(void) {
+    if (usb_sof_fn) {
+        usb_sof_fn(usb_sof_ctx);
+    }
+}
+
+void sim_config_erase(void) {
+    memset(config_sectors, 0xff, sizeof(config_sectors));
+}
+
+uint32_t hal_gpio_get_all(void) {
+    uint32_t sample;
+
+    if (gpio_model) {
+        return gpio_model(gpio_driven_low, gpio_model_ctx);
+    }
+    if (!gpio_sample_cnt) {
+        return 0xffffffff;
+    }
+    sample = gpio_samples[gpio_sample_pos];
+    if (++gpio_sample_pos == gpio_sample_cnt) {
+        gpio_sample_pos = 0;
+    }
+    return sample;
+}
+
+void hal_gpio_setup_input(uint8_t pin, bool pull_up) {
+    (void)pull_up;
+    gpio_driven_low &= ~(1u << pin);
+}
+
+void hal_gpio_drive_low(uint8_t pin) { gpio_driven_low |= 1u << pin; }
+
+void hal_gpio_release(uint8_t pin) { gpio_driven_low &= ~(1u << pin); }
+
+void hal_delay_us(uint32_t us) { sim_us += us; }
+
+uint32_t hal_time_us(void) { return sim_us; }
+
+uint32_t hal_millis(void) { return sim_us / 1000; }
+
+bool hal_sample_timer_start(uint32_t period_us, void (*fn)(void *), void *ctx) {
+    (void)period_us;
+    sample_timer_fn = fn;
+    sample_timer_ctx = ctx;
+    return true;
+}
+
+void hal_sample_timer_nudge(int32_t us) { sample_timer_nudge_us = us; }
+
+void hal_sample_timer_stop(void) { sample_timer_fn = NULL; }
+
+bool hal_usb_sof_start(void (*fn)(void *), void *ctx) {
+    usb_sof_fn = fn;
+    usb_sof_ctx = ctx;
+    return true;
+}
+
+bool hal_hid_ready(uint8_t instance) {
+    (void)instance;
+    return sim_hid.ready;
+}
+
+bool hal_hid_report(uint8_t instance, uint8_t report_id, void const *report,
+                    uint16_t len) {
+    if (len > sizeof(sim_hid.last)) {
+        return false;
+    }
+    sim_hid.reports++;
+    // the report ID goes out in front of the report
+    sim_hid.bytes += len + (report_id ? 1 : 0);
+    sim_hid.last_instance = instance;
+    sim_hid.last_id = report_id;
+    sim_hid.last_len = len;
+    memcpy(sim_hid.last, report, len);
+    return true;
+}
+
+void const *hal_config_sector(uint8_t n) { return config_sectors[n & 1]; }
+
+bool hal_config_sector_write(uint8_t n, void const *data, uint16_t len) {
+    if (len > SIM_CONFIG_SECTOR_LEN) {
+        return false;
+    }
+    memset(config_sectors[n & 1], 0xff, SIM_CONFIG_SECTOR_LEN);
+    memcpy(config_sectors[n & 1], data, len);
+    sim_config_writes++;
+    return true;
+}
+
+void hal_power_low(bool low) { sim_power_low = low; }
+
+// Nothing to wait for: the next sample is what the sleep ended with
+uint32_t hal_sleep_gpio(uint32_t pins, uint32_t levels, uint32_t *t_us) {
+    (void)pins;
+    (void)levels;
+    *t_us = sim_us;
+    return hal_gpio_get_all();
+}
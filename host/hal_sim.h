@@ -0,0 +1,52 @@
+/*
+ * Simulated HAL for host builds.
+ *
+ * GPIO reads replay a caller supplied sample buffer, time is whatever the
+ * caller last set, the sample timer fires when the caller says so, and HID
+ * reports are counted and kept instead of sent.
+ */
+
+#ifndef HAL_SIM_H_
+#define HAL_SIM_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Bytes of each config sector the simulated flash keeps
+#define SIM_CONFIG_SECTOR_LEN 256
+
+struct sim_hid {
+    bool ready;
+    uint32_t reports;
+    uint32_t bytes;
+    uint8_t last_instance;
+    uint8_t last_id;
+    uint16_t last_len;
+    uint8_t last[64];
+};
+
+extern struct sim_hid sim_hid;
+// config sector writes so far
+extern uint32_t sim_config_writes;
+// set by hal_power_low()
+extern bool sim_power_low;
+
+// Replay samples on every hal_gpio_get_all(), wrapping at the end.
+void sim_gpio_stream(uint32_t const *samples, size_t cnt);
+// Or compute each read from the pins currently driven low, e.g. to model a
+// key matrix. Takes precedence over the sample stream while set.
+void sim_gpio_model(uint32_t (*model)(uint32_t driven_low, void *ctx),
+                    void *ctx);
+void sim_set_millis(uint32_t ms);
+void sim_set_time_us(uint32_t us);
+// Run the sample timer callback once, as if its period elapsed.
+void sim_sample_timer_fire(void);
+// Take the nudge asked for since the last call, see hal_sample_timer_nudge().
+int32_t sim_sample_timer_nudge(void);
+// Run the USB SOF callback once.
+void sim_usb_sof(void);
+// Erase both config sectors.
+void sim_config_erase(void);
+
+#endif /* HAL_SIM_H_ */
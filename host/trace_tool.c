@@ -0,0 +1,516 @@
+/*
+ * GPIO trace replay and synthetic bounce generator.
+ *
+ *   umfd_trace gen [-r rate_hz] [-p pins] [-d seconds] [-S severity]
+ *                  [-s seed] -o out.trace
+ *   umfd_trace replay [-m window|eager] [-w us] [-t stable_us] [-q]
+ *                     in.trace
+ *
+ * gen writes a trace (see src/trace.h) of idle-high buttons pressed and
+ * released at random, each edge followed by contact bounce of up to
+ * severity * 400 us and the odd one or two sample glitch on a resting pin
+ * (severity 0-10, 0 is clean).
+ *
+ * replay feeds every sample of a trace, recorded or generated, through
+ * poll_registered_gpios() on the simulated HAL, with the pins set up as
+ * profile pins with the given debounce window (or eager lockout). The true
+ * edges are found from the raw trace alone: a pin that leaves its resting
+ * level and then holds a new one for stable_us made a true edge at the
+ * first sample it left. Every debounced edge is printed with its latency
+ * from the true edge; a debounced edge without one is spurious, a true edge
+ * the debounce never reported is missed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "debounce.h"
+#include "hal_sim.h"
+#include "input.h"
+#include "latency.h"
+#include "trace.h"
+
+#define TRACE_GPIOS 30
+
+struct trace {
+    uint32_t rate_hz;
+    uint32_t pins;
+    size_t cnt;
+    struct trace_rec *recs;
+    // record times with the 32 bit wrap taken out
+    uint64_t *t_us;
+};
+
+struct truth_edge {
+    uint64_t t_us;
+    uint8_t level;
+};
+
+// True edges of one pin, and how far replay got through them
+struct pin_truth {
+    struct truth_edge *edges;
+    size_t cnt;
+    size_t cap;
+    size_t next;
+    bool cur_valid;
+    bool cur_matched;
+    struct truth_edge cur;
+};
+
+static struct pin_truth truth[TRACE_GPIOS];
+static uint32_t replay_level;
+static bool quiet;
+static uint32_t spurious, missed;
+static struct latency_hist edge_latency;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint32_t xorshift(uint32_t *seed) {
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+    return *seed;
+}
+
+static void *xrealloc(void *p, size_t len) {
+    p = realloc(p, len);
+    if (!p) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+//--------------------------------------------------------------------+
+// Trace files
+//--------------------------------------------------------------------+
+
+// Load a trace, skipping anything before the header (e.g. console text
+// captured along with it).
+static int trace_load(char const *path, struct trace *tr) {
+    struct trace_header hdr;
+    uint8_t *buf = NULL;
+    size_t len = 0, cap = 0, off, n, i;
+    uint64_t t = 0;
+    FILE *f = fopen(path, "rb");
+
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    do {
+        if (len == cap) {
+            cap = cap ? cap * 2 : 1 << 16;
+            buf = xrealloc(buf, cap);
+        }
+        n = fread(buf + len, 1, cap - len, f);
+        len += n;
+    } while (n);
+    fclose(f);
+
+    for (off = 0; off + sizeof(hdr) <= len; off++) {
+        memcpy(&hdr, buf + off, sizeof(hdr));
+        if (hdr.magic == TRACE_MAGIC) {
+            break;
+        }
+    }
+    if (off + sizeof(hdr) > len || hdr.version != TRACE_VERSION ||
+        hdr.rec_len != sizeof(struct trace_rec) || !hdr.rate_hz) {
+        fprintf(stderr, "%s: no trace header\n", path);
+        free(buf);
+        return -1;
+    }
+    off += sizeof(hdr);
+    tr->rate_hz = hdr.rate_hz;
+    tr->pins = hdr.pins & ((1u << TRACE_GPIOS) - 1);
+    tr->cnt = (len - off) / sizeof(struct trace_rec);
+    if (tr->cnt < 2) {
+        fprintf(stderr, "%s: fewer than two records\n", path);
+        free(buf);
+        return -1;
+    }
+    tr->recs = xrealloc(NULL, tr->cnt * sizeof(*tr->recs));
+    tr->t_us = xrealloc(NULL, tr->cnt * sizeof(*tr->t_us));
+    memcpy(tr->recs, buf + off, tr->cnt * sizeof(*tr->recs));
+    free(buf);
+    for (i = 0; i < tr->cnt; i++) {
+        if (i) {
+            t += tr->recs[i].t_us - tr->recs[i - 1].t_us;
+        }
+        tr->t_us[i] = t;
+    }
+    return 0;
+}
+
+//--------------------------------------------------------------------+
+// Generator
+//--------------------------------------------------------------------+
+
+struct gen_pin {
+    uint8_t target;
+    uint32_t next_edge;
+    uint32_t bounce_start;
+    uint32_t bounce_end;
+    uint32_t glitch_end;
+};
+
+static void gen_write_rec(FILE *f, uint32_t t_us, uint32_t gpio) {
+    struct trace_rec rec = {.t_us = t_us, .gpio = gpio};
+
+    fwrite(&rec, sizeof(rec), 1, f);
+}
+
+// Presses of 30-250 ms, gaps of 50-800 ms, in samples
+static uint32_t gen_hold(uint32_t *seed, uint8_t pressed, uint32_t rate_hz) {
+    uint32_t ms = pressed ? 30 + xorshift(seed) % 220
+                          : 50 + xorshift(seed) % 750;
+
+    return (uint32_t)((uint64_t)ms * rate_hz / 1000);
+}
+
+static int gen_main(int argc, char **argv) {
+    struct trace_header hdr = {
+        .magic = TRACE_MAGIC,
+        .version = TRACE_VERSION,
+        .rec_len = sizeof(struct trace_rec),
+        .rate_hz = 4000,
+        .pins = 0xff,
+    };
+    struct gen_pin pins[TRACE_GPIOS];
+    struct gen_pin *gp;
+    uint32_t seconds = 60, severity = 3, seed = 0x1234567;
+    uint32_t bounce_max, glitch_per_mil, glitch_max;
+    uint32_t n, total, levels, last = 0, r;
+    char const *out = NULL;
+    FILE *f;
+    int c, p;
+
+    while ((c = getopt(argc, argv, "r:p:d:S:s:o:")) != -1) {
+        switch (c) {
+        case 'r':
+            hdr.rate_hz = strtoul(optarg, NULL, 0);
+            break;
+        case 'p':
+            hdr.pins = strtoul(optarg, NULL, 0) & ((1u << TRACE_GPIOS) - 1);
+            break;
+        case 'd':
+            seconds = strtoul(optarg, NULL, 0);
+            break;
+        case 'S':
+            severity = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            seed = strtoul(optarg, NULL, 0) | 1;
+            break;
+        case 'o':
+            out = optarg;
+            break;
+        default:
+            return 2;
+        }
+    }
+    if (!out || !hdr.rate_hz || severity > 10) {
+        fprintf(stderr, "gen needs -o, a rate and a severity of 0-10\n");
+        return 2;
+    }
+    f = fopen(out, "wb");
+    if (!f) {
+        perror(out);
+        return 1;
+    }
+
+    // bounce up to severity * 400 us, and per pin glitches of up to
+    // 1 + severity / 4 samples at severity * 2 per million samples
+    bounce_max = (uint32_t)((uint64_t)severity * 400 * hdr.rate_hz / 1000000);
+    glitch_per_mil = severity * 2;
+    glitch_max = 1 + severity / 4;
+    memset(pins, 0, sizeof(pins));
+    for (p = 0; p < TRACE_GPIOS; p++) {
+        pins[p].target = 1;
+        pins[p].next_edge = gen_hold(&seed, 0, hdr.rate_hz);
+    }
+    fwrite(&hdr, sizeof(hdr), 1, f);
+
+    total = (uint32_t)((uint64_t)seconds * hdr.rate_hz);
+    for (n = 0; n < total; n++) {
+        levels = 0xffffffff;
+        for (p = 0; p < TRACE_GPIOS; p++) {
+            if (!((hdr.pins >> p) & 0x1)) {
+                continue;
+            }
+            gp = pins + p;
+            if (n == gp->next_edge) {
+                // the true edge: the first sample at the new level
+                gp->target ^= 1;
+                gp->bounce_start = n;
+                gp->bounce_end = n + 1 + (bounce_max ? xorshift(&seed) %
+                                                           bounce_max
+                                                     : 0);
+                gp->next_edge = gp->bounce_end +
+                                gen_hold(&seed, !gp->target, hdr.rate_hz);
+                r = gp->target;
+            } else if (n < gp->bounce_end) {
+                // more and more likely to sit at the new level
+                r = xorshift(&seed) % (gp->bounce_end - gp->bounce_start) <
+                            n - gp->bounce_start
+                        ? gp->target
+                        : !gp->target;
+            } else if (n < gp->glitch_end) {
+                r = !gp->target;
+            } else {
+                r = gp->target;
+                if (xorshift(&seed) % 1000000 < glitch_per_mil) {
+                    gp->glitch_end = n + 1 + xorshift(&seed) % glitch_max;
+                    r = !gp->target;
+                }
+            }
+            if (!r) {
+                levels &= ~(1u << p);
+            }
+        }
+        if (!n || ((levels ^ last) & hdr.pins)) {
+            gen_write_rec(f, (uint32_t)((uint64_t)n * 1000000 / hdr.rate_hz),
+                          levels);
+            last = levels;
+        }
+    }
+    gen_write_rec(f, (uint32_t)((uint64_t)total * 1000000 / hdr.rate_hz),
+                  last);
+    if (fclose(f)) {
+        perror(out);
+        return 1;
+    }
+    return 0;
+}
+
+//--------------------------------------------------------------------+
+// Replay
+//--------------------------------------------------------------------+
+
+static void truth_add(uint8_t pin, uint64_t t_us, uint8_t level) {
+    struct pin_truth *pt = truth + pin;
+
+    if (pt->cnt == pt->cap) {
+        pt->cap = pt->cap ? pt->cap * 2 : 64;
+        pt->edges = xrealloc(pt->edges, pt->cap * sizeof(*pt->edges));
+    }
+    pt->edges[pt->cnt].t_us = t_us;
+    pt->edges[pt->cnt].level = level;
+    pt->cnt++;
+}
+
+// A pin's true edge is the first sample off its resting level, once it then
+// held the new level for stable_us. Going back to rest within that was a
+// glitch, or bounce on the way somewhere.
+static void truth_find(struct trace const *tr, uint32_t stable_us) {
+    uint32_t raw = tr->recs[0].gpio, stable = raw;
+    uint32_t in_burst = 0, changed;
+    uint64_t raw_since[TRACE_GPIOS] = {0}, burst_t[TRACE_GPIOS] = {0};
+    uint64_t t;
+    size_t i;
+    int p;
+
+    for (i = 1; i < tr->cnt; i++) {
+        t = tr->t_us[i];
+        for (p = 0; p < TRACE_GPIOS; p++) {
+            if (!((in_burst >> p) & 0x1) || t - raw_since[p] < stable_us) {
+                continue;
+            }
+            if (((raw ^ stable) >> p) & 0x1) {
+                truth_add(p, burst_t[p], (raw >> p) & 0x1);
+                stable ^= 1u << p;
+            }
+            in_burst &= ~(1u << p);
+        }
+        changed = (tr->recs[i].gpio ^ raw) & tr->pins;
+        raw ^= changed;
+        while (changed) {
+            p = __builtin_ctz(changed);
+            changed &= changed - 1;
+            if (!((in_burst >> p) & 0x1)) {
+                in_burst |= 1u << p;
+                burst_t[p] = t;
+            }
+            raw_since[p] = t;
+        }
+    }
+    // cut off by the end of the trace: take whatever it last held
+    in_burst &= raw ^ stable;
+    while (in_burst) {
+        p = __builtin_ctz(in_burst);
+        in_burst &= in_burst - 1;
+        truth_add(p, burst_t[p], (raw >> p) & 0x1);
+    }
+}
+
+static void report_missed(uint8_t pin, struct truth_edge const *e) {
+    missed++;
+    if (!quiet) {
+        printf("%12llu us  gpio %2u  %-4s  missed\n",
+               (unsigned long long)e->t_us, (unsigned)pin,
+               e->level ? "high" : "low");
+    }
+}
+
+// Match a debounced edge to the latest true edge of its pin up to now.
+static void output_edge(uint8_t pin, uint64_t t_us, uint8_t level) {
+    struct pin_truth *pt = truth + pin;
+
+    while (pt->next < pt->cnt && pt->edges[pt->next].t_us <= t_us) {
+        if (pt->cur_valid && !pt->cur_matched) {
+            report_missed(pin, &pt->cur);
+        }
+        pt->cur = pt->edges[pt->next++];
+        pt->cur_valid = true;
+        pt->cur_matched = false;
+    }
+    if (pt->cur_valid && !pt->cur_matched && pt->cur.level == level) {
+        pt->cur_matched = true;
+        latency_hist_add(&edge_latency, (uint32_t)(t_us - pt->cur.t_us));
+        if (!quiet) {
+            printf("%12llu us  gpio %2u  %-4s  +%llu us\n",
+                   (unsigned long long)t_us, (unsigned)pin,
+                   level ? "high" : "low",
+                   (unsigned long long)(t_us - pt->cur.t_us));
+        }
+        return;
+    }
+    spurious++;
+    if (!quiet) {
+        printf("%12llu us  gpio %2u  %-4s  spurious\n",
+               (unsigned long long)t_us, (unsigned)pin,
+               level ? "high" : "low");
+    }
+}
+
+static uint32_t replay_read(uint32_t driven_low, void *ctx) {
+    (void)driven_low;
+    (void)ctx;
+    return replay_level;
+}
+
+static int replay_main(int argc, char **argv) {
+    struct trace tr;
+    enum debounce_mode mode = DEBOUNCE_MODE_WINDOW;
+    uint32_t window_us = 1000, stable_us = 5000;
+    uint32_t state, changed;
+    uint64_t samples = 0, start, replay_ns, t, dt, k, cnt;
+    size_t i, j;
+    int c, p;
+
+    while ((c = getopt(argc, argv, "m:w:t:q")) != -1) {
+        switch (c) {
+        case 'm':
+            mode = strcmp(optarg, "eager") ? DEBOUNCE_MODE_WINDOW
+                                           : DEBOUNCE_MODE_EAGER;
+            break;
+        case 'w':
+            window_us = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            stable_us = strtoul(optarg, NULL, 0);
+            break;
+        case 'q':
+            quiet = true;
+            break;
+        default:
+            return 2;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "replay needs one trace file\n");
+        return 2;
+    }
+    if (trace_load(argv[optind], &tr)) {
+        return 1;
+    }
+    truth_find(&tr, stable_us);
+    latency_hist_reset(&edge_latency);
+
+    // the trace's pins as profile pins, resting where the trace starts
+    input_init();
+    reg_gpio_pins(tr.pins, tr.recs[0].gpio);
+    set_gpio_debounce_mode(tr.pins, mode,
+                           debounce_mask_from_us(window_us, tr.rate_hz));
+    sim_gpio_model(replay_read, NULL);
+    state = gpio_debounce.state;
+
+    start = now_ns();
+    // every sample from the first record up to the closing one
+    for (i = 0; i + 1 < tr.cnt; i++) {
+        replay_level = tr.recs[i].gpio;
+        dt = tr.t_us[i + 1] - tr.t_us[i];
+        cnt = (dt * tr.rate_hz + 500000) / 1000000;
+        if (!cnt) {
+            cnt = 1;
+        }
+        for (k = 0; k < cnt; k++) {
+            t = tr.t_us[i] + k * 1000000 / tr.rate_hz;
+            sim_set_time_us((uint32_t)t);
+            poll_registered_gpios(NULL, 0);
+            changed = (gpio_debounce.state ^ state) & tr.pins;
+            if (!changed) {
+                continue;
+            }
+            state = gpio_debounce.state;
+            while (changed) {
+                p = __builtin_ctz(changed);
+                changed &= changed - 1;
+                output_edge(p, t, (state >> p) & 0x1);
+            }
+        }
+        samples += cnt;
+    }
+    replay_ns = now_ns() - start;
+    for (p = 0; p < TRACE_GPIOS; p++) {
+        if (truth[p].cur_valid && !truth[p].cur_matched) {
+            report_missed(p, &truth[p].cur);
+        }
+        for (j = truth[p].next; j < truth[p].cnt; j++) {
+            report_missed(p, truth[p].edges + j);
+        }
+    }
+
+    printf("%llu samples at %lu Hz, %s %lu us: %lu edges, %lu spurious, "
+           "%lu missed\n",
+           (unsigned long long)samples, (unsigned long)tr.rate_hz,
+           mode == DEBOUNCE_MODE_EAGER ? "eager" : "window",
+           (unsigned long)window_us, (unsigned long)edge_latency.acc.cnt,
+           (unsigned long)spurious, (unsigned long)missed);
+    if (edge_latency.acc.cnt) {
+        printf("latency us: min %lu avg %lu p50 %lu p99 %lu max %lu\n",
+               (unsigned long)edge_latency.acc.min_us,
+               (unsigned long)(edge_latency.acc.sum_us /
+                               edge_latency.acc.cnt),
+               (unsigned long)latency_hist_percentile(&edge_latency, 500),
+               (unsigned long)latency_hist_percentile(&edge_latency, 990),
+               (unsigned long)edge_latency.acc.max_us);
+    }
+    printf("replay: %.1f M samples/s\n",
+           replay_ns ? (double)samples * 1000.0 / replay_ns : 0.0);
+    return spurious || missed ? 3 : 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc >= 2 && !strcmp(argv[1], "gen")) {
+        return gen_main(argc - 1, argv + 1);
+    }
+    if (argc >= 2 && !strcmp(argv[1], "replay")) {
+        return replay_main(argc - 1, argv + 1);
+    }
+    fprintf(stderr,
+            "usage: %s gen [-r rate_hz] [-p pins] [-d seconds] "
+            "[-S severity] [-s seed] -o out.trace\n"
+            "       %s replay [-m window|eager] [-w us] [-t stable_us] [-q] "
+            "in.trace\n",
+            argv[0], argv[0]);
+    return 2;
+}
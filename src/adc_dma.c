@@ -0,0 +1,84 @@
+/*
+ * Analog axes from the ADC, the ADC and DMA side.
+ *
+ * The data channel moves conversions from the ADC FIFO into the ring with
+ * its write address wrapping on the ring size. When its count runs out it
+ * chains to the re-arm channel, which writes the count back into the data
+ * channel's trigger register. Nothing here ever interrupts the CPU.
+ */
+
+#include "hardware/adc.h"
+#include "hardware/dma.h"
+
+#include "axis.h"
+
+// The ADC takes 96 cycles of its 48 MHz clock per conversion
+#define ADC_CLK_HZ 48000000
+#define ADC_MIN_DIV 96
+
+bool adc_axes_start(struct adc_axes *ax) {
+    dma_channel_config c;
+    float div;
+    int i;
+
+    if (!ax->cnt || ax->dma_ch[0] >= 0) {
+        return false;
+    }
+    ax->dma_ch[0] = dma_claim_unused_channel(false);
+    ax->dma_ch[1] = dma_claim_unused_channel(false);
+    if (ax->dma_ch[0] < 0 || ax->dma_ch[1] < 0) {
+        if (ax->dma_ch[0] >= 0) {
+            dma_channel_unclaim(ax->dma_ch[0]);
+        }
+        ax->dma_ch[0] = -1;
+        ax->dma_ch[1] = -1;
+        return false;
+    }
+
+    adc_init();
+    for (i = 0; i < ax->cnt; i++) {
+        adc_gpio_init(ADC_AXES_FIRST_GPIO + i);
+    }
+    // all four inputs, so ring entry n is always input n & 3
+    adc_select_input(0);
+    adc_set_round_robin((1u << ADC_AXES_MAX) - 1);
+    adc_fifo_setup(true, true, 1, false, false);
+    div = (float)ADC_CLK_HZ / ax->sample_hz - 1;
+    adc_set_clkdiv(div < ADC_MIN_DIV ? 0 : div);
+
+    c = dma_channel_get_default_config(ax->dma_ch[0]);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_ring(&c, true, __builtin_ctz(sizeof(ax->ring)));
+    channel_config_set_dreq(&c, DREQ_ADC);
+    channel_config_set_chain_to(&c, ax->dma_ch[1]);
+    dma_channel_configure(ax->dma_ch[0], &c, ax->ring, &adc_hw->fifo,
+                          ADC_RING_LEN, false);
+
+    // the count is reloaded from the last value written on every trigger
+    ax->ring_len_word = ADC_RING_LEN;
+    c = dma_channel_get_default_config(ax->dma_ch[1]);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, false);
+    dma_channel_configure(ax->dma_ch[1], &c,
+                          &dma_hw->ch[ax->dma_ch[0]].al1_transfer_count_trig,
+                          &ax->ring_len_word, 1, false);
+
+    dma_channel_start(ax->dma_ch[0]);
+    adc_run(true);
+    return true;
+}
+
+void adc_axes_run(struct adc_axes *ax, bool run) {
+    if (ax->dma_ch[0] >= 0) {
+        adc_run(run);
+    }
+}
+
+bool adc_axes_poll(struct adc_axes *ax) {
+    uint32_t addr = dma_hw->ch[ax->dma_ch[0]].write_addr;
+
+    return adc_axes_update(ax, (addr - (uintptr_t)ax->ring) / sizeof(uint16_t));
+}
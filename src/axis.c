@@ -0,0 +1,153 @@
+/*
+ * Analog axes from the ADC.
+ */
+
+#include <string.h>
+
+#include "axis.h"
+
+#define AXIS_OUT_MAX 32767
+
+void axis_init(struct axis *a, enum axis_filter filter, uint8_t filter_shift,
+               uint16_t deadband, uint16_t hysteresis) {
+    memset(a, 0, sizeof(*a));
+    a->filter = filter;
+    a->filter_shift = filter_shift;
+    // the average window is a power of two up to AXIS_AVG_MAX
+    if (filter == AXIS_FILTER_AVERAGE &&
+        (1u << filter_shift) > AXIS_AVG_MAX) {
+        a->filter_shift = __builtin_ctz(AXIS_AVG_MAX);
+    }
+    a->deadband = deadband;
+    a->hysteresis = hysteresis;
+    axis_calibrate(a, 0, 0x8000, AXIS_RAW_FULL_SCALE);
+}
+
+void axis_calibrate(struct axis *a, uint16_t min, uint16_t center,
+                    uint16_t max) {
+    uint32_t lo, hi;
+
+    if (min > center) {
+        min = center;
+    }
+    if (max < center) {
+        max = center;
+    }
+    a->cal_min = min;
+    a->cal_center = center;
+    a->cal_max = max;
+    // each half spans from the edge of the deadband to its end stop
+    lo = center - min > a->deadband ? center - min - a->deadband : 1;
+    hi = max - center > a->deadband ? max - center - a->deadband : 1;
+    a->scale_lo = ((uint32_t)AXIS_OUT_MAX << 16) / lo;
+    a->scale_hi = ((uint32_t)AXIS_OUT_MAX << 16) / hi;
+}
+
+static uint16_t axis_filter(struct axis *a, uint16_t x) {
+    uint8_t n = 1u << a->filter_shift;
+    int i;
+
+    switch (a->filter) {
+    case AXIS_FILTER_AVERAGE:
+        if (!a->primed) {
+            for (i = 0; i < n; i++) {
+                a->avg_buf[i] = x;
+            }
+            a->avg_sum = (uint32_t)x * n;
+        }
+        a->avg_sum += x - a->avg_buf[a->avg_pos];
+        a->avg_buf[a->avg_pos] = x;
+        a->avg_pos = (a->avg_pos + 1) & (n - 1);
+        return a->avg_sum >> a->filter_shift;
+    case AXIS_FILTER_IIR:
+        if (!a->primed) {
+            a->iir_acc = (int32_t)x << 8;
+        }
+        a->iir_acc += (((int32_t)x << 8) - a->iir_acc) >> a->filter_shift;
+        return a->iir_acc >> 8;
+    default:
+        return x;
+    }
+}
+
+// Filtered reading to -32767..32767, 0 inside the deadband. Clamping to the
+// calibrated range keeps the products within 32 bits.
+static int16_t axis_scale(struct axis const *a, uint16_t x) {
+    uint32_t d;
+
+    if (x < a->cal_center) {
+        d = a->cal_center - (x > a->cal_min ? x : a->cal_min);
+        if (d <= a->deadband) {
+            return 0;
+        }
+        d = ((d - a->deadband) * a->scale_lo) >> 16;
+        return -(int16_t)(d < AXIS_OUT_MAX ? d : AXIS_OUT_MAX);
+    }
+    d = (x < a->cal_max ? x : a->cal_max) - a->cal_center;
+    if (d <= a->deadband) {
+        return 0;
+    }
+    d = ((d - a->deadband) * a->scale_hi) >> 16;
+    return d < AXIS_OUT_MAX ? d : AXIS_OUT_MAX;
+}
+
+bool axis_update(struct axis *a, uint16_t x) {
+    int32_t delta;
+
+    a->raw = axis_scale(a, axis_filter(a, x));
+    a->primed = true;
+    delta = a->raw - a->value;
+    if (delta < 0) {
+        delta = -delta;
+    }
+    // past the hysteresis, or settling exactly on centre or an end stop
+    if (delta > a->hysteresis ||
+        (delta && (a->raw == 0 || a->raw == AXIS_OUT_MAX ||
+                   a->raw == -AXIS_OUT_MAX))) {
+        a->value = a->raw;
+        return true;
+    }
+    return false;
+}
+
+void adc_axes_init(struct adc_axes *ax, uint8_t cnt, uint8_t oversample,
+                   uint32_t sample_hz) {
+    memset(ax, 0, sizeof(*ax));
+    ax->cnt = cnt > ADC_AXES_MAX ? ADC_AXES_MAX : cnt;
+    ax->oversample =
+        oversample > ADC_OVERSAMPLE_MAX ? ADC_OVERSAMPLE_MAX : oversample;
+    ax->sample_hz = sample_hz;
+    ax->dma_ch[0] = -1;
+    ax->dma_ch[1] = -1;
+}
+
+bool adc_axes_update(struct adc_axes *ax, uint32_t write_pos) {
+    // the round the DMA is in the middle of may be partly old
+    uint32_t end = write_pos & ~(uint32_t)(ADC_AXES_MAX - 1);
+    uint32_t n = 1u << ax->oversample;
+    uint32_t sum, k;
+    bool changed = false;
+    int i;
+
+    for (i = 0; i < ax->cnt; i++) {
+        sum = 0;
+        for (k = 1; k <= n; k++) {
+            sum += ax->ring[(end - k * ADC_AXES_MAX + i) & (ADC_RING_LEN - 1)] &
+                   0xfff;
+        }
+        changed |= axis_update(ax->axes + i,
+                               sum << (ADC_OVERSAMPLE_MAX - ax->oversample));
+    }
+    if (changed) {
+        ax->updates++;
+    }
+    return changed;
+}
+
+void adc_axes_values(struct adc_axes const *ax, int16_t *out) {
+    int i;
+
+    for (i = 0; i < ax->cnt; i++) {
+        out[i] = ax->axes[i].value;
+    }
+}
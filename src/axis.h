@@ -0,0 +1,112 @@
+/*
+ * Analog axes from the ADC.
+ *
+ * The ADC runs free in round robin over its four GPIO inputs (GPIO 26-29)
+ * and DMA streams every conversion into a ring, re-armed by a second DMA
+ * channel, so sampling takes no CPU at all. Ring entry n holds input n & 3.
+ *
+ * When polled, each axis sums its newest 2^oversample samples straight out
+ * of the ring into one 16 bit value (oversampling and decimation in one
+ * step; the rest of the samples are never touched), then runs it through
+ * an integer filter, calibration and a centre deadband. The result only
+ * moves once it is more than the hysteresis away from the last value, so
+ * ADC noise does not turn into reports.
+ */
+
+#ifndef AXIS_H_
+#define AXIS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define ADC_AXES_MAX 4
+#define ADC_AXES_FIRST_GPIO 26
+// Must be a power of two and a multiple of ADC_AXES_MAX. 64 samples per
+// input is 4 ms at the default rate.
+#define ADC_RING_LEN 256
+// Up to 2^4 samples summed per value, so 12 bit samples fill 16 bits
+#define ADC_OVERSAMPLE_MAX 4
+#define AXIS_AVG_MAX 16
+// Largest decimated reading, a 12 bit full scale shifted up to 16 bits
+#define AXIS_RAW_FULL_SCALE 0xfff0
+
+enum axis_filter {
+    AXIS_FILTER_NONE,
+    // mean of the last 2^param values
+    AXIS_FILTER_AVERAGE,
+    // one pole low pass, y += (x - y) / 2^param
+    AXIS_FILTER_IIR,
+};
+
+struct axis {
+    uint8_t filter;
+    uint8_t filter_shift;
+    // calibration in decimated (0..65535) units
+    uint16_t cal_min;
+    uint16_t cal_center;
+    uint16_t cal_max;
+    // decimated units either side of cal_center that read as centre
+    uint16_t deadband;
+    // output units the value has to move by before it changes
+    uint16_t hysteresis;
+    // 16.16 scales for each half, from the calibration
+    uint32_t scale_lo;
+    uint32_t scale_hi;
+
+    // filter state: the moving average ring and sum, or the IIR output
+    // with 8 fraction bits
+    uint16_t avg_buf[AXIS_AVG_MAX];
+    uint32_t avg_sum;
+    uint8_t avg_pos;
+    int32_t iir_acc;
+    bool primed;
+
+    // last filtered, calibrated value, and what the report carries
+    int16_t raw;
+    int16_t value;
+};
+
+struct adc_axes {
+    uint8_t cnt;
+    uint8_t oversample;
+    uint32_t sample_hz;
+    struct axis axes[ADC_AXES_MAX];
+
+    // DMA writes here, round robin over all four inputs
+    uint16_t ring[ADC_RING_LEN]
+        __attribute__((aligned(ADC_RING_LEN * sizeof(uint16_t))));
+    // DMA data and re-arm channels, see adc_dma.c
+    int8_t dma_ch[2];
+    uint32_t ring_len_word;
+    // polls that changed at least one axis
+    uint32_t updates;
+};
+
+void axis_init(struct axis *a, enum axis_filter filter, uint8_t filter_shift,
+               uint16_t deadband, uint16_t hysteresis);
+// Raw readings (0..AXIS_RAW_FULL_SCALE) at either end and at rest. Defaults
+// to the full range with the centre in the middle.
+void axis_calibrate(struct axis *a, uint16_t min, uint16_t center,
+                    uint16_t max);
+// Feed one decimated reading. Returns true if a->value moved.
+bool axis_update(struct axis *a, uint16_t x);
+
+// cnt axes on the first cnt ADC inputs, each value the sum of
+// 2^oversample samples, sampling all four inputs sample_hz times a second
+// in total.
+void adc_axes_init(struct adc_axes *ax, uint8_t cnt, uint8_t oversample,
+                   uint32_t sample_hz);
+// Claim two DMA channels and start the ADC. Only on the device.
+bool adc_axes_start(struct adc_axes *ax);
+// Run every axis on the newest samples before ring index write_pos.
+// Returns true if any value moved.
+bool adc_axes_update(struct adc_axes *ax, uint32_t write_pos);
+// adc_axes_update() at the DMA's current position. Only on the device.
+bool adc_axes_poll(struct adc_axes *ax);
+// Stop the conversions or run them again, the DMA picking up where it left
+// off. Only on the device.
+void adc_axes_run(struct adc_axes *ax, bool run);
+// Current values into out[0 .. cnt - 1].
+void adc_axes_values(struct adc_axes const *ax, int16_t *out);
+
+#endif /* AXIS_H_ */
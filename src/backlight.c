@@ -0,0 +1,214 @@
+/*
+ * Per-button RGB backlight, the colours.
+ */
+
+#include <string.h>
+
+#include "backlight.h"
+
+void backlight_init(struct backlight *bl, uint8_t cnt, uint8_t pin) {
+    memset(bl, 0, sizeof(*bl));
+    bl->cnt = cnt > BACKLIGHT_MAX_LEDS ? BACKLIGHT_MAX_LEDS : cnt;
+    bl->brightness = 0xff;
+    bl->pin = pin;
+    bl->dma_ch = -1;
+    // all of them off, sent once at start
+    bl->stale = true;
+}
+
+// The LEDs of the chain among button word w
+static uint32_t led_mask(struct backlight const *bl, int w) {
+    int n = bl->cnt - w * 32;
+
+    if (n <= 0) {
+        return 0;
+    }
+    return n >= 32 ? ~0u : (1u << n) - 1;
+}
+
+static void mark_dirty(struct backlight *bl, uint8_t first, uint8_t n) {
+    int i;
+
+    for (i = first; i < first + n; i++) {
+        bl->dirty[i >> 5] |= 1u << (i & 31);
+    }
+}
+
+// Clamp first..first + n - 1 to the chain. Returns the LEDs left.
+static uint8_t clamp_range(struct backlight const *bl, uint8_t first,
+                           uint8_t n) {
+    if (first >= bl->cnt) {
+        return 0;
+    }
+    return n > bl->cnt - first ? bl->cnt - first : n;
+}
+
+void backlight_fill(struct backlight *bl, uint8_t first, uint8_t n,
+                    uint32_t rgb) {
+    int i;
+
+    n = clamp_range(bl, first, n);
+    for (i = first; i < first + n; i++) {
+        bl->base[i] = rgb & 0xffffff;
+    }
+    mark_dirty(bl, first, n);
+}
+
+void backlight_set_brightness(struct backlight *bl, uint8_t level) {
+    if (level != bl->brightness) {
+        bl->brightness = level;
+        mark_dirty(bl, 0, bl->cnt);
+    }
+}
+
+void backlight_set_feedback(struct backlight *bl, bool on, uint32_t rgb,
+                            uint16_t fade_ms) {
+    int w;
+
+    // whatever is lit by the old settings is redone with the new ones; held
+    // buttons are picked up again by the next update
+    for (w = 0; w < BACKLIGHT_LED_WORDS; w++) {
+        bl->dirty[w] |= bl->pressed[w] | bl->fading[w];
+        bl->pressed[w] = 0;
+        bl->fading[w] = 0;
+    }
+    bl->feedback = on;
+    bl->press_rgb = rgb & 0xffffff;
+    bl->fade_ms = fade_ms;
+}
+
+static uint32_t rgb_at(uint8_t const *p) {
+    return (uint32_t)p[0] << 16 | p[1] << 8 | p[2];
+}
+
+bool backlight_report(struct backlight *bl, uint8_t const *buf, uint16_t len) {
+    uint8_t first, n;
+    int i;
+
+    if (!len) {
+        bl->bad_reports++;
+        return false;
+    }
+    switch (buf[0]) {
+    case BACKLIGHT_OP_SET:
+        if (len < 3 || buf[2] > BACKLIGHT_SET_MAX || len < 3 + buf[2] * 3) {
+            break;
+        }
+        first = buf[1];
+        n = clamp_range(bl, first, buf[2]);
+        for (i = 0; i < n; i++) {
+            bl->base[first + i] = rgb_at(buf + 3 + i * 3);
+        }
+        mark_dirty(bl, first, n);
+        bl->reports++;
+        return true;
+    case BACKLIGHT_OP_FILL:
+        if (len < 6) {
+            break;
+        }
+        backlight_fill(bl, buf[1], buf[2], rgb_at(buf + 3));
+        bl->reports++;
+        return true;
+    case BACKLIGHT_OP_BRIGHTNESS:
+        if (len < 2) {
+            break;
+        }
+        backlight_set_brightness(bl, buf[1]);
+        bl->reports++;
+        return true;
+    case BACKLIGHT_OP_FEEDBACK:
+        if (len < 7) {
+            break;
+        }
+        backlight_set_feedback(bl, buf[1], rgb_at(buf + 2),
+                               buf[5] | buf[6] << 8);
+        bl->reports++;
+        return true;
+    default:
+        break;
+    }
+    bl->bad_reports++;
+    return false;
+}
+
+// Channel by channel from a to b, num / den of the way
+static uint32_t rgb_mix(uint32_t a, uint32_t b, uint32_t num, uint32_t den) {
+    uint32_t out = 0;
+    int32_t ca, cb;
+    int s;
+
+    for (s = 0; s < 24; s += 8) {
+        ca = (a >> s) & 0xff;
+        cb = (b >> s) & 0xff;
+        out |= (uint32_t)(ca + (cb - ca) * (int32_t)num / (int32_t)den) << s;
+    }
+    return out;
+}
+
+// 0xRRGGBB at a brightness, as the GRB word the chain wants
+static uint32_t chain_word(uint32_t rgb, uint8_t level) {
+    uint32_t r = (((rgb >> 16) & 0xff) * (level + 1)) >> 8;
+    uint32_t g = (((rgb >> 8) & 0xff) * (level + 1)) >> 8;
+    uint32_t b = ((rgb & 0xff) * (level + 1)) >> 8;
+
+    return g << 24 | r << 16 | b << 8;
+}
+
+static uint32_t led_rgb(struct backlight *bl, int i, uint32_t now_ms) {
+    uint32_t bit = 1u << (i & 31);
+    uint32_t elapsed;
+
+    if (bl->pressed[i >> 5] & bit) {
+        return bl->press_rgb;
+    }
+    if (bl->fading[i >> 5] & bit) {
+        elapsed = now_ms - bl->release_ms[i];
+        if (elapsed < bl->fade_ms) {
+            return rgb_mix(bl->press_rgb, bl->base[i], elapsed, bl->fade_ms);
+        }
+        bl->fading[i >> 5] &= ~bit;
+    }
+    return bl->base[i];
+}
+
+bool backlight_update(struct backlight *bl,
+                      uint32_t const buttons[DINPUT_BTN_WORDS],
+                      uint32_t now_ms) {
+    uint32_t changed, released, dirty, word;
+    bool step = false;
+    int w, i;
+
+    if (bl->feedback) {
+        step = now_ms - bl->step_ms >= BACKLIGHT_FADE_STEP_MS;
+        if (step) {
+            bl->step_ms = now_ms;
+        }
+    }
+    for (w = 0; w < BACKLIGHT_LED_WORDS; w++) {
+        if (bl->feedback) {
+            changed = (buttons[w] ^ bl->pressed[w]) & led_mask(bl, w);
+            bl->pressed[w] ^= changed;
+            // a release starts a fade, a press cuts one short
+            released = bl->fade_ms ? changed & ~buttons[w] : 0;
+            bl->fading[w] = (bl->fading[w] & ~changed) | released;
+            while (released) {
+                bl->release_ms[w * 32 + __builtin_ctz(released)] = now_ms;
+                released &= released - 1;
+            }
+            bl->dirty[w] |= changed | (step ? bl->fading[w] : 0);
+        }
+        dirty = bl->dirty[w];
+        bl->dirty[w] = 0;
+        while (dirty) {
+            i = w * 32 + __builtin_ctz(dirty);
+            dirty &= dirty - 1;
+            word = chain_word(led_rgb(bl, i, now_ms), bl->brightness);
+            if (word != bl->frame[i]) {
+                bl->frame[i] = word;
+                bl->stale = true;
+            }
+            bl->recomputed++;
+        }
+    }
+    return bl->stale;
+}
@@ -0,0 +1,119 @@
+/*
+ * Per-button RGB backlight.
+ *
+ * A WS2812 chain behind the bezel with LED n under button ID n. The host
+ * sets each LED's colour through a vendor output report; the firmware adds
+ * press feedback on top (a held button shows the press colour, fading back
+ * to the host's once released) and scales everything by one brightness.
+ *
+ * frame[] holds the chain's words ready for the PIO, and only LEDs marked
+ * dirty are worked out again: by a host write, a press or release, or a fade
+ * step of an LED still fading. With nothing changing an update only compares
+ * the button words, and a refresh is one DMA transfer of frame[].
+ *
+ * Output report, after the report ID byte:
+ *   BACKLIGHT_OP_SET         first, n, n x {R, G, B}; n up to BACKLIGHT_SET_MAX
+ *   BACKLIGHT_OP_FILL        first, n, R, G, B
+ *   BACKLIGHT_OP_BRIGHTNESS  level (0-255)
+ *   BACKLIGHT_OP_FEEDBACK    on, R, G, B, fade ms (16 bit, little endian)
+ */
+
+#ifndef BACKLIGHT_H_
+#define BACKLIGHT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "input.h"
+
+#define BACKLIGHT_MAX_LEDS 64
+#define BACKLIGHT_LED_WORDS ((BACKLIGHT_MAX_LEDS + 31) / 32)
+// Output report, without the report ID
+#define BACKLIGHT_REPORT_LEN 63
+#define BACKLIGHT_SET_MAX ((BACKLIGHT_REPORT_LEN - 3) / 3)
+// Fading LEDs are worked out again this often
+#define BACKLIGHT_FADE_STEP_MS 10
+
+_Static_assert(BACKLIGHT_MAX_LEDS <= MAX_DINPUT_BTNS,
+               "an LED per button ID at most");
+
+enum backlight_op {
+    BACKLIGHT_OP_SET = 1,
+    BACKLIGHT_OP_FILL,
+    BACKLIGHT_OP_BRIGHTNESS,
+    BACKLIGHT_OP_FEEDBACK,
+};
+
+struct backlight {
+    uint8_t cnt;
+    uint8_t brightness;
+    // the host's colour per LED, 0xRRGGBB
+    uint32_t base[BACKLIGHT_MAX_LEDS];
+
+    // press feedback
+    bool feedback;
+    uint32_t press_rgb;
+    uint16_t fade_ms;
+    uint32_t pressed[BACKLIGHT_LED_WORDS];
+    uint32_t fading[BACKLIGHT_LED_WORDS];
+    uint32_t release_ms[BACKLIGHT_MAX_LEDS];
+    uint32_t step_ms;
+
+    // LEDs whose frame word is out of date
+    uint32_t dirty[BACKLIGHT_LED_WORDS];
+    // GRB, top 24 bits, as the PIO shifts them out
+    uint32_t frame[BACKLIGHT_MAX_LEDS];
+    // frame changed since the last refresh started
+    bool stale;
+
+    // frame words worked out again, refreshes started, output reports taken
+    // and refused
+    uint32_t recomputed;
+    uint32_t refreshes;
+    uint32_t reports;
+    uint32_t bad_reports;
+
+    // PIO and DMA resources, see backlight_pio.c
+    uint8_t pin;
+    uint8_t pio_idx;
+    uint8_t sm;
+    int8_t dma_ch;
+    // the last refresh started at refresh_us and has latched latch_us later
+    uint32_t refresh_us;
+    uint32_t latch_us;
+};
+
+// All LEDs off, full brightness, no press feedback.
+void backlight_init(struct backlight *bl, uint8_t cnt, uint8_t pin);
+
+void backlight_fill(struct backlight *bl, uint8_t first, uint8_t n,
+                    uint32_t rgb);
+void backlight_set_brightness(struct backlight *bl, uint8_t level);
+// Show rgb while a button is held and fade back over fade_ms after it is let
+// go (0 snaps back).
+void backlight_set_feedback(struct backlight *bl, bool on, uint32_t rgb,
+                            uint16_t fade_ms);
+
+// Apply an output report. Returns false, changing nothing, if it is
+// malformed.
+bool backlight_report(struct backlight *bl, uint8_t const *buf, uint16_t len);
+
+// Follow the buttons and the fades, and work out the dirty LEDs again.
+// Returns true if frame changed since the last refresh.
+bool backlight_update(struct backlight *bl,
+                      uint32_t const buttons[DINPUT_BTN_WORDS],
+                      uint32_t now_ms);
+
+// Claim a PIO state machine and a DMA channel for the chain. Only on the
+// device; returns false if the resources are taken.
+bool backlight_start(struct backlight *bl);
+// backlight_update(), then send frame down the chain if it changed and the
+// last refresh has latched. Never waits. Only on the device.
+void backlight_poll(struct backlight *bl,
+                    uint32_t const buttons[DINPUT_BTN_WORDS], uint32_t now_ms);
+// backlight_poll() until frame is on the chain and has latched, waiting out
+// the refresh before it. Only on the device; for going to sleep.
+void backlight_flush(struct backlight *bl,
+                     uint32_t const buttons[DINPUT_BTN_WORDS], uint32_t now_ms);
+
+#endif /* BACKLIGHT_H_ */
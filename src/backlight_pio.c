@@ -0,0 +1,93 @@
+/*
+ * Per-button RGB backlight, the PIO and DMA side.
+ *
+ * A refresh is one DMA transfer of the frame words into the state machine's
+ * FIFO, paced by its DREQ. Words the update changes while one is under way
+ * are either caught by it or leave frame stale for the next, so the frame is
+ * never locked. The chain latches once the line has been low for a while
+ * after the last bit, and the next refresh waits for that.
+ */
+
+#include "hardware/dma.h"
+#include "hardware/pio.h"
+#include "hardware/timer.h"
+
+#include "backlight.h"
+#include "ws2812.pio.h"
+
+// 24 bits at 800 kHz per LED, and the low time newer WS2812Bs latch on
+#define BACKLIGHT_LED_US 30
+#define BACKLIGHT_LATCH_US 300
+
+bool backlight_start(struct backlight *bl) {
+    dma_channel_config c;
+    PIO pio = pio0;
+    int sm;
+    uint offset;
+
+    if (!bl->cnt || bl->dma_ch >= 0) {
+        return false;
+    }
+    if (!pio_can_add_program(pio, &ws2812_program)) {
+        pio = pio1;
+        if (!pio_can_add_program(pio, &ws2812_program)) {
+            return false;
+        }
+    }
+    sm = pio_claim_unused_sm(pio, false);
+    if (sm < 0) {
+        return false;
+    }
+    bl->dma_ch = dma_claim_unused_channel(false);
+    if (bl->dma_ch < 0) {
+        pio_sm_unclaim(pio, sm);
+        return false;
+    }
+    bl->pio_idx = pio_get_index(pio);
+    bl->sm = sm;
+
+    offset = pio_add_program(pio, &ws2812_program);
+    ws2812_program_init(pio, sm, offset, bl->pin);
+
+    c = dma_channel_get_default_config(bl->dma_ch);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, pio_get_dreq(pio, sm, true));
+    dma_channel_configure(bl->dma_ch, &c, &pio->txf[sm], bl->frame, 0, false);
+    return true;
+}
+
+void backlight_poll(struct backlight *bl,
+                    uint32_t const buttons[DINPUT_BTN_WORDS], uint32_t now_ms) {
+    uint32_t now_us;
+
+    if (bl->dma_ch < 0 || !backlight_update(bl, buttons, now_ms)) {
+        return;
+    }
+    now_us = time_us_32();
+    if (now_us - bl->refresh_us < bl->latch_us) {
+        return;
+    }
+    bl->stale = false;
+    bl->refresh_us = now_us;
+    bl->latch_us = bl->cnt * BACKLIGHT_LED_US + BACKLIGHT_LATCH_US;
+    dma_channel_transfer_from_buffer_now(bl->dma_ch, bl->frame, bl->cnt);
+    bl->refreshes++;
+}
+
+void backlight_flush(struct backlight *bl,
+                     uint32_t const buttons[DINPUT_BTN_WORDS], uint32_t now_ms) {
+    uint32_t since;
+
+    if (bl->dma_ch < 0) {
+        return;
+    }
+    while (backlight_update(bl, buttons, now_ms)) {
+        backlight_poll(bl, buttons, now_ms);
+    }
+    since = time_us_32() - bl->refresh_us;
+    if (since < bl->latch_us) {
+        busy_wait_us_32(bl->latch_us - since);
+    }
+}
@@ -0,0 +1,69 @@
+/*
+ * Board profiles: which GPIO is which report button.
+ *
+ * A profile is an X-macro listing X(gpio, button ID, active low) once per
+ * direct GPIO button; UMFD_BOARD picks one by name. Everything the scan
+ * needs is derived from it by the preprocessor: the pin mask, the pull-up
+ * mask, the button count, and board_pack(), which turns debounced GPIO
+ * levels into report bits with one unrolled shift and mask per button
+ * instead of walking button registrations. Buttons that keep their GPIO
+ * number as ID fold into a single mask.
+ *
+ * Profile buttons take report IDs 0 .. BOARD_BTN_CNT - 1, in any order but
+ * each exactly once. Matrix, shift register, encoder and hat inputs come
+ * after them.
+ */
+
+#ifndef BOARD_PROFILE_H_
+#define BOARD_PROFILE_H_
+
+#include <stdint.h>
+
+// The uMFD bezel: GPIO 0-19, button n on GPIO n, switches to ground
+#define BOARD_BUTTONS_UMFD(X)                                                  \
+    X(0, 0, 1) X(1, 1, 1) X(2, 2, 1) X(3, 3, 1) X(4, 4, 1)                     \
+    X(5, 5, 1) X(6, 6, 1) X(7, 7, 1) X(8, 8, 1) X(9, 9, 1)                     \
+    X(10, 10, 1) X(11, 11, 1) X(12, 12, 1) X(13, 13, 1) X(14, 14, 1)           \
+    X(15, 15, 1) X(16, 16, 1) X(17, 17, 1) X(18, 18, 1) X(19, 19, 1)
+
+// Pimoroni Pico Unicorn: A, B, X, Y on GPIO 12-15
+#define BOARD_BUTTONS_UNICORN(X) X(12, 0, 1) X(13, 1, 1) X(14, 2, 1) X(15, 3, 1)
+
+#ifndef UMFD_BOARD
+#define UMFD_BOARD UMFD
+#endif
+
+#define BOARD_CAT_(a, b) a##b
+#define BOARD_CAT(a, b) BOARD_CAT_(a, b)
+#define BOARD_BUTTONS BOARD_CAT(BOARD_BUTTONS_, UMFD_BOARD)
+
+#define BOARD_PIN_BIT_(gpio, id, active_low) | (1u << (gpio))
+#define BOARD_PULL_UP_BIT_(gpio, id, active_low)                               \
+    | ((uint32_t)(active_low) << (gpio))
+#define BOARD_ID_BIT_(gpio, id, active_low) | (1u << (id))
+#define BOARD_COUNT_(gpio, id, active_low) + 1
+
+#define BOARD_GPIO_MASK (0u BOARD_BUTTONS(BOARD_PIN_BIT_))
+// Active low buttons get a pull-up, the rest a pull-down
+#define BOARD_PULL_UP_MASK (0u BOARD_BUTTONS(BOARD_PULL_UP_BIT_))
+#define BOARD_BTN_CNT (0 BOARD_BUTTONS(BOARD_COUNT_))
+
+_Static_assert(BOARD_BTN_CNT <= 30 &&
+                   __builtin_popcount(BOARD_GPIO_MASK) == BOARD_BTN_CNT,
+               "board profile uses a GPIO twice");
+_Static_assert((0u BOARD_BUTTONS(BOARD_ID_BIT_)) ==
+                   (uint32_t)((1ull << BOARD_BTN_CNT) - 1),
+               "board profile button IDs are not 0 .. count - 1, each once");
+
+#define BOARD_PACK_BIT_(gpio, id, active_low)                                  \
+    | (((pressed >> (gpio)) & 1u) << (id))
+
+// Report bits of the profile buttons from debounced GPIO levels, leaving out
+// any pin not in pins (taken by another input).
+static inline uint32_t board_pack(uint32_t levels, uint32_t pins) {
+    uint32_t pressed = (levels ^ BOARD_PULL_UP_MASK) & pins;
+
+    return 0u BOARD_BUTTONS(BOARD_PACK_BIT_);
+}
+
+#endif /* BOARD_PROFILE_H_ */
@@ -0,0 +1,225 @@
+/*
+ * Button mapping kept in flash.
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "board_profile.h"
+#include "config.h"
+#include "debounce.h"
+#include "umfd_hal.h"
+
+// CRC-32 (IEEE 802.3, reflected), a nibble at a time
+static uint32_t const crc_nibble[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4,
+    0x4db26158, 0x5005713c, 0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+    0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+};
+
+uint32_t config_crc(void const *data, uint32_t len) {
+    uint8_t const *p = data;
+    uint32_t crc = 0xffffffff;
+
+    while (len--) {
+        crc ^= *p++;
+        crc = (crc >> 4) ^ crc_nibble[crc & 0xf];
+        crc = (crc >> 4) ^ crc_nibble[crc & 0xf];
+    }
+    return ~crc;
+}
+
+void config_seal(struct config_block *b) {
+    b->magic = CONFIG_MAGIC;
+    b->version = CONFIG_VERSION;
+    b->len = sizeof(*b);
+    b->crc = config_crc(b, offsetof(struct config_block, crc));
+}
+
+bool config_valid(struct config_block const *b, uint32_t allowed_pins,
+                  uint8_t btn_cnt) {
+    uint32_t ids = 0;
+    int i;
+
+    if (b->magic != CONFIG_MAGIC || b->version != CONFIG_VERSION ||
+        b->len != sizeof(*b) ||
+        b->crc != config_crc(b, offsetof(struct config_block, crc))) {
+        return false;
+    }
+    for (i = 0; i < CONFIG_PINS; i++) {
+        if (!(b->pins[i].flags & CONFIG_PIN_USED)) {
+            continue;
+        }
+        if (!((allowed_pins >> i) & 0x1) || b->pins[i].btn_id >= btn_cnt ||
+            ((ids >> b->pins[i].btn_id) & 0x1)) {
+            return false;
+        }
+        ids |= 1u << b->pins[i].btn_id;
+    }
+    return true;
+}
+
+void config_from_profile(struct config_block *b, uint16_t debounce_us) {
+    memset(b, 0, sizeof(*b));
+#define CONFIG_PROFILE_PIN_(gpio, id, active_low)                              \
+    b->pins[gpio].btn_id = id;                                                 \
+    b->pins[gpio].flags =                                                      \
+        CONFIG_PIN_USED | ((active_low) ? 0 : CONFIG_PIN_ACTIVE_HIGH);         \
+    b->pins[gpio].debounce_us = debounce_us;
+    BOARD_BUTTONS(CONFIG_PROFILE_PIN_)
+#undef CONFIG_PROFILE_PIN_
+    config_seal(b);
+}
+
+// Which of the two sectors holds the newest valid block, or -1
+static int config_newest_sector(uint32_t allowed_pins, uint8_t btn_cnt) {
+    struct config_block const *b[2];
+    bool ok[2];
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        b[i] = hal_config_sector(i);
+        ok[i] = config_valid(b[i], allowed_pins, btn_cnt);
+    }
+    if (ok[0] && ok[1]) {
+        return (int32_t)(b[1]->seq - b[0]->seq) > 0 ? 1 : 0;
+    }
+    return ok[0] ? 0 : ok[1] ? 1 : -1;
+}
+
+bool config_store_init(struct config_store *cs, uint32_t allowed_pins,
+                       uint8_t btn_cnt, uint16_t debounce_us) {
+    uint32_t start_us = hal_time_us();
+    int sector;
+
+    memset(cs, 0, sizeof(*cs));
+    cs->allowed_pins = allowed_pins;
+    cs->btn_cnt = btn_cnt;
+    sector = config_newest_sector(allowed_pins, btn_cnt);
+    cs->active_sector = sector;
+    if (sector >= 0) {
+        memcpy(&cs->active, hal_config_sector(sector), sizeof(cs->active));
+    } else {
+        config_from_profile(&cs->active, debounce_us);
+    }
+    cs->staging = cs->active;
+    cs->load_us = hal_time_us() - start_us;
+    return sector >= 0;
+}
+
+bool config_store_save(struct config_store *cs) {
+    uint8_t sector = cs->active_sector == 0 ? 1 : 0;
+
+    cs->staging.seq = cs->active.seq + 1;
+    config_seal(&cs->staging);
+    if (!hal_config_sector_write(sector, &cs->staging, sizeof(cs->staging)) ||
+        memcmp(hal_config_sector(sector), &cs->staging, sizeof(cs->staging))) {
+        return false;
+    }
+    cs->active = cs->staging;
+    cs->active_sector = sector;
+    return true;
+}
+
+uint16_t config_feature_read(struct config_store *cs, uint8_t *buf,
+                             uint16_t len) {
+    uint32_t off = cs->page * CONFIG_PAGE_LEN;
+    uint32_t n = sizeof(cs->active) - off;
+
+    if (len < CONFIG_FEATURE_LEN) {
+        return 0;
+    }
+    memset(buf, 0, CONFIG_FEATURE_LEN);
+    buf[0] = CONFIG_OP_READ;
+    buf[1] = cs->page;
+    buf[2] = cs->commit_pending ? CONFIG_ERR_BUSY : cs->status;
+    buf[3] = CONFIG_FEATURE_PAGES;
+    memcpy(buf + 4, (uint8_t const *)&cs->active + off,
+           n < CONFIG_PAGE_LEN ? n : CONFIG_PAGE_LEN);
+    return CONFIG_FEATURE_LEN;
+}
+
+void config_feature_write(struct config_store *cs, uint8_t const *buf,
+                          uint16_t len, uint16_t debounce_us) {
+    uint32_t off, n;
+
+    if (len < 2 || buf[1] >= CONFIG_FEATURE_PAGES) {
+        return;
+    }
+    // the staging copy must not change under a store in progress
+    if (cs->commit_pending && buf[0] != CONFIG_OP_READ) {
+        cs->status = CONFIG_ERR_BUSY;
+        return;
+    }
+    switch (buf[0]) {
+    case CONFIG_OP_READ:
+        cs->page = buf[1];
+        break;
+    case CONFIG_OP_WRITE:
+        off = buf[1] * CONFIG_PAGE_LEN;
+        n = sizeof(cs->staging) - off;
+        if (n > CONFIG_PAGE_LEN) {
+            n = CONFIG_PAGE_LEN;
+        }
+        if (len < 4 + n) {
+            cs->status = CONFIG_ERR_INVALID;
+            return;
+        }
+        memcpy((uint8_t *)&cs->staging + off, buf + 4, n);
+        cs->status = CONFIG_OK;
+        break;
+    case CONFIG_OP_COMMIT:
+        // the host seals it; the sequence number is ours to set
+        if (!config_valid(&cs->staging, cs->allowed_pins, cs->btn_cnt)) {
+            cs->status = CONFIG_ERR_INVALID;
+            return;
+        }
+        cs->status = CONFIG_OK;
+        cs->commit_pending = true;
+        break;
+    case CONFIG_OP_DEFAULTS:
+        config_from_profile(&cs->staging, debounce_us);
+        cs->status = CONFIG_OK;
+        cs->commit_pending = true;
+        break;
+    default:
+        break;
+    }
+}
+
+void gpio_map_build(struct gpio_map *m, struct config_block const *b,
+                    uint32_t sample_hz) {
+    struct config_pin const *p;
+    uint32_t bit[4][8];
+    uint32_t v;
+    int i, k;
+
+    memset(m, 0, sizeof(*m));
+    memset(bit, 0, sizeof(bit));
+    for (i = 0; i < CONFIG_PINS; i++) {
+        p = b->pins + i;
+        if (!(p->flags & CONFIG_PIN_USED)) {
+            continue;
+        }
+        m->pins |= 1u << i;
+        if (!(p->flags & CONFIG_PIN_ACTIVE_HIGH)) {
+            m->active_low |= 1u << i;
+        }
+        if (p->flags & CONFIG_PIN_EAGER) {
+            m->eager |= 1u << i;
+        }
+        if (sample_hz) {
+            m->debounce_mask[i] =
+                debounce_mask_from_us(p->debounce_us, sample_hz);
+        } else {
+            m->debounce_mask[i] = 0x0f;
+        }
+        bit[i / 8][i % 8] = 1u << p->btn_id;
+    }
+    // every entry is a smaller one plus its lowest set bit
+    for (k = 0; k < 4; k++) {
+        for (v = 1; v < 256; v++) {
+            m->lut[k][v] = m->lut[k][v & (v - 1)] | bit[k][__builtin_ctz(v)];
+        }
+    }
+}
@@ -0,0 +1,148 @@
+/*
+ * Button mapping kept in flash.
+ *
+ * The config block says, per GPIO, which report button it is, whether it
+ * is active high or low, and its debounce window (or eager lockout). It is
+ * a fixed little endian layout, the same in flash, in RAM and on the wire,
+ * so loading it is a CRC check and a copy. gpio_map_build() then turns it
+ * into the tables the scan reads: pin and polarity masks, per pin debounce
+ * masks, and a byte wise lookup that permutes pressed pins into report
+ * bits with four loads.
+ *
+ * Two flash sectors hold the block alternately, each write going to the one
+ * not holding the current block with a higher sequence number, so a write
+ * cut short by a power loss leaves the previous block in place. At boot the
+ * valid block with the higher sequence number wins; without one the board
+ * profile applies.
+ *
+ * The host reads and writes the block through the config feature report in
+ * CONFIG_PAGE_LEN byte pages: write every page into the staging copy, then
+ * commit. A committed block only takes the IDs of the board profile's
+ * buttons, so the report layout, and with it the descriptor, stays the same
+ * and the host does not have to enumerate again.
+ */
+
+#ifndef CONFIG_H_
+#define CONFIG_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CONFIG_MAGIC 0x43464d55 // "UMFC"
+#define CONFIG_VERSION 1
+#define CONFIG_PINS 30
+
+// config_pin.flags
+#define CONFIG_PIN_USED 0x01
+#define CONFIG_PIN_ACTIVE_HIGH 0x02
+// debounce_us is the lockout of the eager filter
+#define CONFIG_PIN_EAGER 0x04
+
+struct config_pin {
+    uint8_t btn_id;
+    uint8_t flags;
+    uint16_t debounce_us;
+};
+
+struct config_block {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t len;
+    // the newer of the two sectors wins
+    uint32_t seq;
+    struct config_pin pins[CONFIG_PINS];
+    // CRC-32 of everything before it
+    uint32_t crc;
+};
+
+_Static_assert(sizeof(struct config_block) == 136,
+               "config block layout is part of the flash and wire format");
+
+// What the scan reads, built from a block
+struct gpio_map {
+    uint32_t pins;
+    uint32_t active_low;
+    uint32_t eager;
+    uint32_t debounce_mask[CONFIG_PINS];
+    // report bits for each byte of pressed pins
+    uint32_t lut[4][256];
+};
+
+// Config feature report: {op, page, status, pages, CONFIG_PAGE_LEN bytes}
+#define CONFIG_PAGE_LEN 56
+#define CONFIG_FEATURE_LEN (4 + CONFIG_PAGE_LEN)
+#define CONFIG_FEATURE_PAGES                                                   \
+    ((sizeof(struct config_block) + CONFIG_PAGE_LEN - 1) / CONFIG_PAGE_LEN)
+
+enum config_op {
+    // pick the page of the current block the next get returns
+    CONFIG_OP_READ,
+    // write a page of the staging block
+    CONFIG_OP_WRITE,
+    // check the staging block, then store and apply it
+    CONFIG_OP_COMMIT,
+    // store and apply the board profile's mapping
+    CONFIG_OP_DEFAULTS,
+};
+
+enum config_status {
+    CONFIG_OK,
+    CONFIG_ERR_INVALID,
+    // a commit is still being stored
+    CONFIG_ERR_BUSY,
+    CONFIG_ERR_FLASH,
+};
+
+struct config_store {
+    // what is in effect, and the sector it came from (-1 for none)
+    struct config_block active;
+    int8_t active_sector;
+    // GPIOs a block may use and the button IDs it may give them
+    uint32_t allowed_pins;
+    uint8_t btn_cnt;
+    // the report side: host written block, and what the next get returns
+    struct config_block staging;
+    uint8_t page;
+    uint8_t status;
+    bool commit_pending;
+    // time to find, check and copy the block at boot
+    uint32_t load_us;
+};
+
+uint32_t config_crc(void const *data, uint32_t len);
+// Set magic, version, length and CRC.
+void config_seal(struct config_block *b);
+// Magic, version, length, CRC, and only allowed pins with IDs below btn_cnt,
+// each ID once.
+bool config_valid(struct config_block const *b, uint32_t allowed_pins,
+                  uint8_t btn_cnt);
+// The board profile's mapping, every pin on the same debounce window.
+void config_from_profile(struct config_block *b, uint16_t debounce_us);
+
+// Load the newest valid block from flash, or the board profile's mapping.
+// Returns true if flash had one.
+bool config_store_init(struct config_store *cs, uint32_t allowed_pins,
+                       uint8_t btn_cnt, uint16_t debounce_us);
+// Write the staging block to the other sector and make it the active one.
+bool config_store_save(struct config_store *cs);
+
+// Feature report handlers. A commit only sets commit_pending; storing
+// erases flash, so it is left to the main loop.
+uint16_t config_feature_read(struct config_store *cs, uint8_t *buf,
+                             uint16_t len);
+void config_feature_write(struct config_store *cs, uint8_t const *buf,
+                          uint16_t len, uint16_t debounce_us);
+
+// Debounce windows in samples at sample_hz, or 4 samples if 0 (polled).
+void gpio_map_build(struct gpio_map *m, struct config_block const *b,
+                    uint32_t sample_hz);
+
+static inline uint32_t gpio_map_pack(struct gpio_map const *m,
+                                     uint32_t levels) {
+    uint32_t pressed = (levels ^ m->active_low) & m->pins;
+
+    return m->lut[0][pressed & 0xff] | m->lut[1][(pressed >> 8) & 0xff] |
+           m->lut[2][(pressed >> 16) & 0xff] | m->lut[3][pressed >> 24];
+}
+
+#endif /* CONFIG_H_ */
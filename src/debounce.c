@@ -0,0 +1,103 @@
+/*
+ * Word-wide vertical counter debounce.
+ *
+ * A window pin flips once it has disagreed with its debounced level for a
+ * full window of consecutive samples, the same thing the per-button history
+ * check (hist & mask == 0 or == mask) decided before. An eager pin flips on
+ * the first disagreeing sample and then reuses the counter planes to count
+ * out its lockout.
+ */
+
+#include <string.h>
+
+#include "debounce.h"
+
+void debounce_vc_init(struct debounce_vc *vc) {
+    memset(vc, 0, sizeof(*vc));
+}
+
+static void debounce_vc_set_thr(struct debounce_vc *vc, uint8_t pin,
+                               uint8_t thr, bool idle_level) {
+    uint32_t bit = 1u << pin;
+    int i;
+
+    vc->locked &= ~bit;
+    for (i = 0; i < DEBOUNCE_CNT_BITS; i++) {
+        vc->cnt[i] &= ~bit;
+        if ((thr >> i) & 1) {
+            vc->thr[i] |= bit;
+        } else {
+            vc->thr[i] &= ~bit;
+        }
+    }
+    if (idle_level) {
+        vc->state |= bit;
+    } else {
+        vc->state &= ~bit;
+    }
+}
+
+void debounce_vc_config_pin(struct debounce_vc *vc, uint8_t pin,
+                            uint32_t window_mask, bool idle_level) {
+    vc->eager &= ~(1u << pin);
+    debounce_vc_set_thr(vc, pin, debounce_window_len(window_mask) - 1,
+                        idle_level);
+}
+
+void debounce_vc_config_pin_eager(struct debounce_vc *vc, uint8_t pin,
+                                  uint32_t lockout_mask, bool idle_level) {
+    uint8_t lockout = lockout_mask ? debounce_window_len(lockout_mask) : 0;
+
+    // the counter tops out at 31
+    if (lockout > (1 << DEBOUNCE_CNT_BITS) - 1) {
+        lockout = (1 << DEBOUNCE_CNT_BITS) - 1;
+    }
+    vc->eager |= 1u << pin;
+    debounce_vc_set_thr(vc, pin, lockout, idle_level);
+}
+
+uint32_t debounce_vc_update(struct debounce_vc *vc, uint32_t sample) {
+    uint32_t diff = sample ^ vc->state;
+    uint32_t t0 = vc->cnt[0], t1 = vc->cnt[1], t2 = vc->cnt[2],
+             t3 = vc->cnt[3], t4 = vc->cnt[4];
+    uint32_t eager = vc->eager;
+    uint32_t eq, toggle, inc, carry;
+
+    // window pins that already saw (window - 1) disagreeing samples, eager
+    // pins that sat out their whole lockout
+    eq = ~((t0 ^ vc->thr[0]) | (t1 ^ vc->thr[1]) | (t2 ^ vc->thr[2]) |
+           (t3 ^ vc->thr[3]) | (t4 ^ vc->thr[4]));
+    vc->locked &= ~eq;
+    toggle = diff & ((eq & ~eager) | (eager & ~vc->locked));
+    vc->state ^= toggle;
+    vc->locked |= toggle & eager;
+
+    // window pins count disagreeing samples, locked eager pins count every
+    // sample since their flip; clear everywhere else
+    inc = (diff & ~toggle & ~eager) | (vc->locked & ~toggle);
+    carry = inc;
+    vc->cnt[0] = (t0 ^ carry) & inc;
+    carry &= t0;
+    vc->cnt[1] = (t1 ^ carry) & inc;
+    carry &= t1;
+    vc->cnt[2] = (t2 ^ carry) & inc;
+    carry &= t2;
+    vc->cnt[3] = (t3 ^ carry) & inc;
+    carry &= t3;
+    vc->cnt[4] = (t4 ^ carry) & inc;
+
+    return toggle;
+}
+
+uint32_t debounce_vc_force(struct debounce_vc *vc, uint32_t pins,
+                           uint32_t levels) {
+    uint32_t toggle = (levels ^ vc->state) & pins;
+    int i;
+
+    vc->state ^= toggle;
+    vc->locked |= toggle & vc->eager;
+    for (i = 0; i < DEBOUNCE_CNT_BITS; i++) {
+        vc->cnt[i] &= ~toggle;
+    }
+    return toggle;
+}
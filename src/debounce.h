@@ -0,0 +1,84 @@
+/*
+ * Word-wide vertical counter debounce.
+ *
+ * Debounces every pin of a 32-bit sample at once. Each pin owns one bit in
+ * each of the counter bit planes, so one update costs the same handful of
+ * bitwise ops whether one or thirty buttons are wired up.
+ *
+ * Pins run one of two filters:
+ *  - window: flip after a full window of samples that disagree with the
+ *    debounced level (the conservative default)
+ *  - eager: flip on the first disagreeing sample, then ignore the pin for a
+ *    lockout of N samples. Lower latency, but any glitch is a press.
+ */
+
+#ifndef DEBOUNCE_H_
+#define DEBOUNCE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Counter planes. 5 planes count to 31, enough for a full 32 sample window.
+#define DEBOUNCE_CNT_BITS 5
+
+struct debounce_vc {
+    // debounced pin levels (raw levels, not pressed/released)
+    uint32_t state;
+    // consecutive samples that disagreed with state, one plane per bit
+    uint32_t cnt[DEBOUNCE_CNT_BITS];
+    // per pin (window length - 1), or lockout length for eager pins
+    uint32_t thr[DEBOUNCE_CNT_BITS];
+    // pins using the eager filter
+    uint32_t eager;
+    // eager pins inside their lockout, cnt counts the samples spent in it
+    uint32_t locked;
+};
+
+// Number of samples a history mask like 0x0f asks for. The old shift
+// register compared the low bits of the history against the mask, so only
+// contiguous low masks were ever meaningful; the window is the mask width.
+static inline uint8_t debounce_window_len(uint32_t window_mask) {
+    if (!window_mask) {
+        return 1;
+    }
+    return 32 - __builtin_clz(window_mask);
+}
+
+// History mask for a window given in microseconds at a fixed sample rate,
+// rounded up to whole samples and clamped to 1..32.
+static inline uint32_t debounce_mask_from_us(uint32_t window_us,
+                                             uint32_t rate_hz) {
+    uint32_t n = (uint32_t)(((uint64_t)window_us * rate_hz + 999999) / 1000000);
+
+    if (n < 1) {
+        n = 1;
+    }
+    if (n >= 32) {
+        return 0xffffffff;
+    }
+    return (1u << n) - 1;
+}
+
+void debounce_vc_init(struct debounce_vc *vc);
+
+// Set the window of one pin and the level it sits at while idle.
+void debounce_vc_config_pin(struct debounce_vc *vc, uint8_t pin,
+                            uint32_t window_mask, bool idle_level);
+
+// Switch one pin to the eager filter with a lockout of as many samples as
+// the lockout mask is wide (see debounce_window_len()).
+void debounce_vc_config_pin_eager(struct debounce_vc *vc, uint8_t pin,
+                                  uint32_t lockout_mask, bool idle_level);
+
+// Feed one raw sample. Returns the mask of pins whose debounced level
+// flipped on this sample; the new levels are in vc->state.
+uint32_t debounce_vc_update(struct debounce_vc *vc, uint32_t sample);
+
+// Take the levels of pins as debounced now, without waiting for samples.
+// Pins that flip start over as if they flipped on a sample: eager ones in
+// their lockout, window ones with an empty window. Returns the pins that
+// flipped.
+uint32_t debounce_vc_force(struct debounce_vc *vc, uint32_t pins,
+                           uint32_t levels);
+
+#endif /* DEBOUNCE_H_ */
@@ -0,0 +1,92 @@
+/*
+ * On-device cycle count of the vertical counter debounce against the old
+ * per-button history loop. Built only with UMFD_DEBOUNCE_BENCH, prints to
+ * stdio once at boot.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hardware/structs/systick.h"
+#include "pico/stdlib.h"
+
+#include "debounce.h"
+
+#define BENCH_BTNS 20
+#define BENCH_ITERS 1024
+
+// The per-button layout poll_registered_gpios() used before the engine.
+struct hist_btn {
+    bool enabled_state;
+    uint8_t gpio_id;
+    uint32_t gpio_debounce_mask;
+    uint32_t hist;
+    bool state;
+};
+
+static struct hist_btn hist_btns[BENCH_BTNS];
+static struct debounce_vc bench_vc;
+static uint32_t samples[BENCH_ITERS];
+
+static void poll_hist(uint32_t raw_gpio) {
+    struct hist_btn *btn;
+    uint32_t gpio_hist_window;
+
+    for (btn = hist_btns; btn < hist_btns + BENCH_BTNS; btn++) {
+        btn->hist = (btn->hist << 1) | ((raw_gpio >> btn->gpio_id) & 0x1);
+        gpio_hist_window = btn->hist & btn->gpio_debounce_mask;
+        if (gpio_hist_window == 0 ||
+            gpio_hist_window == btn->gpio_debounce_mask) {
+            btn->state = (gpio_hist_window & 1) == btn->enabled_state;
+        }
+    }
+}
+
+static inline uint32_t systick_now(void) { return systick_hw->cvr; }
+
+void debounce_bench_run(void) {
+    uint32_t seed = 0x1234567;
+    uint32_t start, hist_cycles, vc_cycles;
+    volatile uint32_t sink = 0;
+    int i;
+
+    // idle high with a bouncing pin now and then, like a lightly used pad
+    for (i = 0; i < BENCH_ITERS; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        samples[i] = 0xffffffff ^ ((seed & 0x7) ? 0 : 1u << (seed % 20));
+    }
+
+    memset(hist_btns, 0, sizeof(hist_btns));
+    debounce_vc_init(&bench_vc);
+    for (i = 0; i < BENCH_BTNS; i++) {
+        hist_btns[i].gpio_id = i;
+        hist_btns[i].gpio_debounce_mask = 0x0f;
+        debounce_vc_config_pin(&bench_vc, i, 0x0f, true);
+    }
+
+    // 24 bit down counter on the processor clock
+    systick_hw->rvr = 0x00ffffff;
+    systick_hw->cvr = 0;
+    systick_hw->csr = 0x5;
+
+    start = systick_now();
+    for (i = 0; i < BENCH_ITERS; i++) {
+        poll_hist(samples[i]);
+    }
+    hist_cycles = (start - systick_now()) & 0x00ffffff;
+
+    start = systick_now();
+    for (i = 0; i < BENCH_ITERS; i++) {
+        sink |= debounce_vc_update(&bench_vc, samples[i]);
+    }
+    vc_cycles = (start - systick_now()) & 0x00ffffff;
+
+    printf("debounce bench: %d buttons, %d polls\n", BENCH_BTNS, BENCH_ITERS);
+    printf("  history loop:     %lu cycles/poll\n",
+           (unsigned long)(hist_cycles / BENCH_ITERS));
+    printf("  vertical counter: %lu cycles/poll\n",
+           (unsigned long)(vc_cycles / BENCH_ITERS));
+    (void)sink;
+}
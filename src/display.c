@@ -0,0 +1,217 @@
+/*
+ * MFD display stream decoder.
+ */
+
+#include <string.h>
+
+#include "display.h"
+
+void display_init(struct display *d, uint16_t width, uint16_t height) {
+    memset(d, 0, sizeof(*d));
+    d->width = width;
+    d->height = height;
+    d->dma_ch = -1;
+}
+
+// Hand the band being filled to the panel side, if it has pixels. With both
+// bands out, the one at fill is the panel's and was just handed over.
+static void band_submit(struct display *d) {
+    struct display_band *b = d->band + d->fill;
+
+    if (d->ready == 2 || !b->len) {
+        return;
+    }
+    if (d->window_due) {
+        b->x = d->cmd.x;
+        b->y = d->cmd.y;
+        b->w = d->cmd.w;
+        b->h = d->cmd.h;
+        d->window_due = false;
+    } else {
+        b->w = 0;
+    }
+    d->ready++;
+    d->fill ^= 1;
+}
+
+void display_band_done(struct display *d) {
+    d->band[d->drain].len = 0;
+    d->drain ^= 1;
+    d->ready--;
+}
+
+static void put_px(struct display *d, uint16_t px) {
+    struct display_band *b = d->band + d->fill;
+
+    b->px[b->len++] = px;
+    if (b->len == DISPLAY_BAND_PX) {
+        band_submit(d);
+    }
+}
+
+// Drop what is left of the current command and look for the next sync word.
+// The pixels decoded so far still go to the panel.
+static void display_lost(struct display *d) {
+    band_submit(d);
+    if (!d->lost) {
+        d->lost = true;
+        d->errors++;
+    }
+    d->state = DISPLAY_HEADER;
+    d->hdr_len = 0;
+    d->half = false;
+}
+
+static void cmd_start(struct display *d) {
+    struct display_cmd const *c = &d->cmd;
+
+    if (c->op == DISPLAY_OP_FRAME) {
+        d->frames++;
+        d->lost = false;
+        return;
+    }
+    if ((c->op != DISPLAY_OP_RAW && c->op != DISPLAY_OP_RLE) || !c->w ||
+        !c->h || c->x >= d->width || c->y >= d->height ||
+        c->w > d->width - c->x || c->h > d->height - c->y) {
+        display_lost(d);
+        return;
+    }
+    d->lost = false;
+    d->left = (uint32_t)c->w * c->h;
+    d->window_due = true;
+    d->rects++;
+    d->state = c->op == DISPLAY_OP_RAW ? DISPLAY_RAW : DISPLAY_RLE_CODE;
+}
+
+static void header_byte(struct display *d, uint8_t c) {
+    d->hdr[d->hdr_len++] = c;
+    // slide along until the sync word lines up
+    if (d->hdr_len == 2 && (d->hdr[0] | d->hdr[1] << 8) != DISPLAY_SYNC) {
+        if (!d->lost) {
+            d->lost = true;
+            d->errors++;
+        }
+        d->hdr[0] = d->hdr[1];
+        d->hdr_len = 1;
+        return;
+    }
+    if (d->hdr_len < sizeof(d->hdr)) {
+        return;
+    }
+    d->hdr_len = 0;
+    memcpy(&d->cmd, d->hdr, sizeof(d->cmd));
+    cmd_start(d);
+}
+
+static void rect_end(struct display *d) {
+    band_submit(d);
+    d->state = DISPLAY_HEADER;
+}
+
+// Take a pixel, which may be split across two feeds. Returns false when the
+// data runs out first.
+static bool take_px(struct display *d, uint8_t const *data, uint32_t len,
+                    uint32_t *i, uint16_t *px) {
+    if (d->half) {
+        if (*i == len) {
+            return false;
+        }
+        *px = d->lo | data[(*i)++] << 8;
+        d->half = false;
+        return true;
+    }
+    if (len - *i >= 2) {
+        *px = data[*i] | data[*i + 1] << 8;
+        *i += 2;
+        return true;
+    }
+    if (*i < len) {
+        d->lo = data[(*i)++];
+        d->half = true;
+    }
+    return false;
+}
+
+uint32_t display_feed(struct display *d, uint8_t const *data, uint32_t len) {
+    struct display_band *b;
+    uint32_t i = 0;
+    uint16_t px, n, k;
+    uint8_t c;
+
+    for (;;) {
+        switch (d->state) {
+        case DISPLAY_HEADER:
+            if (i == len) {
+                return i;
+            }
+            header_byte(d, data[i++]);
+            break;
+        case DISPLAY_RAW:
+        case DISPLAY_RLE_LITERAL:
+            if (d->ready == 2) {
+                d->stalls++;
+                return i;
+            }
+            if (!take_px(d, data, len, &i, &px)) {
+                return i;
+            }
+            put_px(d, px);
+            d->left--;
+            if (d->state == DISPLAY_RLE_LITERAL && !--d->run) {
+                d->state = DISPLAY_RLE_CODE;
+            }
+            if (!d->left) {
+                rect_end(d);
+            }
+            break;
+        case DISPLAY_RLE_CODE:
+            if (i == len) {
+                return i;
+            }
+            c = data[i++];
+            d->run = c < 0x80 ? c + 1 : c - 0x7f;
+            if (d->run > d->left) {
+                display_lost(d);
+                break;
+            }
+            d->state = c < 0x80 ? DISPLAY_RLE_LITERAL : DISPLAY_RLE_REPEAT_PX;
+            break;
+        case DISPLAY_RLE_REPEAT_PX:
+            if (!take_px(d, data, len, &i, &d->rep)) {
+                return i;
+            }
+            d->state = DISPLAY_RLE_REPEAT;
+            break;
+        case DISPLAY_RLE_REPEAT:
+            // a repeat needs no input, only room
+            if (d->ready == 2) {
+                d->stalls++;
+                return i;
+            }
+            b = d->band + d->fill;
+            n = DISPLAY_BAND_PX - b->len;
+            if (n > d->run) {
+                n = d->run;
+            }
+            for (k = 0; k < n; k++) {
+                b->px[b->len + k] = d->rep;
+            }
+            b->len += n;
+            d->run -= n;
+            d->left -= n;
+            if (b->len == DISPLAY_BAND_PX) {
+                band_submit(d);
+            }
+            if (!d->run) {
+                d->state = DISPLAY_RLE_CODE;
+            }
+            if (!d->left) {
+                rect_end(d);
+            }
+            break;
+        default:
+            d->state = DISPLAY_HEADER;
+            break;
+        }
+    }
+}
@@ -0,0 +1,140 @@
+/*
+ * MFD display stream.
+ *
+ * The host streams what the SPI panel behind the bezel shows over a vendor
+ * class bulk OUT endpoint, as a sequence of commands: a display_cmd header
+ * and, for the rectangle commands, RGB565 pixels, all little endian.
+ *
+ *   DISPLAY_OP_RAW    w * h pixels, row by row
+ *   DISPLAY_OP_RLE    runs covering w * h pixels: a byte n, then n + 1
+ *                     literal pixels if n < 0x80, else one pixel repeated
+ *                     n - 0x7f times
+ *   DISPLAY_OP_FRAME  no pixels; every rectangle of a frame was sent
+ *
+ * The host only sends the rectangles that changed. The panel keeps the frame
+ * in its own memory, so the device never holds one: the decoder fills one of
+ * two band buffers while DMA pushes the other into the panel window of its
+ * rectangle. Once both are full the decoder stops taking bytes, the vendor
+ * FIFO fills, the host's bulk OUT is NAKed and the stream goes at the
+ * panel's pace.
+ *
+ * A header without the sync word, or a rectangle off the panel, drops bytes
+ * up to the next sync word, so a host restarting mid command only loses
+ * that command.
+ */
+
+#ifndef DISPLAY_H_
+#define DISPLAY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define DISPLAY_SYNC 0x4d55 // "UM"
+// Pixels per band, two bands are 8 KB
+#define DISPLAY_BAND_PX 2048
+// Longest RLE run either way
+#define DISPLAY_RLE_MAX 128
+
+enum display_op {
+    DISPLAY_OP_RAW = 1,
+    DISPLAY_OP_RLE,
+    DISPLAY_OP_FRAME,
+};
+
+struct display_cmd {
+    uint16_t sync;
+    uint8_t op;
+    // 0, reserved
+    uint8_t flags;
+    uint16_t x;
+    uint16_t y;
+    uint16_t w;
+    uint16_t h;
+};
+
+_Static_assert(sizeof(struct display_cmd) == 12,
+               "display command layout is part of the stream format");
+
+enum display_state {
+    DISPLAY_HEADER,
+    DISPLAY_RAW,
+    DISPLAY_RLE_CODE,
+    DISPLAY_RLE_LITERAL,
+    DISPLAY_RLE_REPEAT_PX,
+    DISPLAY_RLE_REPEAT,
+};
+
+struct display_band {
+    // panel window to open before the pixels; w 0 carries on in the last one
+    uint16_t x, y, w, h;
+    uint16_t len;
+    uint16_t px[DISPLAY_BAND_PX];
+};
+
+struct display {
+    uint16_t width;
+    uint16_t height;
+
+    // decoder
+    uint8_t state;
+    uint8_t hdr_len;
+    uint8_t hdr[sizeof(struct display_cmd)];
+    struct display_cmd cmd;
+    // pixels of the rectangle, and of the RLE run, still to come
+    uint32_t left;
+    uint16_t run;
+    uint16_t rep;
+    // a pixel split across two feeds
+    bool half;
+    uint8_t lo;
+    // the next band starts the rectangle
+    bool window_due;
+    // dropping bytes up to the next sync word
+    bool lost;
+
+    // Bands are filled by the decoder and drained by the panel in turn. The
+    // decoder owns band[fill] unless ready is 2.
+    struct display_band band[2];
+    uint8_t fill;
+    uint8_t drain;
+    uint8_t ready;
+
+    // panel side, see display_spi.c
+    int8_t dma_ch;
+    bool dma_busy;
+    uint8_t init_step;
+    uint32_t wait_us;
+    uint32_t wait_start_us;
+    uint8_t pin_cs;
+    uint8_t pin_dc;
+
+    uint32_t frames;
+    uint32_t rects;
+    // resyncs after a bad header or run
+    uint32_t errors;
+    // times a feed stopped on two full bands
+    uint32_t stalls;
+};
+
+void display_init(struct display *d, uint16_t width, uint16_t height);
+
+// Decode up to len bytes of stream. Returns how many were taken, less than
+// len once both bands are full; feed the rest again later.
+uint32_t display_feed(struct display *d, uint8_t const *data, uint32_t len);
+
+// Panel side. The band to push next, or NULL.
+static inline struct display_band *display_band_next(struct display *d) {
+    return d->ready ? d->band + d->drain : NULL;
+}
+// Panel side. The band from display_band_next() is on the panel.
+void display_band_done(struct display *d);
+
+// Claim SPI and DMA, and start bringing the panel up; display_panel_poll()
+// does the rest. Only on the device.
+bool display_panel_start(struct display *d, uint8_t sck, uint8_t mosi,
+                         uint8_t cs, uint8_t dc, int8_t rst, uint32_t baud);
+// Step the panel bring-up, and hand the next band to DMA once the last one
+// is out. Never waits. Only on the device.
+void display_panel_poll(struct display *d);
+
+#endif /* DISPLAY_H_ */
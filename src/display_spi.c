@@ -0,0 +1,164 @@
+/*
+ * MFD display stream, the SPI panel side.
+ *
+ * An ST7789 (or compatible) controller with its own frame memory, written
+ * through SPI with a GPIO for data/command and one for chip select. The
+ * bring-up steps through a table with its delays checked on each poll, so
+ * USB enumerates meanwhile. Each band opens its window with a few blocking
+ * command bytes, then DMA moves the pixels as 16 bit frames, MSB first as
+ * the panel wants RGB565, while the main loop decodes the next band.
+ */
+
+#include "hardware/dma.h"
+#include "hardware/gpio.h"
+#include "hardware/spi.h"
+#include "hardware/timer.h"
+
+#include "display.h"
+
+#define ST7789_SWRESET 0x01
+#define ST7789_SLPOUT 0x11
+#define ST7789_NORON 0x13
+#define ST7789_INVON 0x21
+#define ST7789_DISPON 0x29
+#define ST7789_CASET 0x2a
+#define ST7789_RASET 0x2b
+#define ST7789_RAMWR 0x2c
+#define ST7789_MADCTL 0x36
+#define ST7789_COLMOD 0x3a
+#define ST7789_RAMWRC 0x3c
+
+struct panel_step {
+    uint8_t cmd;
+    uint8_t len;
+    uint8_t arg;
+    uint8_t wait_ms;
+};
+
+static struct panel_step const panel_init[] = {
+    {ST7789_SWRESET, 0, 0, 150},
+    {ST7789_SLPOUT, 0, 0, 120},
+    // 16 bit RGB565
+    {ST7789_COLMOD, 1, 0x55, 0},
+    {ST7789_MADCTL, 1, 0x00, 0},
+    // most ST7789 modules are wired for inverted colour
+    {ST7789_INVON, 0, 0, 0},
+    {ST7789_NORON, 0, 0, 0},
+    {ST7789_DISPON, 0, 0, 0},
+};
+
+#define PANEL_INIT_STEPS (sizeof(panel_init) / sizeof(panel_init[0]))
+
+// One panel per board, on the SPI its pins belong to
+static spi_inst_t *panel_spi;
+
+// Send a command and its arguments, leaving the bus idle.
+static void panel_cmd(struct display *d, uint8_t cmd, uint8_t const *args,
+                      uint8_t len) {
+    spi_set_format(panel_spi, 8, SPI_CPOL_0, SPI_CPHA_0, SPI_MSB_FIRST);
+    gpio_put(d->pin_dc, 0);
+    spi_write_blocking(panel_spi, &cmd, 1);
+    gpio_put(d->pin_dc, 1);
+    if (len) {
+        spi_write_blocking(panel_spi, args, len);
+    }
+}
+
+// Column or row range, first to last inclusive
+static void panel_range(struct display *d, uint8_t cmd, uint16_t first,
+                        uint16_t len) {
+    uint16_t last = first + len - 1;
+    uint8_t args[4] = {first >> 8, first, last >> 8, last};
+
+    panel_cmd(d, cmd, args, sizeof(args));
+}
+
+bool display_panel_start(struct display *d, uint8_t sck, uint8_t mosi,
+                         uint8_t cs, uint8_t dc, int8_t rst, uint32_t baud) {
+    dma_channel_config c;
+
+    if (d->dma_ch >= 0) {
+        return false;
+    }
+    d->dma_ch = dma_claim_unused_channel(false);
+    if (d->dma_ch < 0) {
+        return false;
+    }
+    // GPIO 8-15 and 24-29 are SPI1, the rest SPI0
+    panel_spi = (sck >> 3) & 0x1 ? spi1 : spi0;
+    spi_init(panel_spi, baud);
+    gpio_set_function(sck, GPIO_FUNC_SPI);
+    gpio_set_function(mosi, GPIO_FUNC_SPI);
+    d->pin_cs = cs;
+    d->pin_dc = dc;
+    gpio_init(cs);
+    gpio_put(cs, 1);
+    gpio_set_dir(cs, GPIO_OUT);
+    gpio_init(dc);
+    gpio_put(dc, 1);
+    gpio_set_dir(dc, GPIO_OUT);
+    if (rst >= 0) {
+        gpio_init(rst);
+        gpio_put(rst, 0);
+        gpio_set_dir(rst, GPIO_OUT);
+        busy_wait_us_32(20);
+        gpio_put(rst, 1);
+    }
+
+    c = dma_channel_get_default_config(d->dma_ch);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, spi_get_dreq(panel_spi, true));
+    dma_channel_configure(d->dma_ch, &c, &spi_get_hw(panel_spi)->dr, NULL, 0,
+                          false);
+
+    // the controller wants 120 ms after a reset before anything else
+    d->init_step = 0;
+    d->wait_start_us = time_us_32();
+    d->wait_us = 120000;
+    return true;
+}
+
+void display_panel_poll(struct display *d) {
+    struct panel_step const *s;
+    struct display_band *b;
+
+    if (d->dma_ch < 0 || time_us_32() - d->wait_start_us < d->wait_us) {
+        return;
+    }
+    d->wait_us = 0;
+    if (d->init_step < PANEL_INIT_STEPS) {
+        s = panel_init + d->init_step++;
+        gpio_put(d->pin_cs, 0);
+        panel_cmd(d, s->cmd, &s->arg, s->len);
+        gpio_put(d->pin_cs, 1);
+        d->wait_start_us = time_us_32();
+        d->wait_us = s->wait_ms * 1000;
+        return;
+    }
+    if (d->dma_busy) {
+        // the last pixel has to leave the shifter before DC may change
+        if (dma_channel_is_busy(d->dma_ch) || spi_is_busy(panel_spi)) {
+            return;
+        }
+        gpio_put(d->pin_cs, 1);
+        d->dma_busy = false;
+        display_band_done(d);
+    }
+    b = display_band_next(d);
+    if (!b) {
+        return;
+    }
+    gpio_put(d->pin_cs, 0);
+    if (b->w) {
+        panel_range(d, ST7789_CASET, b->x, b->w);
+        panel_range(d, ST7789_RASET, b->y, b->h);
+        panel_cmd(d, ST7789_RAMWR, NULL, 0);
+    } else {
+        panel_cmd(d, ST7789_RAMWRC, NULL, 0);
+    }
+    spi_set_format(panel_spi, 16, SPI_CPOL_0, SPI_CPHA_0, SPI_MSB_FIRST);
+    dma_channel_transfer_from_buffer_now(d->dma_ch, b->px, b->len);
+    d->dma_busy = true;
+}
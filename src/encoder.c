@@ -0,0 +1,205 @@
+/*
+ * Quadrature rotary encoders.
+ */
+
+#include <string.h>
+
+#include "encoder.h"
+
+#define ENCODER_AXIS_MAX 32767
+
+// Indexed by (previous AB << 2) | current AB, A in bit 0. A leading B
+// counts up: 00 -> 01 -> 11 -> 10 -> 00.
+static int8_t const quad_delta[16] = {
+    [0x1] = 1, [0x7] = 1, [0xe] = 1, [0x8] = 1,
+    [0x4] = -1, [0xd] = -1, [0xb] = -1, [0x2] = -1,
+};
+// Entries where both pins changed at once: a state went by unseen
+#define QUAD_SKIPPED ((1u << 0x3) | (1u << 0x6) | (1u << 0x9) | (1u << 0xc))
+
+void encoder_bank_init(struct encoder_bank *eb, uint8_t pin_base, uint8_t cnt,
+                       uint32_t sample_hz) {
+    memset(eb, 0, sizeof(*eb));
+    eb->pin_base = pin_base;
+    eb->cnt = cnt > ENCODER_MAX ? ENCODER_MAX : cnt;
+    eb->sample_hz = sample_hz;
+    eb->dma_ch[0] = -1;
+    eb->dma_ch[1] = -1;
+}
+
+void encoder_bank_prime(struct encoder_bank *eb, uint8_t levels) {
+    int i;
+
+    eb->last = levels;
+    for (i = 0; i < eb->cnt; i++) {
+        eb->enc[i].ab = (levels >> (i * 2)) & 3;
+    }
+}
+
+void encoder_set_buttons(struct encoder *e, struct dinput_btn_reg *cw,
+                         struct dinput_btn_reg *ccw, uint8_t counts_per_detent,
+                         uint32_t pulse_us) {
+    e->output = ENCODER_OUT_BUTTONS;
+    e->cw = cw;
+    e->ccw = ccw;
+    e->counts_per_detent = counts_per_detent ? counts_per_detent : 1;
+    e->pulse_us = pulse_us;
+}
+
+void encoder_set_axis(struct encoder *e, uint32_t range, bool wrap) {
+    e->output = wrap ? ENCODER_OUT_AXIS_WRAP : ENCODER_OUT_AXIS;
+    // more counts than axis steps add nothing and overflow encoder_axis()
+    if (range > ENCODER_RANGE_MAX) {
+        range = ENCODER_RANGE_MAX;
+    }
+    e->range = range ? range : 1;
+    e->pos = e->range / 2;
+    e->value = 0;
+}
+
+// Counts to pending detents; any remainder waits for the next transition.
+static void encoder_count_detents(struct encoder *e, int8_t delta) {
+    e->detent_acc += delta;
+    if (e->detent_acc >= e->counts_per_detent) {
+        e->detent_acc = 0;
+        if (e->pending < ENCODER_PENDING_MAX) {
+            e->pending++;
+        }
+    } else if (e->detent_acc <= -e->counts_per_detent) {
+        e->detent_acc = 0;
+        if (e->pending > -ENCODER_PENDING_MAX) {
+            e->pending--;
+        }
+    }
+}
+
+void encoder_bank_feed(struct encoder_bank *eb, uint8_t levels) {
+    struct encoder *e;
+    uint8_t changed = levels ^ eb->last;
+    uint8_t ab, idx;
+    int8_t delta;
+    int i;
+
+    eb->last = levels;
+    eb->transitions++;
+    for (i = 0; i < eb->cnt; i++) {
+        if (!((changed >> (i * 2)) & 3)) {
+            continue;
+        }
+        e = eb->enc + i;
+        ab = (levels >> (i * 2)) & 3;
+        idx = e->ab << 2 | ab;
+        e->ab = ab;
+        delta = quad_delta[idx];
+        e->missed += (QUAD_SKIPPED >> idx) & 1;
+        e->count += delta;
+        if (e->output == ENCODER_OUT_BUTTONS) {
+            encoder_count_detents(e, delta);
+        } else {
+            e->pos += delta;
+        }
+    }
+}
+
+// Press, hold for pulse_us, release, wait as long again, next detent.
+static bool encoder_pulse(struct encoder *e, uint32_t now_us) {
+    struct dinput_btn_reg *btn;
+
+    switch (e->pulse_phase) {
+    case 0:
+        if (!e->pending) {
+            return false;
+        }
+        btn = e->pending > 0 ? e->cw : e->ccw;
+        e->pending += e->pending > 0 ? -1 : 1;
+        if (btn) {
+            btn->state = 1;
+        }
+        e->pulse_phase = 1;
+        e->pulse_start_us = now_us;
+        return true;
+    case 1:
+        if (now_us - e->pulse_start_us < e->pulse_us) {
+            return false;
+        }
+        if (e->cw) {
+            e->cw->state = 0;
+        }
+        if (e->ccw) {
+            e->ccw->state = 0;
+        }
+        e->pulse_phase = 2;
+        e->pulse_start_us = now_us;
+        return true;
+    default:
+        if (now_us - e->pulse_start_us >= e->pulse_us) {
+            e->pulse_phase = 0;
+            return encoder_pulse(e, now_us);
+        }
+        return false;
+    }
+}
+
+static bool encoder_axis(struct encoder *e) {
+    int16_t value;
+
+    if (e->output == ENCODER_OUT_AXIS_WRAP) {
+        e->pos %= (int32_t)e->range;
+        if (e->pos < 0) {
+            e->pos += e->range;
+        }
+    } else if (e->pos < 0) {
+        e->pos = 0;
+    } else if (e->pos > (int32_t)e->range) {
+        e->pos = e->range;
+    }
+    value = (int32_t)((uint32_t)e->pos * (2 * ENCODER_AXIS_MAX) / e->range) -
+            ENCODER_AXIS_MAX;
+    if (value == e->value) {
+        return false;
+    }
+    e->value = value;
+    return true;
+}
+
+bool encoder_bank_update(struct encoder_bank *eb, uint32_t write_pos,
+                         uint32_t now_us) {
+    uint32_t end = write_pos & (ENCODER_RING_LEN - 1);
+    bool changed = false;
+    int i;
+
+    while (eb->read_pos != end) {
+        encoder_bank_feed(eb, eb->ring[eb->read_pos]);
+        eb->read_pos = (eb->read_pos + 1) & (ENCODER_RING_LEN - 1);
+    }
+    for (i = 0; i < eb->cnt; i++) {
+        if (eb->enc[i].output == ENCODER_OUT_BUTTONS) {
+            changed |= encoder_pulse(eb->enc + i, now_us);
+        } else {
+            changed |= encoder_axis(eb->enc + i);
+        }
+    }
+    return changed;
+}
+
+uint8_t encoder_bank_axes(struct encoder_bank const *eb, int16_t *out) {
+    uint8_t n = 0;
+    int i;
+
+    for (i = 0; i < eb->cnt; i++) {
+        if (eb->enc[i].output != ENCODER_OUT_BUTTONS) {
+            out[n++] = eb->enc[i].value;
+        }
+    }
+    return n;
+}
+
+uint32_t encoder_bank_missed(struct encoder_bank const *eb) {
+    uint32_t missed = 0;
+    int i;
+
+    for (i = 0; i < eb->cnt; i++) {
+        missed += eb->enc[i].missed;
+    }
+    return missed;
+}
@@ -0,0 +1,123 @@
+/*
+ * Quadrature rotary encoders.
+ *
+ * The A/B pins of all encoders sit on consecutive GPIOs (encoder n on
+ * pin_base + 2n and + 2n + 1). A PIO state machine samples them all at
+ * once at a high fixed rate and pushes the pin levels only when any of
+ * them changed, and DMA drops each change into a ring. The CPU only works
+ * per transition, not per sample: each encoder looks up (previous AB,
+ * current AB) in a 16 entry table for +1, -1 or nothing, and a transition
+ * that skipped a state (both pins changed at once) counts as a missed step.
+ *
+ * An encoder drives either two virtual buttons, pulsed once per detent for
+ * long enough that a host polling at frame rate sees each one, or an
+ * axis: absolute with end stops, or wrapping for endless heading knobs.
+ */
+
+#ifndef ENCODER_H_
+#define ENCODER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "input.h"
+
+#define ENCODER_MAX 4
+// Must be a power of two
+#define ENCODER_RING_LEN 256
+// Detents waiting to be pulsed out are capped, a spun knob does not keep
+// pulsing for seconds after it stopped
+#define ENCODER_PENDING_MAX 32
+// Axis range in counts, as many as the axis has steps
+#define ENCODER_RANGE_MAX 65535
+
+enum encoder_output {
+    // a cw and a ccw button pulse per detent
+    ENCODER_OUT_BUTTONS,
+    // an axis between two end stops
+    ENCODER_OUT_AXIS,
+    // an axis that wraps around, e.g. a heading
+    ENCODER_OUT_AXIS_WRAP,
+};
+
+struct encoder {
+    uint8_t output;
+    // last A (bit 0) and B (bit 1) levels
+    uint8_t ab;
+    // counts since start, 4 per full quadrature cycle
+    int32_t count;
+    // transitions that skipped a state
+    uint32_t missed;
+
+    // ENCODER_OUT_BUTTONS
+    struct dinput_btn_reg *cw;
+    struct dinput_btn_reg *ccw;
+    uint8_t counts_per_detent;
+    int8_t detent_acc;
+    // detents not pulsed out yet, positive for cw
+    int8_t pending;
+    // 1 while a button is down, 2 during the gap after it
+    uint8_t pulse_phase;
+    uint32_t pulse_us;
+    uint32_t pulse_start_us;
+
+    // ENCODER_OUT_AXIS*: position in counts within 0 .. range
+    uint32_t range;
+    int32_t pos;
+    int16_t value;
+};
+
+struct encoder_bank {
+    uint8_t cnt;
+    uint8_t pin_base;
+    uint32_t sample_hz;
+    struct encoder enc[ENCODER_MAX];
+    // pin levels as of the last decoded entry
+    uint8_t last;
+    // DMA writes a byte of pin levels per change here
+    uint8_t ring[ENCODER_RING_LEN]
+        __attribute__((aligned(ENCODER_RING_LEN)));
+    uint32_t read_pos;
+    uint32_t transitions;
+
+    // PIO and DMA resources, see encoder_pio.c
+    uint8_t pio_idx;
+    uint8_t sm;
+    int8_t dma_ch[2];
+    uint32_t ring_len_word;
+};
+
+void encoder_bank_init(struct encoder_bank *eb, uint8_t pin_base, uint8_t cnt,
+                       uint32_t sample_hz);
+// Take the pin levels at start as where every encoder rests.
+void encoder_bank_prime(struct encoder_bank *eb, uint8_t levels);
+// Pulse cw or ccw for pulse_us, with as long a gap after, per detent.
+void encoder_set_buttons(struct encoder *e, struct dinput_btn_reg *cw,
+                         struct dinput_btn_reg *ccw, uint8_t counts_per_detent,
+                         uint32_t pulse_us);
+// Move an axis across its full range in range counts, starting centered.
+// range is capped at ENCODER_RANGE_MAX.
+void encoder_set_axis(struct encoder *e, uint32_t range, bool wrap);
+
+// Decode one entry of pin levels for every encoder.
+void encoder_bank_feed(struct encoder_bank *eb, uint8_t levels);
+// Decode every entry up to ring index write_pos and move the button pulses
+// along. Returns true if a button or axis changed.
+bool encoder_bank_update(struct encoder_bank *eb, uint32_t write_pos,
+                         uint32_t now_us);
+// Axis values of the encoders that drive one, in encoder order. Returns how
+// many.
+uint8_t encoder_bank_axes(struct encoder_bank const *eb, int16_t *out);
+uint32_t encoder_bank_missed(struct encoder_bank const *eb);
+
+// Claim a PIO state machine and two DMA channels and start watching the
+// pins. Only on the device; returns false if the resources are taken.
+bool encoder_bank_start(struct encoder_bank *eb);
+// encoder_bank_update() at the DMA's current position. Only on the device.
+bool encoder_bank_poll(struct encoder_bank *eb, uint32_t now_us);
+// Stop watching the pins or watch them again. A knob turned in between
+// shows up as one jump, counted as missed if it moved both pins. Only on
+// the device.
+void encoder_bank_run(struct encoder_bank *eb, bool run);
+
+#endif /* ENCODER_H_ */
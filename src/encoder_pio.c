@@ -0,0 +1,103 @@
+/*
+ * Quadrature rotary encoders, the PIO and DMA side.
+ *
+ * The data channel moves one byte of pin levels per change from the state
+ * machine into the ring, its write address wrapping on the ring size. When
+ * its count runs out it chains to the re-arm channel, which writes the count
+ * back into the data channel's trigger register, as for the ADC axes.
+ */
+
+#include "hardware/dma.h"
+#include "hardware/gpio.h"
+#include "hardware/pio.h"
+#include "hardware/timer.h"
+
+#include "encoder.h"
+#include "encoder.pio.h"
+
+static uint8_t encoder_pin_levels(struct encoder_bank const *eb) {
+    return (gpio_get_all() >> eb->pin_base) & ((1u << (eb->cnt * 2)) - 1);
+}
+
+bool encoder_bank_start(struct encoder_bank *eb) {
+    dma_channel_config c;
+    PIO pio = pio0;
+    int sm;
+    uint offset;
+    int i;
+
+    if (!eb->cnt || eb->dma_ch[0] >= 0) {
+        return false;
+    }
+    if (!pio_can_add_program(pio, &encoder_watch_program)) {
+        pio = pio1;
+        if (!pio_can_add_program(pio, &encoder_watch_program)) {
+            return false;
+        }
+    }
+    sm = pio_claim_unused_sm(pio, false);
+    if (sm < 0) {
+        return false;
+    }
+    eb->dma_ch[0] = dma_claim_unused_channel(false);
+    eb->dma_ch[1] = dma_claim_unused_channel(false);
+    if (eb->dma_ch[0] < 0 || eb->dma_ch[1] < 0) {
+        if (eb->dma_ch[0] >= 0) {
+            dma_channel_unclaim(eb->dma_ch[0]);
+        }
+        pio_sm_unclaim(pio, sm);
+        eb->dma_ch[0] = -1;
+        eb->dma_ch[1] = -1;
+        return false;
+    }
+    eb->pio_idx = pio_get_index(pio);
+    eb->sm = sm;
+
+    for (i = 0; i < eb->cnt * 2; i++) {
+        pio_gpio_init(pio, eb->pin_base + i);
+        gpio_pull_up(eb->pin_base + i);
+    }
+    // let the pull-ups settle before taking the resting levels
+    busy_wait_us_32(10);
+    encoder_bank_prime(eb, encoder_pin_levels(eb));
+
+    offset = pio_add_program(pio, &encoder_watch_program);
+    encoder_watch_program_init(pio, sm, offset, eb->pin_base, eb->cnt,
+                               eb->last, eb->sample_hz);
+
+    c = dma_channel_get_default_config(eb->dma_ch[0]);
+    // the levels sit in the low lane of the FIFO word
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_ring(&c, true, __builtin_ctz(sizeof(eb->ring)));
+    channel_config_set_dreq(&c, pio_get_dreq(pio, sm, false));
+    channel_config_set_chain_to(&c, eb->dma_ch[1]);
+    dma_channel_configure(eb->dma_ch[0], &c, eb->ring, &pio->rxf[sm],
+                          ENCODER_RING_LEN, false);
+
+    eb->ring_len_word = ENCODER_RING_LEN;
+    c = dma_channel_get_default_config(eb->dma_ch[1]);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, false);
+    dma_channel_configure(eb->dma_ch[1], &c,
+                          &dma_hw->ch[eb->dma_ch[0]].al1_transfer_count_trig,
+                          &eb->ring_len_word, 1, false);
+
+    dma_channel_start(eb->dma_ch[0]);
+    pio_sm_set_enabled(pio, sm, true);
+    return true;
+}
+
+void encoder_bank_run(struct encoder_bank *eb, bool run) {
+    if (eb->dma_ch[0] >= 0) {
+        pio_sm_set_enabled(eb->pio_idx ? pio1 : pio0, eb->sm, run);
+    }
+}
+
+bool encoder_bank_poll(struct encoder_bank *eb, uint32_t now_us) {
+    uint32_t addr = dma_hw->ch[eb->dma_ch[0]].write_addr;
+
+    return encoder_bank_update(eb, addr - (uintptr_t)eb->ring, now_us);
+}
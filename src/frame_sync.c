@@ -0,0 +1,65 @@
+/*
+ * Report timing locked to the USB frame.
+ */
+
+#include <string.h>
+
+#include "frame_sync.h"
+
+void frame_sync_init(struct frame_sync *fs, uint32_t lead_us) {
+    memset(fs, 0, sizeof(*fs));
+    fs->lead_us = lead_us < FRAME_SYNC_FRAME_US ? lead_us : FRAME_SYNC_FRAME_US;
+}
+
+void frame_sync_sof(struct frame_sync *fs, uint32_t now_us) {
+    __atomic_store_n(&fs->sof_us, now_us, __ATOMIC_RELEASE);
+    fs->frames++;
+}
+
+bool frame_sync_open(struct frame_sync const *fs, uint32_t now_us) {
+    uint32_t since = now_us - frame_sync_sof_us(fs);
+
+    if (!fs->frames || since >= FRAME_SYNC_STALE_US) {
+        return true;
+    }
+    return since >= FRAME_SYNC_FRAME_US - fs->lead_us;
+}
+
+void frame_sync_built(struct frame_sync *fs, uint32_t now_us) {
+    uint32_t since = now_us - frame_sync_sof_us(fs);
+
+    if (!fs->frames || since >= FRAME_SYNC_STALE_US) {
+        return;
+    }
+    // a SOF that went missing still comes on the frame grid
+    fs->build_lead_us += FRAME_SYNC_FRAME_US - since % FRAME_SYNC_FRAME_US;
+    fs->builds++;
+}
+
+uint32_t frame_sync_build_lead_us(struct frame_sync const *fs) {
+    return fs->builds ? (uint32_t)(fs->build_lead_us / fs->builds) : 0;
+}
+
+int32_t frame_sync_sample_offset(struct frame_sync const *fs, uint32_t sof_us,
+                                 uint32_t grid_t_us, uint32_t period_us) {
+    uint32_t target = sof_us + FRAME_SYNC_FRAME_US - fs->lead_us -
+                      FRAME_SYNC_SAMPLE_MARGIN_US;
+    int32_t p = period_us;
+    int32_t max_step = p / 8 ? p / 8 : 1;
+    int32_t d;
+
+    // the grid has a sample d before target; move it by the shorter way
+    d = (int32_t)(target - grid_t_us) % p;
+    if (d >= p / 2) {
+        d -= p;
+    } else if (d < -p / 2) {
+        d += p;
+    }
+    if (d > max_step) {
+        return max_step;
+    }
+    if (d < -max_step) {
+        return -max_step;
+    }
+    return d;
+}
@@ -0,0 +1,65 @@
+/*
+ * Report timing locked to the USB frame.
+ *
+ * The host polls the gamepad endpoint once per 1 ms frame, with its IN
+ * token shortly after the start of frame (SOF). A report handed to the
+ * endpoint earlier in the frame just waits there, getting older. With frame
+ * sync, reports are only built in the last lead_us before the next SOF,
+ * from a sample taken just before, and the sample timer is slowly shifted
+ * so that one of its samples lands right there. A change arriving in that
+ * window, or when the endpoint is idle past it, still goes out at once.
+ *
+ * The SOF time comes from the USB interrupt; everything else is plain
+ * arithmetic on it, so the same code runs on the host.
+ */
+
+#ifndef FRAME_SYNC_H_
+#define FRAME_SYNC_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Full speed frame
+#define FRAME_SYNC_FRAME_US 1000
+// No SOF for this long (suspended, not mounted): send as without sync
+#define FRAME_SYNC_STALE_US 3000
+// Time for the sample to be debounced and published before the build
+#define FRAME_SYNC_SAMPLE_MARGIN_US 20
+
+struct frame_sync {
+    uint32_t lead_us;
+    // written from the SOF interrupt
+    uint32_t sof_us;
+    uint32_t frames;
+    // reports built while SOFs come, and how long before the next one in
+    // total, as measured
+    uint32_t builds;
+    uint64_t build_lead_us;
+};
+
+void frame_sync_init(struct frame_sync *fs, uint32_t lead_us);
+// Note a SOF seen at now_us. This is what the SOF interrupt calls.
+void frame_sync_sof(struct frame_sync *fs, uint32_t now_us);
+
+static inline uint32_t frame_sync_sof_us(struct frame_sync const *fs) {
+    return __atomic_load_n(&fs->sof_us, __ATOMIC_ACQUIRE);
+}
+
+// True from lead_us before the next SOF is due until it comes, or all the
+// time without SOFs.
+bool frame_sync_open(struct frame_sync const *fs, uint32_t now_us);
+
+// A report was built at now_us: account how long before the next SOF.
+void frame_sync_built(struct frame_sync *fs, uint32_t now_us);
+
+// Average of what frame_sync_built() measured, in us.
+uint32_t frame_sync_build_lead_us(struct frame_sync const *fs);
+
+// How far to move a sample grid of period_us, through grid_t_us, so that a
+// sample lands FRAME_SYNC_SAMPLE_MARGIN_US before the build point of the
+// frame that started at sof_us. At most period_us / 8 at a time, so no one
+// period changes by much.
+int32_t frame_sync_sample_offset(struct frame_sync const *fs, uint32_t sof_us,
+                                 uint32_t grid_t_us, uint32_t period_us);
+
+#endif /* FRAME_SYNC_H_ */
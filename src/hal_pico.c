@@ -0,0 +1,238 @@
+/*
+ * uMFD hardware abstraction, the parts too big to inline in umfd_hal.h.
+ */
+
+#include <string.h>
+
+#include "device/usbd_pvt.h"
+#include "hardware/clocks.h"
+#include "hardware/flash.h"
+#include "hardware/irq.h"
+#include "hardware/pll.h"
+#include "hardware/sync.h"
+#include "pico/flash.h"
+#include "pico/time.h"
+
+#include "umfd_hal.h"
+
+static repeating_timer_t sample_timer;
+static void (*sample_timer_fn)(void *);
+static int64_t sample_timer_period_us;
+static int32_t sample_timer_nudge_us;
+
+static bool sample_timer_cb(repeating_timer_t *rt) {
+    sample_timer_fn(rt->user_data);
+    // the SDK takes the next delay from rt after this returns
+    rt->delay_us = -(sample_timer_period_us +
+                     __atomic_exchange_n(&sample_timer_nudge_us, 0,
+                                         __ATOMIC_RELAXED));
+    return true;
+}
+
+bool hal_sample_timer_start(uint32_t period_us, void (*fn)(void *), void *ctx) {
+    sample_timer_fn = fn;
+    sample_timer_period_us = period_us;
+    // negative delay keeps the period fixed no matter how long fn takes
+    return add_repeating_timer_us(-(int64_t)period_us, sample_timer_cb, ctx,
+                                  &sample_timer);
+}
+
+void hal_sample_timer_nudge(int32_t us) {
+    __atomic_store_n(&sample_timer_nudge_us, us, __ATOMIC_RELAXED);
+}
+
+void hal_sample_timer_stop(void) { cancel_repeating_timer(&sample_timer); }
+
+static void (*usb_sof_fn)(void *);
+static void *usb_sof_ctx;
+
+// A class driver that claims no interface, there only for its SOF hook,
+// which TinyUSB calls from the USB interrupt
+static void sof_driver_init(void) {}
+
+static void sof_driver_reset(uint8_t rhport) { (void)rhport; }
+
+static uint16_t sof_driver_open(uint8_t rhport,
+                                tusb_desc_interface_t const *itf,
+                                uint16_t max_len) {
+    (void)rhport;
+    (void)itf;
+    (void)max_len;
+    return 0;
+}
+
+static bool sof_driver_control_xfer(uint8_t rhport, uint8_t stage,
+                                    tusb_control_request_t const *request) {
+    (void)rhport;
+    (void)stage;
+    (void)request;
+    return false;
+}
+
+static bool sof_driver_xfer(uint8_t rhport, uint8_t ep_addr,
+                            xfer_result_t result, uint32_t len) {
+    (void)rhport;
+    (void)ep_addr;
+    (void)result;
+    (void)len;
+    return false;
+}
+
+static void sof_driver_sof(uint8_t rhport, uint32_t frame_count) {
+    (void)rhport;
+    (void)frame_count;
+    if (usb_sof_fn) {
+        usb_sof_fn(usb_sof_ctx);
+    }
+}
+
+static usbd_class_driver_t const sof_driver = {
+#if CFG_TUSB_DEBUG >= 2
+    .name = "SOF",
+#endif
+    .init = sof_driver_init,
+    .reset = sof_driver_reset,
+    .open = sof_driver_open,
+    .control_xfer_cb = sof_driver_control_xfer,
+    .xfer_cb = sof_driver_xfer,
+    .sof = sof_driver_sof,
+};
+
+usbd_class_driver_t const *usbd_app_driver_get_cb(uint8_t *driver_count) {
+    *driver_count = 1;
+    return &sof_driver;
+}
+
+bool hal_usb_sof_start(void (*fn)(void *), void *ctx) {
+    usb_sof_ctx = ctx;
+    __atomic_store_n(&usb_sof_fn, fn, __ATOMIC_RELEASE);
+    // keeps the SOF interrupt on; tud_sof_cb() stays the empty default
+    tud_sof_cb_enable(true);
+    return true;
+}
+
+// The last two sectors of the flash; the firmware is far smaller
+#define HAL_CONFIG_OFFSET (PICO_FLASH_SIZE_BYTES - 2 * FLASH_SECTOR_SIZE)
+
+struct config_flash_job {
+    uint32_t off;
+    uint8_t const *page;
+};
+
+void const *hal_config_sector(uint8_t n) {
+    return (void const *)(uintptr_t)(XIP_BASE + HAL_CONFIG_OFFSET +
+                                     (n & 1) * FLASH_SECTOR_SIZE);
+}
+
+// Runs with the other core parked and interrupts off
+static void config_flash_job_run(void *arg) {
+    struct config_flash_job const *job = arg;
+
+    flash_range_erase(job->off, FLASH_SECTOR_SIZE);
+    flash_range_program(job->off, job->page, FLASH_PAGE_SIZE);
+}
+
+bool hal_config_sector_write(uint8_t n, void const *data, uint16_t len) {
+    static uint8_t page[FLASH_PAGE_SIZE];
+    struct config_flash_job job = {
+        .off = HAL_CONFIG_OFFSET + (n & 1) * FLASH_SECTOR_SIZE,
+        .page = page,
+    };
+
+    if (len > sizeof(page)) {
+        return false;
+    }
+    memset(page, 0xff, sizeof(page));
+    memcpy(page, data, len);
+    return flash_safe_execute(config_flash_job_run, &job, 100) == PICO_OK;
+}
+
+static uint32_t sys_clock_khz;
+
+void hal_power_low(bool low) {
+    uint32_t ref_hz = clock_get_hz(clk_ref);
+
+    if (!low) {
+        // relocks pll_sys and moves clk_sys and clk_peri back onto it
+        set_sys_clock_khz(sys_clock_khz, true);
+        return;
+    }
+    sys_clock_khz = clock_get_hz(clk_sys) / 1000;
+    // clk_ref is the crystal; clk_usb has pll_usb, the timer ticks off clk_ref
+    clock_configure(clk_sys, CLOCKS_CLK_SYS_CTRL_SRC_VALUE_CLK_REF, 0, ref_hz,
+                    ref_hz);
+    pll_deinit(pll_sys);
+}
+
+// GPIOs armed to wake a sleep, and what the first of them saw
+static uint32_t wake_pins;
+static volatile bool wake_fired;
+static uint32_t wake_gpio;
+static uint32_t wake_us;
+
+static void gpio_wake_disarm(void) {
+    uint32_t pins = wake_pins;
+    int pin;
+
+    while (pins) {
+        pin = __builtin_ctz(pins);
+        pins &= pins - 1;
+        gpio_set_irq_enabled(pin, GPIO_IRQ_LEVEL_LOW | GPIO_IRQ_LEVEL_HIGH,
+                             false);
+    }
+    wake_pins = 0;
+}
+
+// Level interrupts catch a pin that moved before it was armed too; they
+// keep firing while the level holds, so the first one disarms them all
+static void gpio_wake_irq(void) {
+    if (!wake_pins) {
+        return;
+    }
+    wake_gpio = gpio_get_all();
+    wake_us = time_us_32();
+    gpio_wake_disarm();
+    wake_fired = true;
+}
+
+uint32_t hal_sleep_gpio(uint32_t pins, uint32_t levels, uint32_t *t_us) {
+    static bool irq_added;
+    uint32_t irq_state;
+    bool fired;
+    int pin;
+
+    if (!irq_added) {
+        irq_add_shared_handler(IO_IRQ_BANK0, gpio_wake_irq,
+                               PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+        irq_set_enabled(IO_IRQ_BANK0, true);
+        irq_added = true;
+    }
+    wake_fired = false;
+    wake_pins = pins;
+    while (pins) {
+        pin = __builtin_ctz(pins);
+        pins &= pins - 1;
+        gpio_set_irq_enabled(pin,
+                             ((levels >> pin) & 0x1) ? GPIO_IRQ_LEVEL_LOW
+                                                     : GPIO_IRQ_LEVEL_HIGH,
+                             true);
+    }
+    // with interrupts masked, one that comes in after the checks still ends
+    // the WFI, and its handler runs right after
+    irq_state = save_and_disable_interrupts();
+    if (!wake_fired && !tud_task_event_ready()) {
+        __wfi();
+    }
+    restore_interrupts(irq_state);
+
+    irq_state = save_and_disable_interrupts();
+    gpio_wake_disarm();
+    fired = wake_fired;
+    restore_interrupts(irq_state);
+    if (fired) {
+        *t_us = wake_us;
+        return wake_gpio;
+    }
+    *t_us = time_us_32();
+    return gpio_get_all();
+}
@@ -0,0 +1,124 @@
+/*
+ * Hat switches from debounced buttons.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "hat.h"
+
+// Indexed by policy, then (newer << 4) | dirs
+#define HAT_LUT_LEN 64
+
+static uint8_t hat_lut[HAT_OPPOSE_POLICIES][HAT_LUT_LEN];
+static bool hat_lut_ready;
+
+// Keep at most one side of an axis. a_newer says which side came last.
+static uint8_t hat_resolve_axis(uint8_t dirs, uint8_t a, uint8_t b,
+                                bool a_newer, enum hat_policy policy) {
+    if ((dirs & (a | b)) != (a | b)) {
+        return dirs;
+    }
+    switch (policy) {
+    case HAT_OPPOSE_LAST_WINS:
+        return dirs & ~(a_newer ? b : a);
+    case HAT_OPPOSE_FIRST_WINS:
+        return dirs & ~(a_newer ? a : b);
+    default:
+        return dirs & ~(a | b);
+    }
+}
+
+static void hat_lut_build(void) {
+    // HID hat values for each direction set, 0 (centered) where there is
+    // none; opposing pairs never get here
+    static uint8_t const hat_value[16] = {
+        [0] = GAMEPAD_HAT_CENTERED,
+        [HAT_DIR_UP] = 1,
+        [HAT_DIR_UP | HAT_DIR_RIGHT] = 2,
+        [HAT_DIR_RIGHT] = 3,
+        [HAT_DIR_DOWN | HAT_DIR_RIGHT] = 4,
+        [HAT_DIR_DOWN] = 5,
+        [HAT_DIR_DOWN | HAT_DIR_LEFT] = 6,
+        [HAT_DIR_LEFT] = 7,
+        [HAT_DIR_UP | HAT_DIR_LEFT] = 8,
+    };
+    uint8_t dirs;
+    int p, i;
+
+    for (p = 0; p < HAT_OPPOSE_POLICIES; p++) {
+        for (i = 0; i < HAT_LUT_LEN; i++) {
+            dirs = hat_resolve_axis(i & 0xf, HAT_DIR_UP, HAT_DIR_DOWN,
+                                    (i >> 4) & 1, p);
+            dirs = hat_resolve_axis(dirs, HAT_DIR_RIGHT, HAT_DIR_LEFT,
+                                    (i >> 5) & 1, p);
+            hat_lut[p][i] = hat_value[dirs];
+        }
+    }
+    hat_lut_ready = true;
+}
+
+void hat_set_init(struct hat_set *hs) {
+    memset(hs, 0, sizeof(*hs));
+    if (!hat_lut_ready) {
+        hat_lut_build();
+    }
+}
+
+int hat_add(struct hat_set *hs, enum hat_ways ways, enum hat_policy policy,
+            uint8_t const *btn_ids) {
+    struct hat *h;
+
+    if (hs->cnt >= GAMEPAD_MAX_HATS || (ways != HAT_4WAY && ways != HAT_8WAY) ||
+        policy >= HAT_OPPOSE_POLICIES) {
+        return -1;
+    }
+    h = hs->hats + hs->cnt;
+    memset(h, 0, sizeof(*h));
+    h->ways = ways;
+    h->policy = policy;
+    memcpy(h->btn_id, btn_ids, ways);
+    return hs->cnt++;
+}
+
+static inline uint32_t hat_btn(uint32_t const buttons[DINPUT_BTN_WORDS],
+                               uint8_t id) {
+    return (buttons[(id >> 5) & (DINPUT_BTN_WORDS - 1)] >> (id & 31)) & 1;
+}
+
+// Raw contacts clockwise from up to HAT_DIR_* bits
+static inline uint8_t hat_gather(struct hat const *h,
+                                 uint32_t const buttons[DINPUT_BTN_WORDS]) {
+    uint32_t raw = 0;
+    int i;
+
+    for (i = 0; i < h->ways; i++) {
+        raw |= hat_btn(buttons, h->btn_id[i]) << i;
+    }
+    if (h->ways == HAT_4WAY) {
+        return raw;
+    }
+    // each diagonal holds both of its neighbours
+    return ((raw | raw >> 1 | raw >> 7) & 1) * HAT_DIR_UP |
+           ((raw >> 1 | raw >> 2 | raw >> 3) & 1) * HAT_DIR_RIGHT |
+           ((raw >> 3 | raw >> 4 | raw >> 5) & 1) * HAT_DIR_DOWN |
+           ((raw >> 5 | raw >> 6 | raw >> 7) & 1) * HAT_DIR_LEFT;
+}
+
+void hat_set_update(struct hat_set *hs,
+                    uint32_t const buttons[DINPUT_BTN_WORDS], uint8_t *hats) {
+    struct hat *h;
+    uint8_t dirs, pressed;
+    int i;
+
+    for (i = 0; i < hs->cnt; i++) {
+        h = hs->hats + i;
+        dirs = hat_gather(h, buttons);
+        // up/right just pressed become newer, down/left just pressed make
+        // them older, otherwise the axis keeps what it had
+        pressed = dirs & ~h->dirs;
+        h->newer = (pressed & 0x3) | (h->newer & ~(pressed >> 2) & 0x3);
+        h->dirs = dirs;
+        hats[i] = hat_lut[h->policy][h->newer << 4 | dirs];
+    }
+}
@@ -0,0 +1,75 @@
+/*
+ * Hat switches from debounced buttons.
+ *
+ * A hat groups the buttons of a 4 way rocker (up, right, down, left) or an 8
+ * way one with its own diagonal contacts (up, up-right, ... up-left) and
+ * turns them into the HID hat value. The buttons are ordinary debounced
+ * inputs; the hat reads their bits out of the packed button words, so it
+ * sees exactly what the input queue saw.
+ *
+ * Up with down (or left with right) held at once is resolved by a policy:
+ * centre that axis, keep the newer one or keep the older one. The newer
+ * side of each axis is one bit of state, so every combination of held
+ * directions, newer sides and policy is one entry of a table built at init,
+ * and each hat costs a single lookup per update.
+ */
+
+#ifndef HAT_H_
+#define HAT_H_
+
+#include <stdint.h>
+
+#include "hid_desc.h"
+#include "input.h"
+
+enum hat_ways {
+    // up, right, down, left; diagonals by holding two
+    HAT_4WAY = 4,
+    // up, up-right, right, ..., up-left, each its own contact
+    HAT_8WAY = 8,
+};
+
+enum hat_policy {
+    // opposing directions cancel out on that axis
+    HAT_OPPOSE_NEUTRAL,
+    // the one pressed last wins
+    HAT_OPPOSE_LAST_WINS,
+    // the one pressed first keeps the axis until released
+    HAT_OPPOSE_FIRST_WINS,
+    HAT_OPPOSE_POLICIES
+};
+
+// Direction bits, after folding in 8 way diagonals
+#define HAT_DIR_UP 0x1
+#define HAT_DIR_RIGHT 0x2
+#define HAT_DIR_DOWN 0x4
+#define HAT_DIR_LEFT 0x8
+
+struct hat {
+    uint8_t ways;
+    uint8_t policy;
+    // button ID of each direction, clockwise from up
+    uint8_t btn_id[HAT_8WAY];
+    // HAT_DIR_* held on the last update
+    uint8_t dirs;
+    // bit 0: up is newer than down, bit 1: right is newer than left
+    uint8_t newer;
+};
+
+struct hat_set {
+    uint8_t cnt;
+    struct hat hats[GAMEPAD_MAX_HATS];
+};
+
+void hat_set_init(struct hat_set *hs);
+// Add a hat over ways button IDs, clockwise from up. Returns its index in
+// the report, or -1 if the set is full.
+int hat_add(struct hat_set *hs, enum hat_ways ways, enum hat_policy policy,
+            uint8_t const *btn_ids);
+
+// Compute every hat from the packed buttons into hats[0 .. cnt - 1]. Call
+// on each new input state, in order, so newer-wins can see the presses.
+void hat_set_update(struct hat_set *hs,
+                    uint32_t const buttons[DINPUT_BTN_WORDS], uint8_t *hats);
+
+#endif /* HAT_H_ */
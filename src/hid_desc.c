@@ -0,0 +1,267 @@
+/*
+ * Gamepad HID report descriptor generator.
+ */
+
+#include <string.h>
+
+#include "hid_desc.h"
+
+// Short item prefixes (tag and type), size bits left 0
+#define ITEM_INPUT 0x80
+#define ITEM_OUTPUT 0x90
+#define ITEM_FEATURE 0xb0
+#define ITEM_COLLECTION 0xa0
+#define ITEM_END_COLLECTION 0xc0
+#define ITEM_USAGE_PAGE 0x04
+#define ITEM_LOGICAL_MIN 0x14
+#define ITEM_LOGICAL_MAX 0x24
+#define ITEM_PHYSICAL_MIN 0x34
+#define ITEM_PHYSICAL_MAX 0x44
+#define ITEM_UNIT 0x64
+#define ITEM_REPORT_SIZE 0x74
+#define ITEM_REPORT_ID 0x84
+#define ITEM_REPORT_COUNT 0x94
+#define ITEM_USAGE 0x08
+#define ITEM_USAGE_MIN 0x18
+#define ITEM_USAGE_MAX 0x28
+
+#define PAGE_DESKTOP 0x01
+#define PAGE_KEYBOARD 0x07
+#define PAGE_BUTTON 0x09
+#define PAGE_VENDOR 0xff00
+#define USAGE_GAMEPAD 0x05
+#define USAGE_KEYBOARD 0x06
+#define USAGE_LEFT_CONTROL 0xe0
+#define USAGE_RIGHT_GUI 0xe7
+#define USAGE_X 0x30
+#define USAGE_HAT_SWITCH 0x39
+#define COLLECTION_APPLICATION 0x01
+#define UNIT_DEGREES 0x14
+
+// Input item flags
+#define IO_CONST 0x01
+#define IO_DATA_VAR_ABS 0x02
+#define IO_NULL_STATE 0x40
+
+struct desc_writer {
+    uint8_t *buf;
+    uint16_t cap;
+    uint16_t len;
+};
+
+static void desc_put(struct desc_writer *w, uint8_t b) {
+    if (w->len < w->cap) {
+        w->buf[w->len] = b;
+    }
+    // keep counting, an overflow shows up as len > cap
+    w->len++;
+}
+
+// Emit an item with the shortest data that holds val as a signed number, so
+// logical ranges read right. Usages and counts we emit stay below 0x8000.
+static void desc_item(struct desc_writer *w, uint8_t item, int32_t val) {
+    if (val >= -128 && val <= 127) {
+        desc_put(w, item | 1);
+        desc_put(w, val);
+    } else if (val >= -32768 && val <= 32767) {
+        desc_put(w, item | 2);
+        desc_put(w, val);
+        desc_put(w, val >> 8);
+    } else {
+        desc_put(w, item | 3);
+        desc_put(w, val);
+        desc_put(w, val >> 8);
+        desc_put(w, val >> 16);
+        desc_put(w, val >> 24);
+    }
+}
+
+// Same for values that are never negative, like the vendor usage page.
+static void desc_uitem(struct desc_writer *w, uint8_t item, uint16_t val) {
+    if (val <= 0xff) {
+        desc_put(w, item | 1);
+        desc_put(w, val);
+    } else {
+        desc_put(w, item | 2);
+        desc_put(w, val);
+        desc_put(w, val >> 8);
+    }
+}
+
+static void desc_pad(struct desc_writer *w, uint8_t bits) {
+    desc_item(w, ITEM_REPORT_SIZE, 1);
+    desc_item(w, ITEM_REPORT_COUNT, bits);
+    desc_item(w, ITEM_INPUT, IO_CONST);
+}
+
+void gamepad_layout_init(struct gamepad_layout *layout, uint8_t report_id,
+                         uint16_t btn_first, uint16_t buttons, uint8_t hats,
+                         uint8_t axes) {
+    memset(layout, 0, sizeof(*layout));
+    layout->report_id = report_id;
+    layout->btn_first = btn_first >= GAMEPAD_MAX_BUTTONS
+                            ? GAMEPAD_MAX_BUTTONS
+                            : btn_first & ~7;
+    if (buttons > GAMEPAD_MAX_BUTTONS - layout->btn_first) {
+        buttons = GAMEPAD_MAX_BUTTONS - layout->btn_first;
+    }
+    layout->buttons = buttons;
+    layout->hats = hats > UMFD_GAMEPAD_HATS ? UMFD_GAMEPAD_HATS : hats;
+    layout->axes = axes > UMFD_GAMEPAD_AXES ? UMFD_GAMEPAD_AXES : axes;
+    layout->hat_off = layout->axes * 2;
+    layout->btn_off = layout->hat_off + (layout->hats + 1) / 2;
+    layout->len = layout->btn_off + (layout->buttons + 7) / 8;
+}
+
+uint16_t gamepad_desc_build(struct gamepad_layout const *layout, uint8_t *desc,
+                            uint16_t cap) {
+    struct desc_writer w = {desc, cap, 0};
+    int i;
+
+    desc_item(&w, ITEM_USAGE_PAGE, PAGE_DESKTOP);
+    desc_item(&w, ITEM_USAGE, USAGE_GAMEPAD);
+    desc_item(&w, ITEM_COLLECTION, COLLECTION_APPLICATION);
+    if (layout->report_id) {
+        desc_item(&w, ITEM_REPORT_ID, layout->report_id);
+    }
+
+    if (layout->axes) {
+        for (i = 0; i < layout->axes; i++) {
+            desc_item(&w, ITEM_USAGE, USAGE_X + i);
+        }
+        desc_item(&w, ITEM_LOGICAL_MIN, -32767);
+        desc_item(&w, ITEM_LOGICAL_MAX, 32767);
+        desc_item(&w, ITEM_REPORT_SIZE, 16);
+        desc_item(&w, ITEM_REPORT_COUNT, layout->axes);
+        desc_item(&w, ITEM_INPUT, IO_DATA_VAR_ABS);
+    }
+
+    if (layout->hats) {
+        for (i = 0; i < layout->hats; i++) {
+            desc_item(&w, ITEM_USAGE, USAGE_HAT_SWITCH);
+        }
+        // 1..8 clockwise from up in 45 degree steps, 0 is out of range and
+        // so reads as centered
+        desc_item(&w, ITEM_LOGICAL_MIN, 1);
+        desc_item(&w, ITEM_LOGICAL_MAX, 8);
+        desc_item(&w, ITEM_PHYSICAL_MIN, 0);
+        desc_item(&w, ITEM_PHYSICAL_MAX, 315);
+        desc_item(&w, ITEM_UNIT, UNIT_DEGREES);
+        desc_item(&w, ITEM_REPORT_SIZE, 4);
+        desc_item(&w, ITEM_REPORT_COUNT, layout->hats);
+        desc_item(&w, ITEM_INPUT, IO_DATA_VAR_ABS | IO_NULL_STATE);
+        desc_item(&w, ITEM_UNIT, 0);
+        desc_item(&w, ITEM_PHYSICAL_MAX, 0);
+        if (layout->hats & 1) {
+            desc_pad(&w, 4);
+        }
+    }
+
+    if (layout->buttons) {
+        desc_item(&w, ITEM_USAGE_PAGE, PAGE_BUTTON);
+        desc_item(&w, ITEM_USAGE_MIN, 1);
+        desc_item(&w, ITEM_USAGE_MAX, layout->buttons);
+        desc_item(&w, ITEM_LOGICAL_MIN, 0);
+        desc_item(&w, ITEM_LOGICAL_MAX, 1);
+        desc_item(&w, ITEM_REPORT_SIZE, 1);
+        desc_item(&w, ITEM_REPORT_COUNT, layout->buttons);
+        desc_item(&w, ITEM_INPUT, IO_DATA_VAR_ABS);
+        if (layout->buttons & 7) {
+            desc_pad(&w, 8 - (layout->buttons & 7));
+        }
+    }
+
+    desc_put(&w, ITEM_END_COLLECTION);
+    return w.len > cap ? 0 : w.len;
+}
+
+void gamepad_report_pack(struct gamepad_layout const *layout, uint8_t *report,
+                         uint32_t const buttons[DINPUT_BTN_WORDS],
+                         uint8_t const *hats, int16_t const *axes) {
+    uint8_t *p = report;
+    uint16_t n, b;
+    int i;
+
+    for (i = 0; i < layout->axes; i++) {
+        uint16_t v = axes ? (uint16_t)axes[i] : 0;
+
+        *p++ = v;
+        *p++ = v >> 8;
+    }
+    for (i = 0; i < layout->hats; i += 2) {
+        *p = hats[i] & 0x0f;
+        if (i + 1 < layout->hats) {
+            *p |= hats[i + 1] << 4;
+        }
+        p++;
+    }
+    // bit n of byte k is button btn_first + k * 8 + n, the words byte by
+    // byte
+    n = (layout->buttons + 7) / 8;
+    for (i = 0; i < n; i++) {
+        b = layout->btn_first / 8 + i;
+        p[i] = buttons[b >> 2] >> ((b & 3) * 8);
+    }
+    if (layout->buttons & 7) {
+        p[n - 1] &= (1u << (layout->buttons & 7)) - 1;
+    }
+}
+
+uint16_t keyboard_desc_build(uint8_t report_id, uint8_t *desc, uint16_t cap) {
+    struct desc_writer w = {desc, cap, 0};
+
+    desc_item(&w, ITEM_USAGE_PAGE, PAGE_DESKTOP);
+    desc_item(&w, ITEM_USAGE, USAGE_KEYBOARD);
+    desc_item(&w, ITEM_COLLECTION, COLLECTION_APPLICATION);
+    desc_item(&w, ITEM_REPORT_ID, report_id);
+    desc_item(&w, ITEM_USAGE_PAGE, PAGE_KEYBOARD);
+    desc_item(&w, ITEM_LOGICAL_MIN, 0);
+    desc_item(&w, ITEM_LOGICAL_MAX, 1);
+    desc_item(&w, ITEM_REPORT_SIZE, 1);
+
+    // modifiers, one bit each
+    desc_uitem(&w, ITEM_USAGE_MIN, USAGE_LEFT_CONTROL);
+    desc_uitem(&w, ITEM_USAGE_MAX, USAGE_RIGHT_GUI);
+    desc_item(&w, ITEM_REPORT_COUNT, 8);
+    desc_item(&w, ITEM_INPUT, IO_DATA_VAR_ABS);
+
+    // a bit per key instead of the boot keyboard's array of 6 usages
+    desc_item(&w, ITEM_USAGE_MIN, 0);
+    desc_item(&w, ITEM_USAGE_MAX, KEYBOARD_USAGES - 1);
+    desc_uitem(&w, ITEM_REPORT_COUNT, KEYBOARD_USAGES);
+    desc_item(&w, ITEM_INPUT, IO_DATA_VAR_ABS);
+
+    desc_put(&w, ITEM_END_COLLECTION);
+    return w.len > cap ? 0 : w.len;
+}
+
+// An opaque len byte vendor report of one kind (main item) in a top level
+// collection of its own
+static uint16_t vendor_desc_build(uint8_t report_id, uint8_t usage,
+                                  uint8_t len, uint8_t main_item,
+                                  uint8_t *desc, uint16_t cap) {
+    struct desc_writer w = {desc, cap, 0};
+
+    desc_uitem(&w, ITEM_USAGE_PAGE, PAGE_VENDOR);
+    desc_item(&w, ITEM_USAGE, usage);
+    desc_item(&w, ITEM_COLLECTION, COLLECTION_APPLICATION);
+    desc_item(&w, ITEM_REPORT_ID, report_id);
+    desc_item(&w, ITEM_USAGE, usage);
+    desc_item(&w, ITEM_LOGICAL_MIN, 0);
+    desc_item(&w, ITEM_LOGICAL_MAX, 255);
+    desc_item(&w, ITEM_REPORT_SIZE, 8);
+    desc_item(&w, ITEM_REPORT_COUNT, len);
+    desc_item(&w, main_item, IO_DATA_VAR_ABS);
+    desc_put(&w, ITEM_END_COLLECTION);
+    return w.len > cap ? 0 : w.len;
+}
+
+uint16_t vendor_feature_desc_build(uint8_t report_id, uint8_t usage,
+                                   uint8_t len, uint8_t *desc, uint16_t cap) {
+    return vendor_desc_build(report_id, usage, len, ITEM_FEATURE, desc, cap);
+}
+
+uint16_t vendor_output_desc_build(uint8_t report_id, uint8_t usage,
+                                  uint8_t len, uint8_t *desc, uint16_t cap) {
+    return vendor_desc_build(report_id, usage, len, ITEM_OUTPUT, desc, cap);
+}
@@ -0,0 +1,107 @@
+/*
+ * Gamepad HID report descriptor generator.
+ *
+ * Builds a descriptor for exactly the inputs the board has: N buttons packed
+ * one bit each, the hats as 4 bit fields, and 16 bit axes only if there are
+ * any. The layout it fills in is what gamepad_report_pack() uses to build the
+ * matching report, so the two cannot drift apart.
+ *
+ * Report layout, after the report ID byte that TinyUSB adds:
+ *   int16_t axes[axes] | 4 bit hats[hats], padded to a byte | buttons bits,
+ *   padded to a byte
+ */
+
+#ifndef HID_DESC_H_
+#define HID_DESC_H_
+
+#include <stdint.h>
+
+#include "input.h"
+
+// Build time limits, see UMFD_GAMEPAD_* in src/CMakeLists.txt. The endpoint
+// buffer is sized from these.
+#ifndef UMFD_GAMEPAD_AXES
+#define UMFD_GAMEPAD_AXES 0
+#endif
+#ifndef UMFD_GAMEPAD_HATS
+#define UMFD_GAMEPAD_HATS 1
+#endif
+
+// X, Y, Z, Rx, Ry, Rz, Slider, Dial
+#define GAMEPAD_MAX_AXES 8
+#define GAMEPAD_MAX_HATS 4
+#define GAMEPAD_MAX_BUTTONS MAX_DINPUT_BTNS
+
+#if UMFD_GAMEPAD_AXES > GAMEPAD_MAX_AXES || UMFD_GAMEPAD_HATS > GAMEPAD_MAX_HATS
+#error "UMFD_GAMEPAD_AXES or UMFD_GAMEPAD_HATS is over the limit"
+#endif
+
+// Largest report this build can send, without the report ID
+#define GAMEPAD_REPORT_MAX_LEN                                                 \
+    (UMFD_GAMEPAD_AXES * 2 + (UMFD_GAMEPAD_HATS + 1) / 2 +                     \
+     GAMEPAD_MAX_BUTTONS / 8)
+#define GAMEPAD_DESC_MAX_LEN 128
+
+// Largest vendor feature report, without the report ID, and the room one
+// takes in the report descriptor. Feature reports go through the same
+// endpoint buffer as the gamepad report.
+#define HID_FEATURE_MAX_LEN 63
+#define HID_FEATURE_DESC_MAX_LEN 32
+
+// N-key rollover keyboard report, without the report ID: a modifier byte,
+// then one bit per Keyboard page usage below KEYBOARD_USAGES. That covers
+// letters, digits, F1-F24, the arrows and the keypad.
+#define KEYBOARD_USAGES 128
+#define KEYBOARD_REPORT_LEN (1 + KEYBOARD_USAGES / 8)
+#define KEYBOARD_DESC_MAX_LEN 48
+
+// Hat values as in TinyUSB's hid_gamepad_hat_t: 0 is centered, 1..8 go
+// clockwise from up.
+#define GAMEPAD_HAT_CENTERED 0
+
+struct gamepad_layout {
+    // 0 for a descriptor without report IDs
+    uint8_t report_id;
+    uint8_t axes;
+    uint8_t hats;
+    // button IDs btn_first.. (a multiple of 8) become buttons 1..
+    uint16_t btn_first;
+    uint16_t buttons;
+    // byte offsets of each part in the report
+    uint8_t hat_off;
+    uint8_t btn_off;
+    // report length, without the report ID
+    uint8_t len;
+};
+
+// Clamps the counts to what the build sized the endpoint for. btn_first is
+// rounded down to a multiple of 8.
+void gamepad_layout_init(struct gamepad_layout *layout, uint8_t report_id,
+                         uint16_t btn_first, uint16_t buttons, uint8_t hats,
+                         uint8_t axes);
+
+// Write the report descriptor for a layout. Returns its length, or 0 if it
+// does not fit in cap.
+uint16_t gamepad_desc_build(struct gamepad_layout const *layout, uint8_t *desc,
+                            uint16_t cap);
+
+// Fill layout->len bytes of report. Button IDs outside the layout's are
+// dropped. With axes NULL all axes report centered.
+void gamepad_report_pack(struct gamepad_layout const *layout, uint8_t *report,
+                         uint32_t const buttons[DINPUT_BTN_WORDS],
+                         uint8_t const *hats, int16_t const *axes);
+
+// Write the descriptor of the keyboard report under report_id. Returns its
+// length, or 0 if it does not fit in cap.
+uint16_t keyboard_desc_build(uint8_t report_id, uint8_t *desc, uint16_t cap);
+
+// Write the descriptor of an opaque len byte vendor feature report under
+// report_id, as its own top level collection so hosts leave it to
+// applications. Returns its length, or 0 if it does not fit in cap.
+uint16_t vendor_feature_desc_build(uint8_t report_id, uint8_t usage,
+                                   uint8_t len, uint8_t *desc, uint16_t cap);
+// The same for a vendor output report, which the host writes.
+uint16_t vendor_output_desc_build(uint8_t report_id, uint8_t usage,
+                                  uint8_t len, uint8_t *desc, uint16_t cap);
+
+#endif /* HID_DESC_H_ */
@@ -0,0 +1,232 @@
+/*
+ * Button registration, GPIO scan and debounce.
+ */
+
+#include <string.h>
+
+#include "input.h"
+#include "umfd_hal.h"
+
+struct debounce_vc gpio_debounce;
+struct latency_hist* gpio_debounce_latency;
+
+// GPIOs registered as buttons or profile pins; the rest (LED, VBUS sense,
+// pins of other inputs) never count as changed
+static uint32_t gpio_pins;
+// GPIOs whose raw level left the debounced one, and when it first did
+static uint32_t gpio_edge_pending;
+static uint32_t gpio_edge_t_us[32];
+
+void input_init(void) {
+    debounce_vc_init(&gpio_debounce);
+    gpio_pins = 0;
+    gpio_edge_pending = 0;
+}
+
+void reg_dinput_btn(struct dinput_btn_reg* d_btn_reg, uint8_t btn_id) {
+    d_btn_reg->state = 0;
+    d_btn_reg->btn_id = btn_id;
+}
+
+void reg_btn(struct phy_btn_reg* btn_reg, struct dinput_btn_reg* d_btn_reg, uint8_t gpio_id, bool enabled_state) {
+    gpio_pins |= 1u << gpio_id;
+    reg_btn_on(&gpio_debounce, btn_reg, d_btn_reg, gpio_id, enabled_state);
+}
+
+void reg_btn_on(struct debounce_vc* vc, struct phy_btn_reg* btn_reg,
+                struct dinput_btn_reg* d_btn_reg, uint8_t bit,
+                bool enabled_state) {
+    if (!btn_reg) {
+        return;
+    }
+    memset(btn_reg, 0, sizeof(*btn_reg));
+    btn_reg->enabled_state = enabled_state;
+    btn_reg->gpio_id = bit;
+    btn_reg->gpio_debounce_mask = 0x0f;
+    btn_reg->d_btn = d_btn_reg;
+    debounce_vc_config_pin(vc, bit, btn_reg->gpio_debounce_mask,
+                           !enabled_state);
+}
+
+void reg_gpio_pins(uint32_t pins, uint32_t idle_levels) {
+    int pin;
+
+    gpio_pins |= pins;
+    while (pins) {
+        pin = __builtin_ctz(pins);
+        pins &= pins - 1;
+        debounce_vc_config_pin(&gpio_debounce, pin, 0x0f,
+                               (idle_levels >> pin) & 0x1);
+    }
+}
+
+void unreg_gpio_pins(uint32_t pins) {
+    gpio_pins &= ~pins;
+    gpio_edge_pending &= ~pins;
+}
+
+uint32_t registered_gpio_pins(void) { return gpio_pins; }
+
+void set_gpio_debounce_mode(uint32_t pins, enum debounce_mode mode,
+                            uint32_t mask) {
+    bool level;
+    int pin;
+
+    while (pins) {
+        pin = __builtin_ctz(pins);
+        pins &= pins - 1;
+        level = (gpio_debounce.state >> pin) & 0x1;
+        if (mode == DEBOUNCE_MODE_EAGER) {
+            debounce_vc_config_pin_eager(&gpio_debounce, pin, mask, level);
+        } else {
+            debounce_vc_config_pin(&gpio_debounce, pin, mask, level);
+        }
+    }
+}
+
+void set_btn_debounce_mask(struct phy_btn_reg* btn_reg, uint32_t mask) {
+    set_btn_debounce_mode(btn_reg, btn_reg->debounce_mode, mask);
+}
+
+void set_btn_debounce_mode(struct phy_btn_reg* btn_reg,
+                           enum debounce_mode mode, uint32_t mask) {
+    set_btn_debounce_mode_on(&gpio_debounce, btn_reg, mode, mask);
+}
+
+void set_btn_debounce_mode_on(struct debounce_vc* vc,
+                              struct phy_btn_reg* btn_reg,
+                              enum debounce_mode mode, uint32_t mask) {
+    bool level = (vc->state >> btn_reg->gpio_id) & 0x1;
+
+    btn_reg->debounce_mode = mode;
+    btn_reg->gpio_debounce_mask = mask;
+    if (mode == DEBOUNCE_MODE_EAGER) {
+        debounce_vc_config_pin_eager(vc, btn_reg->gpio_id, mask, level);
+    } else {
+        debounce_vc_config_pin(vc, btn_reg->gpio_id, mask, level);
+    }
+}
+
+void dispatch_dense_btns(struct phy_btn_reg* btn_arr, uint32_t changed,
+                         uint32_t state) {
+    struct phy_btn_reg* btn;
+    int bit;
+
+    while (changed) {
+        bit = __builtin_ctz(changed);
+        changed &= changed - 1;
+        btn = btn_arr + bit;
+        if (btn->d_btn) {
+            btn->d_btn->state = ((state >> bit) & 0x1) == btn->enabled_state;
+        }
+    }
+}
+
+void poll_registered_gpios(struct phy_btn_reg* btn_arr, uint16_t btn_arr_len) {
+    uint32_t edge_t_us;
+
+    poll_gpio_sample(btn_arr, btn_arr_len, hal_gpio_get_all(), hal_time_us(),
+                     &edge_t_us);
+}
+
+// Remember when each GPIO first left its debounced level, through any
+// bounce, so the debounce decision can be timed from there.
+static void track_gpio_edges(uint32_t sample, uint32_t changed,
+                             uint32_t t_us) {
+    uint32_t fresh = ((sample ^ gpio_debounce.state) | changed) & gpio_pins &
+                     ~gpio_edge_pending;
+    uint32_t pending;
+    int pin;
+
+    // rare: only on the first raw edge of a press or release
+    while (fresh) {
+        pin = __builtin_ctz(fresh);
+        fresh &= fresh - 1;
+        gpio_edge_t_us[pin] = t_us;
+        gpio_edge_pending |= 1u << pin;
+    }
+    gpio_edge_pending &= ~changed;
+    // a glitch that never made it through the filter
+    pending = gpio_edge_pending;
+    while (pending) {
+        pin = __builtin_ctz(pending);
+        pending &= pending - 1;
+        if (t_us - gpio_edge_t_us[pin] > GPIO_EDGE_STALE_US) {
+            gpio_edge_pending &= ~(1u << pin);
+        }
+    }
+}
+
+uint32_t poll_gpio_sample(struct phy_btn_reg* btn_arr, uint16_t btn_arr_len,
+                          uint32_t sample, uint32_t t_us,
+                          uint32_t* edge_t_us) {
+    struct phy_btn_reg* btn = NULL;
+    uint32_t diff = (sample ^ gpio_debounce.state) & gpio_pins;
+    uint32_t changed = debounce_vc_update(&gpio_debounce, sample) & gpio_pins;
+    uint32_t age, max_age = 0;
+    uint32_t pins;
+    int pin;
+
+    // only while some pin is bouncing or differs from its debounced level
+    if (diff | changed | gpio_edge_pending) {
+        track_gpio_edges(sample, changed, t_us);
+    }
+    *edge_t_us = t_us;
+    // nearly every poll ends here, nothing settled into a new level
+    if (!changed) {
+        return 0;
+    }
+    // per changed pin, with a phy_btn_reg or read straight from the state
+    pins = changed;
+    while (pins) {
+        pin = __builtin_ctz(pins);
+        pins &= pins - 1;
+        age = t_us - gpio_edge_t_us[pin];
+        if (age >= max_age) {
+            max_age = age;
+            *edge_t_us = gpio_edge_t_us[pin];
+        }
+        if (gpio_debounce_latency) {
+            latency_hist_add(gpio_debounce_latency, age);
+        }
+    }
+    for (btn = btn_arr; btn < (btn_arr + btn_arr_len); btn++) {
+        if ((changed >> btn->gpio_id) & 0x1) {
+            btn->d_btn->state =
+                ((gpio_debounce.state >> btn->gpio_id) & 0x1) == btn->enabled_state;
+        }
+    }
+    return changed;
+}
+
+uint32_t force_gpio_levels(struct phy_btn_reg* btn_arr, uint16_t btn_arr_len,
+                           uint32_t pins, uint32_t sample) {
+    struct phy_btn_reg* btn;
+    uint32_t changed = debounce_vc_force(&gpio_debounce, pins & gpio_pins,
+                                         sample);
+
+    gpio_edge_pending &= ~changed;
+    for (btn = btn_arr; changed && btn < (btn_arr + btn_arr_len); btn++) {
+        if ((changed >> btn->gpio_id) & 0x1) {
+            btn->d_btn->state =
+                ((gpio_debounce.state >> btn->gpio_id) & 0x1) == btn->enabled_state;
+        }
+    }
+    return changed;
+}
+
+bool poll_dense_words(struct debounce_vc* vc, struct phy_btn_reg* btn_arr,
+                      uint32_t const* words, uint8_t word_cnt) {
+    uint32_t changed;
+    bool any = false;
+    uint8_t w;
+
+    for (w = 0; w < word_cnt; w++) {
+        changed = debounce_vc_update(vc + w, words[w]);
+        if (changed) {
+            dispatch_dense_btns(btn_arr + w * 32, changed, vc[w].state);
+            any = true;
+        }
+    }
+    return any;
+}
@@ -0,0 +1,97 @@
+/*
+ * Button registration, GPIO scan and debounce.
+ */
+
+#ifndef INPUT_H_
+#define INPUT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "debounce.h"
+#include "latency.h"
+
+#define MAX_DINPUT_BTNS 128
+#define DINPUT_BTN_WORDS (MAX_DINPUT_BTNS / 32)
+// Highest ID the gamepad report can carry
+#define MAX_DINPUT_BTN_ID (MAX_DINPUT_BTNS - 1)
+
+struct dinput_btn_reg {
+    bool state;
+    uint8_t btn_id;
+};
+
+enum debounce_mode {
+    // flip after a full window of agreeing samples
+    DEBOUNCE_MODE_WINDOW,
+    // flip on the first edge, then ignore the pin for a lockout
+    DEBOUNCE_MODE_EAGER,
+};
+
+struct phy_btn_reg {
+    bool enabled_state;
+    uint8_t debounce_mode;
+    // GPIO, or the bit in the sample word for non-GPIO sources like a matrix
+    uint8_t gpio_id;
+    // history window, or the lockout for DEBOUNCE_MODE_EAGER
+    uint32_t gpio_debounce_mask;
+    struct dinput_btn_reg* d_btn;
+};
+
+// A raw GPIO edge that has not produced a debounced change within this long
+// was a glitch, and the next one counts as a new first edge.
+#define GPIO_EDGE_STALE_US 20000
+
+extern struct debounce_vc gpio_debounce;
+// Raw edge to debounced change time per GPIO change, NULL to not measure
+extern struct latency_hist* gpio_debounce_latency;
+
+void input_init(void);
+void reg_dinput_btn(struct dinput_btn_reg* d_btn_reg, uint8_t btn_id);
+void reg_btn(struct phy_btn_reg* btn_reg, struct dinput_btn_reg* d_btn_reg,
+             uint8_t gpio_id, bool enabled_state);
+void set_btn_debounce_mask(struct phy_btn_reg* btn_reg, uint32_t mask);
+void set_btn_debounce_mode(struct phy_btn_reg* btn_reg,
+                           enum debounce_mode mode, uint32_t mask);
+
+// GPIOs debounced without a phy_btn_reg, e.g. the board profile buttons
+// (see board_profile.h), which are read straight out of gpio_debounce.state.
+// Idle levels are the bits of idle_levels.
+void reg_gpio_pins(uint32_t pins, uint32_t idle_levels);
+void unreg_gpio_pins(uint32_t pins);
+// GPIOs registered either way
+uint32_t registered_gpio_pins(void);
+void set_gpio_debounce_mode(uint32_t pins, enum debounce_mode mode,
+                            uint32_t mask);
+
+// The same for buttons debounced by another engine than the GPIO one, where
+// gpio_id is the bit in the words fed to that engine.
+void reg_btn_on(struct debounce_vc* vc, struct phy_btn_reg* btn_reg,
+                struct dinput_btn_reg* d_btn_reg, uint8_t bit,
+                bool enabled_state);
+void set_btn_debounce_mode_on(struct debounce_vc* vc,
+                              struct phy_btn_reg* btn_reg,
+                              enum debounce_mode mode, uint32_t mask);
+// Hand changed bits to a dense button array, where btn_arr[n] sits on bit n
+// and unused entries have no d_btn.
+void dispatch_dense_btns(struct phy_btn_reg* btn_arr, uint32_t changed,
+                         uint32_t state);
+// Debounce a multi-word sample (a matrix scan, a shift register frame) with
+// one engine per word and dispatch to the dense button array. Returns true
+// if any bit settled into a new state.
+bool poll_dense_words(struct debounce_vc* vc, struct phy_btn_reg* btn_arr,
+                      uint32_t const* words, uint8_t word_cnt);
+void poll_registered_gpios(struct phy_btn_reg* btn_arr, uint16_t btn_arr_len);
+// Debounce one given sample taken at t_us, e.g. one drained from the
+// sampler. Returns the GPIOs that settled into a new level, and if any, the
+// time of the oldest first raw edge behind them in edge_t_us.
+uint32_t poll_gpio_sample(struct phy_btn_reg* btn_arr, uint16_t btn_arr_len,
+                          uint32_t sample, uint32_t t_us,
+                          uint32_t* edge_t_us);
+// Take the levels of the registered GPIOs among pins in sample as debounced
+// at once (see debounce_vc_force()), e.g. the levels that woke the device
+// from suspend. Returns the GPIOs that changed.
+uint32_t force_gpio_levels(struct phy_btn_reg* btn_arr, uint16_t btn_arr_len,
+                           uint32_t pins, uint32_t sample);
+
+#endif /* INPUT_H_ */
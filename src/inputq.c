@@ -0,0 +1,122 @@
+/*
+ * Lossless input queue between debounce and reporting.
+ */
+
+#include <string.h>
+
+#include "inputq.h"
+
+void inputq_init(struct input_queue *q) {
+    memset(q, 0, sizeof(*q));
+}
+
+static bool inputq_full(struct input_queue *q) {
+    return q->head - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) >= INPUTQ_LEN;
+}
+
+static void inputq_put(struct input_queue *q,
+                       struct input_snapshot const *snap) {
+    q->ring[q->head & (INPUTQ_LEN - 1)] = *snap;
+    memcpy(q->last_pushed, snap->buttons, sizeof(q->last_pushed));
+    __atomic_store_n(&q->head, q->head + 1, __ATOMIC_RELEASE);
+}
+
+void inputq_push(struct input_queue *q, struct input_snapshot const *snap) {
+    int w;
+
+    if (q->held) {
+        q->held_snap = *snap;
+        for (w = 0; w < DINPUT_BTN_WORDS; w++) {
+            q->held_seen[w] |= snap->buttons[w];
+        }
+        inputq_flush(q);
+        return;
+    }
+    if (!inputq_full(q)) {
+        inputq_put(q, snap);
+        return;
+    }
+    q->overflows++;
+    q->held = true;
+    q->held_snap = *snap;
+    memcpy(q->held_seen, snap->buttons, sizeof(q->held_seen));
+}
+
+bool inputq_flush(struct input_queue *q) {
+    struct input_snapshot tap;
+    uint32_t extra[DINPUT_BTN_WORDS];
+    uint32_t any = 0;
+    int w;
+
+    while (q->held && !inputq_full(q)) {
+        // buttons that went down and up again while held, and that the last
+        // pushed state does not show down already
+        for (w = 0; w < DINPUT_BTN_WORDS; w++) {
+            extra[w] = q->held_seen[w] & ~q->held_snap.buttons[w] &
+                       ~q->last_pushed[w];
+            any |= extra[w];
+        }
+        if (!any) {
+            inputq_put(q, &q->held_snap);
+            q->held = false;
+            break;
+        }
+        tap = q->held_snap;
+        for (w = 0; w < DINPUT_BTN_WORDS; w++) {
+            tap.buttons[w] |= extra[w];
+        }
+        inputq_put(q, &tap);
+        // the release still needs its own entry
+        memcpy(q->held_seen, q->held_snap.buttons, sizeof(q->held_seen));
+        any = 0;
+    }
+    return !q->held;
+}
+
+uint16_t inputq_peek_merged(struct input_queue *q,
+                            uint32_t const shown[DINPUT_BTN_WORDS],
+                            struct input_snapshot *out) {
+    uint32_t tail = q->tail;
+    uint32_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+    uint32_t changed[DINPUT_BTN_WORDS] = {0};
+    uint32_t cur[DINPUT_BTN_WORDS];
+    uint32_t diff[DINPUT_BTN_WORDS];
+    uint32_t first_t_us = 0;
+    uint32_t first_edge_us = 0;
+    struct input_snapshot const *e;
+    uint32_t clash;
+    uint16_t n = 0;
+    int w;
+
+    memcpy(cur, shown, sizeof(cur));
+    for (; tail + n != head; n++) {
+        e = q->ring + ((tail + n) & (INPUTQ_LEN - 1));
+        clash = 0;
+        for (w = 0; w < DINPUT_BTN_WORDS; w++) {
+            diff[w] = e->buttons[w] ^ cur[w];
+            clash |= diff[w] & changed[w];
+        }
+        // a button changing back would cancel out its own edge
+        if (clash) {
+            break;
+        }
+        for (w = 0; w < DINPUT_BTN_WORDS; w++) {
+            changed[w] |= diff[w];
+        }
+        memcpy(cur, e->buttons, sizeof(cur));
+        if (!n) {
+            first_t_us = e->sample_t_us;
+            first_edge_us = e->edge_t_us;
+        }
+        *out = *e;
+    }
+    if (n) {
+        out->sample_t_us = first_t_us;
+        out->edge_t_us = first_edge_us;
+    }
+    return n;
+}
+
+void inputq_pop(struct input_queue *q, uint16_t n) {
+    __atomic_store_n(&q->tail, q->tail + n, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,85 @@
+/*
+ * Lossless input queue between debounce and reporting.
+ *
+ * Every debounced change pushes the full input state, with its timestamp,
+ * into a single producer/single consumer ring. The USB side merges the
+ * oldest entries into one report for as long as no button would change twice
+ * within it, so a tap shorter than a report interval still goes out as one
+ * report with the button down and one with it up, while any run of
+ * unrelated edges shares a report.
+ *
+ * If the USB side stops taking reports and the ring fills, the producer
+ * holds back a single folded state instead: the latest state, plus any
+ * button that was pressed and released again meanwhile. Once there is room
+ * again that comes out as one entry with those buttons down and one with
+ * the latest state, so presses survive any amount of backpressure in fixed
+ * memory. Only repeated taps of the same button fold into one.
+ */
+
+#ifndef INPUTQ_H_
+#define INPUTQ_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "hid_desc.h"
+#include "input.h"
+
+// One input state, as pushed by the scanning side
+struct input_snapshot {
+    uint32_t buttons[DINPUT_BTN_WORDS];
+    uint8_t hats[GAMEPAD_MAX_HATS];
+    int16_t axes[GAMEPAD_MAX_AXES];
+    // bumped on every push
+    uint32_t gen;
+    // timestamp of the raw sample that produced this state
+    uint32_t sample_t_us;
+    // first raw edge behind this state, before debouncing; sample_t_us if
+    // the input does not track raw edges
+    uint32_t edge_t_us;
+};
+
+// Must be a power of two
+#define INPUTQ_LEN 32
+
+struct input_queue {
+    // head is only written by the producer, tail only by the consumer
+    uint32_t head;
+    uint32_t tail;
+    struct input_snapshot ring[INPUTQ_LEN];
+
+    // Producer only. While held, the ring was full and held_snap is the
+    // latest state not pushed yet; held_seen is every button down at any
+    // point since.
+    bool held;
+    struct input_snapshot held_snap;
+    uint32_t held_seen[DINPUT_BTN_WORDS];
+    uint32_t last_pushed[DINPUT_BTN_WORDS];
+    // times the ring was full and the producer had to hold back
+    uint32_t overflows;
+};
+
+void inputq_init(struct input_queue *q);
+
+// Producer side. Queue one new state.
+void inputq_push(struct input_queue *q, struct input_snapshot const *snap);
+// Producer side. Push a held back state if there is room by now; call this
+// from the scan loop. Returns true when nothing is held anymore.
+bool inputq_flush(struct input_queue *q);
+
+// Consumer side. Merge the oldest entries that can share one report, given
+// the buttons of the last report (shown), into out, without taking them off
+// the queue. out->sample_t_us and out->edge_t_us are those of the oldest
+// merged entry, the one that waited longest. Returns how many entries were
+// merged, 0 if the queue is empty.
+uint16_t inputq_peek_merged(struct input_queue *q,
+                            uint32_t const shown[DINPUT_BTN_WORDS],
+                            struct input_snapshot *out);
+// Consumer side. True when no edge is waiting for a report.
+static inline bool inputq_empty(struct input_queue *q) {
+    return q->tail == __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+}
+// Consumer side. Drop n entries, once the report built from them went out.
+void inputq_pop(struct input_queue *q, uint16_t n);
+
+#endif /* INPUTQ_H_ */
@@ -0,0 +1,85 @@
+/*
+ * Keyboard output.
+ */
+
+#include <string.h>
+
+#include "keyboard.h"
+#include "umfd_hal.h"
+
+void keymap_init(struct keymap *km) {
+    memset(km, 0, sizeof(*km));
+    memset(km->gamepad, 0xff, sizeof(km->gamepad));
+}
+
+bool keymap_set(struct keymap *km, uint8_t btn_id, uint8_t usage,
+                uint8_t mods, bool also_gamepad) {
+    uint32_t bit = 1u << (btn_id & 31);
+
+    if (btn_id >= MAX_DINPUT_BTNS) {
+        return false;
+    }
+    if (usage >= KEY_USAGE_MOD_FIRST && usage <= KEY_USAGE_MOD_LAST) {
+        mods |= 1u << (usage - KEY_USAGE_MOD_FIRST);
+        usage = 0;
+    } else if (usage >= KEYBOARD_USAGES) {
+        return false;
+    }
+    km->entry[btn_id].usage = usage;
+    km->entry[btn_id].mods = mods;
+    if (usage || mods) {
+        km->keys[btn_id >> 5] |= bit;
+    } else {
+        km->keys[btn_id >> 5] &= ~bit;
+    }
+    if (also_gamepad || !(usage || mods)) {
+        km->gamepad[btn_id >> 5] |= bit;
+    } else {
+        km->gamepad[btn_id >> 5] &= ~bit;
+    }
+    return true;
+}
+
+void keyboard_report_pack(struct keymap const *km,
+                          uint32_t const buttons[DINPUT_BTN_WORDS],
+                          uint8_t *report) {
+    struct keymap_entry const *e;
+    uint32_t pressed;
+    int w;
+
+    memset(report, 0, KEYBOARD_REPORT_LEN);
+    for (w = 0; w < DINPUT_BTN_WORDS; w++) {
+        pressed = buttons[w] & km->keys[w];
+        while (pressed) {
+            e = km->entry + w * 32 + __builtin_ctz(pressed);
+            pressed &= pressed - 1;
+            report[0] |= e->mods;
+            // usage 0 means no key, its bit stays clear
+            if (e->usage) {
+                report[1 + (e->usage >> 3)] |= 1u << (e->usage & 7);
+            }
+        }
+    }
+}
+
+int send_keyboard_report(struct report_sched *sched, uint8_t report_id,
+                         struct keymap const *km,
+                         uint32_t const buttons[DINPUT_BTN_WORDS]) {
+    uint8_t report[KEYBOARD_REPORT_LEN];
+    uint32_t now_ms;
+
+    if (!hal_hid_ready(sched->instance)) {
+        return -1;
+    }
+
+    keyboard_report_pack(km, buttons, report);
+    now_ms = hal_millis();
+    if (!report_sched_due(sched, report, sizeof(report), now_ms)) {
+        return 1;
+    }
+    if (!hal_hid_report(sched->instance, report_id, report, sizeof(report))) {
+        return -1;
+    }
+    report_sched_sent(sched, report, sizeof(report), now_ms);
+    return 0;
+}
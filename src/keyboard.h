@@ -0,0 +1,85 @@
+/*
+ * Keyboard output.
+ *
+ * Sims often bind cockpit buttons to keys rather than to joystick buttons,
+ * so a button can type a key instead of, or as well as, pressing its
+ * gamepad button. The keymap gives button IDs a Keyboard page usage and
+ * modifiers to hold with it. The keyboard report is N-key rollover (see
+ * hid_desc.h): a modifier byte and a bit per key, so every key held at once
+ * goes out in one report rather than the 6 the boot keyboard's array has
+ * room for. Hosts read it with their generic HID keyboard driver; it is not
+ * a boot keyboard, so a BIOS will not see it.
+ *
+ * Packing only walks buttons that are both pressed and mapped to a key, so
+ * a board without keys pays one mask per button word.
+ */
+
+#ifndef KEYBOARD_H_
+#define KEYBOARD_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "hid_desc.h"
+#include "input.h"
+#include "report.h"
+
+// Modifier bits of the report's first byte, usages 0xe0..0xe7 in order
+#define KEY_MOD_LEFT_CTRL 0x01
+#define KEY_MOD_LEFT_SHIFT 0x02
+#define KEY_MOD_LEFT_ALT 0x04
+#define KEY_MOD_LEFT_GUI 0x08
+#define KEY_MOD_RIGHT_CTRL 0x10
+#define KEY_MOD_RIGHT_SHIFT 0x20
+#define KEY_MOD_RIGHT_ALT 0x40
+#define KEY_MOD_RIGHT_GUI 0x80
+
+// Keyboard page usages of the modifier keys
+#define KEY_USAGE_MOD_FIRST 0xe0
+#define KEY_USAGE_MOD_LAST 0xe7
+
+struct keymap_entry {
+    // 0 for a button that only holds modifiers
+    uint8_t usage;
+    uint8_t mods;
+};
+
+struct keymap {
+    // buttons that type a key
+    uint32_t keys[DINPUT_BTN_WORDS];
+    // buttons that still press their gamepad button
+    uint32_t gamepad[DINPUT_BTN_WORDS];
+    struct keymap_entry entry[MAX_DINPUT_BTNS];
+};
+
+// Every button a gamepad button only.
+void keymap_init(struct keymap *km);
+
+// Make btn_id type usage with mods held, and also press its gamepad button
+// if also_gamepad. A modifier usage (0xe0..0xe7) becomes its modifier bit.
+// Returns false for a usage the report has no bit for.
+bool keymap_set(struct keymap *km, uint8_t btn_id, uint8_t usage,
+                uint8_t mods, bool also_gamepad);
+
+// Fill KEYBOARD_REPORT_LEN bytes of report from the pressed buttons.
+void keyboard_report_pack(struct keymap const *km,
+                          uint32_t const buttons[DINPUT_BTN_WORDS],
+                          uint8_t *report);
+
+// The buttons of the gamepad report: those not mapped to a key only.
+static inline void keymap_gamepad_buttons(struct keymap const *km,
+                                          uint32_t const buttons[DINPUT_BTN_WORDS],
+                                          uint32_t out[DINPUT_BTN_WORDS]) {
+    int w;
+
+    for (w = 0; w < DINPUT_BTN_WORDS; w++) {
+        out[w] = buttons[w] & km->gamepad[w];
+    }
+}
+
+// Build the keyboard report and send it if due, like send_gamepad_report().
+int send_keyboard_report(struct report_sched *sched, uint8_t report_id,
+                         struct keymap const *km,
+                         uint32_t const buttons[DINPUT_BTN_WORDS]);
+
+#endif /* KEYBOARD_H_ */
@@ -0,0 +1,90 @@
+/*
+ * Latency accounting.
+ */
+
+#include <string.h>
+
+#include "latency.h"
+
+char const *const latency_stage_names[LATENCY_STAGES] = {
+    "edge->debounced", "debounced->report", "report->complete",
+    "edge->complete", "sample->complete", "wake->complete"};
+
+void latency_acc_reset(struct latency_acc *acc) {
+    memset(acc, 0, sizeof(*acc));
+    acc->min_us = UINT32_MAX;
+}
+
+uint32_t latency_bucket_floor(uint8_t idx) {
+    if (idx < 4) {
+        return idx;
+    }
+    return (uint32_t)(4 + (idx & 3)) << (idx / 4 - 1);
+}
+
+void latency_hist_reset(struct latency_hist *h) {
+    latency_acc_reset(&h->acc);
+    memset(h->buckets, 0, sizeof(h->buckets));
+}
+
+uint32_t latency_hist_percentile(struct latency_hist const *h,
+                                 uint16_t permille) {
+    uint64_t want = ((uint64_t)h->acc.cnt * permille + 999) / 1000;
+    uint64_t seen = 0;
+    int i;
+
+    if (!h->acc.cnt) {
+        return 0;
+    }
+    for (i = 0; i < LATENCY_BUCKETS - 1; i++) {
+        seen += h->buckets[i];
+        if (seen >= want) {
+            break;
+        }
+    }
+    if (i == LATENCY_BUCKETS - 1) {
+        return h->acc.max_us;
+    }
+    // never claim more than was actually seen
+    return latency_bucket_floor(i + 1) - 1 < h->acc.max_us
+               ? latency_bucket_floor(i + 1) - 1
+               : h->acc.max_us;
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+uint16_t latency_feature_read(struct latency_hist const *hists, uint8_t stage,
+                              uint8_t page, uint8_t *buf, uint16_t len) {
+    struct latency_hist const *h;
+    uint32_t words[8];
+    int i;
+
+    if (len < LATENCY_FEATURE_LEN || stage >= LATENCY_STAGES ||
+        page >= LATENCY_FEATURE_PAGES) {
+        return 0;
+    }
+    h = hists + stage;
+    if (!page) {
+        words[0] = h->acc.cnt;
+        words[1] = h->acc.cnt ? h->acc.min_us : 0;
+        words[2] = h->acc.max_us;
+        words[3] = latency_hist_percentile(h, 500);
+        words[4] = latency_hist_percentile(h, 990);
+        words[5] = h->acc.sum_us;
+        words[6] = h->acc.sum_us >> 32;
+        words[7] = LATENCY_BUCKETS;
+    } else {
+        memcpy(words, h->buckets + (page - 1) * 8, sizeof(words));
+    }
+    buf[0] = stage;
+    buf[1] = page;
+    for (i = 0; i < 8; i++) {
+        put_u32(buf + 2 + i * 4, words[i]);
+    }
+    return LATENCY_FEATURE_LEN;
+}
@@ -0,0 +1,108 @@
+/*
+ * Latency accounting.
+ *
+ * latency_acc keeps count, min, max and sum. latency_hist adds fixed
+ * buckets with 4 per power of two (so within 25% everywhere from 1 us to
+ * 114 ms, anything longer in the last bucket) for percentiles. Adding a
+ * value is a clz and a few increments, cheap enough for the scan and USB
+ * paths. Each histogram must have one writer.
+ */
+
+#ifndef LATENCY_H_
+#define LATENCY_H_
+
+#include <stdint.h>
+
+#define LATENCY_BUCKETS 64
+
+struct latency_acc {
+    uint32_t cnt;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t sum_us;
+};
+
+struct latency_hist {
+    struct latency_acc acc;
+    uint32_t buckets[LATENCY_BUCKETS];
+};
+
+// Where a pin change spends its time on the way to the host
+enum latency_stage {
+    // first raw edge to the debounced change
+    LATENCY_DEBOUNCE,
+    // debounced change to the tud_hid_report() carrying it
+    LATENCY_QUEUE,
+    // tud_hid_report() to the report complete callback
+    LATENCY_USB,
+    // first raw edge to the report complete callback
+    LATENCY_TOTAL,
+    // newest sample a report was built from to its complete callback, for
+    // every report sent: how stale what the host reads is
+    LATENCY_AGE,
+    // GPIO interrupt that woke the device from suspend to the complete
+    // callback of the first report after the host resumed
+    LATENCY_WAKE,
+    LATENCY_STAGES
+};
+
+// Short names for printing, indexed by enum latency_stage, at most
+// LATENCY_STAGE_NAME_MAX characters
+#define LATENCY_STAGE_NAME_MAX 17
+extern char const *const latency_stage_names[LATENCY_STAGES];
+
+// Host readable latency stats, see latency_feature_read()
+#define LATENCY_FEATURE_LEN 34
+#define LATENCY_FEATURE_PAGES (1 + LATENCY_BUCKETS / 8)
+// stage value in a set feature report that resets every histogram
+#define LATENCY_FEATURE_RESET 0xff
+
+void latency_acc_reset(struct latency_acc *acc);
+
+static inline void latency_acc_add(struct latency_acc *acc, uint32_t us) {
+    acc->cnt++;
+    acc->sum_us += us;
+    if (us < acc->min_us) {
+        acc->min_us = us;
+    }
+    if (us > acc->max_us) {
+        acc->max_us = us;
+    }
+}
+
+static inline uint8_t latency_bucket(uint32_t us) {
+    uint32_t msb;
+    uint32_t idx;
+
+    if (us < 4) {
+        return us;
+    }
+    msb = 31 - __builtin_clz(us);
+    // top two bits below the leading one pick the quarter
+    idx = (msb - 1) * 4 + ((us >> (msb - 2)) & 3);
+    return idx < LATENCY_BUCKETS ? idx : LATENCY_BUCKETS - 1;
+}
+
+// Smallest value that lands in bucket idx.
+uint32_t latency_bucket_floor(uint8_t idx);
+
+void latency_hist_reset(struct latency_hist *h);
+
+static inline void latency_hist_add(struct latency_hist *h, uint32_t us) {
+    latency_acc_add(&h->acc, us);
+    h->buckets[latency_bucket(us)]++;
+}
+
+// Upper bound of the bucket holding the given per mille point, e.g. 990 for
+// p99. 0 with no samples.
+uint32_t latency_hist_percentile(struct latency_hist const *h,
+                                 uint16_t permille);
+
+// Fill one page of the latency feature report for stage:
+//   [0] stage, [1] page, then 8 little endian uint32_t
+// Page 0 holds cnt, min, max, p50, p99, sum low, sum high and the bucket
+// count; page n holds buckets 8 * (n - 1) .. 8 * n - 1. Returns the length.
+uint16_t latency_feature_read(struct latency_hist const *hists, uint8_t stage,
+                              uint8_t page, uint8_t *buf, uint16_t len);
+
+#endif /* LATENCY_H_ */
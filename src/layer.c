@@ -0,0 +1,348 @@
+/*
+ * Layers, tap vs hold, double taps and chords.
+ */
+
+#include <string.h>
+
+#include "layer.h"
+
+_Static_assert(LAYER_MAX_KEYS * 2 <= TWHEEL_MAX_TIMERS,
+               "a window and a pulse timer per key");
+
+// Timer wheel resolution, plenty for windows of tens of ms
+#define LAYER_TICK_US 1000
+
+enum {
+    KEY_UP,
+    // tap-hold or chord window running
+    KEY_PENDING,
+    KEY_DOWN,
+    // half of a chord; the one pressed second holds its output
+    KEY_CHORDED,
+    // the other half let go, nothing left to release
+    KEY_SPENT,
+};
+
+void layer_engine_init(struct layer_engine *le, uint16_t phys_cnt,
+                       uint32_t hold_us, uint32_t dtap_us, uint32_t chord_us,
+                       uint32_t pulse_us, uint32_t now_us) {
+    int i;
+
+    memset(le, 0, sizeof(*le));
+    memset(le->key_of, LAYER_NONE, sizeof(le->key_of));
+    for (i = 0; i < phys_cnt && i < MAX_DINPUT_BTNS; i++) {
+        le->passthrough[i >> 5] |= 1u << (i & 31);
+    }
+    le->hold_us = hold_us;
+    le->dtap_us = dtap_us;
+    le->chord_us = chord_us;
+    le->pulse_us = pulse_us;
+    twheel_init(&le->wheel, LAYER_TICK_US, now_us);
+}
+
+// The key of btn, set up as a plain button if it had none yet
+static struct layer_key *layer_key_get(struct layer_engine *le, uint8_t btn) {
+    struct layer_key *k;
+
+    if (le->key_of[btn] != LAYER_NONE) {
+        return le->keys + le->key_of[btn];
+    }
+    if (le->key_cnt == LAYER_MAX_KEYS) {
+        return NULL;
+    }
+    k = le->keys + le->key_cnt;
+    memset(k, LAYER_NONE, sizeof(*k));
+    k->btn = btn;
+    k->role = LAYER_ROLE_PLAIN;
+    k->state = KEY_UP;
+    k->press_us = 0;
+    k->press_seq = 0;
+    le->key_of[btn] = le->key_cnt++;
+    le->handled[btn >> 5] |= 1u << (btn & 31);
+    le->passthrough[btn >> 5] &= ~(1u << (btn & 31));
+    return k;
+}
+
+static bool valid_out(uint8_t out) {
+    return out == LAYER_NONE || out < MAX_DINPUT_BTNS;
+}
+
+bool layer_engine_set(struct layer_engine *le, uint8_t btn,
+                      enum layer_role role, uint8_t a, uint8_t b) {
+    struct layer_key *k, *other;
+
+    if (btn >= MAX_DINPUT_BTNS) {
+        return false;
+    }
+    switch (role) {
+    case LAYER_ROLE_SHIFT:
+        if (!a || a >= LAYER_MAX || !valid_out(b)) {
+            return false;
+        }
+        break;
+    case LAYER_ROLE_TAP_HOLD:
+        if (!valid_out(a) || !valid_out(b)) {
+            return false;
+        }
+        break;
+    case LAYER_ROLE_CHORD:
+        if (a == btn || a >= MAX_DINPUT_BTNS || !valid_out(b)) {
+            return false;
+        }
+        break;
+    case LAYER_ROLE_REMAP:
+        if (a >= LAYER_MAX || !valid_out(b)) {
+            return false;
+        }
+        break;
+    case LAYER_ROLE_DOUBLE_TAP:
+        if (!valid_out(a)) {
+            return false;
+        }
+        break;
+    default:
+        return role == LAYER_ROLE_PLAIN;
+    }
+    k = layer_key_get(le, btn);
+    if (!k) {
+        return false;
+    }
+    switch (role) {
+    case LAYER_ROLE_SHIFT:
+        k->role = role;
+        k->arg = a;
+        k->tap_out = b;
+        break;
+    case LAYER_ROLE_TAP_HOLD:
+        k->role = role;
+        k->tap_out = a;
+        k->hold_out = b;
+        break;
+    case LAYER_ROLE_CHORD:
+        other = layer_key_get(le, a);
+        if (!other) {
+            return false;
+        }
+        k->role = other->role = role;
+        k->arg = a;
+        other->arg = btn;
+        k->hold_out = other->hold_out = b;
+        break;
+    case LAYER_ROLE_REMAP:
+        k->remap[a] = b;
+        break;
+    default:
+        k->dtap_out = a;
+        break;
+    }
+    return true;
+}
+
+uint16_t layer_engine_btn_cnt(struct layer_engine const *le,
+                              uint16_t phys_cnt) {
+    struct layer_key const *k;
+    uint16_t cnt = phys_cnt;
+    uint8_t outs[3 + LAYER_MAX];
+    int i;
+
+    for (k = le->keys; k < le->keys + le->key_cnt; k++) {
+        outs[0] = k->tap_out;
+        outs[1] = k->hold_out;
+        outs[2] = k->dtap_out;
+        memcpy(outs + 3, k->remap, LAYER_MAX);
+        for (i = 0; i < (int)sizeof(outs); i++) {
+            if (outs[i] != LAYER_NONE && outs[i] >= cnt) {
+                cnt = outs[i] + 1;
+            }
+        }
+    }
+    return cnt;
+}
+
+void layer_engine_pass(struct layer_engine *le, uint16_t first, uint16_t cnt) {
+    int i;
+
+    for (i = first; i < first + cnt && i < MAX_DINPUT_BTNS; i++) {
+        if (!(le->handled[i >> 5] & (1u << (i & 31)))) {
+            le->passthrough[i >> 5] |= 1u << (i & 31);
+        }
+    }
+}
+
+// What k reports as a plain button on the layer selected now: its output on
+// the highest shift layer held, else on the base layer, else itself
+static uint8_t plain_out(struct layer_engine const *le,
+                         struct layer_key const *k) {
+    int layer = le->layers_held ? 31 - __builtin_clz(le->layers_held) : 0;
+
+    if (k->remap[layer] != LAYER_NONE) {
+        return k->remap[layer];
+    }
+    return k->remap[0] != LAYER_NONE ? k->remap[0] : k->btn;
+}
+
+static void pulse(struct layer_engine *le, struct layer_key *k, uint8_t out,
+                  uint32_t now_us) {
+    if (out == LAYER_NONE) {
+        return;
+    }
+    k->pulse_out = out;
+    twheel_arm(&le->wheel, (k - le->keys) * 2 + 1, now_us, le->pulse_us);
+}
+
+static void key_press(struct layer_engine *le, struct layer_key *k,
+                      uint32_t now_us) {
+    struct layer_key *other;
+    uint16_t timer = (k - le->keys) * 2;
+
+    // press_seq is 0 until the first press
+    if (k->dtap_out != LAYER_NONE && k->press_seq &&
+        now_us - k->press_us < le->dtap_us) {
+        k->dtap_held = k->dtap_out;
+    }
+    k->press_us = now_us;
+    k->press_seq = le->presses;
+    switch (k->role) {
+    case LAYER_ROLE_SHIFT:
+        le->layers_held |= 1u << k->arg;
+        k->state = KEY_DOWN;
+        break;
+    case LAYER_ROLE_TAP_HOLD:
+        k->state = KEY_PENDING;
+        twheel_arm(&le->wheel, timer, now_us, le->hold_us);
+        break;
+    case LAYER_ROLE_CHORD:
+        other = le->keys + le->key_of[k->arg];
+        if (other->state == KEY_PENDING) {
+            twheel_cancel(&le->wheel, (other - le->keys) * 2);
+            other->state = KEY_CHORDED;
+            k->state = KEY_CHORDED;
+            k->held_out = k->hold_out;
+        } else {
+            k->state = KEY_PENDING;
+            twheel_arm(&le->wheel, timer, now_us, le->chord_us);
+        }
+        break;
+    default:
+        k->state = KEY_DOWN;
+        k->held_out = plain_out(le, k);
+        break;
+    }
+}
+
+static void key_release(struct layer_engine *le, struct layer_key *k,
+                        uint32_t now_us) {
+    struct layer_key *other;
+
+    k->dtap_held = LAYER_NONE;
+    switch (k->state) {
+    case KEY_PENDING:
+        // let go within the window: a tap
+        twheel_cancel(&le->wheel, (k - le->keys) * 2);
+        pulse(le, k,
+              k->role == LAYER_ROLE_TAP_HOLD ? k->tap_out : plain_out(le, k),
+              now_us);
+        break;
+    case KEY_DOWN:
+        if (k->role == LAYER_ROLE_SHIFT) {
+            le->layers_held &= ~(1u << k->arg);
+            // a quick tap with nothing pressed while it was down
+            if (now_us - k->press_us < le->hold_us &&
+                le->presses == k->press_seq) {
+                pulse(le, k, k->tap_out, now_us);
+            }
+        }
+        break;
+    case KEY_CHORDED:
+        // the chord ends with either button
+        other = le->keys + le->key_of[k->arg];
+        if (other->state == KEY_CHORDED) {
+            other->state = KEY_SPENT;
+        }
+        other->held_out = LAYER_NONE;
+        break;
+    default:
+        break;
+    }
+    k->held_out = LAYER_NONE;
+    k->state = KEY_UP;
+}
+
+// Collect what the keys hold and pulse into le->out. Returns true if it
+// changed.
+static bool layer_out_build(struct layer_engine *le) {
+    uint32_t out[DINPUT_BTN_WORDS] = {0};
+    struct layer_key const *k;
+    uint8_t ids[3];
+    int i;
+
+    for (k = le->keys; k < le->keys + le->key_cnt; k++) {
+        ids[0] = k->held_out;
+        ids[1] = k->dtap_held;
+        ids[2] = k->pulse_out;
+        for (i = 0; i < 3; i++) {
+            if (ids[i] != LAYER_NONE) {
+                out[ids[i] >> 5] |= 1u << (ids[i] & 31);
+            }
+        }
+    }
+    if (!memcmp(out, le->out, sizeof(out))) {
+        return false;
+    }
+    memcpy(le->out, out, sizeof(out));
+    return true;
+}
+
+bool layer_engine_update(struct layer_engine *le,
+                         uint32_t const in[DINPUT_BTN_WORDS], uint32_t now_us,
+                         uint32_t out[DINPUT_BTN_WORDS]) {
+    uint32_t changed, bit;
+    struct layer_key *k;
+    bool dirty = false;
+    int w;
+
+    for (w = 0; w < DINPUT_BTN_WORDS; w++) {
+        // any press counts against a shift's tap
+        if (in[w] & ~le->in[w]) {
+            le->presses++;
+        }
+        changed = (in[w] ^ le->in[w]) & le->handled[w];
+        le->in[w] = in[w];
+        while (changed) {
+            bit = __builtin_ctz(changed);
+            changed &= changed - 1;
+            k = le->keys + le->key_of[w * 32 + bit];
+            if ((in[w] >> bit) & 0x1) {
+                key_press(le, k, now_us);
+            } else {
+                key_release(le, k, now_us);
+            }
+            dirty = true;
+        }
+    }
+    dirty = dirty && layer_out_build(le);
+    for (w = 0; w < DINPUT_BTN_WORDS; w++) {
+        out[w] = (le->in[w] & le->passthrough[w]) | le->out[w];
+    }
+    return dirty;
+}
+
+bool layer_engine_poll(struct layer_engine *le, uint32_t now_us) {
+    struct layer_key *k;
+    bool dirty = false;
+    uint16_t id;
+
+    while ((id = twheel_expire(&le->wheel, now_us)) != TWHEEL_NONE) {
+        k = le->keys + id / 2;
+        if (id & 1) {
+            k->pulse_out = LAYER_NONE;
+        } else if (k->state == KEY_PENDING) {
+            // held past the window
+            k->state = KEY_DOWN;
+            k->held_out = k->role == LAYER_ROLE_TAP_HOLD ? k->hold_out
+                                                         : plain_out(le, k);
+        }
+        dirty = true;
+    }
+    return dirty && layer_out_build(le);
+}
@@ -0,0 +1,136 @@
+/*
+ * Layers, tap vs hold, double taps and chords.
+ *
+ * Sits between debounce and the input queue and turns the physical button
+ * states into the reported ones, so 20 buttons can do the work of many:
+ *
+ * - A shift button selects a layer while held, and on a layer a button can
+ *   report as another button ID. What a press resolves to is kept until
+ *   its release, whatever the layer does meanwhile. A shift can also have
+ *   a tap output, pulsed when it is let go quickly with nothing pressed in
+ *   between.
+ * - A tap-hold button pulses one output when released within hold_us and
+ *   holds another once held for longer.
+ * - A double-tap output is held on top of the button's own when it is
+ *   pressed again within dtap_us of its last press.
+ * - A chord of two buttons pressed within chord_us of each other holds one
+ *   output instead of theirs.
+ *
+ * Outputs are button IDs of the report, and usually sit past the physical
+ * buttons. A tap is a pulse of pulse_us, so a host polling at frame rate
+ * sees it.
+ *
+ * Only the buttons given a role go through the engine; every other button
+ * below phys_cnt is copied straight to the output with a mask, in the same
+ * update, and adds no latency. Of the rest, only tap-hold and chord buttons
+ * wait, for their windows; the pending windows and pulses are kept on a
+ * timer wheel, see twheel.h.
+ */
+
+#ifndef LAYER_H_
+#define LAYER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "input.h"
+#include "twheel.h"
+
+#define LAYER_MAX 4
+#define LAYER_MAX_KEYS 32
+#define LAYER_NONE 0xff
+
+// What a button is set up as; the roles of the UMFD_LAYER_KEYS groups
+enum layer_role {
+    LAYER_ROLE_PLAIN,
+    // {button, LAYER_ROLE_SHIFT, layer, tap output or LAYER_NONE}
+    LAYER_ROLE_SHIFT,
+    // {button, LAYER_ROLE_TAP_HOLD, tap output, hold output}
+    LAYER_ROLE_TAP_HOLD,
+    // {button, LAYER_ROLE_CHORD, other button, output}
+    LAYER_ROLE_CHORD,
+    // {button, LAYER_ROLE_REMAP, layer, output}: not a role of its own, the
+    // button reports as output on that layer
+    LAYER_ROLE_REMAP,
+    // {button, LAYER_ROLE_DOUBLE_TAP, output, 0}: on top of any role
+    LAYER_ROLE_DOUBLE_TAP,
+};
+
+struct layer_key {
+    uint8_t btn;
+    uint8_t role;
+    // layer of a shift, other button of a chord
+    uint8_t arg;
+    uint8_t tap_out;
+    // hold output of a tap-hold, output of a chord
+    uint8_t hold_out;
+    uint8_t dtap_out;
+    uint8_t remap[LAYER_MAX];
+
+    // pressed and not resolved yet, pressed and resolved, or released
+    uint8_t state;
+    // what the press resolved to, and the double tap output if it counted
+    uint8_t held_out;
+    uint8_t dtap_held;
+    // output pulsed by the last tap, LAYER_NONE once it ended
+    uint8_t pulse_out;
+    uint32_t press_us;
+    // layer_engine.presses at the press
+    uint32_t press_seq;
+};
+
+struct layer_engine {
+    // buttons that go through unchanged
+    uint32_t passthrough[DINPUT_BTN_WORDS];
+    // buttons with a role, and which key each has
+    uint32_t handled[DINPUT_BTN_WORDS];
+    uint8_t key_of[MAX_DINPUT_BTNS];
+    uint8_t key_cnt;
+    struct layer_key keys[LAYER_MAX_KEYS];
+
+    uint32_t hold_us;
+    uint32_t dtap_us;
+    uint32_t chord_us;
+    uint32_t pulse_us;
+
+    // physical state as of the last update
+    uint32_t in[DINPUT_BTN_WORDS];
+    // what the handled buttons report
+    uint32_t out[DINPUT_BTN_WORDS];
+    // shift layers held, bit n for layer n
+    uint8_t layers_held;
+    uint32_t presses;
+    // hold and chord windows at 2 * key, tap pulses at 2 * key + 1
+    struct timer_wheel wheel;
+};
+
+void layer_engine_init(struct layer_engine *le, uint16_t phys_cnt,
+                       uint32_t hold_us, uint32_t dtap_us, uint32_t chord_us,
+                       uint32_t pulse_us, uint32_t now_us);
+
+// Give btn a role, see enum layer_role. A chord is set up on both of its
+// buttons. Returns false when out of keys or for an ID or layer out of
+// range.
+bool layer_engine_set(struct layer_engine *le, uint8_t btn,
+                      enum layer_role role, uint8_t a, uint8_t b);
+
+// The report button count that covers phys_cnt buttons and every output.
+uint16_t layer_engine_btn_cnt(struct layer_engine const *le,
+                              uint16_t phys_cnt);
+
+// Copy cnt IDs from first straight through as well, like the hat contacts
+// that sit past every output. IDs that have a role keep it.
+void layer_engine_pass(struct layer_engine *le, uint16_t first, uint16_t cnt);
+
+// Take a new physical state at now_us and write the reported buttons to
+// out (which may be in). Returns true when out changed for the handled
+// buttons.
+bool layer_engine_update(struct layer_engine *le,
+                         uint32_t const in[DINPUT_BTN_WORDS], uint32_t now_us,
+                         uint32_t out[DINPUT_BTN_WORDS]);
+
+// Run the windows and pulses that ran out by now_us. Returns true when the
+// handled buttons' output changed, to be published with another update.
+bool layer_engine_poll(struct layer_engine *le, uint32_t now_us);
+
+#endif /* LAYER_H_ */
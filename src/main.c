@@ -13,193 +13,1326 @@
 #include "pico/stdlib.h"
 #include "tusb.h"
 
+#ifndef UMFD_CORE1_SCAN
+#define UMFD_CORE1_SCAN 0
+#endif
+#if UMFD_CORE1_SCAN
+#include "hardware/sync.h"
+#include "pico/flash.h"
+#include "pico/multicore.h"
+#endif
+
+#include "axis.h"
+#include "backlight.h"
+#include "board_profile.h"
+#include "config.h"
+#include "display.h"
+#include "encoder.h"
+#include "frame_sync.h"
+#include "hat.h"
+#include "hid_desc.h"
+#include "input.h"
+#include "inputq.h"
+#include "keyboard.h"
+#include "latency.h"
+#include "layer.h"
+#include "matrix.h"
+#include "panel.h"
+#include "report.h"
+#include "sampler.h"
+#include "shiftreg.h"
+#include "suspend.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "umfd_hal.h"
 #include "usb_descriptors.h"
 
-#define MAX_DINPUT_BTN_ID 31
+// GPIOs that use the eager (press on first edge) debounce, and its lockout
+#ifndef UMFD_EAGER_GPIO_MASK
+#define UMFD_EAGER_GPIO_MASK 0
+#endif
+#ifndef UMFD_EAGER_LOCKOUT_US
+#define UMFD_EAGER_LOCKOUT_US 5000
+#endif
+
+// Key matrix: rows on any GPIOs, columns on UMFD_MATRIX_COLS consecutive
+// GPIOs from UMFD_MATRIX_COL_BASE. Scanned every UMFD_MATRIX_SCAN_US.
+#ifndef UMFD_MATRIX
+#define UMFD_MATRIX 0
+#endif
+#ifndef UMFD_MATRIX_ROW_PINS
+#define UMFD_MATRIX_ROW_PINS 8, 9, 10, 11, 12, 13, 14, 15
+#endif
+#ifndef UMFD_MATRIX_COL_BASE
+#define UMFD_MATRIX_COL_BASE 0
+#endif
+#ifndef UMFD_MATRIX_COLS
+#define UMFD_MATRIX_COLS 8
+#endif
+#ifndef UMFD_MATRIX_DIODES
+#define UMFD_MATRIX_DIODES 0
+#endif
+#ifndef UMFD_MATRIX_SETTLE_US
+#define UMFD_MATRIX_SETTLE_US 2
+#endif
+#ifndef UMFD_MATRIX_SCAN_US
+#define UMFD_MATRIX_SCAN_US 500
+#endif
+
+// Mask of a list of up to MATRIX_MAX_ROWS GPIOs, padded with GPIO 31, which
+// the RP2040 does not have
+#define GPIO_LIST_MASK(...)                                                    \
+    GPIO_LIST_MASK_(__VA_ARGS__, 31, 31, 31, 31, 31, 31, 31, 31, 31, 31, 31, \
+                    31, 31, 31, 31, 31)
+#define GPIO_LIST_MASK_(p0, p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, \
+                        p13, p14, p15, ...)                                    \
+    ((1u << (p0) | 1u << (p1) | 1u << (p2) | 1u << (p3) | 1u << (p4) |        \
+      1u << (p5) | 1u << (p6) | 1u << (p7) | 1u << (p8) | 1u << (p9) |        \
+      1u << (p10) | 1u << (p11) | 1u << (p12) | 1u << (p13) | 1u << (p14) |   \
+      1u << (p15)) &                                                           \
+     ~(1u << 31))
+#define MATRIX_PINS                                                            \
+    (UMFD_MATRIX                                                               \
+         ? GPIO_LIST_MASK(UMFD_MATRIX_ROW_PINS) |                              \
+               (((1u << UMFD_MATRIX_COLS) - 1) << UMFD_MATRIX_COL_BASE)        \
+         : 0)
+
+// 74HC165 chain: QH on UMFD_SHIFTREG_DATA_PIN, CLK on UMFD_SHIFTREG_CLK_PIN
+// and SH/LD on the GPIO after it. Inputs are active low (pull-up, switch to
+// ground) and take button IDs after the direct GPIO buttons.
+#ifndef UMFD_SHIFTREG
+#define UMFD_SHIFTREG 0
+#endif
+#ifndef UMFD_SHIFTREG_DATA_PIN
+#define UMFD_SHIFTREG_DATA_PIN 20
+#endif
+#ifndef UMFD_SHIFTREG_CLK_PIN
+#define UMFD_SHIFTREG_CLK_PIN 21
+#endif
+#ifndef UMFD_SHIFTREG_CHIPS
+#define UMFD_SHIFTREG_CHIPS 4
+#endif
+#ifndef UMFD_SHIFTREG_FRAME_HZ
+#define UMFD_SHIFTREG_FRAME_HZ 4000
+#endif
+
+#define SHIFTREG_PINS                                                          \
+    (UMFD_SHIFTREG ? (1u << UMFD_SHIFTREG_DATA_PIN) |                          \
+                         (0x3u << UMFD_SHIFTREG_CLK_PIN)                       \
+                   : 0)
+
+// Hat switches: UMFD_HAT_GPIOS lists UMFD_HAT_WAYS GPIOs per hat, clockwise
+// from up. They are debounced like the buttons but only show up as hats.
+#ifndef UMFD_HAT_WAYS
+#define UMFD_HAT_WAYS HAT_4WAY
+#endif
+#ifndef UMFD_HAT_POLICY
+#define UMFD_HAT_POLICY HAT_OPPOSE_NEUTRAL
+#endif
+
+// Analog axes on the first UMFD_ADC_AXES ADC inputs (GPIO 26..), filtered
+// and polled every UMFD_ADC_POLL_US, see axis.h
+#ifndef UMFD_ADC_AXES
+#define UMFD_ADC_AXES 0
+#endif
+#ifndef UMFD_ADC_SAMPLE_HZ
+#define UMFD_ADC_SAMPLE_HZ 64000
+#endif
+#ifndef UMFD_ADC_OVERSAMPLE
+#define UMFD_ADC_OVERSAMPLE 4
+#endif
+#ifndef UMFD_ADC_POLL_US
+#define UMFD_ADC_POLL_US 1000
+#endif
+#ifndef UMFD_ADC_FILTER
+#define UMFD_ADC_FILTER AXIS_FILTER_AVERAGE
+#endif
+#ifndef UMFD_ADC_FILTER_SHIFT
+#define UMFD_ADC_FILTER_SHIFT 2
+#endif
+#ifndef UMFD_ADC_DEADBAND
+#define UMFD_ADC_DEADBAND 0
+#endif
+#ifndef UMFD_ADC_HYSTERESIS
+#define UMFD_ADC_HYSTERESIS 64
+#endif
+
+#if UMFD_ADC_AXES > UMFD_GAMEPAD_AXES
+#error "UMFD_ADC_AXES needs as many UMFD_GAMEPAD_AXES"
+#endif
+
+#define ADC_AXIS_PINS (((1u << UMFD_ADC_AXES) - 1) << 26)
+
+// Rotary encoders: A and B of encoder n on UMFD_ENCODER_PIN_BASE + 2n and
+// + 2n + 1, watched by PIO, see encoder.h. Each one pulses a cw and a ccw
+// button per detent, or drives an axis after the ADC axes.
+#ifndef UMFD_ENCODERS
+#define UMFD_ENCODERS 0
+#endif
+#ifndef UMFD_ENCODER_PIN_BASE
+#define UMFD_ENCODER_PIN_BASE 16
+#endif
+#ifndef UMFD_ENCODER_SAMPLE_HZ
+#define UMFD_ENCODER_SAMPLE_HZ 500000
+#endif
+#ifndef UMFD_ENCODER_OUTPUT
+#define UMFD_ENCODER_OUTPUT ENCODER_OUT_BUTTONS
+#endif
+#ifndef UMFD_ENCODER_DETENT_COUNTS
+#define UMFD_ENCODER_DETENT_COUNTS 4
+#endif
+#ifndef UMFD_ENCODER_PULSE_MS
+#define UMFD_ENCODER_PULSE_MS 20
+#endif
+#ifndef UMFD_ENCODER_RANGE_COUNTS
+#define UMFD_ENCODER_RANGE_COUNTS 96
+#endif
+
+#define ENCODER_PINS                                                           \
+    (((1u << (UMFD_ENCODERS * 2)) - 1) << UMFD_ENCODER_PIN_BASE)
+_Static_assert(!(ENCODER_PINS & (SHIFTREG_PINS | ADC_AXIS_PINS)),
+               "UMFD_ENCODER_PIN_BASE clashes with the shift registers or "
+               "UMFD_ADC_AXES");
+
+_Static_assert(UMFD_ENCODER_OUTPUT == ENCODER_OUT_BUTTONS ||
+                   UMFD_ADC_AXES + UMFD_ENCODERS <= UMFD_GAMEPAD_AXES,
+               "UMFD_ENCODERS on axes need as many more UMFD_GAMEPAD_AXES");
+_Static_assert(UMFD_ENCODER_RANGE_COUNTS <= ENCODER_RANGE_MAX,
+               "UMFD_ENCODER_RANGE_COUNTS is more than the axis has steps");
+
+// Keyboard output: UMFD_KEYMAP is groups of {button ID, Keyboard page usage,
+// modifiers, also press the gamepad button}, see keyboard.h. The default
+// types F13..F24 on the first 12 buttons, which no application takes for
+// itself, so a sim can bind them like any key.
+#ifndef UMFD_KEYBOARD
+#define UMFD_KEYBOARD 0
+#endif
+#ifndef UMFD_KEYMAP
+#define UMFD_KEYMAP                                                            \
+    0, 0x68, 0, 0, 1, 0x69, 0, 0, 2, 0x6a, 0, 0, 3, 0x6b, 0, 0, 4, 0x6c, 0, 0,  \
+    5, 0x6d, 0, 0, 6, 0x6e, 0, 0, 7, 0x6f, 0, 0, 8, 0x70, 0, 0, 9, 0x71, 0, 0,  \
+    10, 0x72, 0, 0, 11, 0x73, 0, 0
+#endif
+
+// Layers: UMFD_LAYER_KEYS is groups of {button ID, role, a, b}, see
+// layer.h. The default makes button 19 a shift to layer 1, on which buttons
+// 0..7 report as 20..27. Hat contacts are numbered after the last output.
+#ifndef UMFD_LAYERS
+#define UMFD_LAYERS 0
+#endif
+#ifndef UMFD_LAYER_KEYS
+#define UMFD_LAYER_KEYS                                                        \
+    19, LAYER_ROLE_SHIFT, 1, LAYER_NONE, 0, LAYER_ROLE_REMAP, 1, 20, 1,        \
+    LAYER_ROLE_REMAP, 1, 21, 2, LAYER_ROLE_REMAP, 1, 22, 3, LAYER_ROLE_REMAP,  \
+    1, 23, 4, LAYER_ROLE_REMAP, 1, 24, 5, LAYER_ROLE_REMAP, 1, 25, 6,          \
+    LAYER_ROLE_REMAP, 1, 26, 7, LAYER_ROLE_REMAP, 1, 27
+#endif
+#ifndef UMFD_LAYER_HOLD_MS
+#define UMFD_LAYER_HOLD_MS 200
+#endif
+#ifndef UMFD_LAYER_DTAP_MS
+#define UMFD_LAYER_DTAP_MS 250
+#endif
+#ifndef UMFD_LAYER_CHORD_MS
+#define UMFD_LAYER_CHORD_MS 50
+#endif
+#ifndef UMFD_LAYER_PULSE_MS
+#define UMFD_LAYER_PULSE_MS 20
+#endif
+
+// HID panels: UMFD_HID_PANELS (tusb_config.h) interfaces, with
+// UMFD_HID_PANEL_BUTTONS buttons each in order and the rest on the last;
+// 0 splits evenly, see panel.h
+#ifndef UMFD_HID_PANEL_BUTTONS
+#define UMFD_HID_PANEL_BUTTONS 0
+#endif
+
+// Build reports in the last UMFD_SOF_LEAD_US of each USB frame, from a
+// sample taken right before, see frame_sync.h
+#ifndef UMFD_SOF_SYNC
+#define UMFD_SOF_SYNC 0
+#endif
+#ifndef UMFD_SOF_LEAD_US
+#define UMFD_SOF_LEAD_US 100
+#endif
+
+// Stop scanning and run off the crystal while the host has the bus
+// suspended, and let a button wake it, see suspend.h. A wakeup the host does
+// not answer within UMFD_SUSPEND_WAKE_TIMEOUT_MS goes back to sleep.
+#ifndef UMFD_SUSPEND
+#define UMFD_SUSPEND 0
+#endif
+#ifndef UMFD_SUSPEND_WAKE_TIMEOUT_MS
+#define UMFD_SUSPEND_WAKE_TIMEOUT_MS 1000
+#endif
+
+// SPI panel behind the bezel, fed by the host over a vendor bulk endpoint,
+// see display.h. SCK and MOSI have to be SPI pins of the same instance; no
+// reset pin (-1) when RST is tied high.
+#ifndef UMFD_DISPLAY
+#define UMFD_DISPLAY 0
+#endif
+#ifndef UMFD_DISPLAY_WIDTH
+#define UMFD_DISPLAY_WIDTH 240
+#endif
+#ifndef UMFD_DISPLAY_HEIGHT
+#define UMFD_DISPLAY_HEIGHT 320
+#endif
+#ifndef UMFD_DISPLAY_SCK_PIN
+#define UMFD_DISPLAY_SCK_PIN 26
+#endif
+#ifndef UMFD_DISPLAY_MOSI_PIN
+#define UMFD_DISPLAY_MOSI_PIN 27
+#endif
+#ifndef UMFD_DISPLAY_CS_PIN
+#define UMFD_DISPLAY_CS_PIN 19
+#endif
+#ifndef UMFD_DISPLAY_DC_PIN
+#define UMFD_DISPLAY_DC_PIN 28
+#endif
+#ifndef UMFD_DISPLAY_RST_PIN
+#define UMFD_DISPLAY_RST_PIN -1
+#endif
+#ifndef UMFD_DISPLAY_SPI_HZ
+#define UMFD_DISPLAY_SPI_HZ 62500000
+#endif
+
+#define DISPLAY_PINS                                                           \
+    ((1u << UMFD_DISPLAY_SCK_PIN) | (1u << UMFD_DISPLAY_MOSI_PIN) |            \
+     (1u << UMFD_DISPLAY_CS_PIN) | (1u << UMFD_DISPLAY_DC_PIN) |               \
+     (UMFD_DISPLAY_RST_PIN >= 0 ? 1u << (UMFD_DISPLAY_RST_PIN & 31) : 0))
+_Static_assert(!UMFD_DISPLAY ||
+                   !(DISPLAY_PINS & (MATRIX_PINS | SHIFTREG_PINS |
+                                     ENCODER_PINS | ADC_AXIS_PINS)),
+               "the display pins clash with the matrix, the shift registers, "
+               "the encoders or UMFD_ADC_AXES");
 
-struct dinput_btn_reg {
-    bool state;
-    uint8_t btn_id;
-};
+// WS2812 chain behind the buttons on UMFD_BACKLIGHT_PIN, LED n under button
+// ID n, see backlight.h. Lit UMFD_BACKLIGHT_COLOR (0xRRGGBB) until the host
+// sets its own; a held button shows UMFD_BACKLIGHT_PRESS_COLOR and fades back
+// over UMFD_BACKLIGHT_FADE_MS once let go.
+#ifndef UMFD_BACKLIGHT
+#define UMFD_BACKLIGHT 0
+#endif
+#ifndef UMFD_BACKLIGHT_LEDS
+#define UMFD_BACKLIGHT_LEDS 20
+#endif
+#ifndef UMFD_BACKLIGHT_PIN
+#define UMFD_BACKLIGHT_PIN 21
+#endif
+#ifndef UMFD_BACKLIGHT_COLOR
+#define UMFD_BACKLIGHT_COLOR 0x202020
+#endif
+#ifndef UMFD_BACKLIGHT_FEEDBACK
+#define UMFD_BACKLIGHT_FEEDBACK 1
+#endif
+#ifndef UMFD_BACKLIGHT_PRESS_COLOR
+#define UMFD_BACKLIGHT_PRESS_COLOR 0xffffff
+#endif
+#ifndef UMFD_BACKLIGHT_FADE_MS
+#define UMFD_BACKLIGHT_FADE_MS 250
+#endif
 
-struct gpio_state {
-    bool last;
-    uint32_t hist;
-};
+_Static_assert(!UMFD_BACKLIGHT ||
+                   !((1u << UMFD_BACKLIGHT_PIN) &
+                     ((UMFD_DISPLAY ? DISPLAY_PINS : 0) | MATRIX_PINS |
+                      SHIFTREG_PINS | ENCODER_PINS | ADC_AXIS_PINS)),
+               "UMFD_BACKLIGHT_PIN clashes with the display, the matrix, the "
+               "shift registers, the encoders or UMFD_ADC_AXES");
 
-struct phy_btn_reg {
-    bool enabled_state;
-    uint8_t gpio_id;
-    uint32_t gpio_debounce_mask;
-    struct gpio_state gpio_state;
-    struct dinput_btn_reg* d_btn;
-};
+// CDC-ACM telemetry console, see telemetry.h
+#ifndef UMFD_CDC_CONSOLE
+#define UMFD_CDC_CONSOLE 0
+#endif
+// GPIO traces are streamed out over the console, see trace.h. Replay needs
+// the samples at a fixed rate.
+#define GPIO_TRACE (UMFD_CDC_CONSOLE && UMFD_SAMPLE_RATE_HZ)
 
+#if UMFD_CORE1_SCAN && !UMFD_SAMPLE_RATE_HZ
+#error "UMFD_CORE1_SCAN needs a fixed UMFD_SAMPLE_RATE_HZ"
+#endif
 
 static uint32_t blink_interval_ms = 1500;
-struct dinput_btn_reg global_d_btns[32];
+// Owned by the scanning side: core1 with UMFD_CORE1_SCAN, else the main loop.
+// The USB side only ever looks at input_queue.
+struct phy_btn_reg global_phy_btns[32];
+uint8_t global_phy_btn_cnt = 0;
+// Indexed by button ID; the board profile's IDs are not registered here
+struct dinput_btn_reg global_d_btns[MAX_DINPUT_BTNS];
 uint8_t global_d_btn_cnt = 0;
-uint8_t global_hat_state = 0;
+// Board profile GPIOs not taken by another input, packed by board_pack()
+uint32_t board_pins;
+// The mapping from flash or the host, when there is one. Built on core0 into
+// the map the scanning side is not using and handed over through
+// gpio_map_pending; only the scanning side touches gpio_map_active.
+struct config_store config_store;
+struct gpio_map gpio_maps[2];
+static uint8_t gpio_map_next;
+struct gpio_map *gpio_map_active;
+struct gpio_map *gpio_map_pending;
+// When the first report went out, in us since boot
+uint32_t boot_first_report_us;
+// Newest GPIO sample debounced, written by the scanning side after
+// publishing what it changed
+uint32_t last_sample_t_us;
+#if UMFD_SOF_SYNC
+// SOF times from the USB interrupt
+struct frame_sync usb_frame_sync;
+#endif
+#if UMFD_SUSPEND
+// Core0 only (the main loop and TinyUSB callbacks), but for the wake levels
+// the scanning side takes
+struct usb_suspend usb_suspend;
+#if UMFD_CORE1_SCAN
+// core0 asks core1 to park for a suspend, core1 tells when it has
+static bool scan_park;
+static bool scan_parked;
+#endif
+#endif
+// Scanning side only, hats are computed along with each published state
+struct hat_set gamepad_hats;
+#if UMFD_LAYERS
+// Scanning side only, after the hats
+struct layer_engine button_layers;
+#endif
+struct input_queue input_queue;
+// Panel 0 carries the hats, axes and keyboard on top of its buttons
+struct hid_panel hid_panels[UMFD_HID_PANELS];
+#if UMFD_KEYBOARD
+struct keymap keymap;
+struct report_sched keyboard_sched;
+#endif
+// Written by the stage's own side, read by the stats print and the latency
+// feature report, see latency.h
+struct latency_hist latency_stages[LATENCY_STAGES];
+// samples by the scanning side, reports by the USB side
+struct telem_counters telem_counters;
+#if UMFD_CDC_CONSOLE
+// Only written from core0 (main loop and TinyUSB callbacks)
+struct telem_ring console_ring;
+#define CONSOLE_LOG(str) TELEM_LOG(&console_ring, str)
+#else
+#define CONSOLE_LOG(str) ((void)0)
+#endif
+#if UMFD_SAMPLE_RATE_HZ
+struct sampler gpio_sampler;
+#endif
+#if GPIO_TRACE
+// Fed by the scanning side, drained by the console
+struct trace_recorder gpio_trace;
+#endif
+#if UMFD_MATRIX
+struct matrix key_matrix;
+#endif
+#if UMFD_SHIFTREG
+struct shiftreg_chain sr_chain;
+#endif
+#if UMFD_ADC_AXES
+struct adc_axes adc_axes;
+#endif
+#if UMFD_ENCODERS
+struct encoder_bank encoder_bank;
+#endif
+#if UMFD_DISPLAY
+// Only touched from the core0 main loop
+struct display mfd_display;
+#endif
+#if UMFD_BACKLIGHT
+// Core0 only: the main loop and TinyUSB callbacks
+struct backlight button_backlight;
+#endif
 
 void led_blinking_task(void);
 void hid_task(void);
+void input_task(void);
+void core1_scan_main(void);
+void stats_print_task(void);
+void console_task(void);
+void config_task(void);
+void display_task(void);
+void backlight_task(void);
+bool suspend_task(void);
+static void gpio_map_apply(struct gpio_map *m);
+void debounce_bench_run(void);
+#if UMFD_SOF_SYNC
+static void usb_sof_cb(void *ctx) { frame_sync_sof(ctx, time_us_32()); }
+#endif
 
-void reg_dinput_btn(struct dinput_btn_reg* d_btn_reg, uint8_t btn_id) {
-    d_btn_reg->state = 0;
-    d_btn_reg->btn_id = btn_id;
-}
+int main(void) {
+    struct phy_btn_reg *phy_btns = global_phy_btns;
+    int phy_btn_cnt = 0;
+    // the board profile buttons have the first IDs
+    int d_btn_cnt = BOARD_BTN_CNT;
+    uint32_t matrix_pins = 0;
+    uint32_t hat_pins = 0;
+    uint32_t encoder_pins = 0;
+    uint32_t display_pins = UMFD_DISPLAY ? DISPLAY_PINS : 0;
+    uint32_t backlight_pins = UMFD_BACKLIGHT ? 1u << UMFD_BACKLIGHT_PIN : 0;
+    int report_btn_cnt;
+    int i = 0;
 
-void reg_btn(struct phy_btn_reg* btn_reg, struct dinput_btn_reg* d_btn_reg, uint8_t gpio_id, bool enabled_state) {
-    if (!btn_reg) {
-        return;
+    stdio_init_all();
+    input_init();
+    inputq_init(&input_queue);
+    hat_set_init(&gamepad_hats);
+#ifdef UMFD_HAT_GPIOS
+    static uint8_t const hat_gpios[] = {UMFD_HAT_GPIOS};
+    _Static_assert(sizeof(hat_gpios) % UMFD_HAT_WAYS == 0 &&
+                       sizeof(hat_gpios) / UMFD_HAT_WAYS <= UMFD_GAMEPAD_HATS,
+                   "UMFD_HAT_GPIOS does not fit UMFD_GAMEPAD_HATS hats");
+    for (i = 0; i < (int)sizeof(hat_gpios); i++) {
+        hat_pins |= 1u << hat_gpios[i];
     }
-    memset(btn_reg, 0, sizeof(*btn_reg));
-    btn_reg->enabled_state = enabled_state;
-    btn_reg->gpio_id = gpio_id;
-    btn_reg->gpio_debounce_mask = 0x0f;
-    btn_reg->d_btn = d_btn_reg;
-}
-
-void poll_registered_gpios(struct phy_btn_reg* btn_arr, uint16_t btn_arr_len) {
-    struct phy_btn_reg* btn = NULL;
-    uint32_t raw_gpio = gpio_get_all();
-    uint32_t gpio_hist_window = 0;
-
-    for (btn = btn_arr; btn < (btn_arr + btn_arr_len); btn++) {
-        // check if button is supposed to change
-        btn->gpio_state.hist = (btn->gpio_state.hist << 1)
-                | ((raw_gpio >> btn->gpio_id) & 0x1);
-        gpio_hist_window = (btn->gpio_state.hist) & btn->gpio_debounce_mask;
-        if ( gpio_hist_window == 0 || gpio_hist_window == btn->gpio_debounce_mask ) {
-            if ((gpio_hist_window & 1) == btn->enabled_state) {
-                btn->d_btn->state = true;
-            }
-            else {
-                btn->d_btn->state = false;
+#endif
+
+#if UMFD_ENCODERS
+    encoder_bank_init(&encoder_bank, UMFD_ENCODER_PIN_BASE, UMFD_ENCODERS,
+                      UMFD_ENCODER_SAMPLE_HZ);
+    encoder_pins = ((1u << (encoder_bank.cnt * 2)) - 1)
+                   << UMFD_ENCODER_PIN_BASE;
+#endif
+
+#if UMFD_MATRIX
+    // Matrix keys take the next button IDs, row by row
+    {
+        static uint8_t const row_pins[] = {UMFD_MATRIX_ROW_PINS};
+        int r, c;
+
+        matrix_init(&key_matrix, row_pins, sizeof(row_pins), UMFD_MATRIX_COL_BASE,
+                    UMFD_MATRIX_COLS, UMFD_MATRIX_DIODES, UMFD_MATRIX_SETTLE_US);
+        for (r = 0; r < key_matrix.rows; r++) {
+            matrix_pins |= 1u << row_pins[r];
+            for (c = 0; c < key_matrix.cols; c++) {
+                reg_dinput_btn(global_d_btns + d_btn_cnt, d_btn_cnt);
+                reg_matrix_btn(&key_matrix, global_d_btns + d_btn_cnt, r, c);
+                set_matrix_btn_debounce_mode(
+                    &key_matrix, matrix_key(&key_matrix, r, c),
+                    DEBOUNCE_MODE_WINDOW,
+                    debounce_mask_from_us(UMFD_DEBOUNCE_US,
+                                          1000000 / UMFD_MATRIX_SCAN_US));
+                d_btn_cnt++;
             }
         }
+        matrix_pins |= ((1u << key_matrix.cols) - 1) << UMFD_MATRIX_COL_BASE;
     }
-}
+#endif
 
-int main(void) {
-    //struct dinput_btn_reg d_btns[32];
-    struct phy_btn_reg phy_btns[32];
-    int phy_btn_cnt = 0;
-    int d_btn_cnt = 0;
-    int i = 0;
+    // Board profile buttons (UMFD_BOARD), less any pin the matrix, the hats,
+    // the encoders, the display or the backlight took; the rest keep their
+    // IDs
+    board_pins = BOARD_GPIO_MASK & ~(matrix_pins | hat_pins | encoder_pins |
+                                     display_pins | backlight_pins);
+    for (i = 0; i < 30; i++) {
+        if (!((board_pins >> i) & 0x1)) {
+            continue;
+        }
+        if ((BOARD_PULL_UP_MASK >> i) & 0x1) {
+            gpio_pull_up(i);
+        } else {
+            gpio_pull_down(i);
+        }
+    }
+    reg_gpio_pins(board_pins, BOARD_PULL_UP_MASK);
+#if UMFD_SHIFTREG
+    shiftreg_init(&sr_chain, UMFD_SHIFTREG_DATA_PIN, UMFD_SHIFTREG_CLK_PIN,
+                  UMFD_SHIFTREG_CHIPS, UMFD_SHIFTREG_FRAME_HZ);
+    for (i = 0; i < sr_chain.chips * 8 && d_btn_cnt < MAX_DINPUT_BTNS; i++) {
+        reg_dinput_btn(global_d_btns + d_btn_cnt, d_btn_cnt);
+        reg_shiftreg_btn(&sr_chain, global_d_btns + d_btn_cnt, i, 1);
+        // the engines see one sample per frame
+        set_shiftreg_btn_debounce_mode(
+            &sr_chain, shiftreg_key(&sr_chain, i), DEBOUNCE_MODE_WINDOW,
+            debounce_mask_from_us(UMFD_DEBOUNCE_US, UMFD_SHIFTREG_FRAME_HZ));
+        d_btn_cnt++;
+    }
+#endif
+#if UMFD_ENCODERS
+    // cw and ccw buttons of each encoder, pressed only by the encoder
+    for (i = 0; i < encoder_bank.cnt; i++) {
+        if (UMFD_ENCODER_OUTPUT != ENCODER_OUT_BUTTONS) {
+            encoder_set_axis(encoder_bank.enc + i, UMFD_ENCODER_RANGE_COUNTS,
+                             UMFD_ENCODER_OUTPUT == ENCODER_OUT_AXIS_WRAP);
+            continue;
+        }
+        if (d_btn_cnt + 2 > MAX_DINPUT_BTNS) {
+            break;
+        }
+        reg_dinput_btn(global_d_btns + d_btn_cnt, d_btn_cnt);
+        reg_dinput_btn(global_d_btns + d_btn_cnt + 1, d_btn_cnt + 1);
+        encoder_set_buttons(encoder_bank.enc + i, global_d_btns + d_btn_cnt,
+                            global_d_btns + d_btn_cnt + 1,
+                            UMFD_ENCODER_DETENT_COUNTS,
+                            UMFD_ENCODER_PULSE_MS * 1000);
+        d_btn_cnt += 2;
+    }
+#endif
+    report_btn_cnt = d_btn_cnt;
+#if UMFD_LAYERS
+    {
+        static uint8_t const roles[] = {UMFD_LAYER_KEYS};
+        _Static_assert(sizeof(roles) % 4 == 0,
+                       "UMFD_LAYER_KEYS is groups of {button, role, a, b}");
 
-    stdio_init_all();
+        layer_engine_init(&button_layers, report_btn_cnt,
+                          UMFD_LAYER_HOLD_MS * 1000, UMFD_LAYER_DTAP_MS * 1000,
+                          UMFD_LAYER_CHORD_MS * 1000,
+                          UMFD_LAYER_PULSE_MS * 1000, time_us_32());
+        for (i = 0; i < (int)sizeof(roles); i += 4) {
+            if (roles[i] < report_btn_cnt) {
+                layer_engine_set(&button_layers, roles[i], roles[i + 1],
+                                 roles[i + 2], roles[i + 3]);
+            }
+        }
+        // outputs past the last button get report bits of their own
+        report_btn_cnt = layer_engine_btn_cnt(&button_layers, report_btn_cnt);
+    }
+#endif
 
-    // Setup uFD buttons.
-    // Uses gpios 0-19
-    for (i = 0; i < 20; i++) {
-        gpio_pull_up(i);
-        reg_dinput_btn(global_d_btns + d_btn_cnt, i);
-        reg_btn(phy_btns + phy_btn_cnt, global_d_btns + d_btn_cnt, i, 0);
-        d_btn_cnt++;
-        phy_btn_cnt++;
+    // hat contacts take the IDs past the last report button, layer outputs
+    // included, so they are queued and debounced like buttons but never
+    // reported as such
+    for (; d_btn_cnt < report_btn_cnt; d_btn_cnt++) {
+        reg_dinput_btn(global_d_btns + d_btn_cnt, d_btn_cnt);
     }
+#ifdef UMFD_HAT_GPIOS
+    {
+        uint8_t ids[HAT_8WAY];
+        int h, n;
+
+        for (h = 0; h < (int)sizeof(hat_gpios) / UMFD_HAT_WAYS; h++) {
+            for (n = 0; n < UMFD_HAT_WAYS && d_btn_cnt < MAX_DINPUT_BTNS; n++) {
+                i = hat_gpios[h * UMFD_HAT_WAYS + n];
+                gpio_pull_up(i);
+                reg_dinput_btn(global_d_btns + d_btn_cnt, d_btn_cnt);
+                reg_btn(phy_btns + phy_btn_cnt, global_d_btns + d_btn_cnt, i,
+                        0);
+                ids[n] = d_btn_cnt;
+                d_btn_cnt++;
+                phy_btn_cnt++;
+            }
+            if (n == UMFD_HAT_WAYS) {
+                hat_add(&gamepad_hats, UMFD_HAT_WAYS, UMFD_HAT_POLICY, ids);
+            }
+        }
+    }
+#endif
     global_d_btn_cnt = d_btn_cnt;
+    global_phy_btn_cnt = phy_btn_cnt;
+#if UMFD_LAYERS
+    // the hat contacts go through the engine untouched
+    layer_engine_pass(&button_layers, report_btn_cnt,
+                      global_d_btn_cnt - report_btn_cnt);
+#endif
+
+#if UMFD_KEYBOARD
+    {
+        static uint8_t const keys[] = {UMFD_KEYMAP};
+        _Static_assert(sizeof(keys) % 4 == 0,
+                       "UMFD_KEYMAP is groups of {button, usage, mods, also "
+                       "gamepad}");
+
+        keymap_init(&keymap);
+        for (i = 0; i < (int)sizeof(keys); i += 4) {
+            if (keys[i] < report_btn_cnt) {
+                keymap_set(&keymap, keys[i], keys[i + 1], keys[i + 2],
+                           keys[i + 3]);
+            }
+        }
+    }
+    // a key held is held until the release, repeating it buys nothing
+    report_sched_init(&keyboard_sched, 0,
+                      UMFD_REPORT_MODE == REPORT_MODE_ALWAYS
+                          ? REPORT_MODE_ON_CHANGE
+                          : UMFD_REPORT_MODE,
+                      UMFD_REPORT_KEEPALIVE_MS);
+#endif
+
+#if UMFD_ADC_AXES
+    adc_axes_init(&adc_axes, UMFD_ADC_AXES, UMFD_ADC_OVERSAMPLE,
+                  UMFD_ADC_SAMPLE_HZ);
+    for (i = 0; i < UMFD_ADC_AXES; i++) {
+        axis_init(adc_axes.axes + i, UMFD_ADC_FILTER, UMFD_ADC_FILTER_SHIFT,
+                  UMFD_ADC_DEADBAND, UMFD_ADC_HYSTERESIS);
+    }
+#endif
+
+#if UMFD_SAMPLE_RATE_HZ
+    // debounce windows are real time once samples come at a fixed rate
+    set_gpio_debounce_mode(board_pins & ~UMFD_EAGER_GPIO_MASK,
+                           DEBOUNCE_MODE_WINDOW,
+                           debounce_mask_from_us(UMFD_DEBOUNCE_US,
+                                                 UMFD_SAMPLE_RATE_HZ));
+    set_gpio_debounce_mode(board_pins & UMFD_EAGER_GPIO_MASK,
+                           DEBOUNCE_MODE_EAGER,
+                           debounce_mask_from_us(UMFD_EAGER_LOCKOUT_US,
+                                                 UMFD_SAMPLE_RATE_HZ));
+    for (i = 0; i < phy_btn_cnt; i++) {
+        if ((UMFD_EAGER_GPIO_MASK >> phy_btns[i].gpio_id) & 0x1) {
+            set_btn_debounce_mode(phy_btns + i, DEBOUNCE_MODE_EAGER,
+                                  debounce_mask_from_us(UMFD_EAGER_LOCKOUT_US,
+                                                        UMFD_SAMPLE_RATE_HZ));
+        } else {
+            set_btn_debounce_mask(phy_btns + i,
+                                  debounce_mask_from_us(UMFD_DEBOUNCE_US,
+                                                        UMFD_SAMPLE_RATE_HZ));
+        }
+    }
+    sampler_init(&gpio_sampler, UMFD_SAMPLE_RATE_HZ);
+#else
+    // without a fixed rate the lockout is counted in loop iterations
+    set_gpio_debounce_mode(board_pins & UMFD_EAGER_GPIO_MASK,
+                           DEBOUNCE_MODE_EAGER, 0x0f);
+    for (i = 0; i < phy_btn_cnt; i++) {
+        if ((UMFD_EAGER_GPIO_MASK >> phy_btns[i].gpio_id) & 0x1) {
+            set_btn_debounce_mode(phy_btns + i, DEBOUNCE_MODE_EAGER,
+                                  phy_btns[i].gpio_debounce_mask);
+        }
+    }
+#endif
+    for (i = 0; i < LATENCY_STAGES; i++) {
+        latency_hist_reset(latency_stages + i);
+    }
+    gpio_debounce_latency = latency_stages + LATENCY_DEBOUNCE;
 
-    // Setup for Pimironi Unicorn Buttons
-    //
-    //gpio_pull_up(12);
-    //reg_dinput_btn(global_d_btns + d_btn_cnt, 0);
-    //reg_btn(phy_btns + phy_btn_cnt, global_d_btns + d_btn_cnt, 12, 0);
-    //d_btn_cnt++; phy_btn_cnt++;
-    //gpio_pull_up(13);
-    //reg_dinput_btn(global_d_btns + d_btn_cnt, 1);
-    //reg_btn(phy_btns + phy_btn_cnt, global_d_btns + d_btn_cnt, 13, 0);
-    //d_btn_cnt++; phy_btn_cnt++;
-    //gpio_pull_up(14);
-    //reg_dinput_btn(global_d_btns + d_btn_cnt, 2);
-    //reg_btn(phy_btns + phy_btn_cnt, global_d_btns + d_btn_cnt, 14, 0);
-    //d_btn_cnt++; phy_btn_cnt++;
-    //gpio_pull_up(15);
-    //reg_dinput_btn(global_d_btns + d_btn_cnt, 3);
-    //reg_btn(phy_btns + phy_btn_cnt, global_d_btns + d_btn_cnt, 15, 0);
-    //d_btn_cnt++; phy_btn_cnt++;
+    // a mapping stored in flash replaces the profile's from the start
+    if (config_store_init(&config_store, board_pins, BOARD_BTN_CNT,
+                          UMFD_DEBOUNCE_US)) {
+        gpio_map_build(gpio_maps, &config_store.active, UMFD_SAMPLE_RATE_HZ);
+        gpio_map_apply(gpio_maps);
+        gpio_map_next = 1;
+    }
+    telem_counters_reset(&telem_counters, time_us_32());
+#if UMFD_SOF_SYNC
+    frame_sync_init(&usb_frame_sync, UMFD_SOF_LEAD_US);
+#endif
+#if UMFD_SUSPEND
+    usb_suspend_init(&usb_suspend, UMFD_SUSPEND_WAKE_TIMEOUT_MS * 1000);
+#endif
+#if UMFD_CDC_CONSOLE
+    telem_ring_init(&console_ring);
+#endif
+#if GPIO_TRACE
+    trace_recorder_init(&gpio_trace, UMFD_SAMPLE_RATE_HZ);
+#endif
+#if UMFD_DISPLAY
+    display_init(&mfd_display, UMFD_DISPLAY_WIDTH, UMFD_DISPLAY_HEIGHT);
+#endif
+#if UMFD_BACKLIGHT
+    backlight_init(&button_backlight, UMFD_BACKLIGHT_LEDS, UMFD_BACKLIGHT_PIN);
+    backlight_fill(&button_backlight, 0, UMFD_BACKLIGHT_LEDS,
+                   UMFD_BACKLIGHT_COLOR);
+    backlight_set_feedback(&button_backlight, UMFD_BACKLIGHT_FEEDBACK,
+                           UMFD_BACKLIGHT_PRESS_COLOR, UMFD_BACKLIGHT_FADE_MS);
+#endif
+
+    // one button bit per registered button, nothing more, split over the
+    // panels
+    {
+        static uint16_t const sizes[] = {UMFD_HID_PANEL_BUTTONS};
+        uint16_t first[UMFD_HID_PANELS], count[UMFD_HID_PANELS];
+
+        hid_panels_split(report_btn_cnt, UMFD_HID_PANELS, sizes,
+                         sizeof(sizes) / sizeof(sizes[0]), first, count);
+        for (i = 0; i < UMFD_HID_PANELS; i++) {
+            hid_panel_init(hid_panels + i, i, i ? 0 : REPORT_ID_GAMEPAD,
+                           first[i], count[i], i ? 0 : UMFD_GAMEPAD_HATS,
+                           i ? 0 : UMFD_GAMEPAD_AXES, UMFD_REPORT_MODE,
+                           UMFD_REPORT_KEEPALIVE_MS);
+        }
+        // the hat contacts past the report buttons show up in panel 0's hats
+        hid_panel_watch(hid_panels, report_btn_cnt,
+                        global_d_btn_cnt - report_btn_cnt);
+#if UMFD_KEYBOARD
+        // any button can type a key
+        memset(hid_panels[0].mask, 0xff, sizeof(hid_panels[0].mask));
+#endif
+    }
+    usb_desc_hid_init(&hid_panels[0].layout, UMFD_KEYBOARD, UMFD_BACKLIGHT);
+    for (i = 1; i < UMFD_HID_PANELS; i++) {
+        usb_desc_hid_panel_init(i, &hid_panels[i].layout);
+    }
 
     board_init();
     tusb_init();
+#if UMFD_SOF_SYNC
+    hal_usb_sof_start(usb_sof_cb, &usb_frame_sync);
+#endif
+
+#if UMFD_SHIFTREG
+    shiftreg_start(&sr_chain);
+#endif
+#if UMFD_ADC_AXES
+    adc_axes_start(&adc_axes);
+#endif
+#if UMFD_ENCODERS
+    encoder_bank_start(&encoder_bank);
+#endif
+#if UMFD_DISPLAY
+    // the panel comes up over the next few hundred ms of display_task()
+    display_panel_start(&mfd_display, UMFD_DISPLAY_SCK_PIN,
+                        UMFD_DISPLAY_MOSI_PIN, UMFD_DISPLAY_CS_PIN,
+                        UMFD_DISPLAY_DC_PIN, UMFD_DISPLAY_RST_PIN,
+                        UMFD_DISPLAY_SPI_HZ);
+#endif
+#if UMFD_BACKLIGHT
+    backlight_start(&button_backlight);
+#endif
+#if UMFD_CORE1_SCAN
+    multicore_launch_core1(core1_scan_main);
+#elif UMFD_SAMPLE_RATE_HZ
+    sampler_start(&gpio_sampler);
+#endif
+
+#ifdef UMFD_DEBOUNCE_BENCH
+    debounce_bench_run();
+#endif
 
     while (1) {
         tud_task(); // tinyusb device task
+        if (suspend_task()) {
+            continue; // asleep, the rest waits for the host or a button
+        }
         led_blinking_task();
-        poll_registered_gpios(phy_btns, phy_btn_cnt);
+        input_task();
         hid_task();
+        stats_print_task();
+        console_task();
+        config_task();
+        display_task();
+        backlight_task();
     }
 
     return 0;
 }
 
+//--------------------------------------------------------------------+
+// INPUT TASK
+//--------------------------------------------------------------------+
+
+static void publish_input(uint32_t t_us, uint32_t edge_t_us) {
+    static struct input_snapshot snap;
+
+    pack_dinput_btns(global_d_btns + BOARD_BTN_CNT,
+                     global_d_btn_cnt - BOARD_BTN_CNT, snap.buttons);
+    if (gpio_map_active) {
+        snap.buttons[0] |= gpio_map_pack(gpio_map_active, gpio_debounce.state);
+    } else {
+        snap.buttons[0] |= board_pack(gpio_debounce.state, board_pins);
+    }
+    hat_set_update(&gamepad_hats, snap.buttons, snap.hats);
+#if UMFD_LAYERS
+    layer_engine_update(&button_layers, snap.buttons, t_us, snap.buttons);
+#endif
+#if UMFD_ADC_AXES
+    adc_axes_values(&adc_axes, snap.axes);
+#endif
+#if UMFD_ENCODERS
+    encoder_bank_axes(&encoder_bank, snap.axes + UMFD_ADC_AXES);
+#endif
+    snap.gen++;
+    snap.sample_t_us = t_us;
+    snap.edge_t_us = edge_t_us;
+    inputq_push(&input_queue, &snap);
+}
+
+// Debounce one sample and publish the result if any button changed.
+static void scan_sample(uint32_t gpio, uint32_t t_us) {
+    uint32_t edge_t_us;
+
+    telem_counters.samples++;
+#if GPIO_TRACE
+    trace_capture(&gpio_trace, gpio, t_us);
+#endif
+    if (poll_gpio_sample(global_phy_btns, global_phy_btn_cnt, gpio, t_us,
+                         &edge_t_us)) {
+        publish_input(t_us, edge_t_us);
+    }
+    __atomic_store_n(&last_sample_t_us, t_us, __ATOMIC_RELEASE);
+}
+
+// Move the direct GPIO buttons over to a new mapping: pulls, debounce and
+// the report permutation. Scanning side only, or before scanning starts.
+static void gpio_map_apply(struct gpio_map *m) {
+    uint32_t old = gpio_map_active ? gpio_map_active->pins : board_pins;
+    int i;
+
+    unreg_gpio_pins(old & ~m->pins);
+    reg_gpio_pins(m->pins, m->active_low);
+    for (i = 0; i < CONFIG_PINS; i++) {
+        if (!((m->pins >> i) & 0x1)) {
+            if ((old >> i) & 0x1) {
+                gpio_disable_pulls(i);
+            }
+            continue;
+        }
+        if ((m->active_low >> i) & 0x1) {
+            gpio_pull_up(i);
+        } else {
+            gpio_pull_down(i);
+        }
+        set_gpio_debounce_mode(1u << i,
+                               ((m->eager >> i) & 0x1) ? DEBOUNCE_MODE_EAGER
+                                                       : DEBOUNCE_MODE_WINDOW,
+                               m->debounce_mask[i]);
+    }
+    gpio_map_active = m;
+}
+
+// Take a mapping core0 just committed, between two samples.
+static void gpio_map_task(void) {
+    struct gpio_map *m = __atomic_load_n(&gpio_map_pending, __ATOMIC_ACQUIRE);
+    uint32_t now_us;
+
+    if (!m) {
+        return;
+    }
+    gpio_map_apply(m);
+    __atomic_store_n(&gpio_map_pending, NULL, __ATOMIC_RELEASE);
+    // buttons may have moved to other report bits
+    now_us = time_us_32();
+    publish_input(now_us, now_us);
+}
+
+// Scan the key matrix if its period is up.
+static void matrix_task(void) {
+#if UMFD_MATRIX
+    static uint32_t start_us = 0;
+    uint32_t now_us = time_us_32();
+
+    if (now_us - start_us < UMFD_MATRIX_SCAN_US)
+        return; // not enough time
+    start_us = now_us;
+
+    if (matrix_scan(&key_matrix)) {
+        publish_input(now_us, now_us);
+    }
+#endif
+}
+
+// Debounce the newest shift register frame, if one came in since last time.
+static void shiftreg_task(void) {
+#if UMFD_SHIFTREG
+    uint32_t now_us;
+
+    if (shiftreg_poll(&sr_chain)) {
+        now_us = time_us_32();
+        publish_input(now_us, now_us);
+    }
+#endif
+}
+
+// Filter the newest ADC samples if the axis period is up, and publish when an
+// axis moved past its hysteresis.
+static void axis_task(void) {
+#if UMFD_ADC_AXES
+    static uint32_t start_us = 0;
+    uint32_t now_us = time_us_32();
+
+    if (now_us - start_us < UMFD_ADC_POLL_US)
+        return; // not enough time
+    start_us = now_us;
+
+    if (adc_axes_poll(&adc_axes)) {
+        publish_input(now_us, now_us);
+    }
+#endif
+}
+
+// Decode whatever transitions the encoders' DMA wrote since last time and
+// move the detent pulses along. Cheap enough to run on every pass.
+static void encoder_task(void) {
+#if UMFD_ENCODERS
+    uint32_t now_us = time_us_32();
+
+    if (encoder_bank_poll(&encoder_bank, now_us)) {
+        publish_input(now_us, now_us);
+    }
+#endif
+}
+
+// Run out the layer engine's hold and chord windows and tap pulses, and
+// publish what they resolved to.
+static void layer_task(void) {
+#if UMFD_LAYERS
+    uint32_t now_us = time_us_32();
+
+    if (layer_engine_poll(&button_layers, now_us)) {
+        publish_input(now_us, now_us);
+    }
+#endif
+}
+
+// Take the GPIO levels that woke the device from suspend as debounced and
+// publish them ahead of any new sample, so the press that woke it is queued
+// even if it is over before the scan restarts.
+static void wake_task(void) {
+#if UMFD_SUSPEND
+    uint32_t pins, gpio, t_us;
+
+    if (!usb_suspend_take_wake(&usb_suspend, &pins, &gpio, &t_us)) {
+        return;
+    }
+    if (force_gpio_levels(global_phy_btns, global_phy_btn_cnt, pins, gpio)) {
+        publish_input(t_us, t_us);
+    }
+#endif
+}
+
+#if UMFD_CORE1_SCAN
+// Wait here while core0 has the device suspended. Returns true if it did.
+static bool scan_park_task(void) {
+#if UMFD_SUSPEND
+    if (!__atomic_load_n(&scan_park, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    __atomic_store_n(&scan_parked, true, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&scan_park, __ATOMIC_ACQUIRE)) {
+        __wfe();
+    }
+    __atomic_store_n(&scan_parked, false, __ATOMIC_RELEASE);
+    return true;
+#else
+    return false;
+#endif
+}
+
+// core1 does nothing but sample on a fixed period, so neither tud_task() nor
+// an interrupt on core0 can push a sample late.
+void core1_scan_main(void) {
+    struct gpio_sample sample;
+    uint32_t next_us = time_us_32();
+#if UMFD_SOF_SYNC
+    uint32_t sof_us, synced_sof_us = 0;
+#endif
+
+    // lets core0 park this core while it writes the config to flash
+    flash_safe_execute_core_init();
+    while (1) {
+        if (scan_park_task()) {
+            // the grid starts over after a suspend
+            next_us = time_us_32();
+        }
+        while ((int32_t)(time_us_32() - next_us) < 0) {
+            tight_loop_contents();
+        }
+        next_us += gpio_sampler.period_us;
+        wake_task();
+#if UMFD_SOF_SYNC
+        // once a frame, move the sample grid towards its build point
+        sof_us = frame_sync_sof_us(&usb_frame_sync);
+        if (sof_us != synced_sof_us) {
+            synced_sof_us = sof_us;
+            next_us += frame_sync_sample_offset(&usb_frame_sync, sof_us,
+                                                next_us,
+                                                gpio_sampler.period_us);
+        }
+#endif
+        sampler_capture(&gpio_sampler);
+        while (sampler_pop(&gpio_sampler, &sample)) {
+            scan_sample(sample.gpio, sample.t_us);
+        }
+        gpio_map_task();
+        matrix_task();
+        shiftreg_task();
+        axis_task();
+        encoder_task();
+        layer_task();
+        inputq_flush(&input_queue);
+    }
+}
+#endif
+
+void input_task(void) {
+#if UMFD_CORE1_SCAN
+    return;
+#elif UMFD_SAMPLE_RATE_HZ
+    struct gpio_sample sample;
+
+    wake_task();
+    while (sampler_pop(&gpio_sampler, &sample)) {
+        scan_sample(sample.gpio, sample.t_us);
+    }
+    gpio_map_task();
+    matrix_task();
+    shiftreg_task();
+    axis_task();
+    encoder_task();
+    layer_task();
+    inputq_flush(&input_queue);
+#else
+    wake_task();
+    scan_sample(gpio_get_all(), time_us_32());
+    gpio_map_task();
+    matrix_task();
+    shiftreg_task();
+    axis_task();
+    encoder_task();
+    layer_task();
+    inputq_flush(&input_queue);
+#endif
+}
+
 //--------------------------------------------------------------------+
 // Device callbacks
 //--------------------------------------------------------------------+
 
 // Invoked when device is mounted
 void tud_mount_cb(void) {
-    return;
+    int i;
+
+    // a fresh host has seen nothing yet
+    for (i = 0; i < UMFD_HID_PANELS; i++) {
+        report_sched_reset(&hid_panels[i].sched);
+    }
+#if UMFD_KEYBOARD
+    report_sched_reset(&keyboard_sched);
+#endif
+#if UMFD_SUSPEND
+    // a bus reset ends a suspend without a resume
+    usb_suspend_resume(&usb_suspend, time_us_32());
+#endif
+    CONSOLE_LOG("usb: mounted\r\n");
 }
 
 // Invoked when device is unmounted
 void tud_umount_cb(void) {
-    return;
+    int i;
+
+    for (i = 0; i < UMFD_HID_PANELS; i++) {
+        report_sched_reset(&hid_panels[i].sched);
+    }
+#if UMFD_KEYBOARD
+    report_sched_reset(&keyboard_sched);
+#endif
+#if UMFD_SUSPEND
+    usb_suspend_resume(&usb_suspend, time_us_32());
+#endif
+    CONSOLE_LOG("usb: unmounted\r\n");
 }
 
 // Invoked when usb bus is suspended
 // remote_wakeup_en : if host allow us  to perform remote wakeup
 // Within 7ms, device must draw an average of current less than 2.5 mA from bus
+// (the main loop goes to sleep in suspend_task())
 void tud_suspend_cb(bool remote_wakeup_en) {
+#if UMFD_SUSPEND
+    usb_suspend_enter(&usb_suspend, remote_wakeup_en, time_us_32());
+#else
     (void)remote_wakeup_en;
+#endif
+    CONSOLE_LOG("usb: suspended\r\n");
     return;
 }
 
 // Invoked when usb bus is resumed
-void tud_resume_cb(void) { blink_interval_ms = 1500; }
+void tud_resume_cb(void) {
+    blink_interval_ms = 1500;
+#if UMFD_SUSPEND
+    usb_suspend_resume(&usb_suspend, time_us_32());
+#endif
+    CONSOLE_LOG("usb: resumed\r\n");
+}
 
 //--------------------------------------------------------------------+
 // USB HID
 //--------------------------------------------------------------------+
 
-static int send_hid_report() {
-    struct dinput_btn_reg *d_btn;
-    uint32_t button_state = 0;
+// The report carrying new edges that TinyUSB has not completed yet: when it
+// was handed over, and the oldest raw edge in it
+static bool latency_in_flight;
+static uint32_t latency_sent_us;
+static uint32_t latency_edge_us;
+// The report in flight caught up with every queued edge; the newest sample
+// it reflects
+static bool age_in_flight;
+static uint32_t age_sample_us;
+// What GET_REPORT on the latency feature report returns, picked by the host
+// with SET_REPORT
+static uint8_t latency_feature_stage;
+static uint8_t latency_feature_page;
+#if UMFD_KEYBOARD
+// The keyboard report of the last state went out, its gamepad report has
+// not yet
+static bool gamepad_pending;
+#endif
+// State of the last report handed to TinyUSB; the backlight follows it
+static struct input_snapshot shown;
+
+// Send what changed in state s on panel 0: the keyboard report first, then,
+// on the next call, the gamepad report. Returns 0 when a report went out, 1
+// when neither changed and -1 when the endpoint was busy.
+static int send_input_reports(struct input_snapshot const *s) {
+    struct hid_panel *p = hid_panels;
 
-    // skip if hid is not ready yet
-    if (!tud_hid_ready()) {
-        return -1;
+#if UMFD_KEYBOARD
+    uint32_t buttons[DINPUT_BTN_WORDS];
+    int ret;
+
+    if (!gamepad_pending) {
+        ret = send_keyboard_report(&keyboard_sched, REPORT_ID_KEYBOARD,
+                                   &keymap, s->buttons);
+        if (ret != 1) {
+            gamepad_pending = ret == 0;
+            return ret;
+        }
     }
+    keymap_gamepad_buttons(&keymap, s->buttons, buttons);
+    ret = send_gamepad_report(&p->sched, &p->layout, buttons, s->hats,
+                              s->axes);
+    if (ret >= 0) {
+        gamepad_pending = false;
+    }
+    return ret;
+#else
+    return send_gamepad_report(&p->sched, &p->layout, s->buttons, s->hats,
+                               s->axes);
+#endif
+}
 
-    for (d_btn = global_d_btns; d_btn < global_d_btns + global_d_btn_cnt; d_btn++) {
-        if (d_btn->btn_id > MAX_DINPUT_BTN_ID || d_btn->btn_id < 0) {
-            // Do we want to check here? This takes time. We could just validate at registration..
-            continue;
+// Send the next state on every panel: the oldest queued edges that fit in
+// one report, or the last state again when nothing is queued (for the
+// ALWAYS and KEEPALIVE modes). Queued edges are dropped once one panel took
+// them; a panel that was busy owes them and reports them along with the
+// next state, which is held back while it would change one of that panel's
+// owed buttons again (see panel.h). With keyboard output, panel 0 sends the
+// keyboard report first and the gamepad report of the same state on a later
+// call, so it owes the state until then.
+static int send_hid_report(void) {
+    struct input_snapshot next;
+    uint32_t sample_us = __atomic_load_n(&last_sample_t_us, __ATOMIC_ACQUIRE);
+    uint32_t now_us;
+    uint16_t merged;
+    int rets[UMFD_HID_PANELS];
+#if UMFD_KEYBOARD && UMFD_HID_PANELS > 1
+    uint32_t pad_buttons[DINPUT_BTN_WORDS];
+#else
+    uint32_t const *pad_buttons = next.buttons;
+#endif
+    int ret = -1;
+    int i;
+
+    merged = inputq_peek_merged(&input_queue, shown.buttons, &next);
+    if (merged && !hid_panels_can_take(hid_panels, UMFD_HID_PANELS,
+                                       shown.buttons, next.buttons)) {
+        // a busy panel has to catch up first
+        merged = 0;
+    }
+    if (!merged) {
+        next = shown;
+    }
+#if UMFD_KEYBOARD
+    // a new state starts over with its keyboard report; the gamepad report
+    // of the last one would be stale, and its edges are all still in next
+    if (merged) {
+        gamepad_pending = false;
+    }
+#endif
+#if UMFD_KEYBOARD && UMFD_HID_PANELS > 1
+    // buttons that only type a key stay released on the other panels too
+    keymap_gamepad_buttons(&keymap, next.buttons, pad_buttons);
+#endif
+    for (i = 0; i < UMFD_HID_PANELS; i++) {
+        rets[i] = i ? send_gamepad_report(&hid_panels[i].sched,
+                                          &hid_panels[i].layout, pad_buttons,
+                                          next.hats, next.axes)
+                    : send_input_reports(&next);
+        // 0 when any panel sent, 1 when the others had nothing to send
+        if (rets[i] == 0 || (rets[i] > 0 && ret < 0)) {
+            ret = rets[i];
         }
-        button_state |= (d_btn->state << d_btn->btn_id);
     }
+    if (ret < 0) {
+        // only count tries that had something to say, not every idle loop
+        if (merged || hid_panels[0].sched.mode == REPORT_MODE_ALWAYS) {
+            telem_counters.reports_busy++;
+        }
+        return ret;
+    }
+#if UMFD_KEYBOARD
+    if (gamepad_pending) {
+        rets[0] = -1;
+    }
+#endif
+    for (i = 0; i < UMFD_HID_PANELS; i++) {
+        hid_panel_settle(hid_panels + i, rets[i], next.buttons);
+    }
+    if (ret == 0) {
+        if (!boot_first_report_us) {
+            boot_first_report_us = time_us_32();
+        }
+#if UMFD_SOF_SYNC
+        frame_sync_built(&usb_frame_sync, time_us_32());
+#endif
+        telem_counters.reports_sent++;
+    } else {
+        telem_counters.reports_unchanged++;
+    }
+    inputq_pop(&input_queue, merged);
+    if (ret == 0) {
+        age_in_flight = inputq_empty(&input_queue);
+        age_sample_us = sample_us;
+    }
+    // oldest debounced change in this report to tud_hid_report() latency
+    if (ret == 0 && merged) {
+        now_us = time_us_32();
+        latency_hist_add(latency_stages + LATENCY_QUEUE,
+                         now_us - next.sample_t_us);
+        latency_in_flight = true;
+        latency_sent_us = now_us;
+        latency_edge_us = next.edge_t_us;
+    } else if (ret == 0) {
+        // a repeat of the last state, nothing new to time
+        latency_in_flight = false;
+    }
+    shown = next;
+    return ret;
+}
+
+#if UMFD_SOF_SYNC
+// Once a frame, nudge the sample timer towards a sample right before the
+// build point, and debounce every sample taken so far.
+static void sof_sync_samples(void) {
+#if UMFD_SAMPLE_RATE_HZ && !UMFD_CORE1_SCAN
+    static uint32_t synced_sof_us;
+    uint32_t sof_us = frame_sync_sof_us(&usb_frame_sync);
 
-    hid_gamepad_report_t report = {.x = 50,
-                                   .y = 0,
-                                   .z = 0,
-                                   .rz = 0,
-                                   .rx = 0,
-                                   .ry = 0,
-                                   .hat = global_hat_state,
-                                   .buttons = button_state};
-    tud_hid_report(REPORT_ID_GAMEPAD, &report, sizeof(report));
+    if (sof_us != synced_sof_us) {
+        synced_sof_us = sof_us;
+        hal_sample_timer_nudge(frame_sync_sample_offset(
+            &usb_frame_sync, sof_us, gpio_sampler.last_t_us,
+            gpio_sampler.period_us));
+    }
+    input_task();
+#endif
 }
+#endif
 
-// Every 1ms, we will sent 1 report for each HID profile (keyboard, mouse etc
-// ..) tud_hid_report_complete_cb() is used to send the next report after
-// previous one is complete
+// In REPORT_MODE_ALWAYS we send 1 report every 1ms. The change driven modes
+// try on every loop and let the scheduler drop unchanged reports, so a new
+// state goes out as soon as the endpoint is free.
 void hid_task(void) {
+#if !UMFD_SOF_SYNC
     const uint32_t interval_ms = 1;
     static uint32_t start_ms = 0;
+#endif
 
-    if (board_millis() - start_ms < interval_ms)
-        return; // not enough time
-    start_ms += interval_ms;
+#if UMFD_SUSPEND
+    // woken by a button, the queue holds on to it until the host resumes
+    if (usb_suspend.state != USB_SUSPEND_AWAKE)
+        return;
+#endif
+#if UMFD_SOF_SYNC
+    // the SOF paces every mode, the report waits for the end of the frame
+    if (!frame_sync_open(&usb_frame_sync, time_us_32()))
+        return; // not late enough in the frame
+    sof_sync_samples();
+#else
+    if (hid_panels[0].sched.mode == REPORT_MODE_ALWAYS) {
+        if (board_millis() - start_ms < interval_ms)
+            return; // not enough time
+        start_ms += interval_ms;
+    }
+#endif
 
     send_hid_report();
 }
@@ -209,13 +1342,57 @@ void hid_task(void) {
 // Note: For composite reports, report[0] is report ID
 void tud_hid_report_complete_cb(uint8_t instance, uint8_t const *report,
                                 uint16_t len) {
-    (void)instance;
     (void)len;
 
-    uint8_t next_report_id = report[0] + 1;
+    uint32_t now_us;
+#if UMFD_SUSPEND
+    uint32_t wake_us;
+#endif
 
-    if (next_report_id < REPORT_ID_COUNT) {
-        send_hid_report(next_report_id, board_button_read());
+    // the other panels only send their gamepad report, without an ID
+    if (instance) {
+        if (instance >= UMFD_HID_PANELS) {
+            return;
+        }
+        report_sched_complete(&hid_panels[instance].sched);
+    } else if (report[0] == REPORT_ID_GAMEPAD) {
+        report_sched_complete(&hid_panels[0].sched);
+#if UMFD_KEYBOARD
+    } else if (report[0] == REPORT_ID_KEYBOARD) {
+        report_sched_complete(&keyboard_sched);
+#endif
+    } else {
+        return;
+    }
+    if (latency_in_flight) {
+        now_us = time_us_32();
+        latency_hist_add(latency_stages + LATENCY_USB,
+                         now_us - latency_sent_us);
+        latency_hist_add(latency_stages + LATENCY_TOTAL,
+                         now_us - latency_edge_us);
+        latency_in_flight = false;
+    }
+    if (age_in_flight) {
+        latency_hist_add(latency_stages + LATENCY_AGE,
+                         time_us_32() - age_sample_us);
+        age_in_flight = false;
+    }
+#if UMFD_SUSPEND
+    if (usb_suspend_report_done(&usb_suspend, time_us_32(), &wake_us)) {
+        latency_hist_add(latency_stages + LATENCY_WAKE, wake_us);
+    }
+#endif
+    // the endpoint is free again, hand it the next batch of queued edges now
+    // rather than on the next loop
+#if UMFD_SOF_SYNC
+    // (with frame sync, only in the build window; this is usually early in
+    // the next frame, so hid_task() gets to it)
+    if (!frame_sync_open(&usb_frame_sync, time_us_32())) {
+        return;
+    }
+#endif
+    if (hid_panels[0].sched.mode != REPORT_MODE_ALWAYS) {
+        send_hid_report();
     }
 }
 
@@ -225,13 +1402,19 @@ void tud_hid_report_complete_cb(uint8_t instance, uint8_t const *report,
 uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id,
                                hid_report_type_t report_type, uint8_t *buffer,
                                uint16_t reqlen) {
-    // TODO not Implemented
-    (void)instance;
-    (void)report_id;
-    (void)report_type;
-    (void)buffer;
-    (void)reqlen;
-
+    // the feature reports live on the first interface only
+    if (instance) {
+        return 0;
+    }
+    if (report_id == REPORT_ID_LATENCY &&
+        report_type == HID_REPORT_TYPE_FEATURE) {
+        return latency_feature_read(latency_stages, latency_feature_stage,
+                                    latency_feature_page, buffer, reqlen);
+    }
+    if (report_id == REPORT_ID_CONFIG &&
+        report_type == HID_REPORT_TYPE_FEATURE) {
+        return config_feature_read(&config_store, buffer, reqlen);
+    }
     return 0;
 }
 
@@ -240,28 +1423,508 @@ uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id,
 void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id,
                            hid_report_type_t report_type, uint8_t const *buffer,
                            uint16_t bufsize) {
-    (void)instance;
-
-    if (report_type == HID_REPORT_TYPE_OUTPUT) {
-        // Set keyboard LED e.g Capslock, Numlock etc...
-        if (report_id == REPORT_ID_KEYBOARD) {
-            // bufsize should be (at least) 1
-            if (bufsize < 1)
-                return;
-
-            uint8_t const kbd_leds = buffer[0];
-
-            if (kbd_leds & KEYBOARD_LED_CAPSLOCK) {
-                // Capslock On: disable blink, turn led on
-                blink_interval_ms = 0;
-                board_led_write(true);
-            } else {
-                // Caplocks Off: back to normal blink
-                board_led_write(false);
-                blink_interval_ms = 1500;
-            }
+    int i;
+
+    if (instance) {
+        return;
+    }
+    // reports on the OUT endpoint arrive with their ID still in front
+    if (report_id == 0 && bufsize) {
+        report_id = buffer[0];
+        report_type = HID_REPORT_TYPE_OUTPUT;
+        buffer++;
+        bufsize--;
+    }
+#if UMFD_BACKLIGHT
+    if (report_id == REPORT_ID_BACKLIGHT &&
+        report_type == HID_REPORT_TYPE_OUTPUT) {
+        backlight_report(&button_backlight, buffer, bufsize);
+        return;
+    }
+#endif
+    // a commit is only stored and applied later, by config_task()
+    if (report_id == REPORT_ID_CONFIG &&
+        report_type == HID_REPORT_TYPE_FEATURE) {
+        config_feature_write(&config_store, buffer, bufsize, UMFD_DEBOUNCE_US);
+        return;
+    }
+    if (report_id != REPORT_ID_LATENCY ||
+        report_type != HID_REPORT_TYPE_FEATURE || bufsize < 2) {
+        return;
+    }
+    // {stage, page} picks what the next GET_REPORT returns, stage
+    // LATENCY_FEATURE_RESET clears every stage instead
+    if (buffer[0] == LATENCY_FEATURE_RESET) {
+        for (i = 0; i < LATENCY_STAGES; i++) {
+            latency_hist_reset(latency_stages + i);
         }
+        return;
+    }
+    latency_feature_stage = buffer[0];
+    latency_feature_page = buffer[1];
+}
+
+//--------------------------------------------------------------------+
+// CONFIG TASK
+//--------------------------------------------------------------------+
+
+// Store a committed mapping in flash, then hand it to the scanning side.
+// Waits while the last one is still being taken over, since its map is the
+// one that would be rebuilt.
+void config_task(void) {
+    struct gpio_map *m;
+
+    if (!config_store.commit_pending ||
+        __atomic_load_n(&gpio_map_pending, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    if (config_store_save(&config_store)) {
+        m = gpio_maps + gpio_map_next;
+        gpio_map_next ^= 1;
+        gpio_map_build(m, &config_store.active, UMFD_SAMPLE_RATE_HZ);
+        __atomic_store_n(&gpio_map_pending, m, __ATOMIC_RELEASE);
+        CONSOLE_LOG("config: stored and applied\r\n");
+    } else {
+        config_store.status = CONFIG_ERR_FLASH;
+        CONSOLE_LOG("config: flash write failed\r\n");
+    }
+    config_store.commit_pending = false;
+}
+
+//--------------------------------------------------------------------+
+// SUSPEND TASK
+//--------------------------------------------------------------------+
+
+#if UMFD_SUSPEND
+// Running off the crystal with the scanning side stopped
+static bool suspend_low;
+
+// The PIO and ADC inputs stop with the scanning. PIO runs off clk_sys and
+// would only slow down, and the ADC free-runs off the USB PLL, which stays.
+static void scan_inputs_run(bool run) {
+#if UMFD_SHIFTREG
+    shiftreg_run(&sr_chain, run);
+#endif
+#if UMFD_ADC_AXES
+    adc_axes_run(&adc_axes, run);
+#endif
+#if UMFD_ENCODERS
+    encoder_bank_run(&encoder_bank, run);
+#endif
+    (void)run;
+}
+
+// Stop the scanning side, with what it sampled so far debounced. Returns
+// false while core1 has not parked yet.
+static bool scan_pause(void) {
+#if UMFD_CORE1_SCAN
+    __atomic_store_n(&scan_park, true, __ATOMIC_RELEASE);
+    if (!__atomic_load_n(&scan_parked, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+#else
+#if UMFD_SAMPLE_RATE_HZ
+    sampler_stop(&gpio_sampler);
+#endif
+    input_task();
+#endif
+    scan_inputs_run(false);
+    return true;
+}
+
+static void scan_resume(void) {
+    scan_inputs_run(true);
+#if UMFD_CORE1_SCAN
+    __atomic_store_n(&scan_park, false, __ATOMIC_RELEASE);
+    __sev();
+    // or a quick suspend again would take this park's ack
+    while (__atomic_load_n(&scan_parked, __ATOMIC_ACQUIRE)) {
+        tight_loop_contents();
+    }
+#elif UMFD_SAMPLE_RATE_HZ
+    sampler_start(&gpio_sampler);
+#endif
+}
+
+// The LED and the backlight go dark while asleep.
+static void suspend_lights(bool off) {
+#if UMFD_BACKLIGHT
+    static uint8_t brightness;
+
+    if (off) {
+        brightness = button_backlight.brightness;
+    }
+    backlight_set_brightness(&button_backlight, off ? 0 : brightness);
+    // dark before the clock drops, not whenever the loop comes round again
+    if (off) {
+        backlight_flush(&button_backlight, shown.buttons, board_millis());
+    } else {
+        backlight_poll(&button_backlight, shown.buttons, board_millis());
+    }
+#endif
+    if (off) {
+        board_led_write(false);
+    }
+}
+
+static void suspend_sleep(uint32_t now_us) {
+    usb_suspend_sleep(&usb_suspend, registered_gpio_pins(),
+                      gpio_debounce.state, now_us);
+    suspend_lights(true);
+    hal_power_low(true);
+    suspend_low = true;
+}
+
+static void suspend_wake(void) {
+    hal_power_low(false);
+    scan_resume();
+    suspend_lights(false);
+    suspend_low = false;
+}
+#endif
+
+// While the bus is suspended, sleep between interrupts at a low clock
+// instead of running the loop, until the host resumes or a button wakes the
+// device (and with it the host). Returns true while asleep.
+bool suspend_task(void) {
+#if UMFD_SUSPEND
+    uint32_t now_us = time_us_32();
+    uint32_t start_us, end_us, gpio;
+
+    if (usb_suspend.state != USB_SUSPEND_ASLEEP &&
+        !usb_suspend_poll(&usb_suspend, now_us)) {
+        if (suspend_low) {
+            // the host resumed on its own
+            suspend_wake();
+        }
+        return false;
+    }
+    if (!suspend_low) {
+        // the scanning side owns the debounce state until it has stopped
+        if (!scan_pause()) {
+            return true;
+        }
+        suspend_sleep(now_us);
+    }
+    start_us = time_us_32();
+    gpio = hal_sleep_gpio(usb_suspend.wake_pins, usb_suspend.sleep_levels,
+                          &end_us);
+    if (!usb_suspend_waited(&usb_suspend, start_us, end_us, gpio)) {
+        return true;
+    }
+    // a button: the scanning side queues it while the host wakes up
+    suspend_wake();
+    while (time_us_32() - usb_suspend.suspend_us <
+           USB_SUSPEND_WAKE_HOLDOFF_US) {
+        tight_loop_contents();
+    }
+    if (tud_remote_wakeup()) {
+        CONSOLE_LOG("usb: remote wakeup\r\n");
+    }
+    return false;
+#else
+    return false;
+#endif
+}
+
+//--------------------------------------------------------------------+
+// STATS PRINT TASK
+//--------------------------------------------------------------------+
+
+// With UMFD_STATS_PRINT, print the latency of each stage since boot (and the
+// matrix scan and shift register frame rates) every 5s. stdio output
+// blocks, so this is for measuring, not for normal builds.
+void stats_print_task(void) {
+#ifdef UMFD_STATS_PRINT
+    const uint32_t interval_ms = 5000;
+    static uint32_t start_ms = 0;
+    struct latency_hist const *h;
+    int i;
+
+    if (board_millis() - start_ms < interval_ms)
+        return; // not enough time
+    start_ms += interval_ms;
+
+#if UMFD_MATRIX
+    printf("matrix: %lu scans/s, worst scan %lu us, %lu ghosted scans\n",
+           (unsigned long)key_matrix.scan_rate_hz,
+           (unsigned long)key_matrix.scan_us_max,
+           (unsigned long)key_matrix.ghost_scans);
+#endif
+#if UMFD_SHIFTREG
+    printf("shiftreg: %lu frames/s, %lu frames missed\n",
+           (unsigned long)sr_chain.frame_rate_hz,
+           (unsigned long)sr_chain.missed_frames);
+#endif
+    printf("boot: config loaded in %lu us, first report at %lu us\n",
+           (unsigned long)config_store.load_us,
+           (unsigned long)boot_first_report_us);
+#if UMFD_SOF_SYNC
+    printf("sof: %lu frames, reports built %lu us before the next on average "
+           "(%lu us configured)\n",
+           (unsigned long)usb_frame_sync.frames,
+           (unsigned long)frame_sync_build_lead_us(&usb_frame_sync),
+           (unsigned long)usb_frame_sync.lead_us);
+#endif
+#if UMFD_SUSPEND
+    printf("suspend: %lu suspends, %lu ms asleep, awake %lu us of it for %lu "
+           "interrupts; %lu wakeups (%lu unanswered), last resumed %lu us "
+           "after the button\n",
+           (unsigned long)usb_suspend.suspends,
+           (unsigned long)usb_suspend.asleep_ms,
+           (unsigned long)usb_suspend.run_us,
+           (unsigned long)usb_suspend.irq_wakes,
+           (unsigned long)usb_suspend.wakeups,
+           (unsigned long)usb_suspend.wake_timeouts,
+           (unsigned long)usb_suspend.resume_us);
+#endif
+#if UMFD_DISPLAY
+    printf("display: %lu frames, %lu rects, %lu errors, %lu stalls\n",
+           (unsigned long)mfd_display.frames, (unsigned long)mfd_display.rects,
+           (unsigned long)mfd_display.errors,
+           (unsigned long)mfd_display.stalls);
+#endif
+#if UMFD_BACKLIGHT
+    printf("backlight: %lu reports (%lu bad), %lu LEDs recomputed, %lu "
+           "refreshes\n",
+           (unsigned long)button_backlight.reports,
+           (unsigned long)button_backlight.bad_reports,
+           (unsigned long)button_backlight.recomputed,
+           (unsigned long)button_backlight.refreshes);
+#endif
+#if UMFD_ENCODERS
+    printf("encoders: %lu transitions, %lu missed steps\n",
+           (unsigned long)encoder_bank.transitions,
+           (unsigned long)encoder_bank_missed(&encoder_bank));
+#endif
+    if (input_queue.overflows) {
+        printf("input queue: full %lu times\n",
+               (unsigned long)input_queue.overflows);
+    }
+    for (i = 0; i < LATENCY_STAGES; i++) {
+        h = latency_stages + i;
+        if (!h->acc.cnt)
+            continue;
+        printf("%s us: min %lu avg %lu p99 %lu max %lu (n=%lu, %s)\n",
+               latency_stage_names[i], (unsigned long)h->acc.min_us,
+               (unsigned long)(h->acc.sum_us / h->acc.cnt),
+               (unsigned long)latency_hist_percentile(h, 990),
+               (unsigned long)h->acc.max_us, (unsigned long)h->acc.cnt,
+               UMFD_CORE1_SCAN ? "core1 scan" : "core0 scan");
+    }
+#endif
+}
+
+//--------------------------------------------------------------------+
+// CONSOLE TASK
+//--------------------------------------------------------------------+
+
+#if UMFD_CDC_CONSOLE
+static void console_command(int c) {
+    static char const latency_fmt[] =
+        "%s us: min %lu p50 %lu p99 %lu max %lu (n=%lu)\r\n";
+    struct latency_hist const *h;
+    int i;
+
+    // the stage name in place of its %s, five figures at 10 digits
+    _Static_assert(sizeof(latency_fmt) - 2 + LATENCY_STAGE_NAME_MAX + 7 * 5 <=
+                       TELEM_LINE_MAX,
+                   "the latency line is longer than TELEM_LINE_MAX");
+
+    switch (c) {
+    case 's':
+        telem_dump_counters(&console_ring, &telem_counters);
+        for (i = 0; i < LATENCY_STAGES; i++) {
+            h = latency_stages + i;
+            if (!h->acc.cnt)
+                continue;
+            telem_printf(&console_ring, latency_fmt,
+                         latency_stage_names[i], (unsigned long)h->acc.min_us,
+                         (unsigned long)latency_hist_percentile(h, 500),
+                         (unsigned long)latency_hist_percentile(h, 990),
+                         (unsigned long)h->acc.max_us,
+                         (unsigned long)h->acc.cnt);
+        }
+        if (input_queue.overflows) {
+            TELEM_PRINTF(&console_ring, "input queue: full %lu times\r\n",
+                         (unsigned long)input_queue.overflows);
+        }
+        TELEM_PRINTF(&console_ring,
+                     "boot: config loaded in %lu us, first report at %lu "
+                     "us\r\n",
+                     (unsigned long)config_store.load_us,
+                     (unsigned long)boot_first_report_us);
+#if UMFD_SOF_SYNC
+        TELEM_PRINTF(&console_ring,
+                     "sof: %lu frames, reports built %lu us before the "
+                     "next on average (%lu us configured)\r\n",
+                     (unsigned long)usb_frame_sync.frames,
+                     (unsigned long)frame_sync_build_lead_us(&usb_frame_sync),
+                     (unsigned long)usb_frame_sync.lead_us);
+#endif
+#if UMFD_SUSPEND
+        TELEM_PRINTF(&console_ring, "suspend: %lu suspends, %lu ms asleep\r\n",
+                     (unsigned long)usb_suspend.suspends,
+                     (unsigned long)usb_suspend.asleep_ms);
+        TELEM_PRINTF(&console_ring,
+                     "suspend: awake %lu us for %lu interrupts\r\n",
+                     (unsigned long)usb_suspend.run_us,
+                     (unsigned long)usb_suspend.irq_wakes);
+        TELEM_PRINTF(&console_ring,
+                     "suspend: %lu wakeups (%lu unanswered), resumed %lu us "
+                     "after the button\r\n",
+                     (unsigned long)usb_suspend.wakeups,
+                     (unsigned long)usb_suspend.wake_timeouts,
+                     (unsigned long)usb_suspend.resume_us);
+#endif
+#if UMFD_DISPLAY
+        TELEM_PRINTF(&console_ring,
+                     "display: %lu frames, %lu rects, %lu errors, %lu "
+                     "stalls\r\n",
+                     (unsigned long)mfd_display.frames,
+                     (unsigned long)mfd_display.rects,
+                     (unsigned long)mfd_display.errors,
+                     (unsigned long)mfd_display.stalls);
+#endif
+#if UMFD_BACKLIGHT
+        TELEM_PRINTF(&console_ring,
+                     "backlight: %lu reports (%lu bad), %lu LEDs recomputed, "
+                     "%lu refreshes\r\n",
+                     (unsigned long)button_backlight.reports,
+                     (unsigned long)button_backlight.bad_reports,
+                     (unsigned long)button_backlight.recomputed,
+                     (unsigned long)button_backlight.refreshes);
+#endif
+#if UMFD_ENCODERS
+        TELEM_PRINTF(&console_ring,
+                     "encoders: %lu transitions, %lu missed steps\r\n",
+                     (unsigned long)encoder_bank.transitions,
+                     (unsigned long)encoder_bank_missed(&encoder_bank));
+#endif
+        break;
+    case 'r':
+        // racy against the scanning core like the latency reset, fine for
+        // counters
+        telem_counters_reset(&telem_counters, time_us_32());
+        for (i = 0; i < LATENCY_STAGES; i++) {
+            latency_hist_reset(latency_stages + i);
+        }
+        CONSOLE_LOG("counters reset\r\n");
+        break;
+#if GPIO_TRACE
+    case 't':
+        // binary from here on, until the next 't'
+        if (trace_active(&gpio_trace)) {
+            trace_stop(&gpio_trace);
+        } else {
+            trace_start(&gpio_trace, registered_gpio_pins());
+        }
+        break;
+#endif
+    case '?':
+    case 'h':
+        CONSOLE_LOG("s: dump counters and latency, r: reset them\r\n");
+#if GPIO_TRACE
+        CONSOLE_LOG("t: start or stop a GPIO trace\r\n");
+#endif
+        break;
+    default:
+        break;
+    }
+}
+#endif
+
+// Take console commands, and move queued console output to the CDC FIFO
+// while no input edge is waiting for a report. Nothing here blocks.
+void console_task(void) {
+#if UMFD_CDC_CONSOLE
+    uint8_t buf[CFG_TUD_CDC_EP_BUFSIZE];
+    uint32_t room;
+    uint16_t n;
+
+    telem_rate_update(&telem_counters, time_us_32());
+    if (!tud_cdc_connected()) {
+        return;
+    }
+    while (tud_cdc_available()) {
+        console_command(tud_cdc_read_char());
+    }
+    if (!inputq_empty(&input_queue)) {
+        return;
+    }
+    room = tud_cdc_write_available();
+#if GPIO_TRACE
+    // a trace has the console to itself, text waits in the ring
+    if (trace_active(&gpio_trace)) {
+        n = trace_read(&gpio_trace, buf,
+                       room < sizeof(buf) ? room : sizeof(buf), time_us_32());
+        if (n) {
+            tud_cdc_write(buf, n);
+            tud_cdc_write_flush();
+        }
+        if (!trace_active(&gpio_trace)) {
+            TELEM_PRINTF(&console_ring,
+                         "\r\ntrace: %lu records, %lu dropped\r\n",
+                         (unsigned long)gpio_trace.records,
+                         (unsigned long)gpio_trace.dropped);
+        }
+        return;
+    }
+#endif
+    if (!telem_pending(&console_ring)) {
+        return;
+    }
+    n = telem_read(&console_ring, buf, room < sizeof(buf) ? room : sizeof(buf));
+    if (n) {
+        tud_cdc_write(buf, n);
+        tud_cdc_write_flush();
+    }
+#endif
+}
+
+//--------------------------------------------------------------------+
+// DISPLAY TASK
+//--------------------------------------------------------------------+
+
+// Keep the panel DMA busy, and decode at most one packet of the display
+// stream per pass, only while no input edge is waiting for a report. Bytes
+// the decoder could not take yet wait here for the panel to catch up.
+void display_task(void) {
+#if UMFD_DISPLAY
+    static uint8_t buf[CFG_TUD_VENDOR_EPSIZE];
+    static uint32_t off, len;
+
+    display_panel_poll(&mfd_display);
+    if (!inputq_empty(&input_queue)) {
+        return;
+    }
+    if (off == len) {
+        if (!tud_vendor_available()) {
+            return;
+        }
+        len = tud_vendor_read(buf, sizeof(buf));
+        off = 0;
+    }
+    off += display_feed(&mfd_display, buf + off, len - off);
+    // a band may have filled up just now
+    display_panel_poll(&mfd_display);
+#endif
+}
+
+//--------------------------------------------------------------------+
+// BACKLIGHT TASK
+//--------------------------------------------------------------------+
+
+// Light the buttons as the host last saw them, so press feedback never runs
+// ahead of the report; like the display, only while no input edge is
+// waiting for one.
+void backlight_task(void) {
+#if UMFD_BACKLIGHT
+    if (!inputq_empty(&input_queue)) {
+        return;
     }
+    backlight_poll(&button_backlight, shown.buttons, board_millis());
+#endif
 }
 
 //--------------------------------------------------------------------+
@@ -0,0 +1,159 @@
+/*
+ * Row/column button matrix scanner.
+ */
+
+#include <string.h>
+
+#include "matrix.h"
+#include "umfd_hal.h"
+
+void matrix_init(struct matrix *m, uint8_t const *row_pins, uint8_t rows,
+                 uint8_t col_base, uint8_t cols, bool diodes,
+                 uint16_t settle_us) {
+    int i;
+
+    memset(m, 0, sizeof(*m));
+    if (rows > MATRIX_MAX_ROWS) {
+        rows = MATRIX_MAX_ROWS;
+    }
+    if (cols > MATRIX_MAX_COLS) {
+        cols = MATRIX_MAX_COLS;
+    }
+    if (rows * cols > MATRIX_MAX_KEYS) {
+        rows = MATRIX_MAX_KEYS / cols;
+    }
+    m->rows = rows;
+    m->cols = cols;
+    m->col_base = col_base;
+    m->diodes = diodes;
+    m->settle_us = settle_us;
+    memcpy(m->row_pins, row_pins, rows);
+
+    // keys idle released (0), so a zeroed engine is already in the right state
+    for (i = 0; i < MATRIX_WORDS; i++) {
+        debounce_vc_init(m->vc + i);
+    }
+    for (i = 0; i < rows; i++) {
+        hal_gpio_setup_input(row_pins[i], false);
+    }
+    for (i = 0; i < cols; i++) {
+        hal_gpio_setup_input(col_base + i, true);
+    }
+    m->rate_window_start_us = hal_time_us();
+}
+
+struct phy_btn_reg *matrix_key(struct matrix *m, uint8_t row, uint8_t col) {
+    if (row >= m->rows || col >= m->cols) {
+        return NULL;
+    }
+    return m->keys + row * m->cols + col;
+}
+
+void reg_matrix_btn(struct matrix *m, struct dinput_btn_reg *d_btn,
+                    uint8_t row, uint8_t col) {
+    struct phy_btn_reg *key = matrix_key(m, row, col);
+    uint8_t k;
+
+    if (!key) {
+        return;
+    }
+    k = key - m->keys;
+    reg_btn_on(m->vc + (k >> 5), key, d_btn, k & 31, 1);
+}
+
+void set_matrix_btn_debounce_mode(struct matrix *m, struct phy_btn_reg *key,
+                                  enum debounce_mode mode, uint32_t mask) {
+    uint8_t k = key - m->keys;
+
+    set_btn_debounce_mode_on(m->vc + (k >> 5), key, mode, mask);
+}
+
+// Without diodes, three pressed corners of a rectangle make the fourth read
+// pressed too, and no scan can tell which of the four is the phantom. Any
+// two rows sharing two or more pressed columns form such a rectangle; those
+// keys keep their previous reading until the pattern clears.
+static bool matrix_mask_ghosts(struct matrix *m, uint16_t *row_bits) {
+    uint16_t ambiguous[MATRIX_MAX_ROWS] = {0};
+    uint16_t common;
+    bool ghost = false;
+    int r0, r1;
+
+    for (r0 = 0; r0 < m->rows; r0++) {
+        // a row with a single key down cannot be part of a rectangle
+        if (!(row_bits[r0] & (row_bits[r0] - 1))) {
+            continue;
+        }
+        for (r1 = r0 + 1; r1 < m->rows; r1++) {
+            common = row_bits[r0] & row_bits[r1];
+            if (common & (common - 1)) {
+                ambiguous[r0] |= common;
+                ambiguous[r1] |= common;
+                ghost = true;
+            }
+        }
+    }
+    if (!ghost) {
+        return false;
+    }
+    for (r0 = 0; r0 < m->rows; r0++) {
+        row_bits[r0] = (row_bits[r0] & ~ambiguous[r0]) |
+                       (m->row_raw[r0] & ambiguous[r0]);
+    }
+    return true;
+}
+
+static void matrix_count_scan(struct matrix *m, uint32_t start_us) {
+    uint32_t now_us = hal_time_us();
+    uint32_t window_us;
+
+    if (now_us - start_us > m->scan_us_max) {
+        m->scan_us_max = now_us - start_us;
+    }
+    m->scans++;
+    m->rate_window_scans++;
+    window_us = now_us - m->rate_window_start_us;
+    if (window_us >= 1000000) {
+        m->scan_rate_hz =
+            (uint32_t)((uint64_t)m->rate_window_scans * 1000000 / window_us);
+        m->rate_window_scans = 0;
+        m->rate_window_start_us = now_us;
+    }
+}
+
+bool matrix_scan(struct matrix *m) {
+    uint16_t row_bits[MATRIX_MAX_ROWS];
+    uint32_t words[MATRIX_WORDS] = {0};
+    uint32_t col_mask = (1u << m->cols) - 1;
+    uint32_t start_us = hal_time_us();
+    uint16_t pos;
+    bool any;
+    int r;
+
+    for (r = 0; r < m->rows; r++) {
+        hal_gpio_drive_low(m->row_pins[r]);
+        if (m->settle_us) {
+            hal_delay_us(m->settle_us);
+        }
+        row_bits[r] = ~(hal_gpio_get_all() >> m->col_base) & col_mask;
+        hal_gpio_release(m->row_pins[r]);
+    }
+
+    if (!m->diodes && matrix_mask_ghosts(m, row_bits)) {
+        m->ghost_scans++;
+    }
+
+    // pack rows into the key bitmap, a row may straddle two words
+    for (r = 0, pos = 0; r < m->rows; r++, pos += m->cols) {
+        m->row_raw[r] = row_bits[r];
+        words[pos >> 5] |= (uint32_t)row_bits[r] << (pos & 31);
+        if ((pos & 31) + m->cols > 32) {
+            words[(pos >> 5) + 1] |= (uint32_t)row_bits[r] >> (32 - (pos & 31));
+        }
+    }
+
+    any = poll_dense_words(m->vc, m->keys, words,
+                           (m->rows * m->cols + 31) / 32);
+
+    matrix_count_scan(m, start_us);
+    return any;
+}
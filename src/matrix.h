@@ -0,0 +1,65 @@
+/*
+ * Row/column button matrix scanner.
+ *
+ * Rows are driven low one at a time, columns sit on consecutive GPIOs with
+ * pull-ups and read low where a key on the driven row is pressed. Key
+ * row * cols + col becomes that bit of a packed key bitmap, which is
+ * debounced 32 keys at a time by the vertical counter engine and handed to
+ * the usual phy_btn_reg/dinput_btn_reg pairs.
+ */
+
+#ifndef MATRIX_H_
+#define MATRIX_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "debounce.h"
+#include "input.h"
+
+#define MATRIX_MAX_ROWS 16
+#define MATRIX_MAX_COLS 16
+#define MATRIX_MAX_KEYS 128
+#define MATRIX_WORDS (MATRIX_MAX_KEYS / 32)
+
+struct matrix {
+    uint8_t rows;
+    uint8_t cols;
+    uint8_t col_base;
+    uint8_t row_pins[MATRIX_MAX_ROWS];
+    // time for a column to follow its row after the row is switched
+    uint16_t settle_us;
+    // with a diode per key there is no ghosting to look for
+    bool diodes;
+
+    // last raw (pressed = 1) columns per row, after ghost masking
+    uint16_t row_raw[MATRIX_MAX_ROWS];
+    struct debounce_vc vc[MATRIX_WORDS];
+    // indexed by key number, d_btn is NULL for unused keys
+    struct phy_btn_reg keys[MATRIX_MAX_KEYS];
+
+    // scans that found an ambiguous (ghosting) key pattern
+    uint32_t ghost_scans;
+    uint32_t scans;
+    uint32_t scan_us_max;
+    // scans completed over the last full second
+    uint32_t scan_rate_hz;
+    uint32_t rate_window_start_us;
+    uint32_t rate_window_scans;
+};
+
+void matrix_init(struct matrix *m, uint8_t const *row_pins, uint8_t rows,
+                 uint8_t col_base, uint8_t cols, bool diodes,
+                 uint16_t settle_us);
+void reg_matrix_btn(struct matrix *m, struct dinput_btn_reg *d_btn,
+                    uint8_t row, uint8_t col);
+// Key number to phy_btn_reg, e.g. to change its debounce. NULL if out of range.
+struct phy_btn_reg *matrix_key(struct matrix *m, uint8_t row, uint8_t col);
+void set_matrix_btn_debounce_mode(struct matrix *m, struct phy_btn_reg *key,
+                                  enum debounce_mode mode, uint32_t mask);
+
+// Scan the whole matrix once and debounce it. Returns true if any key
+// settled into a new state.
+bool matrix_scan(struct matrix *m);
+
+#endif /* MATRIX_H_ */
@@ -0,0 +1,89 @@
+/*
+ * Inputs split across several HID interfaces.
+ */
+
+#include <string.h>
+
+#include "panel.h"
+
+void hid_panel_init(struct hid_panel *p, uint8_t instance, uint8_t report_id,
+                    uint16_t btn_first, uint16_t buttons, uint8_t hats,
+                    uint8_t axes, enum report_mode mode,
+                    uint16_t keepalive_ms) {
+    memset(p, 0, sizeof(*p));
+    gamepad_layout_init(&p->layout, report_id, btn_first, buttons, hats, axes);
+    report_sched_init(&p->sched, instance, mode, keepalive_ms);
+    hid_panel_watch(p, p->layout.btn_first, p->layout.buttons);
+}
+
+void hid_panel_watch(struct hid_panel *p, uint16_t first, uint16_t cnt) {
+    int i;
+
+    for (i = first; i < first + cnt && i < MAX_DINPUT_BTNS; i++) {
+        p->mask[i >> 5] |= 1u << (i & 31);
+    }
+}
+
+void hid_panels_split(uint16_t buttons, uint8_t cnt, uint16_t const *sizes,
+                      uint8_t sizes_cnt, uint16_t *first, uint16_t *count) {
+    uint16_t even = ((buttons + cnt - 1) / cnt + 7) & ~7;
+    uint16_t at = 0, left, n;
+    int k;
+
+    for (k = 0; k < cnt; k++) {
+        left = buttons > at ? buttons - at : 0;
+        if (k == cnt - 1) {
+            n = left;
+        } else if (k < sizes_cnt && sizes[k]) {
+            n = (sizes[k] + 7) & ~7;
+        } else {
+            n = even;
+        }
+        if (n > left) {
+            n = left;
+        }
+        // an interface without a single input does not enumerate, so a
+        // panel left over gets 8 that never press
+        if (!n) {
+            at = (at + 7) & ~7;
+            n = 8;
+        }
+        first[k] = at;
+        count[k] = n;
+        at += n;
+    }
+}
+
+int hid_panel_send(struct hid_panel *p, struct input_snapshot const *s) {
+    int ret = send_gamepad_report(&p->sched, &p->layout, s->buttons, s->hats,
+                                  s->axes);
+
+    hid_panel_settle(p, ret, s->buttons);
+    return ret;
+}
+
+void hid_panel_settle(struct hid_panel *p, int ret,
+                      uint32_t const buttons[DINPUT_BTN_WORDS]) {
+    p->owed = ret < 0;
+    if (!p->owed) {
+        memcpy(p->sent, buttons, sizeof(p->sent));
+    }
+}
+
+bool hid_panels_can_take(struct hid_panel const *panels, uint8_t cnt,
+                         uint32_t const cur[DINPUT_BTN_WORDS],
+                         uint32_t const next[DINPUT_BTN_WORDS]) {
+    struct hid_panel const *p;
+    uint32_t clash = 0;
+    int w;
+
+    for (p = panels; p < panels + cnt; p++) {
+        if (!p->owed) {
+            continue;
+        }
+        for (w = 0; w < DINPUT_BTN_WORDS; w++) {
+            clash |= (cur[w] ^ p->sent[w]) & (cur[w] ^ next[w]) & p->mask[w];
+        }
+    }
+    return !clash;
+}
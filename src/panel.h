@@ -0,0 +1,75 @@
+/*
+ * Inputs split across several HID interfaces.
+ *
+ * A big pit squeezed into one gamepad runs into what games read from one
+ * DirectInput device (often 32 buttons), and one endpoint busy with a report
+ * holds up every input behind it. A panel is one HID interface with its own
+ * IN endpoint, report descriptor and scheduler, reporting a slice of the
+ * button IDs, e.g. one bezel each. Panel 0 is the first interface and also
+ * carries the hats, the axes and the keyboard report; the others are plain
+ * button pads without report IDs.
+ *
+ * Every panel reports every state taken off the input queue, but not in
+ * lockstep: a panel whose endpoint is busy just owes the current state and
+ * sends it when it is free, while the others move on to newer states. The
+ * only wait is when a state would change one of an owing panel's own
+ * buttons a second time, which would lose that panel an edge.
+ */
+
+#ifndef PANEL_H_
+#define PANEL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "hid_desc.h"
+#include "input.h"
+#include "inputq.h"
+#include "report.h"
+
+#define HID_PANELS_MAX 4
+
+struct hid_panel {
+    struct gamepad_layout layout;
+    struct report_sched sched;
+    // buttons whose edges this panel has to report
+    uint32_t mask[DINPUT_BTN_WORDS];
+    // the input state as of the last report it handed over (or found
+    // unchanged), and whether a later one is still owed
+    uint32_t sent[DINPUT_BTN_WORDS];
+    bool owed;
+};
+
+// Panel on HID interface instance for button IDs btn_first.., see
+// gamepad_layout_init(). Its mask covers those buttons.
+void hid_panel_init(struct hid_panel *p, uint8_t instance, uint8_t report_id,
+                    uint16_t btn_first, uint16_t buttons, uint8_t hats,
+                    uint8_t axes, enum report_mode mode,
+                    uint16_t keepalive_ms);
+
+// Add button IDs first.. (cnt of them) to p's mask, for inputs it reports
+// other than as buttons: panel 0's hat contacts.
+void hid_panel_watch(struct hid_panel *p, uint16_t first, uint16_t cnt);
+
+// Split buttons over cnt panels: sizes[k] for panel k while given (rounded
+// up to a multiple of 8, 0 for an even split), the rest to the last. A panel
+// left without buttons gets 8 past the last one. Fills first[] and count[].
+void hid_panels_split(uint16_t buttons, uint8_t cnt, uint16_t const *sizes,
+                      uint8_t sizes_cnt, uint16_t *first, uint16_t *count);
+
+// Send state s on p if it changed for p, like send_gamepad_report(), and
+// book the outcome with hid_panel_settle().
+int hid_panel_send(struct hid_panel *p, struct input_snapshot const *s);
+
+// After trying to hand p the state with buttons: ret as from
+// send_gamepad_report(), -1 (busy) leaves the state owed.
+void hid_panel_settle(struct hid_panel *p, int ret,
+                      uint32_t const buttons[DINPUT_BTN_WORDS]);
+
+// Whether the state can move from cur to next now: not while it changes a
+// button some owing panel has changed unreported since its last report.
+bool hid_panels_can_take(struct hid_panel const *panels, uint8_t cnt,
+                         uint32_t const cur[DINPUT_BTN_WORDS],
+                         uint32_t const next[DINPUT_BTN_WORDS]);
+
+#endif /* PANEL_H_ */
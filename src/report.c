@@ -0,0 +1,94 @@
+/*
+ * HID report building.
+ */
+
+#include <string.h>
+
+#include "report.h"
+#include "umfd_hal.h"
+
+void pack_dinput_btns(struct dinput_btn_reg *d_btns, uint16_t d_btn_cnt,
+                      uint32_t words[DINPUT_BTN_WORDS]) {
+    struct dinput_btn_reg *d_btn;
+
+    memset(words, 0, DINPUT_BTN_WORDS * sizeof(words[0]));
+    for (d_btn = d_btns; d_btn < d_btns + d_btn_cnt; d_btn++) {
+        if (d_btn->btn_id >= MAX_DINPUT_BTNS) {
+            // Do we want to check here? This takes time. We could just validate at registration..
+            continue;
+        }
+        words[d_btn->btn_id >> 5] |= (uint32_t)d_btn->state
+                                     << (d_btn->btn_id & 31);
+    }
+}
+
+void report_sched_init(struct report_sched *sched, uint8_t instance,
+                       enum report_mode mode, uint16_t keepalive_ms) {
+    memset(sched, 0, sizeof(*sched));
+    sched->instance = instance;
+    sched->mode = mode;
+    sched->keepalive_ms = keepalive_ms;
+}
+
+void report_sched_reset(struct report_sched *sched) {
+    sched->in_flight = false;
+    sched->acked_valid = false;
+}
+
+bool report_sched_due(struct report_sched *sched, void const *report,
+                      uint16_t len, uint32_t now_ms) {
+    if (sched->mode == REPORT_MODE_ALWAYS || !sched->acked_valid) {
+        return true;
+    }
+    if (len != sched->acked_len || memcmp(report, sched->acked_buf, len)) {
+        return true;
+    }
+    return sched->mode == REPORT_MODE_ON_CHANGE_KEEPALIVE &&
+           now_ms - sched->last_tx_ms >= sched->keepalive_ms;
+}
+
+void report_sched_sent(struct report_sched *sched, void const *report,
+                       uint16_t len, uint32_t now_ms) {
+    if (len > REPORT_SCHED_MAX_LEN) {
+        len = REPORT_SCHED_MAX_LEN;
+    }
+    memcpy(sched->in_flight_buf, report, len);
+    sched->in_flight_len = len;
+    sched->in_flight = true;
+    sched->last_tx_ms = now_ms;
+}
+
+void report_sched_complete(struct report_sched *sched) {
+    if (!sched->in_flight) {
+        return;
+    }
+    memcpy(sched->acked_buf, sched->in_flight_buf, sched->in_flight_len);
+    sched->acked_len = sched->in_flight_len;
+    sched->acked_valid = true;
+    sched->in_flight = false;
+}
+
+int send_gamepad_report(struct report_sched *sched,
+                        struct gamepad_layout const *layout,
+                        uint32_t const buttons[DINPUT_BTN_WORDS],
+                        uint8_t const *hats, int16_t const *axes) {
+    uint8_t report[GAMEPAD_REPORT_MAX_LEN];
+    uint32_t now_ms;
+
+    // skip if hid is not ready yet
+    if (!hal_hid_ready(sched->instance)) {
+        return -1;
+    }
+
+    gamepad_report_pack(layout, report, buttons, hats, axes);
+    now_ms = hal_millis();
+    if (!report_sched_due(sched, report, layout->len, now_ms)) {
+        return 1;
+    }
+    if (!hal_hid_report(sched->instance, layout->report_id, report,
+                        layout->len)) {
+        return -1;
+    }
+    report_sched_sent(sched, report, layout->len, now_ms);
+    return 0;
+}
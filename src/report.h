@@ -0,0 +1,71 @@
+/*
+ * HID report building.
+ */
+
+#ifndef REPORT_H_
+#define REPORT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "hid_desc.h"
+#include "input.h"
+
+enum report_mode {
+    // send every hid_task() tick, whether or not anything changed
+    REPORT_MODE_ALWAYS,
+    // send only when the report differs from the last one the host acked
+    REPORT_MODE_ON_CHANGE,
+    // on change, plus a repeat after keepalive_ms without one
+    REPORT_MODE_ON_CHANGE_KEEPALIVE,
+};
+
+// Build time defaults, see UMFD_REPORT_MODE in src/CMakeLists.txt
+#ifndef UMFD_REPORT_MODE
+#define UMFD_REPORT_MODE REPORT_MODE_ON_CHANGE
+#endif
+#ifndef UMFD_REPORT_KEEPALIVE_MS
+#define UMFD_REPORT_KEEPALIVE_MS 100
+#endif
+
+#define REPORT_SCHED_MAX_LEN 64
+
+// Tracks what the host has for one report ID so unchanged reports are not
+// sent again. A report is only taken as delivered once its complete
+// callback fires; until then it is "in flight".
+struct report_sched {
+    // HID interface the report goes out on
+    uint8_t instance;
+    enum report_mode mode;
+    uint16_t keepalive_ms;
+    bool in_flight;
+    bool acked_valid;
+    uint16_t in_flight_len;
+    uint16_t acked_len;
+    uint32_t last_tx_ms;
+    uint8_t in_flight_buf[REPORT_SCHED_MAX_LEN];
+    uint8_t acked_buf[REPORT_SCHED_MAX_LEN];
+};
+
+void pack_dinput_btns(struct dinput_btn_reg *d_btns, uint16_t d_btn_cnt,
+                      uint32_t words[DINPUT_BTN_WORDS]);
+
+void report_sched_init(struct report_sched *sched, uint8_t instance,
+                       enum report_mode mode, uint16_t keepalive_ms);
+// Forget what the host has, e.g. after a (re)mount.
+void report_sched_reset(struct report_sched *sched);
+bool report_sched_due(struct report_sched *sched, void const *report,
+                      uint16_t len, uint32_t now_ms);
+void report_sched_sent(struct report_sched *sched, void const *report,
+                       uint16_t len, uint32_t now_ms);
+void report_sched_complete(struct report_sched *sched);
+
+// Build the report for layout (see hid_desc.h) and send it if due. With axes
+// NULL all axes report centered. Returns 0 when a report went out, 1 when it
+// was skipped as unchanged and -1 when the endpoint was busy.
+int send_gamepad_report(struct report_sched *sched,
+                        struct gamepad_layout const *layout,
+                        uint32_t const buttons[DINPUT_BTN_WORDS],
+                        uint8_t const *hats, int16_t const *axes);
+
+#endif /* REPORT_H_ */
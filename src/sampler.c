@@ -0,0 +1,69 @@
+/*
+ * Fixed rate GPIO sampler.
+ */
+
+#include <string.h>
+
+#include "sampler.h"
+#include "umfd_hal.h"
+
+void sampler_init(struct sampler *s, uint32_t rate_hz) {
+    memset(s, 0, sizeof(*s));
+    s->rate_hz = rate_hz;
+    s->period_us = 1000000 / rate_hz;
+    sampler_reset_jitter(s);
+}
+
+void sampler_reset_jitter(struct sampler *s) {
+    s->interval_min_us = UINT32_MAX;
+    s->interval_max_us = 0;
+}
+
+static void sampler_timer_cb(void *ctx) { sampler_capture(ctx); }
+
+bool sampler_start(struct sampler *s) {
+    return hal_sample_timer_start(s->period_us, sampler_timer_cb, s);
+}
+
+void sampler_stop(struct sampler *s) {
+    hal_sample_timer_stop();
+    s->last_t_us = 0;
+}
+
+void sampler_capture(struct sampler *s) {
+    uint32_t gpio = hal_gpio_get_all();
+    uint32_t t_us = hal_time_us();
+    uint32_t head = s->head;
+    uint32_t interval;
+
+    if (s->last_t_us) {
+        interval = t_us - s->last_t_us;
+        if (interval < s->interval_min_us) {
+            s->interval_min_us = interval;
+        }
+        if (interval > s->interval_max_us) {
+            s->interval_max_us = interval;
+        }
+    }
+    s->last_t_us = t_us;
+
+    if (head - __atomic_load_n(&s->tail, __ATOMIC_ACQUIRE) >=
+        SAMPLER_RING_LEN) {
+        s->overruns++;
+        return;
+    }
+    s->ring[head & (SAMPLER_RING_LEN - 1)].t_us = t_us;
+    s->ring[head & (SAMPLER_RING_LEN - 1)].gpio = gpio;
+    __atomic_store_n(&s->head, head + 1, __ATOMIC_RELEASE);
+}
+
+bool sampler_pop(struct sampler *s, struct gpio_sample *out) {
+    uint32_t tail = s->tail;
+
+    if (tail == __atomic_load_n(&s->head, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    *out = s->ring[tail & (SAMPLER_RING_LEN - 1)];
+    __atomic_store_n(&s->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
@@ -0,0 +1,59 @@
+/*
+ * Fixed rate GPIO sampler.
+ *
+ * A repeating timer captures gpio_get_all() with a timestamp into a ring
+ * buffer, independent of how long the main loop takes. The main loop drains
+ * the ring and debounces the samples in order, so debounce windows are a
+ * fixed number of sample periods, i.e. real time.
+ */
+
+#ifndef SAMPLER_H_
+#define SAMPLER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Build time defaults, see src/CMakeLists.txt. A rate of 0 samples from the
+// main loop as before, with windows counted in loop iterations.
+#ifndef UMFD_SAMPLE_RATE_HZ
+#define UMFD_SAMPLE_RATE_HZ 4000
+#endif
+#ifndef UMFD_DEBOUNCE_US
+#define UMFD_DEBOUNCE_US 1000
+#endif
+
+// Must be a power of two. 64 samples is 8 ms of slack at 8 kHz.
+#define SAMPLER_RING_LEN 64
+
+struct gpio_sample {
+    uint32_t t_us;
+    uint32_t gpio;
+};
+
+struct sampler {
+    uint32_t rate_hz;
+    uint32_t period_us;
+    // head is only written by the timer, tail only by the consumer
+    uint32_t head;
+    uint32_t tail;
+    // samples dropped because the consumer fell a full ring behind
+    uint32_t overruns;
+    // spread of the measured capture to capture interval
+    uint32_t last_t_us;
+    uint32_t interval_min_us;
+    uint32_t interval_max_us;
+    struct gpio_sample ring[SAMPLER_RING_LEN];
+};
+
+void sampler_init(struct sampler *s, uint32_t rate_hz);
+bool sampler_start(struct sampler *s);
+// Stop the timer, e.g. for a USB suspend. What it captured is still there
+// to pop, and the gap until the next start does not count as jitter.
+void sampler_stop(struct sampler *s);
+// Take one sample now. This is what the timer calls.
+void sampler_capture(struct sampler *s);
+bool sampler_pop(struct sampler *s, struct gpio_sample *out);
+// Forget the interval spread measured so far.
+void sampler_reset_jitter(struct sampler *s);
+
+#endif /* SAMPLER_H_ */
@@ -0,0 +1,88 @@
+/*
+ * 74HC165 shift register input chains, the debounce side. The PIO and DMA
+ * side lives in shiftreg_pio.c.
+ */
+
+#include <string.h>
+
+#include "shiftreg.h"
+#include "umfd_hal.h"
+
+void shiftreg_init(struct shiftreg_chain *sr, uint8_t data_pin,
+                   uint8_t clk_pin, uint8_t chips, uint32_t frame_hz) {
+    int i;
+
+    memset(sr, 0, sizeof(*sr));
+    if (chips > SHIFTREG_MAX_CHIPS) {
+        chips = SHIFTREG_MAX_CHIPS;
+    }
+    sr->chips = chips;
+    sr->data_pin = data_pin;
+    sr->clk_pin = clk_pin;
+    sr->frame_hz = frame_hz;
+    sr->dma_ch[0] = -1;
+    sr->dma_ch[1] = -1;
+    for (i = 0; i < SHIFTREG_WORDS; i++) {
+        debounce_vc_init(sr->vc + i);
+    }
+    sr->rate_window_start_us = hal_time_us();
+}
+
+struct phy_btn_reg *shiftreg_key(struct shiftreg_chain *sr, uint16_t input) {
+    if (input >= sr->chips * 8) {
+        return NULL;
+    }
+    return sr->keys + input;
+}
+
+void reg_shiftreg_btn(struct shiftreg_chain *sr, struct dinput_btn_reg *d_btn,
+                      uint16_t input, bool active_low) {
+    struct phy_btn_reg *key = shiftreg_key(sr, input);
+
+    if (!key) {
+        return;
+    }
+    reg_btn_on(sr->vc + (input >> 5), key, d_btn, input & 31, !active_low);
+}
+
+void set_shiftreg_btn_debounce_mode(struct shiftreg_chain *sr,
+                                    struct phy_btn_reg *key,
+                                    enum debounce_mode mode, uint32_t mask) {
+    uint16_t input = key - sr->keys;
+
+    set_btn_debounce_mode_on(sr->vc + (input >> 5), key, mode, mask);
+}
+
+static void shiftreg_count_frames(struct shiftreg_chain *sr, uint32_t frames) {
+    uint32_t now_us = hal_time_us();
+    uint32_t window_us = now_us - sr->rate_window_start_us;
+
+    if (window_us >= 1000000) {
+        sr->frame_rate_hz = (uint32_t)(
+            (uint64_t)(frames - sr->rate_window_frames) * 1000000 / window_us);
+        sr->rate_window_frames = frames;
+        sr->rate_window_start_us = now_us;
+    }
+}
+
+bool shiftreg_poll(struct shiftreg_chain *sr) {
+    uint32_t words[SHIFTREG_WORDS];
+    uint8_t word_cnt = (sr->chips + 3) / 4;
+    uint32_t frames;
+
+    // Once frame n + 1 lands DMA starts overwriting the buffer of frame n,
+    // so a copy that saw the counter move may be torn and is taken again.
+    do {
+        frames = __atomic_load_n(&sr->frames, __ATOMIC_ACQUIRE);
+        if (frames == sr->polled_frame) {
+            return false;
+        }
+        memcpy(words, sr->buf[(frames - 1) & 1], word_cnt * 4);
+    } while (__atomic_load_n(&sr->frames, __ATOMIC_ACQUIRE) != frames);
+
+    sr->missed_frames += frames - sr->polled_frame - 1;
+    sr->polled_frame = frames;
+    shiftreg_count_frames(sr, frames);
+
+    return poll_dense_words(sr->vc, sr->keys, words, word_cnt);
+}
@@ -0,0 +1,80 @@
+/*
+ * 74HC165 shift register input chains.
+ *
+ * A PIO state machine clocks the chain continuously (load, then one clock
+ * per input) and DMA drops each frame into one half of a double buffer, so a
+ * full scan costs the CPU nothing but a tiny DMA interrupt per frame. Input
+ * n of chip c (A = 0 .. H = 7, chip 0 nearest the Pico) is bit c * 8 + n of
+ * the frame, which is debounced 32 inputs at a time by the vertical counter
+ * engine like the GPIOs and the matrix.
+ *
+ * Wiring: QH of chip 0 to the data pin, CLK and SH/LD on two consecutive
+ * GPIOs (clk_pin, clk_pin + 1), QH of chip c + 1 to SER of chip c.
+ */
+
+#ifndef SHIFTREG_H_
+#define SHIFTREG_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "debounce.h"
+#include "input.h"
+
+#define SHIFTREG_MAX_CHIPS 32
+#define SHIFTREG_MAX_INPUTS (SHIFTREG_MAX_CHIPS * 8)
+#define SHIFTREG_WORDS (SHIFTREG_MAX_INPUTS / 32)
+
+struct shiftreg_chain {
+    uint8_t chips;
+    uint8_t data_pin;
+    uint8_t clk_pin;
+    // frames per second the PIO clock divider was set up for
+    uint32_t frame_hz;
+
+    // DMA writes frame n (counting from 1) into buf[(n - 1) & 1]
+    uint32_t buf[2][SHIFTREG_WORDS];
+    // frames completed, bumped by the DMA interrupt
+    volatile uint32_t frames;
+    // last frame handed to the debounce engines
+    uint32_t polled_frame;
+    // frames that completed without being polled
+    uint32_t missed_frames;
+    struct debounce_vc vc[SHIFTREG_WORDS];
+    // indexed by input number, d_btn is NULL for unused inputs
+    struct phy_btn_reg keys[SHIFTREG_MAX_INPUTS];
+
+    // frames completed over the last full second
+    uint32_t frame_rate_hz;
+    uint32_t rate_window_start_us;
+    uint32_t rate_window_frames;
+
+    // PIO and DMA resources, see shiftreg_pio.c
+    uint8_t pio_idx;
+    uint8_t sm;
+    int8_t dma_ch[2];
+};
+
+void shiftreg_init(struct shiftreg_chain *sr, uint8_t data_pin,
+                   uint8_t clk_pin, uint8_t chips, uint32_t frame_hz);
+// Inputs idle high (pull-ups, switch to ground) when active_low is set.
+void reg_shiftreg_btn(struct shiftreg_chain *sr, struct dinput_btn_reg *d_btn,
+                      uint16_t input, bool active_low);
+// Input number to phy_btn_reg. NULL if out of range.
+struct phy_btn_reg *shiftreg_key(struct shiftreg_chain *sr, uint16_t input);
+void set_shiftreg_btn_debounce_mode(struct shiftreg_chain *sr,
+                                    struct phy_btn_reg *key,
+                                    enum debounce_mode mode, uint32_t mask);
+
+// Claim a PIO state machine and two DMA channels and start clocking. Only on
+// the device; returns false if the resources are taken.
+bool shiftreg_start(struct shiftreg_chain *sr);
+// Stop clocking or clock on from where it stopped; the frame it stopped in
+// ends up half old. Only on the device.
+void shiftreg_run(struct shiftreg_chain *sr, bool run);
+
+// Debounce the newest complete frame, if there is one the engines have not
+// seen yet. Returns true if any input settled into a new state.
+bool shiftreg_poll(struct shiftreg_chain *sr);
+
+#endif /* SHIFTREG_H_ */
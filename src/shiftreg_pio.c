@@ -0,0 +1,99 @@
+/*
+ * 74HC165 shift register input chains, the PIO and DMA side.
+ *
+ * Two DMA channels take turns draining the state machine, each into its own
+ * half of the frame buffer, and start each other when done. The interrupt
+ * at the end of each frame only rewinds the finished channel's write address
+ * and bumps the frame counter.
+ */
+
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/pio.h"
+
+#include "shiftreg.h"
+#include "shiftreg.pio.h"
+
+// One chain per build, the DMA interrupt needs to find it
+static struct shiftreg_chain *irq_chain;
+
+static void shiftreg_dma_irq(void) {
+    struct shiftreg_chain *sr = irq_chain;
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        if (!dma_channel_get_irq0_status(sr->dma_ch[i])) {
+            continue;
+        }
+        dma_channel_acknowledge_irq0(sr->dma_ch[i]);
+        dma_channel_set_write_addr(sr->dma_ch[i], sr->buf[i], false);
+        __atomic_store_n(&sr->frames, sr->frames + 1, __ATOMIC_RELEASE);
+    }
+}
+
+static void shiftreg_dma_setup(struct shiftreg_chain *sr, PIO pio, int i) {
+    dma_channel_config c = dma_channel_get_default_config(sr->dma_ch[i]);
+
+    // the byte sits in the low lane of the FIFO word with a left shift
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_dreq(&c, pio_get_dreq(pio, sr->sm, false));
+    channel_config_set_chain_to(&c, sr->dma_ch[i ^ 1]);
+    dma_channel_configure(sr->dma_ch[i], &c, sr->buf[i], &pio->rxf[sr->sm],
+                          sr->chips, false);
+    dma_channel_set_irq0_enabled(sr->dma_ch[i], true);
+}
+
+bool shiftreg_start(struct shiftreg_chain *sr) {
+    PIO pio = pio0;
+    int sm;
+    uint offset;
+
+    if (irq_chain || !sr->chips) {
+        return false;
+    }
+    if (!pio_can_add_program(pio, &shiftreg165_program)) {
+        pio = pio1;
+        if (!pio_can_add_program(pio, &shiftreg165_program)) {
+            return false;
+        }
+    }
+    sm = pio_claim_unused_sm(pio, false);
+    if (sm < 0) {
+        return false;
+    }
+    sr->dma_ch[0] = dma_claim_unused_channel(false);
+    sr->dma_ch[1] = dma_claim_unused_channel(false);
+    if (sr->dma_ch[0] < 0 || sr->dma_ch[1] < 0) {
+        if (sr->dma_ch[0] >= 0) {
+            dma_channel_unclaim(sr->dma_ch[0]);
+        }
+        pio_sm_unclaim(pio, sm);
+        sr->dma_ch[0] = -1;
+        sr->dma_ch[1] = -1;
+        return false;
+    }
+    sr->pio_idx = pio_get_index(pio);
+    sr->sm = sm;
+    offset = pio_add_program(pio, &shiftreg165_program);
+    shiftreg165_program_init(pio, sm, offset, sr->data_pin, sr->clk_pin,
+                             sr->chips * 8, sr->frame_hz);
+
+    irq_chain = sr;
+    shiftreg_dma_setup(sr, pio, 0);
+    shiftreg_dma_setup(sr, pio, 1);
+    irq_add_shared_handler(DMA_IRQ_0, shiftreg_dma_irq,
+                           PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(DMA_IRQ_0, true);
+
+    dma_channel_start(sr->dma_ch[0]);
+    pio_sm_set_enabled(pio, sm, true);
+    return true;
+}
+
+void shiftreg_run(struct shiftreg_chain *sr, bool run) {
+    if (irq_chain == sr) {
+        pio_sm_set_enabled(sr->pio_idx ? pio1 : pio0, sr->sm, run);
+    }
+}
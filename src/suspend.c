@@ -0,0 +1,92 @@
+/*
+ * USB suspend and remote wakeup.
+ */
+
+#include <string.h>
+
+#include "suspend.h"
+
+void usb_suspend_init(struct usb_suspend *s, uint32_t wake_timeout_us) {
+    memset(s, 0, sizeof(*s));
+    s->wake_timeout_us = wake_timeout_us;
+}
+
+void usb_suspend_enter(struct usb_suspend *s, bool remote_wakeup,
+                       uint32_t now_us) {
+    if (s->state != USB_SUSPEND_AWAKE) {
+        return;
+    }
+    s->state = USB_SUSPEND_ASLEEP;
+    s->remote_wakeup = remote_wakeup;
+    s->suspend_us = now_us;
+    s->suspends++;
+}
+
+void usb_suspend_sleep(struct usb_suspend *s, uint32_t pins, uint32_t levels,
+                       uint32_t now_us) {
+    s->wake_pins = s->remote_wakeup ? pins : 0;
+    s->sleep_levels = levels;
+    s->sleep_end_us = now_us;
+}
+
+bool usb_suspend_waited(struct usb_suspend *s, uint32_t start_us,
+                        uint32_t end_us, uint32_t gpio) {
+    s->run_us += start_us - s->sleep_end_us;
+    s->sleep_end_us = end_us;
+    s->irq_wakes++;
+    if (s->state != USB_SUSPEND_ASLEEP ||
+        !((gpio ^ s->sleep_levels) & s->wake_pins)) {
+        return false;
+    }
+    s->state = USB_SUSPEND_WAKING;
+    s->asleep_ms += (end_us - s->suspend_us) / 1000;
+    s->wake_gpio = gpio;
+    s->wake_us = end_us;
+    s->wakeups++;
+    __atomic_store_n(&s->wake_pending, true, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool usb_suspend_take_wake(struct usb_suspend *s, uint32_t *pins,
+                           uint32_t *gpio, uint32_t *t_us) {
+    if (!__atomic_load_n(&s->wake_pending, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    *pins = (s->wake_gpio ^ s->sleep_levels) & s->wake_pins;
+    *gpio = s->wake_gpio;
+    *t_us = s->wake_us;
+    __atomic_store_n(&s->wake_pending, false, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool usb_suspend_poll(struct usb_suspend *s, uint32_t now_us) {
+    if (s->state != USB_SUSPEND_WAKING ||
+        now_us - s->wake_us < s->wake_timeout_us) {
+        return false;
+    }
+    // the press stays queued for whenever the host does resume
+    s->state = USB_SUSPEND_ASLEEP;
+    s->suspend_us = now_us;
+    s->wake_timeouts++;
+    return true;
+}
+
+void usb_suspend_resume(struct usb_suspend *s, uint32_t now_us) {
+    if (s->state == USB_SUSPEND_ASLEEP) {
+        s->asleep_ms += (now_us - s->suspend_us) / 1000;
+    } else if (s->state == USB_SUSPEND_WAKING) {
+        s->resume_us = now_us - s->wake_us;
+        s->report_pending = true;
+    }
+    s->state = USB_SUSPEND_AWAKE;
+}
+
+bool usb_suspend_report_done(struct usb_suspend *s, uint32_t now_us,
+                             uint32_t *wake_us) {
+    if (!s->report_pending) {
+        return false;
+    }
+    s->report_pending = false;
+    *wake_us = now_us - s->wake_us;
+    return true;
+}
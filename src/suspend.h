@@ -0,0 +1,102 @@
+/*
+ * USB suspend and remote wakeup.
+ *
+ * While the host has the bus suspended, the device stops scanning and sleeps
+ * between interrupts at a low clock (see hal_power_low() and
+ * hal_sleep_gpio()). If the host allowed remote wakeup, a direct GPIO button
+ * leaving the level it was debounced at wakes it up: scanning restarts, the
+ * device signals the wakeup, and the GPIO levels taken in the interrupt
+ * that woke it are handed to the scanning side. That counts them as
+ * debounced at once, like an eager edge, and queues them before the first
+ * new sample, so the press that woke the host goes out in the first report
+ * after the resume however short it was.
+ *
+ * Only the state and the bookkeeping live here; the sleeping is the HAL's,
+ * so the same code runs on the host. The time spent awake for interrupts
+ * while asleep is counted as the measure of the idle current the firmware
+ * is responsible for.
+ */
+
+#ifndef SUSPEND_H_
+#define SUSPEND_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The bus has to be idle for 5 ms before a remote wakeup; the suspend
+// callback comes after 3
+#define USB_SUSPEND_WAKE_HOLDOFF_US 2000
+
+enum usb_suspend_state {
+    USB_SUSPEND_AWAKE,
+    // bus suspended, the device sleeps
+    USB_SUSPEND_ASLEEP,
+    // a button woke the device, the host has not resumed the bus yet
+    USB_SUSPEND_WAKING,
+};
+
+struct usb_suspend {
+    uint8_t state;
+    bool remote_wakeup;
+    // a wakeup the host does not answer within this goes back to sleep
+    uint32_t wake_timeout_us;
+    // GPIOs that wake the device and the levels they sleep at
+    uint32_t wake_pins;
+    uint32_t sleep_levels;
+    uint32_t suspend_us;
+    // what woke the device, until the scanning side takes it
+    bool wake_pending;
+    uint32_t wake_gpio;
+    uint32_t wake_us;
+    // the first report after a wakeup has not completed yet
+    bool report_pending;
+    // end of the last sleep, awake since
+    uint32_t sleep_end_us;
+
+    // suspends, wakeups signalled and the ones the host never answered
+    uint32_t suspends;
+    uint32_t wakeups;
+    uint32_t wake_timeouts;
+    uint32_t asleep_ms;
+    // sleeps cut short by an interrupt, and the time spent awake between
+    // them: the duty cycle that sets the idle current
+    uint32_t irq_wakes;
+    uint32_t run_us;
+    // button to bus resume, the last wakeup
+    uint32_t resume_us;
+};
+
+void usb_suspend_init(struct usb_suspend *s, uint32_t wake_timeout_us);
+
+// The host suspended the bus at now_us, allowing remote wakeup or not.
+void usb_suspend_enter(struct usb_suspend *s, bool remote_wakeup,
+                       uint32_t now_us);
+
+// Going to sleep with the scanning stopped: pins wake the device once they
+// leave levels. No pin does without remote wakeup.
+void usb_suspend_sleep(struct usb_suspend *s, uint32_t pins, uint32_t levels,
+                       uint32_t now_us);
+
+// Account a sleep from start_us that ended at end_us with the GPIOs at gpio.
+// Returns true when a wake pin moved: the device is waking up.
+bool usb_suspend_waited(struct usb_suspend *s, uint32_t start_us,
+                        uint32_t end_us, uint32_t gpio);
+
+// Scanning side: the pins that woke the device, their levels and when, once
+// per wakeup.
+bool usb_suspend_take_wake(struct usb_suspend *s, uint32_t *pins,
+                           uint32_t *gpio, uint32_t *t_us);
+
+// While waking, give up on a host that did not resume in time. Returns true
+// when the device has to go back to sleep.
+bool usb_suspend_poll(struct usb_suspend *s, uint32_t now_us);
+
+// The host resumed (or reset) the bus at now_us.
+void usb_suspend_resume(struct usb_suspend *s, uint32_t now_us);
+
+// A report completed at now_us. Returns true, with the time since the
+// button woke the device, for the first one after a wakeup.
+bool usb_suspend_report_done(struct usb_suspend *s, uint32_t now_us,
+                             uint32_t *wake_us);
+
+#endif /* SUSPEND_H_ */
@@ -0,0 +1,97 @@
+/*
+ * Telemetry console buffering and counters.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "telemetry.h"
+
+void telem_ring_init(struct telem_ring *r) {
+    memset(r, 0, sizeof(*r));
+}
+
+bool telem_write(struct telem_ring *r, void const *data, uint16_t len) {
+    uint32_t head = r->head;
+    uint32_t pos = head & (TELEM_RING_LEN - 1);
+    uint32_t first;
+
+    if (TELEM_RING_LEN - (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE)) <
+        len) {
+        r->dropped++;
+        return false;
+    }
+    // at most two copies, around the end of the buffer
+    first = TELEM_RING_LEN - pos < len ? TELEM_RING_LEN - pos : len;
+    memcpy(r->buf + pos, data, first);
+    memcpy(r->buf, (uint8_t const *)data + first, len - first);
+    __atomic_store_n(&r->head, head + len, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool telem_printf(struct telem_ring *r, char const *fmt, ...) {
+    char line[TELEM_LINE_MAX];
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (n < 0) {
+        return false;
+    }
+    return telem_write(r, line,
+                       n < (int)sizeof(line) ? n : (int)sizeof(line) - 1);
+}
+
+uint16_t telem_read(struct telem_ring *r, uint8_t *out, uint16_t cap) {
+    uint32_t tail = r->tail;
+    uint32_t avail = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - tail;
+    uint32_t pos = tail & (TELEM_RING_LEN - 1);
+    uint32_t n = avail < cap ? avail : cap;
+    uint32_t first = TELEM_RING_LEN - pos < n ? TELEM_RING_LEN - pos : n;
+
+    memcpy(out, r->buf + pos, first);
+    memcpy(out + first, r->buf, n - first);
+    __atomic_store_n(&r->tail, tail + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+void telem_counters_reset(struct telem_counters *c, uint32_t now_us) {
+    memset(c, 0, sizeof(*c));
+    c->rate_window_start_us = now_us;
+}
+
+void telem_rate_update(struct telem_counters *c, uint32_t now_us) {
+    uint32_t window_us = now_us - c->rate_window_start_us;
+    uint32_t samples, reports;
+
+    if (window_us < 1000000) {
+        return;
+    }
+    // the scanning side may be on the other core, take one value and use it
+    samples = __atomic_load_n(&c->samples, __ATOMIC_RELAXED);
+    reports = c->reports_sent;
+    c->sample_rate_hz = (uint32_t)((uint64_t)(samples - c->rate_window_samples) *
+                                   1000000 / window_us);
+    c->report_rate_hz = (uint32_t)((uint64_t)(reports - c->rate_window_reports) *
+                                   1000000 / window_us);
+    c->rate_window_samples = samples;
+    c->rate_window_reports = reports;
+    c->rate_window_start_us = now_us;
+}
+
+void telem_dump_counters(struct telem_ring *r,
+                         struct telem_counters const *c) {
+    TELEM_PRINTF(r, "scan: %lu samples/s, %lu total\r\n",
+                 (unsigned long)c->sample_rate_hz,
+                 (unsigned long)__atomic_load_n(&c->samples, __ATOMIC_RELAXED));
+    TELEM_PRINTF(r, "reports: %lu/s, %lu sent, %lu busy, %lu unchanged\r\n",
+                 (unsigned long)c->report_rate_hz,
+                 (unsigned long)c->reports_sent,
+                 (unsigned long)c->reports_busy,
+                 (unsigned long)c->reports_unchanged);
+    TELEM_PRINTF(r, "console: %lu lines dropped\r\n",
+                 (unsigned long)r->dropped);
+}
@@ -0,0 +1,88 @@
+/*
+ * Telemetry console buffering and counters.
+ *
+ * Log lines go into a single producer/single consumer byte ring. Writing is
+ * a bounded memcpy that never waits: a line that does not fit is dropped
+ * whole and counted. The main loop drains the ring to the CDC console only
+ * while it has nothing else to do, so logging cannot hold up a report.
+ *
+ * The counters are bumped from the scan and USB paths and turned into rates
+ * once a second from the main loop.
+ */
+
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Must be a power of two
+#define TELEM_RING_LEN 1024
+// Longest line telem_printf() formats, anything past it is cut
+#define TELEM_LINE_MAX 128
+
+struct telem_ring {
+    // head is only written by the producer, tail only by the consumer
+    uint32_t head;
+    uint32_t tail;
+    // lines dropped because the ring was full
+    uint32_t dropped;
+    uint8_t buf[TELEM_RING_LEN];
+};
+
+struct telem_counters {
+    // raw samples debounced (or matrix scans, shift register frames); written
+    // by the scanning side
+    uint32_t samples;
+    // written by the USB side: reports handed to TinyUSB, reports not sent
+    // because the endpoint was busy (tud_hid_ready() false), and reports
+    // dropped as unchanged
+    uint32_t reports_sent;
+    uint32_t reports_busy;
+    uint32_t reports_unchanged;
+
+    // over the last full second, updated by telem_rate_update()
+    uint32_t sample_rate_hz;
+    uint32_t report_rate_hz;
+    uint32_t rate_window_start_us;
+    uint32_t rate_window_samples;
+    uint32_t rate_window_reports;
+};
+
+void telem_ring_init(struct telem_ring *r);
+
+// Producer side. Queue len bytes, all or nothing. Returns false (and counts
+// a drop) when there is no room.
+bool telem_write(struct telem_ring *r, void const *data, uint16_t len);
+// Fixed strings from the hot path cost a memcpy and nothing else
+#define TELEM_LOG(r, str) telem_write((r), (str), sizeof(str) - 1)
+// Producer side. Format a line first; for idle time, not the hot path.
+bool telem_printf(struct telem_ring *r, char const *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+// telem_printf() of a literal format with up to 8 %lu arguments, checked at
+// compile time to fit TELEM_LINE_MAX with each at 10 digits, 7 more than
+// its %lu.
+#define TELEM_PRINTF(r, fmt, ...)                                              \
+    do {                                                                       \
+        _Static_assert(sizeof(fmt) + 7 * TELEM_NARGS(__VA_ARGS__) <=           \
+                           TELEM_LINE_MAX,                                     \
+                       "longer than TELEM_LINE_MAX: " fmt);                    \
+        telem_printf((r), fmt, __VA_ARGS__);                                   \
+    } while (0)
+#define TELEM_NARGS(...) TELEM_NARGS_(__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define TELEM_NARGS_(a, b, c, d, e, f, g, h, n, ...) n
+
+// Consumer side. Take up to cap bytes off the ring. Returns how many.
+uint16_t telem_read(struct telem_ring *r, uint8_t *out, uint16_t cap);
+static inline uint32_t telem_pending(struct telem_ring *r) {
+    return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - r->tail;
+}
+
+void telem_counters_reset(struct telem_counters *c, uint32_t now_us);
+// Recompute the rates once a full second has passed since the last time.
+void telem_rate_update(struct telem_counters *c, uint32_t now_us);
+// Queue a readable dump of the counters.
+void telem_dump_counters(struct telem_ring *r,
+                         struct telem_counters const *c);
+
+#endif /* TELEMETRY_H_ */
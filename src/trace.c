@@ -0,0 +1,91 @@
+/*
+ * GPIO trace recording.
+ */
+
+#include <string.h>
+
+#include "trace.h"
+
+void trace_recorder_init(struct trace_recorder *tr, uint32_t rate_hz) {
+    memset(tr, 0, sizeof(*tr));
+    tr->rate_hz = rate_hz;
+}
+
+void trace_start(struct trace_recorder *tr, uint32_t pins) {
+    tr->tail = __atomic_load_n(&tr->head, __ATOMIC_ACQUIRE);
+    tr->pins = pins;
+    tr->session++;
+    tr->dropped = 0;
+    tr->records = 0;
+    tr->header_due = true;
+    tr->out = TRACE_OUT_RECORDS;
+    __atomic_store_n(&tr->on, true, __ATOMIC_RELEASE);
+}
+
+void trace_stop(struct trace_recorder *tr) {
+    __atomic_store_n(&tr->on, false, __ATOMIC_RELEASE);
+    if (tr->out != TRACE_OUT_IDLE) {
+        tr->out = TRACE_OUT_STOPPING;
+    }
+}
+
+void trace_push(struct trace_recorder *tr, uint32_t gpio, uint32_t t_us) {
+    uint32_t head = tr->head;
+    struct trace_rec *rec;
+
+    if (head - __atomic_load_n(&tr->tail, __ATOMIC_ACQUIRE) >=
+        TRACE_RING_LEN) {
+        tr->dropped++;
+        return;
+    }
+    rec = tr->ring + (head & (TRACE_RING_LEN - 1));
+    rec->t_us = t_us;
+    rec->gpio = gpio;
+    tr->last = gpio;
+    tr->seen_session = tr->session;
+    __atomic_store_n(&tr->head, head + 1, __ATOMIC_RELEASE);
+}
+
+uint16_t trace_read(struct trace_recorder *tr, uint8_t *out, uint16_t cap,
+                    uint32_t now_us) {
+    struct trace_header hdr;
+    struct trace_rec end;
+    uint32_t tail = tr->tail;
+    uint32_t avail;
+    uint16_t n = 0;
+
+    if (tr->header_due) {
+        if (cap < sizeof(hdr)) {
+            return 0;
+        }
+        hdr.magic = TRACE_MAGIC;
+        hdr.version = TRACE_VERSION;
+        hdr.rec_len = sizeof(struct trace_rec);
+        hdr.rate_hz = tr->rate_hz;
+        hdr.pins = tr->pins;
+        memcpy(out, &hdr, sizeof(hdr));
+        n = sizeof(hdr);
+        tr->header_due = false;
+    }
+    avail = __atomic_load_n(&tr->head, __ATOMIC_ACQUIRE) - tail;
+    while (avail && (uint16_t)(cap - n) >= sizeof(struct trace_rec)) {
+        memcpy(out + n, tr->ring + (tail & (TRACE_RING_LEN - 1)),
+               sizeof(struct trace_rec));
+        tr->last_gpio = tr->ring[tail & (TRACE_RING_LEN - 1)].gpio;
+        n += sizeof(struct trace_rec);
+        tail++;
+        avail--;
+        tr->records++;
+    }
+    __atomic_store_n(&tr->tail, tail, __ATOMIC_RELEASE);
+    // the closing record says how long the last levels lasted
+    if (tr->out == TRACE_OUT_STOPPING && !avail &&
+        (uint16_t)(cap - n) >= sizeof(struct trace_rec)) {
+        end.t_us = now_us;
+        end.gpio = tr->last_gpio;
+        memcpy(out + n, &end, sizeof(end));
+        n += sizeof(end);
+        tr->out = TRACE_OUT_IDLE;
+    }
+    return n;
+}
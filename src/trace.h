@@ -0,0 +1,106 @@
+/*
+ * GPIO trace recording.
+ *
+ * A trace is the raw GPIO samples the debounce saw, timestamped, so a
+ * capture of a real switch can be replayed through the debounce code on the
+ * host (host/trace_tool.c). It is a trace_header followed by trace_rec
+ * records, all little endian. Samples are taken at header.rate_hz, and a
+ * record is only written for the first sample and for each sample where one
+ * of header.pins differs from the last record; the samples in between are
+ * implied, repeating the last record. The final record repeats the levels
+ * of the one before it at the time the trace stopped.
+ *
+ * On the device the scanning side feeds every sample to trace_capture(),
+ * which is a load and a compare while nothing is being recorded, and the
+ * records go through a single producer/single consumer ring to the console,
+ * which streams them out in place of its text while a trace runs.
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TRACE_MAGIC 0x544d4655 // "UMFT"
+#define TRACE_VERSION 1
+// Must be a power of two. 256 changes is a lot of bounce to buffer.
+#define TRACE_RING_LEN 256
+
+struct trace_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t rec_len;
+    uint32_t rate_hz;
+    // GPIOs whose changes were recorded
+    uint32_t pins;
+};
+
+struct trace_rec {
+    uint32_t t_us;
+    uint32_t gpio;
+};
+
+_Static_assert(sizeof(struct trace_header) == 16 &&
+                   sizeof(struct trace_rec) == 8,
+               "trace layout is part of the file format");
+
+enum trace_out {
+    TRACE_OUT_IDLE,
+    TRACE_OUT_RECORDS,
+    // stopped, the rest of the ring and the final record still to go
+    TRACE_OUT_STOPPING,
+};
+
+struct trace_recorder {
+    // set by the consumer, read by the producer
+    bool on;
+    uint32_t pins;
+    uint32_t session;
+    // producer only
+    uint32_t seen_session;
+    uint32_t last;
+    // head is only written by the producer, tail only by the consumer
+    uint32_t head;
+    uint32_t tail;
+    // records lost to a full ring, the trace is not exact if any
+    uint32_t dropped;
+
+    // consumer only
+    uint32_t rate_hz;
+    uint8_t out;
+    bool header_due;
+    uint32_t records;
+    uint32_t last_gpio;
+    struct trace_rec ring[TRACE_RING_LEN];
+};
+
+void trace_recorder_init(struct trace_recorder *tr, uint32_t rate_hz);
+
+// Consumer side. Start a trace of the given GPIOs, dropping whatever an
+// earlier one left in the ring.
+void trace_start(struct trace_recorder *tr, uint32_t pins);
+// Consumer side. Stop taking samples; trace_read() still hands out the rest.
+void trace_stop(struct trace_recorder *tr);
+static inline bool trace_active(struct trace_recorder const *tr) {
+    return tr->out != TRACE_OUT_IDLE;
+}
+// Consumer side. Take the header, whole records and finally the closing
+// record, up to cap bytes. Returns how many.
+uint16_t trace_read(struct trace_recorder *tr, uint8_t *out, uint16_t cap,
+                    uint32_t now_us);
+
+void trace_push(struct trace_recorder *tr, uint32_t gpio, uint32_t t_us);
+
+// Producer side, on every sample.
+static inline void trace_capture(struct trace_recorder *tr, uint32_t gpio,
+                                 uint32_t t_us) {
+    if (!__atomic_load_n(&tr->on, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    if (((gpio ^ tr->last) & tr->pins) || tr->seen_session != tr->session) {
+        trace_push(tr, gpio, t_us);
+    }
+}
+
+#endif /* TRACE_H_ */
@@ -26,6 +26,8 @@
 #ifndef _TUSB_CONFIG_H_
 #define _TUSB_CONFIG_H_
 
+#include "hid_desc.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -96,14 +98,54 @@ extern "C" {
 #endif
 
 //------------- CLASS -------------//
-#define CFG_TUD_HID 1
-#define CFG_TUD_CDC 0
+// The telemetry console, see UMFD_CDC_CONSOLE in src/CMakeLists.txt
+#ifndef UMFD_CDC_CONSOLE
+#define UMFD_CDC_CONSOLE 0
+#endif
+
+// The display stream, see UMFD_DISPLAY in src/CMakeLists.txt
+#ifndef UMFD_DISPLAY
+#define UMFD_DISPLAY 0
+#endif
+
+// The backlight, see UMFD_BACKLIGHT in src/CMakeLists.txt
+#ifndef UMFD_BACKLIGHT
+#define UMFD_BACKLIGHT 0
+#endif
+
+// HID interfaces the buttons are split over, see UMFD_HID_PANELS in
+// src/CMakeLists.txt and panel.h
+#ifndef UMFD_HID_PANELS
+#define UMFD_HID_PANELS 1
+#endif
+#if UMFD_HID_PANELS < 1 || UMFD_HID_PANELS > 4
+#error "UMFD_HID_PANELS must be 1..4"
+#endif
+
+#define CFG_TUD_HID UMFD_HID_PANELS
+#define CFG_TUD_CDC UMFD_CDC_CONSOLE
 #define CFG_TUD_MSC 0
 #define CFG_TUD_MIDI 0
-#define CFG_TUD_VENDOR 0
-
-// HID buffer size Should be sufficient to hold ID (if any) + Data
-#define CFG_TUD_HID_EP_BUFSIZE 16
+#define CFG_TUD_VENDOR UMFD_DISPLAY
+
+// HID buffer size Should be sufficient to hold ID (if any) + Data. Sized for
+// the largest gamepad or feature report this build can generate, see
+// hid_desc.h
+#define CFG_TUD_HID_EP_BUFSIZE                                                 \
+    (1 + (GAMEPAD_REPORT_MAX_LEN > HID_FEATURE_MAX_LEN ? GAMEPAD_REPORT_MAX_LEN \
+                                                       : HID_FEATURE_MAX_LEN))
+
+// CDC FIFO sizes. The console only ever holds a few lines in flight, the
+// rest waits in its own ring, see telemetry.h
+#define CFG_TUD_CDC_RX_BUFSIZE 64
+#define CFG_TUD_CDC_TX_BUFSIZE 256
+#define CFG_TUD_CDC_EP_BUFSIZE 64
+
+// Vendor FIFO sizes. The display stream is only read as fast as the panel
+// takes it; a full RX FIFO NAKs the host. Nothing is sent back.
+#define CFG_TUD_VENDOR_RX_BUFSIZE 1024
+#define CFG_TUD_VENDOR_TX_BUFSIZE 64
+#define CFG_TUD_VENDOR_EPSIZE 64
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,95 @@
+/*
+ * Hashed timer wheel.
+ */
+
+#include <string.h>
+
+#include "twheel.h"
+
+void twheel_init(struct timer_wheel *w, uint32_t tick_us, uint32_t now_us) {
+    int i;
+
+    memset(w, 0, sizeof(*w));
+    w->tick_us = tick_us ? tick_us : 1;
+    w->tick_end_us = now_us;
+    for (i = 0; i < TWHEEL_SLOTS; i++) {
+        w->slot[i] = TWHEEL_NONE;
+    }
+}
+
+static void twheel_unlink(struct timer_wheel *w, uint16_t id) {
+    struct twheel_timer *t = w->timers + id;
+
+    if (t->prev != TWHEEL_NONE) {
+        w->timers[t->prev].next = t->next;
+    } else {
+        w->slot[t->due_tick & (TWHEEL_SLOTS - 1)] = t->next;
+    }
+    if (t->next != TWHEEL_NONE) {
+        w->timers[t->next].prev = t->prev;
+    }
+    t->armed = false;
+    w->armed--;
+}
+
+void twheel_arm(struct timer_wheel *w, uint16_t id, uint32_t now_us,
+                uint32_t delay_us) {
+    struct twheel_timer *t = w->timers + id;
+    int32_t ahead = (int32_t)(now_us + delay_us - w->tick_end_us);
+    uint32_t ticks = ahead > 0 ? (ahead + w->tick_us - 1) / w->tick_us : 1;
+    uint16_t *head;
+
+    if (id >= TWHEEL_MAX_TIMERS) {
+        return;
+    }
+    if (t->armed) {
+        twheel_unlink(w, id);
+    }
+    t->due_tick = w->tick + ticks;
+    head = w->slot + (t->due_tick & (TWHEEL_SLOTS - 1));
+    t->prev = TWHEEL_NONE;
+    t->next = *head;
+    if (*head != TWHEEL_NONE) {
+        w->timers[*head].prev = id;
+    }
+    *head = id;
+    t->armed = true;
+    w->armed++;
+}
+
+void twheel_cancel(struct timer_wheel *w, uint16_t id) {
+    if (id < TWHEEL_MAX_TIMERS && w->timers[id].armed) {
+        twheel_unlink(w, id);
+    }
+}
+
+uint16_t twheel_expire(struct timer_wheel *w, uint32_t now_us) {
+    int32_t elapsed = (int32_t)(now_us - w->tick_end_us);
+    uint32_t target, ticks;
+    uint16_t id;
+
+    if (elapsed < (int32_t)w->tick_us) {
+        return TWHEEL_NONE;
+    }
+    ticks = elapsed / w->tick_us;
+    target = w->tick + ticks;
+    // nothing to look at, or a gap long enough to pass every slot anyway
+    if (!w->armed || ticks > TWHEEL_SLOTS) {
+        ticks = w->armed ? ticks - TWHEEL_SLOTS : ticks;
+        w->tick += ticks;
+        w->tick_end_us += ticks * w->tick_us;
+    }
+    while (w->tick != target) {
+        for (id = w->slot[(w->tick + 1) & (TWHEEL_SLOTS - 1)];
+             id != TWHEEL_NONE; id = w->timers[id].next) {
+            // later turns of the wheel share the slot
+            if ((int32_t)(w->timers[id].due_tick - target) <= 0) {
+                twheel_unlink(w, id);
+                return id;
+            }
+        }
+        w->tick++;
+        w->tick_end_us += w->tick_us;
+    }
+    return TWHEEL_NONE;
+}
@@ -0,0 +1,54 @@
+/*
+ * Hashed timer wheel.
+ *
+ * Timeouts that are armed and cancelled far more often than they fire, like
+ * the layer engine's hold and chord windows (see layer.h). Time moves in
+ * ticks of tick_us; a timer due at tick t sits on the list of slot
+ * t % TWHEEL_SLOTS, so arming and cancelling are O(1) whatever else is
+ * pending, and moving time on only looks at the slots it passes. A timer
+ * more than a turn of the wheel ahead just stays put until its turn comes.
+ *
+ * Timers are a fixed pool indexed by the caller's IDs, linked through their
+ * indexes rather than pointers.
+ */
+
+#ifndef TWHEEL_H_
+#define TWHEEL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Must be a power of two
+#define TWHEEL_SLOTS 256
+#define TWHEEL_MAX_TIMERS 64
+#define TWHEEL_NONE 0xffff
+
+struct twheel_timer {
+    uint16_t next;
+    uint16_t prev;
+    uint32_t due_tick;
+    bool armed;
+};
+
+struct timer_wheel {
+    uint32_t tick_us;
+    // last tick fully expired, and when it ended
+    uint32_t tick;
+    uint32_t tick_end_us;
+    uint16_t armed;
+    uint16_t slot[TWHEEL_SLOTS];
+    struct twheel_timer timers[TWHEEL_MAX_TIMERS];
+};
+
+void twheel_init(struct timer_wheel *w, uint32_t tick_us, uint32_t now_us);
+
+// (Re)arm timer id to fire delay_us after now_us, at least one tick later.
+void twheel_arm(struct timer_wheel *w, uint16_t id, uint32_t now_us,
+                uint32_t delay_us);
+void twheel_cancel(struct timer_wheel *w, uint16_t id);
+
+// Take one timer due by now_us off the wheel. Returns its ID, or TWHEEL_NONE
+// once nothing is due; call until then.
+uint16_t twheel_expire(struct timer_wheel *w, uint32_t now_us);
+
+#endif /* TWHEEL_H_ */
@@ -0,0 +1,100 @@
+/*
+ * uMFD hardware abstraction.
+ *
+ * Everything the core (scan, debounce, report building) needs from the board.
+ * On the Pico these are thin inlines over the SDK and TinyUSB; with
+ * UMFD_HOST they are plain functions supplied by the simulated HAL in host/.
+ */
+
+#ifndef UMFD_HAL_H_
+#define UMFD_HAL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef UMFD_HOST
+
+uint32_t hal_gpio_get_all(void);
+void hal_gpio_setup_input(uint8_t pin, bool pull_up);
+void hal_gpio_drive_low(uint8_t pin);
+void hal_gpio_release(uint8_t pin);
+void hal_delay_us(uint32_t us);
+uint32_t hal_time_us(void);
+uint32_t hal_millis(void);
+bool hal_hid_ready(uint8_t instance);
+bool hal_hid_report(uint8_t instance, uint8_t report_id, void const *report,
+                    uint16_t len);
+
+#else
+
+#include "bsp/board.h"
+#include "hardware/gpio.h"
+#include "hardware/timer.h"
+#include "tusb.h"
+
+static inline uint32_t hal_gpio_get_all(void) { return gpio_get_all(); }
+
+static inline void hal_gpio_setup_input(uint8_t pin, bool pull_up) {
+    gpio_init(pin);
+    gpio_set_dir(pin, GPIO_IN);
+    if (pull_up) {
+        gpio_pull_up(pin);
+    } else {
+        gpio_disable_pulls(pin);
+    }
+}
+
+// Open drain style: drive low, or let go and float as an input.
+static inline void hal_gpio_drive_low(uint8_t pin) {
+    gpio_put(pin, 0);
+    gpio_set_dir(pin, GPIO_OUT);
+}
+
+static inline void hal_gpio_release(uint8_t pin) { gpio_set_dir(pin, GPIO_IN); }
+
+static inline void hal_delay_us(uint32_t us) { busy_wait_us_32(us); }
+
+static inline uint32_t hal_time_us(void) { return time_us_32(); }
+
+static inline uint32_t hal_millis(void) { return board_millis(); }
+
+static inline bool hal_hid_ready(uint8_t instance) {
+    return tud_hid_n_ready(instance);
+}
+
+static inline bool hal_hid_report(uint8_t instance, uint8_t report_id,
+                                  void const *report, uint16_t len) {
+    return tud_hid_n_report(instance, report_id, report, len);
+}
+
+#endif
+
+// Call fn(ctx) from interrupt context every period_us, measured start to
+// start. There is a single sample timer; see hal_pico.c and host/hal_sim.c.
+bool hal_sample_timer_start(uint32_t period_us, void (*fn)(void *), void *ctx);
+// Move the next sample timer tick by us, once; later ticks keep the period
+// from there.
+void hal_sample_timer_nudge(int32_t us);
+// Stop the sample timer; hal_sample_timer_start() starts it again.
+void hal_sample_timer_stop(void);
+
+// Call fn(ctx) from interrupt context on every USB start of frame.
+bool hal_usb_sof_start(void (*fn)(void *), void *ctx);
+
+// The two flash sectors set aside for the config block (see config.h),
+// readable in place.
+void const *hal_config_sector(uint8_t n);
+// Erase sector n and write len bytes to its start. The flash is unreadable
+// meanwhile, so both cores stall for the tens of ms an erase takes.
+bool hal_config_sector_write(uint8_t n, void const *data, uint16_t len);
+
+// Run the system clock (and with it the cores, PIO and the peripheral clock)
+// straight off the crystal for a USB suspend, or back at the speed it ran
+// at before. USB and the microsecond timer keep their own clocks.
+void hal_power_low(bool low);
+// Sleep until an interrupt, or until one of pins leaves its level in levels.
+// Returns the GPIO levels as one of those pins moved, taken in its
+// interrupt, or else as the sleep ended; t_us is when.
+uint32_t hal_sleep_gpio(uint32_t pins, uint32_t levels, uint32_t *t_us);
+
+#endif /* UMFD_HAL_H_ */
@@ -24,32 +24,60 @@
  */
 
 #include "usb_descriptors.h"
+#include "backlight.h"
+#include "config.h"
+#include "latency.h"
 #include "tusb.h"
 
+#if LATENCY_FEATURE_LEN > HID_FEATURE_MAX_LEN
+#error "latency feature report does not fit the HID endpoint buffer"
+#endif
+#if CONFIG_FEATURE_LEN > HID_FEATURE_MAX_LEN
+#error "config feature report does not fit the HID endpoint buffer"
+#endif
+#if KEYBOARD_REPORT_LEN > HID_FEATURE_MAX_LEN
+#error "keyboard report does not fit the HID endpoint buffer"
+#endif
+#if BACKLIGHT_REPORT_LEN > HID_FEATURE_MAX_LEN
+#error "backlight report does not fit the HID endpoint buffer"
+#endif
+
 /* A combination of interfaces must have a unique product id, since PC will save
  * device driver after the first plug. Same VID/PID with different interface e.g
  * MSC (first), then CDC (later) will possibly cause system error on PC.
  *
  * Auto ProductID layout's Bitmap:
- *   [MSB]         HID | MSC | CDC          [LSB]
+ *   [MSB]  HID panels - 1 (2 bits) | VENDOR | MIDI | HID | MSC | CDC  [LSB]
  */
 #define _PID_MAP(itf, n) ((CFG_TUD_##itf) << (n))
 #define USB_PID                                                                \
-    (0x4000 | _PID_MAP(CDC, 0) | _PID_MAP(MSC, 1) | _PID_MAP(HID, 2) |         \
-     _PID_MAP(MIDI, 3) | _PID_MAP(VENDOR, 4))
+    (0x4000 | _PID_MAP(CDC, 0) | _PID_MAP(MSC, 1) |                            \
+     (CFG_TUD_HID ? 1 : 0) << 2 | _PID_MAP(MIDI, 3) | _PID_MAP(VENDOR, 4) |    \
+     (CFG_TUD_HID - 1) << 5)
 
 #define USB_VID 0xf00d
 #define USB_BCD 0x0200
 
+// CDC needs an interface association, which needs the device to say so
+#if CFG_TUD_CDC
+#define USB_DEVICE_CLASS TUSB_CLASS_MISC
+#define USB_DEVICE_SUBCLASS MISC_SUBCLASS_COMMON
+#define USB_DEVICE_PROTOCOL MISC_PROTOCOL_IAD
+#else
+#define USB_DEVICE_CLASS 0x00
+#define USB_DEVICE_SUBCLASS 0x00
+#define USB_DEVICE_PROTOCOL 0x00
+#endif
+
 //--------------------------------------------------------------------+
 // Device Descriptors
 //--------------------------------------------------------------------+
 tusb_desc_device_t const desc_device = {.bLength = sizeof(tusb_desc_device_t),
                                         .bDescriptorType = TUSB_DESC_DEVICE,
                                         .bcdUSB = USB_BCD,
-                                        .bDeviceClass = 0x00,
-                                        .bDeviceSubClass = 0x00,
-                                        .bDeviceProtocol = 0x00,
+                                        .bDeviceClass = USB_DEVICE_CLASS,
+                                        .bDeviceSubClass = USB_DEVICE_SUBCLASS,
+                                        .bDeviceProtocol = USB_DEVICE_PROTOCOL,
                                         .bMaxPacketSize0 =
                                             CFG_TUD_ENDPOINT0_SIZE,
 
@@ -73,17 +101,22 @@ uint8_t const *tud_descriptor_device_cb(void) {
 // HID Report Descriptor
 //--------------------------------------------------------------------+
 
-uint8_t const desc_hid_report[] = {
-    TUD_HID_REPORT_DESC_KEYBOARD(HID_REPORT_ID(REPORT_ID_KEYBOARD)),
-    TUD_HID_REPORT_DESC_MOUSE(HID_REPORT_ID(REPORT_ID_MOUSE)),
-    TUD_HID_REPORT_DESC_CONSUMER(HID_REPORT_ID(REPORT_ID_CONSUMER_CONTROL)),
-    TUD_HID_REPORT_DESC_GAMEPAD(HID_REPORT_ID(REPORT_ID_GAMEPAD))};
+// Generated at boot by usb_desc_hid_init() for the buttons, hats and axes the
+// board actually has, see hid_desc.h
+static uint8_t desc_hid_report[GAMEPAD_DESC_MAX_LEN + KEYBOARD_DESC_MAX_LEN +
+                               3 * HID_FEATURE_DESC_MAX_LEN];
+
+// The other panels' button pads, by usb_desc_hid_panel_init(), see panel.h
+static uint8_t desc_hid_panel[CFG_TUD_HID > 1 ? CFG_TUD_HID - 1 : 1]
+                             [GAMEPAD_DESC_MAX_LEN];
 
 // Invoked when received GET HID REPORT DESCRIPTOR
 // Application return pointer to descriptor
 // Descriptor contents must exist long enough for transfer to complete
 uint8_t const *tud_hid_descriptor_report_cb(uint8_t instance) {
-    (void)instance;
+    if (instance && instance < CFG_TUD_HID) {
+        return desc_hid_panel[instance - 1];
+    }
     return desc_hid_report;
 }
 
@@ -91,23 +124,185 @@ uint8_t const *tud_hid_descriptor_report_cb(uint8_t instance) {
 // Configuration Descriptor
 //--------------------------------------------------------------------+
 
-enum { ITF_NUM_HID, ITF_NUM_TOTAL };
+enum {
+    ITF_NUM_HID,
+    // the other panels follow in order, instance k on ITF_NUM_HID + k
+    ITF_NUM_HID_LAST = ITF_NUM_HID + CFG_TUD_HID - 1,
+#if CFG_TUD_CDC
+    ITF_NUM_CDC,
+    ITF_NUM_CDC_DATA,
+#endif
+#if CFG_TUD_VENDOR
+    ITF_NUM_VENDOR,
+#endif
+    ITF_NUM_TOTAL
+};
 
-#define CONFIG_TOTAL_LEN (TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN)
+// The backlight's output reports come in on an interrupt OUT endpoint rather
+// than one control transfer each
+#if UMFD_BACKLIGHT
+#define HID_ITF_DESC_LEN TUD_HID_INOUT_DESC_LEN
+#else
+#define HID_ITF_DESC_LEN TUD_HID_DESC_LEN
+#endif
 
-#define EPNUM_HID 0x81
+#define CONFIG_TOTAL_LEN                                                       \
+    (TUD_CONFIG_DESC_LEN + HID_ITF_DESC_LEN +                                \
+     (CFG_TUD_HID - 1) * TUD_HID_DESC_LEN + CFG_TUD_CDC * TUD_CDC_DESC_LEN +  \
+     CFG_TUD_VENDOR * TUD_VENDOR_DESC_LEN)
 
-uint8_t const desc_configuration[] = {
+#define EPNUM_HID 0x81
+#define EPNUM_HID_OUT 0x01
+#define EPNUM_CDC_NOTIF 0x82
+#define EPNUM_CDC_OUT 0x03
+#define EPNUM_CDC_IN 0x83
+#define EPNUM_VENDOR_OUT 0x04
+#define EPNUM_VENDOR_IN 0x84
+// and on for the other panels
+#define EPNUM_HID_PANEL 0x85
+
+// Interface names, only set when there is more than one panel
+#define STRID_PANEL 6
+#define HID_PANEL_STRID(k) (CFG_TUD_HID > 1 ? STRID_PANEL + (k) : 0)
+
+// Where TUD_HID_DESCRIPTOR() puts the report descriptor length and the IN
+// endpoint size, patched by usb_desc_hid_init(). TUD_HID_INOUT_DESCRIPTOR()
+// has the OUT endpoint first, which keeps the full buffer size.
+#define HID_DESC_REPORT_LEN_OFF (TUD_CONFIG_DESC_LEN + 9 + 7)
+#define HID_DESC_EP_SIZE_OFF                                                   \
+    (TUD_CONFIG_DESC_LEN + 9 + 9 + 4 + (UMFD_BACKLIGHT ? 7 : 0))
+// The same for the other panels, which follow the first one
+#define HID_PANEL_DESC_OFF(k)                                                  \
+    (TUD_CONFIG_DESC_LEN + HID_ITF_DESC_LEN + ((k) - 1) * TUD_HID_DESC_LEN)
+
+// Interface number, string index, protocol, report descriptor len, EP In
+// address, size & polling interval
+#define HID_PANEL_DESCRIPTOR(k)                                                \
+    TUD_HID_DESCRIPTOR(ITF_NUM_HID + (k), HID_PANEL_STRID(k),                  \
+                       HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_panel[0]),       \
+                       EPNUM_HID_PANEL + (k) - 1, CFG_TUD_HID_EP_BUFSIZE, 1)
+
+uint8_t desc_configuration[] = {
     // Config number, interface count, string index, total length, attribute,
     // power in mA
     TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN,
                           TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, 100),
 
+#if UMFD_BACKLIGHT
+    // Interface number, string index, protocol, report descriptor len, EP Out
+    // and In address, size & polling interval
+    TUD_HID_INOUT_DESCRIPTOR(ITF_NUM_HID, HID_PANEL_STRID(0),
+                             HID_ITF_PROTOCOL_NONE,
+                             sizeof(desc_hid_report), EPNUM_HID_OUT,
+                             EPNUM_HID, CFG_TUD_HID_EP_BUFSIZE, 1),
+#else
     // Interface number, string index, protocol, report descriptor len, EP In
     // address, size & polling interval
-    TUD_HID_DESCRIPTOR(ITF_NUM_HID, 0, HID_ITF_PROTOCOL_NONE,
+    TUD_HID_DESCRIPTOR(ITF_NUM_HID, HID_PANEL_STRID(0), HID_ITF_PROTOCOL_NONE,
                        sizeof(desc_hid_report), EPNUM_HID,
-                       CFG_TUD_HID_EP_BUFSIZE, 5)};
+                       CFG_TUD_HID_EP_BUFSIZE, 1),
+#endif
+#if CFG_TUD_HID > 1
+    HID_PANEL_DESCRIPTOR(1),
+#endif
+#if CFG_TUD_HID > 2
+    HID_PANEL_DESCRIPTOR(2),
+#endif
+#if CFG_TUD_HID > 3
+    HID_PANEL_DESCRIPTOR(3),
+#endif
+
+#if CFG_TUD_CDC
+    // Interface number, string index, EP notification address and size, EP
+    // data address (out, in) and size. Bulk, so it only gets the bus time
+    // the HID interrupt endpoint leaves over.
+    TUD_CDC_DESCRIPTOR(ITF_NUM_CDC, 4, EPNUM_CDC_NOTIF, 8, EPNUM_CDC_OUT,
+                       EPNUM_CDC_IN, CFG_TUD_CDC_EP_BUFSIZE),
+#endif
+
+#if CFG_TUD_VENDOR
+    // Interface number, string index, EP out and in address, EP size. The
+    // display stream, bulk like the console.
+    TUD_VENDOR_DESCRIPTOR(ITF_NUM_VENDOR, 5, EPNUM_VENDOR_OUT,
+                          EPNUM_VENDOR_IN, CFG_TUD_VENDOR_EPSIZE),
+#endif
+};
+
+bool usb_desc_hid_init(struct gamepad_layout const *layout, bool keyboard,
+                       bool backlight) {
+    uint16_t desc_len =
+        gamepad_desc_build(layout, desc_hid_report, sizeof(desc_hid_report));
+    uint16_t keyboard_len, feature_len;
+    // the report ID goes out in front of the report
+    uint16_t ep_size = layout->len + (layout->report_id ? 1 : 0);
+
+    // report IDs are all or nothing within one descriptor
+    if (!desc_len || !layout->report_id || ep_size > CFG_TUD_HID_EP_BUFSIZE) {
+        return false;
+    }
+    if (keyboard) {
+        keyboard_len = keyboard_desc_build(REPORT_ID_KEYBOARD,
+                                           desc_hid_report + desc_len,
+                                           sizeof(desc_hid_report) - desc_len);
+        if (!keyboard_len) {
+            return false;
+        }
+        desc_len += keyboard_len;
+        if (ep_size < 1 + KEYBOARD_REPORT_LEN) {
+            ep_size = 1 + KEYBOARD_REPORT_LEN;
+        }
+    }
+    if (backlight) {
+        feature_len = vendor_output_desc_build(
+            REPORT_ID_BACKLIGHT, REPORT_ID_BACKLIGHT, BACKLIGHT_REPORT_LEN,
+            desc_hid_report + desc_len, sizeof(desc_hid_report) - desc_len);
+        if (!feature_len) {
+            return false;
+        }
+        desc_len += feature_len;
+    }
+    feature_len = vendor_feature_desc_build(
+        REPORT_ID_LATENCY, REPORT_ID_LATENCY, LATENCY_FEATURE_LEN,
+        desc_hid_report + desc_len, sizeof(desc_hid_report) - desc_len);
+    if (!feature_len) {
+        return false;
+    }
+    desc_len += feature_len;
+    feature_len = vendor_feature_desc_build(
+        REPORT_ID_CONFIG, REPORT_ID_CONFIG, CONFIG_FEATURE_LEN,
+        desc_hid_report + desc_len, sizeof(desc_hid_report) - desc_len);
+    if (!feature_len) {
+        return false;
+    }
+    desc_len += feature_len;
+    desc_configuration[HID_DESC_REPORT_LEN_OFF] = TU_U16_LOW(desc_len);
+    desc_configuration[HID_DESC_REPORT_LEN_OFF + 1] = TU_U16_HIGH(desc_len);
+    desc_configuration[HID_DESC_EP_SIZE_OFF] = TU_U16_LOW(ep_size);
+    desc_configuration[HID_DESC_EP_SIZE_OFF + 1] = TU_U16_HIGH(ep_size);
+    return true;
+}
+
+bool usb_desc_hid_panel_init(uint8_t instance,
+                             struct gamepad_layout const *layout) {
+    uint16_t desc_len, off;
+
+    // nothing else shares these interfaces, so no report ID
+    if (!instance || instance >= CFG_TUD_HID || layout->report_id ||
+        layout->len > CFG_TUD_HID_EP_BUFSIZE) {
+        return false;
+    }
+    desc_len = gamepad_desc_build(layout, desc_hid_panel[instance - 1],
+                                  sizeof(desc_hid_panel[0]));
+    if (!desc_len) {
+        return false;
+    }
+    off = HID_PANEL_DESC_OFF(instance);
+    desc_configuration[off + 9 + 7] = TU_U16_LOW(desc_len);
+    desc_configuration[off + 9 + 7 + 1] = TU_U16_HIGH(desc_len);
+    desc_configuration[off + 9 + 9 + 4] = TU_U16_LOW(layout->len);
+    desc_configuration[off + 9 + 9 + 4 + 1] = TU_U16_HIGH(layout->len);
+    return true;
+}
 
 #if TUD_OPT_HIGH_SPEED
 // Per USB specs: high speed capable device must report device_qualifier and
@@ -123,9 +318,9 @@ tusb_desc_device_qualifier_t const desc_device_qualifier = {
     .bDescriptorType = TUSB_DESC_DEVICE_QUALIFIER,
     .bcdUSB = USB_BCD,
 
-    .bDeviceClass = 0x00,
-    .bDeviceSubClass = 0x00,
-    .bDeviceProtocol = 0x00,
+    .bDeviceClass = USB_DEVICE_CLASS,
+    .bDeviceSubClass = USB_DEVICE_SUBCLASS,
+    .bDeviceProtocol = USB_DEVICE_PROTOCOL,
 
     .bMaxPacketSize0 = CFG_TUD_ENDPOINT0_SIZE,
     .bNumConfigurations = 0x01,
@@ -179,6 +374,12 @@ char const *string_desc_arr[] = {
     "Nitepone",                  // 1: Manufacturer
     "uMFD",           // 2: Product
     "1",                   // 3: Serials, should use chip ID
+    "uMFD Console",        // 4: CDC Interface
+    "uMFD Display",        // 5: Vendor Interface
+    "uMFD Panel 1",        // 6..9: HID Interfaces, with more than one
+    "uMFD Panel 2",
+    "uMFD Panel 3",
+    "uMFD Panel 4",
 };
 
 static uint16_t _desc_str[32];
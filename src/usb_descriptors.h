@@ -25,12 +25,32 @@
 #ifndef USB_DESCRIPTORS_H_
 #define USB_DESCRIPTORS_H_
 
+#include "hid_desc.h"
+
 enum {
-    REPORT_ID_KEYBOARD = 1,
-    REPORT_ID_MOUSE,
-    REPORT_ID_CONSUMER_CONTROL,
-    REPORT_ID_GAMEPAD,
+    REPORT_ID_GAMEPAD = 1,
+    // vendor feature report with the latency stats, see latency.h
+    REPORT_ID_LATENCY,
+    // vendor feature report with the button mapping, see config.h
+    REPORT_ID_CONFIG,
+    // NKRO keyboard, see keyboard.h
+    REPORT_ID_KEYBOARD,
+    // vendor output report with backlight colours, see backlight.h
+    REPORT_ID_BACKLIGHT,
     REPORT_ID_COUNT
 };
 
+// Generate the HID report descriptor for layout, plus the keyboard report if
+// keyboard, the backlight output report if backlight and the vendor feature
+// reports, and fix up the lengths in the configuration descriptor to match.
+// Call before tusb_init().
+bool usb_desc_hid_init(struct gamepad_layout const *layout, bool keyboard,
+                       bool backlight);
+
+// Generate the report descriptor of the extra panel on HID interface
+// instance (1..), a button pad without a report ID, see panel.h. Call before
+// tusb_init().
+bool usb_desc_hid_panel_init(uint8_t instance,
+                             struct gamepad_layout const *layout);
+
 #endif /* USB_DESCRIPTORS_H_ */